@@ -0,0 +1,44 @@
+#include "capture_bp.h"
+
+int capture_bp_send(const captureBpOps_t *ops, void *frame, bool *spilled)
+{
+    bool copied = false;
+
+    if (ops->held(ops->ctx) > 0) {
+        // a consumer is lagging, keep the frame buffers free for the next capture
+        copied = ops->spill(ops->ctx, frame) == 0;
+    }
+    if (spilled) {
+        *spilled = copied;
+    }
+    if (ops->send(ops->ctx, frame)) {
+        return CAPTURE_BP_OUT;
+    }
+    if (ops->divert && ops->divert(ops->ctx, frame)) {
+        return CAPTURE_BP_DIVERT;
+    }
+    return CAPTURE_BP_DROP;
+}
+
+bool capture_bp_pool_take(captureBpPool_t *pool, size_t len)
+{
+    if (len > pool->limit || pool->used > pool->limit - len) {
+        return false;
+    }
+    pool->used += len;
+    return true;
+}
+
+void capture_bp_pool_give(captureBpPool_t *pool, size_t len)
+{
+    pool->used = len > pool->used ? 0 : pool->used - len;
+}
+
+uint32_t capture_bp_queue_depth(size_t memory, size_t frame_budget, uint32_t min, uint32_t max)
+{
+    size_t depth = frame_budget ? memory / frame_budget : 0;
+    if (depth < min) {
+        depth = min;
+    }
+    return depth > max ? max : (uint32_t)depth;
+}
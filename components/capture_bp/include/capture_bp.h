@@ -0,0 +1,102 @@
+#ifndef __CAPTURE_BP_H__
+#define __CAPTURE_BP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Backpressure of the capture pipeline.
+ *
+ * A captured frame goes to the output queue (the uplink). While a consumer still holds an
+ * earlier frame the frame is copied to a bounded spill pool, so that the consumers do not
+ * hold the few camera frame buffers the next capture needs. When the output queue is full the frame is
+ * diverted to the spill queue (local storage). It is dropped only if both refuse it.
+ */
+
+enum {
+    CAPTURE_BP_OUT = 0,         /* The output queue took the frame */
+    CAPTURE_BP_DIVERT,          /* The spill queue took the frame */
+    CAPTURE_BP_DROP,            /* No queue took the frame, the caller frees it */
+};
+
+/**
+ * @brief Spill pool, the bytes of frames copied out of the camera frame buffers
+ */
+typedef struct captureBpPool {
+    size_t limit;               /* Pool size in bytes */
+    size_t used;                /* Bytes in use */
+} captureBpPool_t;
+
+/**
+ * @brief Queues and frame of the pipeline
+ */
+typedef struct captureBpOps {
+    void *ctx;
+
+    /**
+     * @brief Frames sent earlier that are queued or being consumed
+     */
+    size_t (*held)(void *ctx);
+
+    /**
+     * @brief Copy the frame to the spill pool and return its frame buffer to the camera
+     * @return 0 on success, the frame is kept in its frame buffer else
+     */
+    int (*spill)(void *ctx, void *frame);
+
+    /**
+     * @brief Send the frame to the output queue, without waiting
+     * @return true if the queue took it
+     */
+    bool (*send)(void *ctx, void *frame);
+
+    /**
+     * @brief Send the frame to the spill queue, may be NULL if there is none
+     * @return true if the queue took it
+     */
+    bool (*divert)(void *ctx, void *frame);
+} captureBpOps_t;
+
+/**
+ * @brief Hand a captured frame to the queues
+ * @param ops Queues
+ * @param frame Frame, passed to the callbacks
+ * @param spilled Set to whether the frame was copied to the spill pool, may be NULL
+ * @return CAPTURE_BP_*
+ */
+int capture_bp_send(const captureBpOps_t *ops, void *frame, bool *spilled);
+
+/**
+ * @brief Reserve bytes of the spill pool
+ * @param pool Pool
+ * @param len Bytes
+ * @return true if they fit, false if the pool is full
+ */
+bool capture_bp_pool_take(captureBpPool_t *pool, size_t len);
+
+/**
+ * @brief Release bytes reserved in the spill pool
+ * @param pool Pool
+ * @param len Bytes
+ */
+void capture_bp_pool_give(captureBpPool_t *pool, size_t len);
+
+/**
+ * @brief Depth of a frame queue from the memory its frames may take
+ * @param memory Bytes the queued frames may take
+ * @param frame_budget Bytes reserved per queued frame
+ * @param min Smallest depth
+ * @param max Largest depth
+ */
+uint32_t capture_bp_queue_depth(size_t memory, size_t frame_budget, uint32_t min, uint32_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAPTURE_BP_H__ */
@@ -0,0 +1,249 @@
+/*
+ * Runs a PIR burst through a simulated capture pipeline, as camera.c feeds it: a camera
+ * with two frame buffers, an uplink that takes seconds per frame and a flash writer. The
+ * frames a policy loses are counted: dropped when no queue took them, missed when the
+ * camera had no free frame buffer soon enough after the trigger to catch the subject.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "capture_bp.h"
+#include "host_test.h"
+
+#define TICK_MS         10
+#define FB_COUNT        2           /* Camera frame buffers */
+#define FB_LATE_MS      500         /* A frame captured later than this after its trigger is missed */
+#define BURST           30          /* Frames of the burst */
+#define BURST_PERIOD_MS 250
+#define UPLINK_MS       1500        /* Uplink time per frame */
+#define FLASH_MS        200         /* Flash write time per frame */
+#define DIVERT_WAIT_MS  200         /* camera.c waits this long for a slot of the spill queue */
+#define PSRAM_FREE      (8 * 1024 * 1024)
+#define FRAME_BUDGET    (512 * 1024)
+#define QUEUE_MAX       32
+
+typedef struct frame {
+    size_t len;
+    bool in_fb;                 /* Holds a camera frame buffer, else copied to the pool */
+} frame_t;
+
+typedef struct queue {
+    frame_t *items[QUEUE_MAX];
+    int depth;
+    int head, count;
+} queue_t;
+
+typedef struct consumer {
+    queue_t queue;
+    frame_t *busy;              /* Frame being sent or written */
+    int left_ms;
+    int period_ms;
+    int done;
+} consumer_t;
+
+typedef struct pipeline {
+    bool backpressure;          /* Else the frame is dropped when the output queue is full */
+    int fb_free;
+    captureBpPool_t pool;
+    size_t pool_peak;
+    consumer_t uplink, flash;
+    int captured, dropped, missed, spilled, diverted;
+} pipeline_t;
+
+static bool queue_push(queue_t *q, frame_t *f)
+{
+    if (q->count == q->depth) {
+        return false;
+    }
+    q->items[(q->head + q->count++) % QUEUE_MAX] = f;
+    return true;
+}
+
+static frame_t *queue_pop(queue_t *q)
+{
+    if (q->count == 0) {
+        return NULL;
+    }
+    frame_t *f = q->items[q->head];
+    q->head = (q->head + 1) % QUEUE_MAX;
+    q->count--;
+    return f;
+}
+
+static void frame_free(pipeline_t *p, frame_t *f)
+{
+    if (f->in_fb) {
+        p->fb_free++;
+    } else {
+        capture_bp_pool_give(&p->pool, f->len);
+    }
+    free(f);
+}
+
+static size_t bp_held(void *ctx)
+{
+    pipeline_t *p = ctx;
+    return p->uplink.queue.count + (p->uplink.busy != NULL) + p->flash.queue.count + (p->flash.busy != NULL);
+}
+
+static int bp_spill(void *ctx, void *frame)
+{
+    pipeline_t *p = ctx;
+    frame_t *f = frame;
+    if (!f->in_fb || !capture_bp_pool_take(&p->pool, f->len)) {
+        return -1;
+    }
+    if (p->pool.used > p->pool_peak) {
+        p->pool_peak = p->pool.used;
+    }
+    f->in_fb = false;
+    p->fb_free++;
+    p->spilled++;
+    return 0;
+}
+
+static bool bp_send(void *ctx, void *frame)
+{
+    pipeline_t *p = ctx;
+    return queue_push(&p->uplink.queue, frame);
+}
+
+static bool bp_divert(void *ctx, void *frame)
+{
+    pipeline_t *p = ctx;
+    consumer_t *c = &p->flash;
+    // the writer finishes its frame while the camera waits for a slot
+    if (c->queue.count == c->queue.depth && c->busy && c->left_ms <= DIVERT_WAIT_MS) {
+        frame_free(p, c->busy);
+        c->done++;
+        c->busy = queue_pop(&c->queue);
+        c->left_ms = c->period_ms;
+    }
+    return queue_push(&c->queue, frame);
+}
+
+static void consumer_tick(pipeline_t *p, consumer_t *c)
+{
+    if (c->busy == NULL) {
+        c->busy = queue_pop(&c->queue);
+        c->left_ms = c->period_ms;
+    }
+    if (c->busy && (c->left_ms -= TICK_MS) <= 0) {
+        frame_free(p, c->busy);
+        c->busy = NULL;
+        c->done++;
+    }
+}
+
+/**
+ * @brief Run a burst through the pipeline until it drains
+ * @param pool_limit Spill pool size
+ * @param out_depth Depth of the output queue
+ * @param flash_depth Depth of the spill queue
+ */
+static void simulate(pipeline_t *p, bool backpressure, size_t pool_limit, int out_depth, int flash_depth)
+{
+    uint32_t seed = 3;
+    int pending = 0, waited_ms = 0, requested = 0;
+
+    memset(p, 0, sizeof(pipeline_t));
+    p->backpressure = backpressure;
+    p->fb_free = FB_COUNT;
+    p->pool.limit = pool_limit;
+    p->uplink.queue.depth = out_depth;
+    p->uplink.period_ms = UPLINK_MS;
+    p->flash.queue.depth = flash_depth;
+    p->flash.period_ms = FLASH_MS;
+    captureBpOps_t ops = {
+        .ctx = p,
+        .held = bp_held,
+        .spill = bp_spill,
+        .send = bp_send,
+        .divert = bp_divert,
+    };
+
+    for (int t = 0; requested < BURST || pending || p->uplink.busy || p->uplink.queue.count ||
+         p->flash.busy || p->flash.queue.count; t += TICK_MS) {
+        if (requested < BURST && t % BURST_PERIOD_MS == 0) {
+            requested++;
+            pending++;
+        }
+        if (pending && p->fb_free == 0 && (waited_ms += TICK_MS) >= FB_LATE_MS) {
+            pending--;
+            p->missed++;
+            waited_ms = 0;
+        }
+        if (pending && p->fb_free > 0) {
+            frame_t *f = malloc(sizeof(frame_t));
+            f->len = 150 * 1024 + seed % (100 * 1024);
+            f->in_fb = true;
+            seed = seed * 1103515245 + 12345;
+            p->fb_free--;
+            pending--;
+            waited_ms = 0;
+            p->captured++;
+            int route = backpressure ? capture_bp_send(&ops, f, NULL)
+                                     : (bp_send(p, f) ? CAPTURE_BP_OUT : CAPTURE_BP_DROP);
+            if (route == CAPTURE_BP_DIVERT) {
+                p->diverted++;
+            } else if (route == CAPTURE_BP_DROP) {
+                p->dropped++;
+                frame_free(p, f);
+            }
+        }
+        consumer_tick(p, &p->uplink);
+        consumer_tick(p, &p->flash);
+        CHECK(p->pool.used <= p->pool.limit);
+        CHECK(p->fb_free >= 0 && p->fb_free <= FB_COUNT);
+    }
+    // every frame is accounted for, and every buffer is back
+    CHECK(p->captured + p->missed == BURST);
+    CHECK(p->uplink.done + p->flash.done + p->dropped == p->captured);
+    CHECK(p->pool.used == 0 && p->fb_free == FB_COUNT);
+}
+
+static void show(const char *name, const pipeline_t *p)
+{
+    printf("%-32s sent %2d stored %2d dropped %2d missed %2d (spilled %2d, pool peak %4zu KB)\n", name,
+           p->uplink.done, p->flash.done, p->dropped, p->missed, p->spilled, p->pool_peak / 1024);
+}
+
+int main(void)
+{
+    pipeline_t fixed, bp, sized, no_pool;
+
+    // the pool
+    captureBpPool_t pool = { .limit = 100 };
+    CHECK(capture_bp_pool_take(&pool, 60) && pool.used == 60);
+    CHECK(!capture_bp_pool_take(&pool, 41) && pool.used == 60);
+    CHECK(capture_bp_pool_take(&pool, 40) && pool.used == 100);
+    CHECK(!capture_bp_pool_take(&pool, (size_t)-1));
+    capture_bp_pool_give(&pool, 100);
+    CHECK(pool.used == 0);
+
+    // queue depths, as main.c sizes them from the PSRAM
+    uint32_t depth = capture_bp_queue_depth(PSRAM_FREE / 3, FRAME_BUDGET, 3, 16);
+    CHECK(depth == 5);
+    CHECK(capture_bp_queue_depth(0, FRAME_BUDGET, 3, 16) == 3);
+    CHECK(capture_bp_queue_depth(SIZE_MAX, FRAME_BUDGET, 3, 16) == 16);
+    CHECK(capture_bp_queue_depth(1000, 0, 2, 16) == 2);
+
+    // a burst against a slow uplink
+    simulate(&fixed, false, 0, 3, 2);
+    simulate(&bp, true, PSRAM_FREE / 3, 3, 2);
+    simulate(&sized, true, PSRAM_FREE / 3, depth, depth);
+    simulate(&no_pool, true, 0, 3, 2);
+    show("drop when full, queues 3/2", &fixed);
+    show("backpressure, queues 3/2", &bp);
+    show("backpressure, queues from PSRAM", &sized);
+    show("backpressure, no pool", &no_pool);
+
+    CHECK(fixed.dropped + fixed.missed > BURST / 2);
+    CHECK(bp.dropped + bp.missed < fixed.dropped + fixed.missed);
+    CHECK(sized.dropped == 0 && sized.missed == 0 && sized.diverted > 0);
+    CHECK(sized.uplink.done > bp.uplink.done);
+    // without a pool the consumers keep the frame buffers, frames are missed rather than dropped
+    CHECK(no_pool.spilled == 0 && no_pool.missed > 0);
+
+    return host_test_end();
+}
@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <string.h>
+#include "chunk_upload.h"
+
+size_t chunk_upload_size(size_t configured, size_t min, size_t max)
+{
+    size_t size = configured < min ? min : configured;
+    return size > max ? max : size;
+}
+
+int chunk_upload_run(const chunkUpload_t *up, size_t *offset)
+{
+    if (*offset > up->total || up->chunk_size == 0) {
+        return CHUNK_ERR_ARG;
+    }
+    while (*offset < up->total) {
+        const uint8_t *chunk = NULL;
+        size_t len = up->data(up->ctx, *offset, &chunk);
+        if (len == 0 || chunk == NULL) {
+            return CHUNK_ERR_ARG;
+        }
+        if (len > up->chunk_size) {
+            len = up->chunk_size;
+        }
+        if (len > up->total - *offset) {
+            len = up->total - *offset;
+        }
+        if (up->send(up->ctx, chunk, len, *offset) != 0) {
+            return CHUNK_ERR_SEND;
+        }
+        *offset += len;
+        if (up->progress) {
+            up->progress(up->ctx, *offset);
+        }
+    }
+    return CHUNK_OK;
+}
+
+uint32_t chunk_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+int chunk_assembly_add(chunkAssembly_t *a, size_t offset, size_t total, uint32_t crc, uint32_t chunk_crc,
+                       const uint8_t *data, size_t len)
+{
+    if (a->buf == NULL) {
+        a->buf = malloc(total ? total : 1);
+        if (a->buf == NULL) {
+            return CHUNK_RX_MISMATCH;
+        }
+        a->total = total;
+        a->crc = crc;
+        a->have = 0;
+        a->running = 0;
+    }
+    if (total != a->total || crc != a->crc || len > total || offset > total - len) {
+        return CHUNK_RX_MISMATCH;
+    }
+    if (chunk_crc32(0, data, len) != chunk_crc) {
+        return CHUNK_RX_BAD_CRC;
+    }
+    if (offset + len <= a->have) {
+        return CHUNK_RX_DUPLICATE;
+    }
+    if (offset != a->have) {
+        return CHUNK_RX_GAP;
+    }
+    memcpy(a->buf + offset, data, len);
+    a->running = chunk_crc32(a->running, data, len);
+    a->have += len;
+    if (a->have < a->total) {
+        return CHUNK_RX_KEPT;
+    }
+    return a->running == a->crc ? CHUNK_RX_DONE : CHUNK_RX_CORRUPT;
+}
+
+void chunk_assembly_free(chunkAssembly_t *a)
+{
+    free(a->buf);
+    memset(a, 0, sizeof(chunkAssembly_t));
+}
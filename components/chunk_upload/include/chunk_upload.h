@@ -0,0 +1,123 @@
+#ifndef __CHUNK_UPLOAD_H__
+#define __CHUNK_UPLOAD_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Resumable chunked upload of an image.
+ *
+ * The sender sends the chunks in order from the last acknowledged offset, one at a time,
+ * and reports each acknowledged offset so that it can be persisted: a later attempt starts
+ * from there instead of byte zero. A chunk never spans two of the buffers the image is
+ * made of (the EXIF prefix and the frame).
+ *
+ * The receiver keeps a chunk only if its offset equals the bytes it already has, so chunks
+ * sent again after a resume are dropped, and checks the CRC32 of each chunk and of the
+ * whole image. Every chunk carries the image length and the CRC32 of the whole image.
+ */
+
+enum {
+    CHUNK_OK = 0,
+    CHUNK_ERR_ARG = -1,         /* Bad offset or no data at the offset */
+    CHUNK_ERR_SEND = -2,        /* A chunk was not acknowledged, the offset is the last acknowledged one */
+};
+
+/**
+ * @brief Upload of one image
+ */
+typedef struct chunkUpload {
+    size_t total;               /* Image length */
+    size_t chunk_size;          /* Longest chunk */
+    void *ctx;
+
+    /**
+     * @brief Get the bytes of the image at an offset
+     * @return Bytes contiguous at the offset, 0 if there are none
+     */
+    size_t (*data)(void *ctx, size_t offset, const uint8_t **data);
+
+    /**
+     * @brief Send a chunk and wait for its acknowledgement
+     * @return 0 when acknowledged
+     */
+    int (*send)(void *ctx, const uint8_t *chunk, size_t len, size_t offset);
+
+    /**
+     * @brief An acknowledged offset, to persist, may be NULL
+     */
+    void (*progress)(void *ctx, size_t offset);
+} chunkUpload_t;
+
+/**
+ * @brief Chunk size from a configured one and the limits of the link
+ * @param configured Configured chunk size
+ * @param min Smallest chunk
+ * @param max Longest chunk the link takes
+ */
+size_t chunk_upload_size(size_t configured, size_t min, size_t max);
+
+/**
+ * @brief Send the chunks of an image from an offset to its end
+ * @param up Upload
+ * @param offset Offset to start from, the last acknowledged one on return
+ * @return CHUNK_OK when the last chunk is acknowledged, else CHUNK_ERR_*
+ */
+int chunk_upload_run(const chunkUpload_t *up, size_t *offset);
+
+/**
+ * @brief CRC32 as esp_rom_crc32_le() and zlib compute it
+ * @param crc CRC of the bytes before, 0 to start
+ */
+uint32_t chunk_crc32(uint32_t crc, const uint8_t *buf, size_t len);
+
+enum {
+    CHUNK_RX_KEPT = 0,          /* Appended */
+    CHUNK_RX_DONE,              /* Appended, the image is complete and its CRC32 checks */
+    CHUNK_RX_DUPLICATE,         /* Already received, sent again after a resume */
+    CHUNK_RX_GAP,               /* Past the bytes received, a chunk before it is missing */
+    CHUNK_RX_BAD_CRC,           /* CRC32 of the chunk does not match */
+    CHUNK_RX_MISMATCH,          /* Length or CRC32 of the image differs from the first chunk */
+    CHUNK_RX_CORRUPT,           /* Complete, but the CRC32 of the image does not match */
+};
+
+/**
+ * @brief Image being received
+ */
+typedef struct chunkAssembly {
+    uint8_t *buf;               /* Image, allocated at the first chunk */
+    size_t total;
+    size_t have;                /* Bytes received, the offset of the next chunk */
+    uint32_t crc;               /* CRC32 of the image, as sent */
+    uint32_t running;           /* CRC32 of the bytes received */
+} chunkAssembly_t;
+
+/**
+ * @brief Add a received chunk
+ * @param a Image, zeroed before the first chunk
+ * @param offset Offset of the chunk
+ * @param total Image length
+ * @param crc CRC32 of the image
+ * @param chunk_crc CRC32 of the chunk
+ * @param data Chunk bytes
+ * @param len Chunk length
+ * @return CHUNK_RX_*, a chunk is to be acknowledged unless CHUNK_RX_GAP, BAD_CRC or MISMATCH
+ */
+int chunk_assembly_add(chunkAssembly_t *a, size_t offset, size_t total, uint32_t crc, uint32_t chunk_crc,
+                       const uint8_t *data, size_t len);
+
+/**
+ * @brief Free an image
+ */
+void chunk_assembly_free(chunkAssembly_t *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CHUNK_UPLOAD_H__ */
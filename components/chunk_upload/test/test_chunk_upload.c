@@ -0,0 +1,227 @@
+/*
+ * Uploads an image in chunks over a simulated lossy link to the reassembler, as the
+ * firmware does over CAT1: a failed chunk ends the wake, the acknowledged offset is kept
+ * as storage keeps it in the .prg sidecar, and the next wake resumes from it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chunk_upload.h"
+#include "host_test.h"
+
+#define PREFIX_LEN  1234        /* EXIF prefix in front of the frame */
+#define FRAME_LEN   150000
+#define CHUNK_SIZE  4096
+#define MAX_WAKES   1000
+#define SEEDS       20          /* Images sent over each link */
+
+/**
+ * @brief Loss rates of the link, in 1/1000 per chunk
+ */
+typedef struct lossy {
+    int lost;               /* The chunk never reaches the server */
+    int corrupt;            /* A byte of the chunk is flipped on the way */
+    int ack_lost;           /* The server keeps the chunk, its acknowledgement is lost */
+} lossy_t;
+
+typedef struct link {
+    lossy_t loss;
+    uint32_t seed;
+    const uint8_t *parts[2];
+    size_t lens[2];
+    size_t total;
+    uint32_t crc;
+    chunkAssembly_t server;
+    size_t sidecar;         /* Offset persisted by the device */
+    size_t sent;            /* Bytes sent, resends included */
+    int failures;
+    int done;
+    int spanning;           /* Chunks spanning the prefix and the frame */
+} link_t;
+
+static uint32_t rnd(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 8) & 0xffffff;
+}
+
+static bool chance(link_t *link, int per_mille)
+{
+    return (int)(rnd(&link->seed) % 1000) < per_mille;
+}
+
+static size_t image_data(void *ctx, size_t offset, const uint8_t **data)
+{
+    link_t *link = ctx;
+    if (offset < link->lens[0]) {
+        *data = link->parts[0] + offset;
+        return link->lens[0] - offset;
+    }
+    offset -= link->lens[0];
+    if (offset < link->lens[1]) {
+        *data = link->parts[1] + offset;
+        return link->lens[1] - offset;
+    }
+    return 0;
+}
+
+static int image_send(void *ctx, const uint8_t *chunk, size_t len, size_t offset)
+{
+    link_t *link = ctx;
+    uint8_t copy[CHUNK_SIZE];
+    uint32_t chunk_crc = chunk_crc32(0, chunk, len);
+
+    link->sent += len;
+    if (offset < link->lens[0] && offset + len > link->lens[0]) {
+        link->spanning++;
+    }
+    if (chance(link, link->loss.lost)) {
+        return -1;
+    }
+    memcpy(copy, chunk, len);
+    if (chance(link, link->loss.corrupt)) {
+        copy[rnd(&link->seed) % len] ^= 0x20;
+    }
+    int ret = chunk_assembly_add(&link->server, offset, link->total, link->crc, chunk_crc, copy, len);
+    if (ret == CHUNK_RX_DONE) {
+        link->done++;
+    }
+    if (ret != CHUNK_RX_KEPT && ret != CHUNK_RX_DONE && ret != CHUNK_RX_DUPLICATE) {
+        return -1;
+    }
+    return chance(link, link->loss.ack_lost) ? -1 : 0;
+}
+
+static void image_progress(void *ctx, size_t offset)
+{
+    link_t *link = ctx;
+    link->sidecar = offset;
+}
+
+/**
+ * @brief Upload wake after wake until the image is acknowledged
+ * @param resume Resume from the sidecar, else start each wake from byte zero
+ * @return Wakes taken, MAX_WAKES + 1 if it never ended
+ */
+static int upload(link_t *link, bool resume)
+{
+    chunkUpload_t up = {
+        .total = link->total,
+        .chunk_size = CHUNK_SIZE,
+        .ctx = link,
+        .data = image_data,
+        .send = image_send,
+        .progress = image_progress,
+    };
+
+    for (int wake = 1; wake <= MAX_WAKES; wake++) {
+        size_t offset = resume ? link->sidecar : 0;
+        if (!resume) {
+            // the server starts over with the sender
+            chunk_assembly_free(&link->server);
+        }
+        if (chunk_upload_run(&up, &offset) == CHUNK_OK) {
+            return wake;
+        }
+        link->failures++;
+    }
+    return MAX_WAKES + 1;
+}
+
+static void link_init(link_t *link, const uint8_t *prefix, const uint8_t *frame, lossy_t loss, uint32_t seed)
+{
+    memset(link, 0, sizeof(link_t));
+    link->loss = loss;
+    link->seed = seed;
+    link->parts[0] = prefix;
+    link->parts[1] = frame;
+    link->lens[0] = PREFIX_LEN;
+    link->lens[1] = FRAME_LEN;
+    link->total = PREFIX_LEN + FRAME_LEN;
+    link->crc = chunk_crc32(chunk_crc32(0, prefix, PREFIX_LEN), frame, FRAME_LEN);
+}
+
+static bool received(const link_t *link, const uint8_t *prefix, const uint8_t *frame)
+{
+    return link->server.have == link->total && memcmp(link->server.buf, prefix, PREFIX_LEN) == 0 &&
+           memcmp(link->server.buf + PREFIX_LEN, frame, FRAME_LEN) == 0;
+}
+
+int main(void)
+{
+    static uint8_t prefix[PREFIX_LEN], frame[FRAME_LEN];
+    uint32_t seed = 7;
+    link_t link;
+
+    for (size_t i = 0; i < PREFIX_LEN; i++) {
+        prefix[i] = (uint8_t)rnd(&seed);
+    }
+    for (size_t i = 0; i < FRAME_LEN; i++) {
+        frame[i] = (uint8_t)rnd(&seed);
+    }
+
+    // CRC32 of esp_rom_crc32_le(0, ...) and zlib
+    CHECK(chunk_crc32(0, (const uint8_t *)"123456789", 9) == 0xcbf43926);
+    CHECK(chunk_upload_size(0, 1024, 8192) == 1024);
+    CHECK(chunk_upload_size(4000, 1024, 8192) == 4000);
+    CHECK(chunk_upload_size(100000, 1024, 8192) == 8192);
+
+    // a clean link, one wake
+    lossy_t clean = {0};
+    link_init(&link, prefix, frame, clean, 1);
+    CHECK(upload(&link, true) == 1);
+    CHECK(link.done == 1 && received(&link, prefix, frame));
+    CHECK(link.sent == link.total && link.spanning == 0);
+    chunk_assembly_free(&link.server);
+
+    // the receiver rules
+    chunkAssembly_t a = {0};
+    uint32_t crc = chunk_crc32(0, frame, 300);
+    CHECK(chunk_assembly_add(&a, 0, 300, crc, chunk_crc32(0, frame, 100), frame, 100) == CHUNK_RX_KEPT);
+    CHECK(chunk_assembly_add(&a, 200, 300, crc, chunk_crc32(0, frame + 200, 100), frame + 200, 100) == CHUNK_RX_GAP);
+    CHECK(chunk_assembly_add(&a, 0, 300, crc, chunk_crc32(0, frame, 100), frame, 100) == CHUNK_RX_DUPLICATE);
+    CHECK(chunk_assembly_add(&a, 100, 300, crc, 0, frame + 100, 100) == CHUNK_RX_BAD_CRC);
+    CHECK(chunk_assembly_add(&a, 100, 301, crc, chunk_crc32(0, frame + 100, 100), frame + 100, 100) == CHUNK_RX_MISMATCH);
+    CHECK(chunk_assembly_add(&a, 100, 300, crc, chunk_crc32(0, frame + 100, 200), frame + 100, 200) == CHUNK_RX_DONE);
+    chunk_assembly_free(&a);
+    CHECK(chunk_assembly_add(&a, 0, 4, crc, chunk_crc32(0, frame, 4), frame, 4) == CHUNK_RX_CORRUPT);
+    chunk_assembly_free(&a);
+
+    // lossy links: every failure costs at most the chunk in flight, over a few seeds each
+    const lossy_t links[] = {
+        { .lost = 50 },
+        { .corrupt = 50 },
+        { .ack_lost = 50 },
+        { .lost = 30, .corrupt = 10, .ack_lost = 30 },
+    };
+    for (size_t i = 0; i < sizeof(links) / sizeof(links[0]); i++) {
+        int wakes = 0, restart_wakes = 0;
+        size_t sent = 0, restart_sent = 0;
+        for (uint32_t s = 0; s < SEEDS; s++) {
+            link_t restart;
+            link_init(&link, prefix, frame, links[i], 100 * i + s);
+            wakes += upload(&link, true);
+            CHECK(link.done == 1 && received(&link, prefix, frame));
+            CHECK(link.sent <= link.total + (size_t)link.failures * CHUNK_SIZE);
+            CHECK(link.spanning == 0);
+            sent += link.sent;
+
+            link_init(&restart, prefix, frame, links[i], 100 * i + s);
+            restart_wakes += upload(&restart, false);
+            restart_sent += restart.sent;
+            chunk_assembly_free(&link.server);
+            chunk_assembly_free(&restart.server);
+        }
+        CHECK(wakes < restart_wakes && sent < restart_sent);
+        printf("loss %2d/%2d/%2d per mille, %d images: resume %d wakes %zu KB, from zero %d wakes %zu KB\n",
+               links[i].lost, links[i].corrupt, links[i].ack_lost, SEEDS, wakes, sent / 1024,
+               restart_wakes, restart_sent / 1024);
+    }
+
+    // a sidecar past the image is refused
+    chunkUpload_t up = { .total = 10, .chunk_size = 4, .data = image_data, .send = image_send };
+    size_t offset = 11;
+    CHECK(chunk_upload_run(&up, &offset) == CHUNK_ERR_ARG);
+
+    return host_test_end();
+}
@@ -0,0 +1,634 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "delta_patch.h"
+
+#define DELTA_BLOCK_HEADER_SIZE 8
+#define DELTA_OP_HEADER_SIZE    12
+#define DELTA_OLD_CHUNK         256     /* Old image bytes read at a time by a diff */
+
+#define MAXBITS     15      /* Longest deflate code */
+#define MAXLCODES   288     /* Literal/length codes */
+#define MAXDCODES   30      /* Distance codes */
+
+/**
+ * @brief Canonical Huffman code, as count of codes per length and symbols by code
+ */
+typedef struct huffman {
+    int16_t count[MAXBITS + 1];
+    int16_t symbol[MAXLCODES];
+} huffman_t;
+
+/**
+ * @brief One shot raw deflate decoder state
+ */
+typedef struct inflateState {
+    const uint8_t *in;
+    size_t in_len;
+    size_t in_pos;
+    uint32_t bitbuf;
+    int bitcnt;
+    uint8_t *out;
+    size_t out_len;
+    size_t out_pos;
+    bool err;
+    huffman_t lencode;
+    huffman_t distcode;
+} inflateState_t;
+
+typedef enum {
+    STAGE_HEADER = 0,   /* Patch header */
+    STAGE_BLOCK,        /* Block header */
+    STAGE_DATA,         /* Compressed bytes of a block */
+} deltaStage_e;
+
+typedef enum {
+    OP_HEADER = 0,      /* Lengths and seek of the next op */
+    OP_DIFF,            /* Diff bytes */
+    OP_EXTRA,           /* Extra bytes */
+} deltaOp_e;
+
+struct deltaPatch {
+    delta_read_cb read_old;
+    delta_write_cb write_new;
+    void *ctx;
+    int error;                  /* First error, sticky */
+    deltaHeader_t header;
+    deltaStage_e stage;
+    uint8_t head[DELTA_HEADER_SIZE];    /* Patch header, then block header bytes */
+    size_t head_len;
+    uint32_t raw_len;           /* Raw length of the current block */
+    uint32_t comp_len;          /* Compressed length of the current block */
+    uint32_t comp_fill;         /* Compressed bytes of the current block received */
+    uint8_t *comp;
+    uint8_t *raw;
+    deltaOp_e op;
+    uint8_t op_head[DELTA_OP_HEADER_SIZE];
+    size_t op_head_len;
+    uint32_t diff_left;
+    uint32_t extra_left;
+    int32_t seek;
+    uint32_t old_pos;           /* Position in the old image */
+    uint32_t new_pos;           /* New image bytes passed to the write callback */
+    uint32_t crc;               /* CRC32 of these bytes */
+    uint8_t out[DELTA_OUT_SIZE];
+    size_t out_len;
+    uint8_t old[DELTA_OLD_CHUNK];
+    inflateState_t inflate;
+};
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+uint32_t delta_crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+/*------------------------------------------------------------------------*/
+/* Raw deflate (RFC 1951) of one block, decoded in one go into a buffer */
+
+static uint32_t bits(inflateState_t *s, int need)
+{
+    uint32_t val = s->bitbuf;
+    while (s->bitcnt < need) {
+        if (s->in_pos == s->in_len) {
+            s->err = true;
+            return 0;
+        }
+        val |= (uint32_t)s->in[s->in_pos++] << s->bitcnt;
+        s->bitcnt += 8;
+    }
+    s->bitbuf = val >> need;
+    s->bitcnt -= need;
+    return val & ((1UL << need) - 1);
+}
+
+static int decode(inflateState_t *s, const huffman_t *h)
+{
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= MAXBITS; len++) {
+        code |= bits(s, 1);
+        int count = h->count[len];
+        if (code - count < first) {
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+/**
+ * @return 0 for a complete code, > 0 for an incomplete one, < 0 for an over-subscribed one
+ */
+static int construct(huffman_t *h, const int16_t *length, int n)
+{
+    int16_t offs[MAXBITS + 1];
+    int left = 1;
+
+    memset(h->count, 0, sizeof(h->count));
+    for (int sym = 0; sym < n; sym++) {
+        h->count[length[sym]]++;
+    }
+    if (h->count[0] == n) {
+        return 0;
+    }
+    for (int len = 1; len <= MAXBITS; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) {
+            return left;
+        }
+    }
+    offs[1] = 0;
+    for (int len = 1; len < MAXBITS; len++) {
+        offs[len + 1] = offs[len] + h->count[len];
+    }
+    for (int sym = 0; sym < n; sym++) {
+        if (length[sym] != 0) {
+            h->symbol[offs[length[sym]]++] = sym;
+        }
+    }
+    return left;
+}
+
+static bool stored(inflateState_t *s)
+{
+    s->bitbuf = 0;
+    s->bitcnt = 0;
+    if (s->in_pos + 4 > s->in_len) {
+        return false;
+    }
+    uint32_t len = s->in[s->in_pos] | s->in[s->in_pos + 1] << 8;
+    uint32_t nlen = s->in[s->in_pos + 2] | s->in[s->in_pos + 3] << 8;
+    s->in_pos += 4;
+    if (len != (~nlen & 0xffff) || s->in_pos + len > s->in_len || s->out_pos + len > s->out_len) {
+        return false;
+    }
+    memcpy(s->out + s->out_pos, s->in + s->in_pos, len);
+    s->in_pos += len;
+    s->out_pos += len;
+    return true;
+}
+
+static bool codes(inflateState_t *s)
+{
+    static const uint16_t lbase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const uint8_t lext[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const uint16_t dbase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+        4097, 6145, 8193, 12289, 16385, 24577
+    };
+    static const uint8_t dext[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+
+    while (!s->err) {
+        int sym = decode(s, &s->lencode);
+        if (sym < 0) {
+            return false;
+        }
+        if (sym < 256) {
+            if (s->out_pos == s->out_len) {
+                return false;
+            }
+            s->out[s->out_pos++] = sym;
+        } else if (sym == 256) {
+            return true;
+        } else {
+            sym -= 257;
+            if (sym >= 29) {
+                return false;
+            }
+            uint32_t len = lbase[sym] + bits(s, lext[sym]);
+            int dsym = decode(s, &s->distcode);
+            if (dsym < 0 || dsym >= 30) {
+                return false;
+            }
+            uint32_t dist = dbase[dsym] + bits(s, dext[dsym]);
+            // each block is compressed on its own, references stay in the block
+            if (dist > s->out_pos || s->out_pos + len > s->out_len) {
+                return false;
+            }
+            for (uint32_t i = 0; i < len; i++, s->out_pos++) {
+                s->out[s->out_pos] = s->out[s->out_pos - dist];
+            }
+        }
+    }
+    return false;
+}
+
+static bool fixed(inflateState_t *s)
+{
+    int16_t lengths[MAXLCODES];
+    int sym = 0;
+
+    for (; sym < 144; sym++) {
+        lengths[sym] = 8;
+    }
+    for (; sym < 256; sym++) {
+        lengths[sym] = 9;
+    }
+    for (; sym < 280; sym++) {
+        lengths[sym] = 7;
+    }
+    for (; sym < MAXLCODES; sym++) {
+        lengths[sym] = 8;
+    }
+    construct(&s->lencode, lengths, MAXLCODES);
+    for (sym = 0; sym < MAXDCODES; sym++) {
+        lengths[sym] = 5;
+    }
+    construct(&s->distcode, lengths, MAXDCODES);
+    return codes(s);
+}
+
+static bool dynamic(inflateState_t *s)
+{
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    int16_t lengths[MAXLCODES + MAXDCODES];
+    int nlen = bits(s, 5) + 257;
+    int ndist = bits(s, 5) + 1;
+    int ncode = bits(s, 4) + 4;
+    int index;
+
+    if (s->err || nlen > 286 || ndist > MAXDCODES) {
+        return false;
+    }
+    for (index = 0; index < ncode; index++) {
+        lengths[order[index]] = bits(s, 3);
+    }
+    for (; index < 19; index++) {
+        lengths[order[index]] = 0;
+    }
+    if (construct(&s->lencode, lengths, 19) != 0) {
+        return false;
+    }
+    index = 0;
+    while (index < nlen + ndist) {
+        int sym = decode(s, &s->lencode);
+        if (sym < 0 || s->err) {
+            return false;
+        }
+        if (sym < 16) {
+            lengths[index++] = sym;
+            continue;
+        }
+        int16_t len = 0;
+        int repeat;
+        if (sym == 16) {
+            if (index == 0) {
+                return false;
+            }
+            len = lengths[index - 1];
+            repeat = 3 + bits(s, 2);
+        } else if (sym == 17) {
+            repeat = 3 + bits(s, 3);
+        } else {
+            repeat = 11 + bits(s, 7);
+        }
+        if (index + repeat > nlen + ndist) {
+            return false;
+        }
+        while (repeat--) {
+            lengths[index++] = len;
+        }
+    }
+    if (lengths[256] == 0) {
+        return false;
+    }
+    int err = construct(&s->lencode, lengths, nlen);
+    if (err < 0 || (err > 0 && nlen != s->lencode.count[0] + s->lencode.count[1])) {
+        return false;
+    }
+    err = construct(&s->distcode, lengths + nlen, ndist);
+    if (err < 0 || (err > 0 && ndist != s->distcode.count[0] + s->distcode.count[1])) {
+        return false;
+    }
+    return codes(s);
+}
+
+/**
+ * @return Number of bytes decoded, -1 on a corrupted stream
+ */
+static int inflate_block(inflateState_t *s, uint8_t *out, size_t out_len, const uint8_t *in, size_t in_len)
+{
+    uint32_t last;
+
+    s->in = in;
+    s->in_len = in_len;
+    s->in_pos = 0;
+    s->bitbuf = 0;
+    s->bitcnt = 0;
+    s->out = out;
+    s->out_len = out_len;
+    s->out_pos = 0;
+    s->err = false;
+    do {
+        last = bits(s, 1);
+        bool ok;
+        switch (bits(s, 2)) {
+        case 0:
+            ok = stored(s);
+            break;
+        case 1:
+            ok = fixed(s);
+            break;
+        case 2:
+            ok = dynamic(s);
+            break;
+        default:
+            ok = false;
+            break;
+        }
+        if (!ok || s->err) {
+            return -1;
+        }
+    } while (!last);
+    return s->out_pos;
+}
+
+/*------------------------------------------------------------------------*/
+/* Op stream */
+
+static int flush(deltaPatch_t *patch)
+{
+    if (patch->out_len == 0) {
+        return DELTA_OK;
+    }
+    patch->crc = delta_crc32(patch->crc, patch->out, patch->out_len);
+    if (patch->write_new(patch->ctx, patch->out, patch->out_len) != 0) {
+        return DELTA_ERR_WRITE;
+    }
+    patch->new_pos += patch->out_len;
+    patch->out_len = 0;
+    return DELTA_OK;
+}
+
+/**
+ * @brief Move past the parts of the op that are done, even between blocks
+ */
+static int next_stage(deltaPatch_t *patch)
+{
+    if (patch->op == OP_DIFF && patch->diff_left == 0) {
+        patch->op = OP_EXTRA;
+    }
+    if (patch->op == OP_EXTRA && patch->extra_left == 0) {
+        int64_t pos = (int64_t)patch->old_pos + patch->seek;
+        if (pos < 0 || pos > patch->header.old_size) {
+            return DELTA_ERR_FORMAT;
+        }
+        patch->old_pos = pos;
+        patch->op = OP_HEADER;
+    }
+    return DELTA_OK;
+}
+
+/**
+ * @brief Run the ops of a raw block, an op may span blocks
+ */
+static int apply_ops(deltaPatch_t *patch, const uint8_t *data, size_t len)
+{
+    const deltaHeader_t *h = &patch->header;
+
+    while (len > 0) {
+        size_t n;
+        switch (patch->op) {
+        case OP_HEADER:
+            n = DELTA_OP_HEADER_SIZE - patch->op_head_len;
+            n = n < len ? n : len;
+            memcpy(patch->op_head + patch->op_head_len, data, n);
+            patch->op_head_len += n;
+            data += n;
+            len -= n;
+            if (patch->op_head_len < DELTA_OP_HEADER_SIZE) {
+                break;
+            }
+            patch->op_head_len = 0;
+            patch->diff_left = get_u32(patch->op_head);
+            patch->extra_left = get_u32(patch->op_head + 4);
+            patch->seek = (int32_t)get_u32(patch->op_head + 8);
+            uint32_t written = patch->new_pos + patch->out_len;
+            if (patch->diff_left > h->new_size - written ||
+                    patch->extra_left > h->new_size - written - patch->diff_left ||
+                    patch->diff_left > h->old_size - patch->old_pos) {
+                return DELTA_ERR_FORMAT;
+            }
+            patch->op = OP_DIFF;
+            int err = next_stage(patch);
+            if (err != DELTA_OK) {
+                return err;
+            }
+            break;
+        case OP_DIFF:
+        case OP_EXTRA: {
+            uint32_t *left = patch->op == OP_DIFF ? &patch->diff_left : &patch->extra_left;
+            n = *left < len ? *left : len;
+            n = n < DELTA_OLD_CHUNK ? n : DELTA_OLD_CHUNK;
+            n = n < DELTA_OUT_SIZE - patch->out_len ? n : DELTA_OUT_SIZE - patch->out_len;
+            if (n > 0 && patch->op == OP_DIFF) {
+                if (patch->read_old(patch->ctx, patch->old_pos, patch->old, n) != 0) {
+                    return DELTA_ERR_READ;
+                }
+                for (size_t i = 0; i < n; i++) {
+                    patch->out[patch->out_len + i] = data[i] + patch->old[i];
+                }
+                patch->old_pos += n;
+            } else if (n > 0) {
+                memcpy(patch->out + patch->out_len, data, n);
+            }
+            patch->out_len += n;
+            *left -= n;
+            data += n;
+            len -= n;
+            if (patch->out_len == DELTA_OUT_SIZE) {
+                int err = flush(patch);
+                if (err != DELTA_OK) {
+                    return err;
+                }
+            }
+            int err = next_stage(patch);
+            if (err != DELTA_OK) {
+                return err;
+            }
+            break;
+        }
+        }
+    }
+    return DELTA_OK;
+}
+
+/**
+ * @brief Check the old image before anything is written, the output buffer is free then
+ */
+static int check_old_image(deltaPatch_t *patch)
+{
+    uint32_t crc = 0;
+    for (uint32_t offset = 0; offset < patch->header.old_size; offset += DELTA_OUT_SIZE) {
+        size_t n = patch->header.old_size - offset;
+        n = n < DELTA_OUT_SIZE ? n : DELTA_OUT_SIZE;
+        if (patch->read_old(patch->ctx, offset, patch->out, n) != 0) {
+            return DELTA_ERR_READ;
+        }
+        crc = delta_crc32(crc, patch->out, n);
+    }
+    return crc == patch->header.old_crc ? DELTA_OK : DELTA_ERR_OLD_IMAGE;
+}
+
+static int parse_header(deltaPatch_t *patch)
+{
+    deltaHeader_t *h = &patch->header;
+
+    if (memcmp(patch->head, DELTA_MAGIC, 8) != 0) {
+        return DELTA_ERR_FORMAT;
+    }
+    h->old_size = get_u32(patch->head + 8);
+    h->old_crc = get_u32(patch->head + 12);
+    h->new_size = get_u32(patch->head + 16);
+    h->new_crc = get_u32(patch->head + 20);
+    h->block_size = get_u32(patch->head + 24);
+    if (h->block_size == 0 || h->block_size > DELTA_BLOCK_MAX) {
+        return DELTA_ERR_FORMAT;
+    }
+    // deflate may grow incompressible data by 5 bytes per 64 KB stored block
+    patch->comp = malloc(h->block_size + h->block_size / 1024 + 64);
+    patch->raw = malloc(h->block_size);
+    if (patch->comp == NULL || patch->raw == NULL) {
+        return DELTA_ERR_NO_MEM;
+    }
+    return check_old_image(patch);
+}
+
+static int feed(deltaPatch_t *patch, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        size_t n;
+        switch (patch->stage) {
+        case STAGE_HEADER:
+        case STAGE_BLOCK: {
+            size_t size = patch->stage == STAGE_HEADER ? DELTA_HEADER_SIZE : DELTA_BLOCK_HEADER_SIZE;
+            n = size - patch->head_len;
+            n = n < len ? n : len;
+            memcpy(patch->head + patch->head_len, data, n);
+            patch->head_len += n;
+            data += n;
+            len -= n;
+            if (patch->head_len < size) {
+                break;
+            }
+            patch->head_len = 0;
+            if (patch->stage == STAGE_HEADER) {
+                int err = parse_header(patch);
+                if (err != DELTA_OK) {
+                    return err;
+                }
+                patch->stage = STAGE_BLOCK;
+                break;
+            }
+            patch->raw_len = get_u32(patch->head);
+            patch->comp_len = get_u32(patch->head + 4);
+            patch->comp_fill = 0;
+            if (patch->raw_len == 0 || patch->raw_len > patch->header.block_size ||
+                    patch->comp_len == 0 || patch->comp_len > patch->header.block_size + patch->header.block_size / 1024 + 64) {
+                return DELTA_ERR_FORMAT;
+            }
+            patch->stage = STAGE_DATA;
+            break;
+        }
+        case STAGE_DATA:
+            n = patch->comp_len - patch->comp_fill;
+            n = n < len ? n : len;
+            memcpy(patch->comp + patch->comp_fill, data, n);
+            patch->comp_fill += n;
+            data += n;
+            len -= n;
+            if (patch->comp_fill < patch->comp_len) {
+                break;
+            }
+            if (inflate_block(&patch->inflate, patch->raw, patch->raw_len, patch->comp, patch->comp_len) != (int)patch->raw_len) {
+                return DELTA_ERR_FORMAT;
+            }
+            int err = apply_ops(patch, patch->raw, patch->raw_len);
+            if (err != DELTA_OK) {
+                return err;
+            }
+            patch->stage = STAGE_BLOCK;
+            break;
+        }
+    }
+    return DELTA_OK;
+}
+
+/*------------------------------------------------------------------------*/
+
+deltaPatch_t *delta_patch_new(delta_read_cb read_old, delta_write_cb write_new, void *ctx)
+{
+    deltaPatch_t *patch = calloc(1, sizeof(deltaPatch_t));
+    if (patch == NULL) {
+        return NULL;
+    }
+    patch->read_old = read_old;
+    patch->write_new = write_new;
+    patch->ctx = ctx;
+    return patch;
+}
+
+int delta_patch_feed(deltaPatch_t *patch, const uint8_t *data, size_t len)
+{
+    if (patch->error == DELTA_OK) {
+        patch->error = feed(patch, data, len);
+    }
+    return patch->error;
+}
+
+int delta_patch_finish(deltaPatch_t *patch)
+{
+    if (patch->error != DELTA_OK) {
+        return patch->error;
+    }
+    if (patch->stage != STAGE_BLOCK || patch->head_len != 0 || patch->op != OP_HEADER || patch->op_head_len != 0) {
+        return patch->error = DELTA_ERR_TRUNCATED;
+    }
+    patch->error = flush(patch);
+    if (patch->error == DELTA_OK && patch->new_pos != patch->header.new_size) {
+        patch->error = DELTA_ERR_TRUNCATED;
+    }
+    if (patch->error == DELTA_OK && patch->crc != patch->header.new_crc) {
+        patch->error = DELTA_ERR_CRC;
+    }
+    return patch->error;
+}
+
+const deltaHeader_t *delta_patch_header(const deltaPatch_t *patch)
+{
+    return patch->stage == STAGE_HEADER ? NULL : &patch->header;
+}
+
+void delta_patch_free(deltaPatch_t *patch)
+{
+    if (patch == NULL) {
+        return;
+    }
+    free(patch->comp);
+    free(patch->raw);
+    free(patch);
+}
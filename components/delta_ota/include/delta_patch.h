@@ -0,0 +1,125 @@
+#ifndef __DELTA_PATCH_H__
+#define __DELTA_PATCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Delta firmware patch, made by tools/delta_ota.py from the running image and the new one.
+ *
+ * Header (little endian, 32 bytes):
+ *   "NEDELTA1", old size, old CRC32, new size, new CRC32, block size, reserved
+ * then blocks of the compressed op stream, each one raw deflate on its own:
+ *   raw length, compressed length, compressed bytes
+ * The op stream is a series of bsdiff style ops:
+ *   diff length, extra length, old seek (int32), diff bytes, extra bytes
+ * Diff bytes are added to the old image at the old position, extra bytes are copied,
+ * then the old position moves by the seek.
+ */
+
+#define DELTA_MAGIC         "NEDELTA1"
+#define DELTA_HEADER_SIZE   32
+#define DELTA_BLOCK_MAX     (64 * 1024)     /* Largest block size accepted */
+#define DELTA_OUT_SIZE      4096            /* New image bytes passed to the write callback at a time */
+
+enum {
+    DELTA_OK = 0,
+    DELTA_ERR_FORMAT = -1,      /* Not a patch, or a corrupted one */
+    DELTA_ERR_NO_MEM = -2,
+    DELTA_ERR_OLD_IMAGE = -3,   /* The old image is not the one the patch was made from */
+    DELTA_ERR_READ = -4,        /* The read callback failed */
+    DELTA_ERR_WRITE = -5,       /* The write callback failed */
+    DELTA_ERR_CRC = -6,         /* The new image does not match its CRC32 */
+    DELTA_ERR_TRUNCATED = -7,   /* The patch ended early */
+};
+
+/**
+ * @brief Patch header
+ */
+typedef struct deltaHeader {
+    uint32_t old_size;      /* Size of the image the patch applies to */
+    uint32_t old_crc;       /* CRC32 of that image */
+    uint32_t new_size;      /* Size of the image the patch makes */
+    uint32_t new_crc;       /* CRC32 of that image */
+    uint32_t block_size;    /* Largest raw block of the op stream */
+} deltaHeader_t;
+
+/**
+ * @brief Reads the old image
+ * @param ctx Caller context
+ * @param offset Offset in the old image
+ * @param buf Buffer to fill
+ * @param len Bytes to read
+ * @return 0 on success
+ */
+typedef int (*delta_read_cb)(void *ctx, uint32_t offset, uint8_t *buf, size_t len);
+
+/**
+ * @brief Takes the next bytes of the new image
+ * @param ctx Caller context
+ * @param data New image bytes, DELTA_OUT_SIZE at a time except the last ones
+ * @param len Number of bytes
+ * @return 0 on success
+ */
+typedef int (*delta_write_cb)(void *ctx, const uint8_t *data, size_t len);
+
+typedef struct deltaPatch deltaPatch_t;
+
+/**
+ * @brief Create a patch applier
+ * @param read_old Old image reader
+ * @param write_new New image writer
+ * @param ctx Context passed to both callbacks
+ * @return Applier, NULL if out of memory
+ */
+deltaPatch_t *delta_patch_new(delta_read_cb read_old, delta_write_cb write_new, void *ctx);
+
+/**
+ * @brief Feed the next bytes of the patch, split anywhere
+ *
+ * Once the header is in, the old image is checked against its CRC32 before anything is written
+ * @param patch Applier
+ * @param data Patch bytes
+ * @param len Number of bytes
+ * @return DELTA_OK, or the first error, which every later call returns too
+ */
+int delta_patch_feed(deltaPatch_t *patch, const uint8_t *data, size_t len);
+
+/**
+ * @brief Complete the new image after the last patch byte
+ * @param patch Applier
+ * @return DELTA_OK if the whole new image was written and matches its CRC32
+ */
+int delta_patch_finish(deltaPatch_t *patch);
+
+/**
+ * @brief Patch header
+ * @param patch Applier
+ * @return Header, NULL until its bytes are fed
+ */
+const deltaHeader_t *delta_patch_header(const deltaPatch_t *patch);
+
+/**
+ * @brief Free a patch applier
+ * @param patch Applier, may be NULL
+ */
+void delta_patch_free(deltaPatch_t *patch);
+
+/**
+ * @brief CRC32 of the patch format, the one of esp_rom_crc32_le and zlib
+ * @param crc CRC32 of the previous bytes, 0 to start
+ * @param data Bytes
+ * @param len Number of bytes
+ * @return CRC32 including these bytes
+ */
+uint32_t delta_crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DELTA_PATCH_H__ */
@@ -0,0 +1,217 @@
+/*
+ * Applies patches made by tools/delta_ota.py on the host.
+ *
+ *   test_delta_patch                    synthetic images
+ *   test_delta_patch running.bin new.bin  real images
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "delta_patch.h"
+#include "host_test.h"
+
+#define TOOL "python3 ../../../tools/delta_ota.py"
+
+typedef struct image {
+    uint8_t *data;
+    size_t len;
+    size_t size;
+} image_t;
+
+typedef struct images {
+    const image_t *old;
+    image_t new;
+    int fail_write_at;      /* Fails the n-th write if > 0 */
+    int writes;
+} images_t;
+
+static int read_old(void *ctx, uint32_t offset, uint8_t *buf, size_t len)
+{
+    images_t *images = ctx;
+    if (offset + len > images->old->len) {
+        return -1;
+    }
+    memcpy(buf, images->old->data + offset, len);
+    return 0;
+}
+
+static int write_new(void *ctx, const uint8_t *data, size_t len)
+{
+    images_t *images = ctx;
+    if (++images->writes == images->fail_write_at) {
+        return -1;
+    }
+    if (images->new.len + len > images->new.size) {
+        images->new.size = (images->new.len + len) * 2;
+        images->new.data = realloc(images->new.data, images->new.size);
+    }
+    memcpy(images->new.data + images->new.len, data, len);
+    images->new.len += len;
+    return 0;
+}
+
+static int load(const char *path, image_t *image)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    image->len = ftell(f);
+    image->size = image->len;
+    fseek(f, 0, SEEK_SET);
+    image->data = malloc(image->len + 1);
+    size_t n = fread(image->data, 1, image->len, f);
+    fclose(f);
+    return n == image->len ? 0 : -1;
+}
+
+static int save(const char *path, const image_t *image)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    size_t n = fwrite(image->data, 1, image->len, f);
+    fclose(f);
+    return n == image->len ? 0 : -1;
+}
+
+/**
+ * @brief Apply a patch fed in random pieces, like HTTP reads
+ * @return Result of delta_patch_finish, or the first error of the feed
+ */
+static int apply(const image_t *old, const image_t *patch, size_t patch_len, images_t *images)
+{
+    images->old = old;
+    images->new.len = 0;
+    images->writes = 0;
+    deltaPatch_t *p = delta_patch_new(read_old, write_new, images);
+    int err = DELTA_OK;
+    for (size_t pos = 0; pos < patch_len && err == DELTA_OK; ) {
+        size_t n = 1 + rand() % 3000;
+        n = n < patch_len - pos ? n : patch_len - pos;
+        err = delta_patch_feed(p, patch->data + pos, n);
+        pos += n;
+    }
+    if (err == DELTA_OK) {
+        CHECK(delta_patch_header(p) != NULL);
+        err = delta_patch_finish(p);
+    }
+    delta_patch_free(p);
+    return err;
+}
+
+/**
+ * @brief Firmware like image, runs of code with repeated instructions and tables
+ */
+static void make_old(image_t *image, size_t len)
+{
+    image->data = malloc(len);
+    image->len = image->size = len;
+    for (size_t i = 0; i < len; ) {
+        size_t run = 4 + rand() % 60;
+        uint8_t b = rand() % 4;
+        int random = rand() % 3 == 0;
+        for (size_t j = 0; j < run && i < len; j++, i++) {
+            image->data[i] = random ? rand() : b;
+        }
+    }
+}
+
+/**
+ * @brief The next build, some bytes changed, code inserted, removed and moved
+ */
+static void make_new(const image_t *old, image_t *image)
+{
+    size_t insert = 3000;
+    image->size = old->len + insert;
+    image->data = malloc(image->size);
+    memcpy(image->data, old->data, 5000);
+    for (size_t i = 0; i < insert; i++) {
+        image->data[5000 + i] = rand();
+    }
+    size_t len = 5000 + insert;
+    // 20 KB removed
+    memcpy(image->data + len, old->data + 5000, old->len / 3 - 5000);
+    len += old->len / 3 - 5000;
+    memcpy(image->data + len, old->data + old->len / 3 + 20000, old->len - old->len / 3 - 20000);
+    len += old->len - old->len / 3 - 20000;
+    // a moved function
+    memcpy(image->data + len / 2, old->data + 100, 8000);
+    for (int i = 0; i < 200; i++) {
+        image->data[rand() % len] = rand();
+    }
+    image->len = len;
+}
+
+int main(int argc, char *argv[])
+{
+    image_t old = {0}, new = {0}, patch = {0};
+    images_t images = {0};
+    const char *old_path = "old.bin", *new_path = "new.bin";
+
+    srand(1);
+    if (argc == 3) {
+        old_path = argv[1];
+        new_path = argv[2];
+        CHECK(load(old_path, &old) == 0);
+        CHECK(load(new_path, &new) == 0);
+    } else {
+        make_old(&old, 1200 * 1024);
+        make_new(&old, &new);
+        CHECK(save(old_path, &old) == 0);
+        CHECK(save(new_path, &new) == 0);
+    }
+    if (g_failed) {
+        return 1;
+    }
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), TOOL " diff %s %s patch.bin", old_path, new_path);
+    CHECK(system(cmd) == 0);
+    CHECK(load("patch.bin", &patch) == 0);
+    if (g_failed) {
+        return 1;
+    }
+
+    // the patch makes the new image
+    CHECK(apply(&old, &patch, patch.len, &images) == DELTA_OK);
+    CHECK(images.new.len == new.len);
+    CHECK(images.new.data != NULL && memcmp(images.new.data, new.data, new.len) == 0);
+    CHECK(delta_crc32(0, new.data, new.len) == delta_crc32(delta_crc32(0, new.data, 100), new.data + 100, new.len - 100));
+
+    // another running image is refused before anything is written
+    old.data[old.len / 2] ^= 0x01;
+    CHECK(apply(&old, &patch, patch.len, &images) == DELTA_ERR_OLD_IMAGE);
+    CHECK(images.writes == 0);
+    old.data[old.len / 2] ^= 0x01;
+
+    // a patch cut short is not a complete image
+    CHECK(apply(&old, &patch, patch.len - 1, &images) == DELTA_ERR_TRUNCATED);
+    CHECK(apply(&old, &patch, DELTA_HEADER_SIZE + 5, &images) == DELTA_ERR_TRUNCATED);
+
+    // corrupted patches
+    patch.data[20] ^= 0x55;     // new image CRC32
+    CHECK(apply(&old, &patch, patch.len, &images) == DELTA_ERR_CRC);
+    CHECK(images.new.len == new.len);
+    patch.data[20] ^= 0x55;
+    patch.data[DELTA_HEADER_SIZE + 4] ^= 0x55;  // compressed length of the first block
+    CHECK(apply(&old, &patch, patch.len, &images) != DELTA_OK);
+    patch.data[DELTA_HEADER_SIZE + 4] ^= 0x55;
+    patch.data[0] = 'X';
+    CHECK(apply(&old, &patch, patch.len, &images) == DELTA_ERR_FORMAT);
+    patch.data[0] = DELTA_MAGIC[0];
+
+    // write errors stop the patch
+    images.fail_write_at = 2;
+    CHECK(apply(&old, &patch, patch.len, &images) == DELTA_ERR_WRITE);
+    images.fail_write_at = 0;
+
+    printf("%s -> %s: patch of %zu bytes, %.1f%% of %zu\n", old_path, new_path, patch.len,
+           100.0 * patch.len / (new.len ? new.len : 1), new.len);
+    free(old.data);
+    free(new.data);
+    free(patch.data);
+    free(images.new.data);
+    return host_test_end();
+}
@@ -0,0 +1,133 @@
+#include <math.h>
+#include <string.h>
+#include "drift_fit.h"
+
+enum { REG_RATE, REG_OFFSET, REG_TEMP, REG_MAX };   /* Regressors: elapsed, 1, elapsed * temp */
+
+void drift_fit_reset(driftFit_t *fit)
+{
+    memset(fit, 0, sizeof(driftFit_t));
+}
+
+/**
+ * @brief Solve the normal equations of some regressors by Gauss elimination
+ * @param fit Fit
+ * @param regs Regressors to solve for
+ * @param n Number of regressors
+ * @param coef Solution, by regressor
+ * @return 0 on success, -1 if the system is singular
+ */
+static int solve(const driftFit_t *fit, const int *regs, int n, double coef[REG_MAX])
+{
+    double a[REG_MAX][REG_MAX + 1];
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            a[i][j] = fit->sxx[regs[i]][regs[j]];
+        }
+        a[i][n] = fit->sxy[regs[i]];
+    }
+    for (int i = 0; i < n; i++) {
+        int pivot = i;
+        for (int k = i + 1; k < n; k++) {
+            if (fabs(a[k][i]) > fabs(a[pivot][i])) {
+                pivot = k;
+            }
+        }
+        if (fabs(a[pivot][i]) < 1e-12 * (fabs(fit->sxx[regs[i]][regs[i]]) + 1e-300)) {
+            return -1;
+        }
+        for (int j = 0; j <= n; j++) {
+            double t = a[i][j];
+            a[i][j] = a[pivot][j];
+            a[pivot][j] = t;
+        }
+        for (int k = 0; k < n; k++) {
+            if (k == i) {
+                continue;
+            }
+            double f = a[k][i] / a[i][i];
+            for (int j = i; j <= n; j++) {
+                a[k][j] -= f * a[i][j];
+            }
+        }
+    }
+    memset(coef, 0, sizeof(double) * REG_MAX);
+    for (int i = 0; i < n; i++) {
+        coef[regs[i]] = a[i][n] / a[i][i];
+    }
+    return 0;
+}
+
+/**
+ * @brief Solve the fit with the regressors the samples can tell apart
+ */
+static void drift_fit_solve(driftFit_t *fit)
+{
+    double coef[REG_MAX] = {0};
+    int regs[REG_MAX];
+    int n = 0;
+
+    fit->rate = 0;
+    fit->offset = 0;
+    fit->temp_coef = 0;
+    if (fit->sw <= 0 || fit->sxx[REG_RATE][REG_RATE] <= 0) {
+        return;
+    }
+    // sw * sxx - sx^2, over sw^2, is the weighted variance of the intervals
+    double sx = fit->sxx[REG_RATE][REG_OFFSET];
+    double var_elapsed = (fit->sw * fit->sxx[REG_RATE][REG_RATE] - sx * sx) / (fit->sw * fit->sw);
+    double var_temp = fit->stt / fit->sw - (fit->st / fit->sw) * (fit->st / fit->sw);
+
+    regs[n++] = REG_RATE;
+    if (fit->sw > 1.5 && var_elapsed > DRIFT_FIT_MIN_SPREAD_S * DRIFT_FIT_MIN_SPREAD_S) {
+        regs[n++] = REG_OFFSET;
+    }
+    if (fit->sw > 1.5 && var_temp > DRIFT_FIT_MIN_SPREAD_C * DRIFT_FIT_MIN_SPREAD_C) {
+        regs[n++] = REG_TEMP;
+    }
+    // drop the last regressors while the samples can not tell them apart
+    while (solve(fit, regs, n, coef) != 0) {
+        if (--n == 0) {
+            return;
+        }
+    }
+    fit->rate = coef[REG_RATE];
+    fit->offset = coef[REG_OFFSET];
+    fit->temp_coef = coef[REG_TEMP];
+}
+
+void drift_fit_add(driftFit_t *fit, double elapsed, double drift, double temp, double start_temp, double weight)
+{
+    double dt = isnan(temp) ? 0 : temp - DRIFT_FIT_TEMP_REF;
+    double x[REG_MAX] = { elapsed, 1, elapsed * dt };
+
+    // score the prediction made for this interval before learning it
+    if (fit->sw > 1.5 && elapsed > 0) {
+        double err = (drift_fit_predict(fit, elapsed, start_temp) - drift) / elapsed;
+        fit->see = fit->see * DRIFT_FIT_FORGET + weight * err * err;
+        fit->sew = fit->sew * DRIFT_FIT_FORGET + weight;
+        fit->margin = sqrt(fit->see / fit->sew);
+    }
+    fit->sw = fit->sw * DRIFT_FIT_FORGET + weight;
+    fit->st = fit->st * DRIFT_FIT_FORGET + weight * dt;
+    fit->stt = fit->stt * DRIFT_FIT_FORGET + weight * dt * dt;
+    for (int i = 0; i < REG_MAX; i++) {
+        for (int j = 0; j < REG_MAX; j++) {
+            fit->sxx[i][j] = fit->sxx[i][j] * DRIFT_FIT_FORGET + weight * x[i] * x[j];
+        }
+        fit->sxy[i] = fit->sxy[i] * DRIFT_FIT_FORGET + weight * x[i] * drift;
+    }
+    drift_fit_solve(fit);
+}
+
+double drift_fit_predict(const driftFit_t *fit, double elapsed, double temp)
+{
+    double dt = isnan(temp) ? 0 : temp - DRIFT_FIT_TEMP_REF;
+    return fit->rate * elapsed + fit->offset + fit->temp_coef * elapsed * dt;
+}
+
+double drift_fit_predict_safe(const driftFit_t *fit, double elapsed, double temp)
+{
+    return drift_fit_predict(fit, elapsed, temp) - DRIFT_FIT_MARGIN_SIGMA * fit->margin * elapsed;
+}
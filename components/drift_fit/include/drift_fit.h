@@ -0,0 +1,89 @@
+#ifndef __DRIFT_FIT_H__
+#define __DRIFT_FIT_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Weighted least-squares fit of the drift of a clock between two syncs:
+ *
+ *     drift = rate * elapsed + offset + temp_coef * elapsed * (temp - DRIFT_FIT_TEMP_REF)
+ *
+ * where elapsed is the clock time between the syncs, drift is (real - clock) over it and
+ * temp the mean temperature over it. Older samples are down-weighted by DRIFT_FIT_FORGET
+ * at each new one. The offset is fitted only once the intervals spread enough to tell it
+ * from the rate, the temperature coefficient only once the temperatures do; until then
+ * they are 0. The state is plain data, so it can be kept in RTC memory.
+ *
+ * A prediction is as likely to be over the real drift as under it, and a compensation
+ * over the real drift wakes the device early. The errors of the predictions the fit made
+ * for each interval from the temperature at its start are tracked too, so the caller can
+ * compensate DRIFT_FIT_MARGIN_SIGMA times their root mean square less.
+ */
+
+#define DRIFT_FIT_FORGET        0.8     /* Forgetting factor (0-1), the smaller the value, the higher the weight of recent samples */
+#define DRIFT_FIT_MIN_SPREAD_S  1800    /* Intervals must spread this much before the offset is fitted */
+#define DRIFT_FIT_MIN_SPREAD_C  3.0     /* Temperatures must spread this much before their coefficient is fitted */
+#define DRIFT_FIT_TEMP_REF      25.0    /* Temperature the rate is fitted at, Celsius */
+#define DRIFT_FIT_MARGIN_SIGMA  2.5     /* Prediction errors the safe prediction stays under, in root mean squares */
+
+/**
+ * @brief Fit state, zeroed by drift_fit_reset()
+ */
+typedef struct driftFit {
+    double sw;                  /* Sum of sample weights */
+    double sxx[3][3];           /* Weighted sums of the products of the regressors */
+    double sxy[3];              /* Weighted sums of each regressor times the drift */
+    double st;                  /* Weighted sum of the temperatures from the reference */
+    double stt;                 /* Weighted sum of their squares */
+    double see;                 /* Weighted sum of the squared prediction errors, per elapsed second */
+    double sew;                 /* Sum of the weights of the predictions */
+    float rate;                 /* Fitted drift per elapsed second at the reference temperature */
+    float offset;               /* Fitted drift per interval independent of its length, seconds */
+    float temp_coef;            /* Fitted drift per elapsed second and Celsius from the reference */
+    float margin;               /* Root mean square of the prediction errors, per elapsed second */
+} driftFit_t;
+
+/**
+ * @brief Clear a fit, it predicts no drift
+ * @param fit Fit
+ */
+void drift_fit_reset(driftFit_t *fit);
+
+/**
+ * @brief Add a sync interval and solve the fit
+ * @param fit Fit
+ * @param elapsed Clock seconds elapsed
+ * @param drift Drift seconds, real minus clock
+ * @param temp Mean temperature over the interval in Celsius, NAN if unknown
+ * @param start_temp Temperature at the start of the interval, the one it was predicted with, NAN if unknown
+ * @param weight Sample weight
+ */
+void drift_fit_add(driftFit_t *fit, double elapsed, double drift, double temp, double start_temp, double weight);
+
+/**
+ * @brief Predicted drift over an interval
+ * @param fit Fit
+ * @param elapsed Clock seconds of the interval
+ * @param temp Temperature expected over it in Celsius, NAN if unknown
+ * @return Drift seconds, real minus clock
+ */
+double drift_fit_predict(const driftFit_t *fit, double elapsed, double temp);
+
+/**
+ * @brief Predicted drift over an interval less DRIFT_FIT_MARGIN_SIGMA error margins, to wake late rather than early
+ * @param fit Fit
+ * @param elapsed Clock seconds of the interval
+ * @param temp Temperature expected over it in Celsius, NAN if unknown
+ * @return Drift seconds, real minus clock
+ */
+double drift_fit_predict_safe(const driftFit_t *fit, double elapsed, double temp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DRIFT_FIT_H__ */
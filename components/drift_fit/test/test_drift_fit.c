@@ -0,0 +1,202 @@
+/*
+ * Fits a simulated RTC whose rate depends on the temperature, synced over NTP at random
+ * intervals through a daily temperature cycle, and scores the drift predicted for each
+ * interval before it is added, as sleep.c compensates the next sleep: the mean error and
+ * the rate of early wakes, where the predicted drift exceeds the real one. The decaying
+ * average of the error rates sleep.c compensated with before the fit is scored alongside,
+ * as it was and less a margin of its own errors taken as the fit takes it.
+ */
+#include <stdio.h>
+#include <math.h>
+#include "drift_fit.h"
+#include "host_test.h"
+
+#define DAY         86400.0
+#define PI          3.14159265358979323846
+#define SYNCS       400
+#define WARMUP      20          /* Syncs before the predictions are scored */
+#define EARLY_S     1.0         /* Over-compensation that makes the device wake early */
+#define EARLY_MAX   0.02        /* Rate of early wakes the safe prediction may have */
+
+/* The simulated clock */
+#define TRUE_RATE   0.012       /* Slow by 1.2% at the reference temperature */
+#define TRUE_COEF   0.0004      /* And by 0.04% more per Celsius */
+#define TRUE_OFFSET 2.0         /* Seconds each sync interval, e.g. boot time not counted */
+
+static uint32_t rnd(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 8) & 0xffffff;
+}
+
+/* Outdoor temperature, a daily cycle around 15 C */
+static double temperature(double t)
+{
+    return 15.0 + 12.0 * sin(2 * PI * t / DAY);
+}
+
+typedef struct score {
+    double abs_err;             /* Sum of the absolute prediction errors, seconds */
+    int early;                  /* Predictions over the real drift by more than EARLY_S */
+    int count;
+} score_t;
+
+/* The compensator of sleep.c before the fit: a decaying average of the last error rates */
+#define AVG_HISTORY 5
+#define AVG_ALPHA   0.4
+
+typedef struct avgComp {
+    double errors[AVG_HISTORY];
+    int index;
+    int count;
+    double see;                 /* Prediction errors as driftFit_t tracks them */
+    double sew;
+} avgComp_t;
+
+static double avg_predict(const avgComp_t *a, double elapsed);
+
+static void avg_add(avgComp_t *a, double elapsed, double drift)
+{
+    double rate = drift / elapsed;
+    if (elapsed < 300 || rate < -0.1 || rate > 0.1) {
+        return;
+    }
+    if (a->count > 1) {
+        double err = (avg_predict(a, elapsed) - drift) / elapsed;
+        a->see = a->see * DRIFT_FIT_FORGET + err * err;
+        a->sew = a->sew * DRIFT_FIT_FORGET + 1;
+    }
+    a->errors[a->index] = rate;
+    a->index = (a->index + 1) % AVG_HISTORY;
+    if (a->count < AVG_HISTORY) {
+        a->count++;
+    }
+}
+
+static double avg_predict(const avgComp_t *a, double elapsed)
+{
+    double sum = 0, total = 0, weight = 1;
+    for (int i = 0; i < a->count; i++) {
+        sum += a->errors[(a->index - 1 - i + AVG_HISTORY) % AVG_HISTORY] * weight;
+        total += weight;
+        weight *= 1 - AVG_ALPHA;
+    }
+    double rate = total > 0 ? sum / total : 0;
+    // long sleeps were compensated 0.1% less by hand so that they end late
+    if (elapsed > 5 * 3600) {
+        rate -= 0.001;
+    }
+    return round(elapsed * rate);
+}
+
+static double avg_predict_safe(const avgComp_t *a, double elapsed)
+{
+    double margin = a->sew > 0 ? sqrt(a->see / a->sew) : 0;
+    return avg_predict(a, elapsed) - DRIFT_FIT_MARGIN_SIGMA * margin * elapsed;
+}
+
+static void score_add(score_t *s, double predicted, double drift)
+{
+    s->abs_err += fabs(predicted - drift);
+    s->early += predicted - drift > EARLY_S;
+    s->count++;
+}
+
+static void score_show(const char *name, const score_t *s)
+{
+    printf("%-20s mean error %6.1fs, early wakes %5.1f%%\n", name, s->abs_err / s->count,
+           100.0 * s->early / s->count);
+}
+
+int main(void)
+{
+    driftFit_t fit;
+
+    // exact samples are fitted exactly
+    drift_fit_reset(&fit);
+    CHECK(drift_fit_predict(&fit, 3600, 20) == 0);
+    const double xs[] = { 3600, 7200, 14400, 21600, 28800, 10800 };
+    const double ts[] = { 25, 10, 35, 18, 30, 5 };
+    for (int i = 0; i < 6; i++) {
+        double y = 0.01 * xs[i] + 3 + 0.0005 * xs[i] * (ts[i] - DRIFT_FIT_TEMP_REF);
+        drift_fit_add(&fit, xs[i], y, ts[i], ts[i], 1.0);
+    }
+    CHECK(fabs(fit.rate - 0.01) < 1e-6 && fabs(fit.offset - 3) < 1e-3 && fabs(fit.temp_coef - 0.0005) < 1e-7);
+    CHECK(fabs(drift_fit_predict(&fit, 3600, 15) - (36 + 3 - 18)) < 1e-2);
+
+    // equal intervals at one temperature, only the rate is fitted
+    drift_fit_reset(&fit);
+    for (int i = 0; i < 5; i++) {
+        drift_fit_add(&fit, 3600, 36 + 2, 20, 20, 1.0);
+    }
+    CHECK(fit.offset == 0 && fit.temp_coef == 0);
+    CHECK(fabs(fit.rate - 38.0 / 3600) < 1e-6);
+
+    // unknown temperatures, the temperature coefficient is never fitted
+    drift_fit_reset(&fit);
+    for (int i = 0; i < 6; i++) {
+        drift_fit_add(&fit, xs[i], 0.01 * xs[i] + 3, NAN, NAN, 1.0);
+    }
+    CHECK(fit.temp_coef == 0 && fabs(fit.rate - 0.01) < 1e-6 && fabs(fit.offset - 3) < 1e-3);
+    CHECK(fabs(drift_fit_predict(&fit, 3600, NAN) - 39) < 1e-2);
+
+    // a simulated clock synced at random intervals of 1 to 8 hours
+    driftFit_t with_temp, without_temp;
+    avgComp_t avg = {0};
+    score_t none = {0}, average = {0}, average_safe = {0}, plain = {0}, temp = {0}, safe = {0};
+    uint32_t seed = 11;
+    double t = 0;
+    drift_fit_reset(&with_temp);
+    drift_fit_reset(&without_temp);
+    for (int i = 0; i < SYNCS; i++) {
+        double real = 3600 + rnd(&seed) % (7 * 3600);
+        double mean_temp = 0;
+        for (int m = 0; m < 60; m++) {
+            mean_temp += temperature(t + real * (m + 0.5) / 60) / 60;
+        }
+        double rate = TRUE_RATE + TRUE_COEF * (mean_temp - DRIFT_FIT_TEMP_REF);
+        // both ends are read with 1 s resolution
+        double elapsed = round((real - TRUE_OFFSET) / (1 + rate));
+        double drift = real - elapsed;
+        double start_temp = temperature(t);
+
+        if (i >= WARMUP) {
+            score_add(&none, 0, drift);
+            score_add(&average, avg_predict(&avg, elapsed), drift);
+            score_add(&average_safe, avg_predict_safe(&avg, elapsed), drift);
+            score_add(&plain, drift_fit_predict(&without_temp, elapsed, NAN), drift);
+            score_add(&temp, drift_fit_predict(&with_temp, elapsed, start_temp), drift);
+            score_add(&safe, drift_fit_predict_safe(&with_temp, elapsed, start_temp), drift);
+        }
+        // the firmware averages the temperatures read at each wake of the interval
+        avg_add(&avg, elapsed, drift);
+        drift_fit_add(&without_temp, elapsed, drift, NAN, NAN, 1.0);
+        drift_fit_add(&with_temp, elapsed, drift, mean_temp, start_temp, 1.0);
+        t += real;
+    }
+    score_show("uncompensated", &none);
+    score_show("decaying average", &average);
+    score_show("average less margin", &average_safe);
+    score_show("rate and offset", &plain);
+    score_show("with temperature", &temp);
+    score_show("less the margin", &safe);
+    printf("fit: rate %.4f%% offset %+.2fs coef %.4f%%/C (true %.4f%% %+.2fs %.4f%%/C)\n", with_temp.rate * 100,
+           with_temp.offset, with_temp.temp_coef * 100, TRUE_RATE * 100, TRUE_OFFSET, TRUE_COEF * 100);
+    CHECK(temp.abs_err < plain.abs_err && plain.abs_err < none.abs_err);
+    CHECK(temp.abs_err < average.abs_err);
+    // the safe prediction all but never wakes early, at the same margin the decaying average
+    // ends more than twice as late
+    CHECK(safe.early < EARLY_MAX * safe.count);
+    CHECK(average.early > 10 * safe.early && safe.abs_err * 2 < average_safe.abs_err);
+    CHECK(fabs(with_temp.temp_coef - TRUE_COEF) < TRUE_COEF * 0.2);
+    CHECK(fabs(with_temp.rate - TRUE_RATE) < TRUE_RATE * 0.1);
+
+    // the fit follows a clock whose rate changed
+    for (int i = 0; i < 30; i++) {
+        double elapsed = 3600 + 1800 * (i % 4);
+        drift_fit_add(&with_temp, elapsed, -0.02 * elapsed, DRIFT_FIT_TEMP_REF, DRIFT_FIT_TEMP_REF, 1.0);
+    }
+    CHECK(fabs(drift_fit_predict(&with_temp, 3600, DRIFT_FIT_TEMP_REF) + 72) < 5);
+
+    return host_test_end();
+}
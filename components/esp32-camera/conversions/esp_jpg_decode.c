@@ -13,7 +13,10 @@
 // limitations under the License.
 #include "esp_jpg_decode.h"
 
+#include <stdlib.h>
+#include <string.h>
 #include "esp_system.h"
+#include "jpg_slice.h"
 #if ESP_IDF_VERSION_MAJOR >= 4 // IDF 4+
 #if CONFIG_IDF_TARGET_ESP32 // ESP32/PICO-D4
 #include "esp32/rom/tjpgd.h"
@@ -38,6 +41,8 @@
 static const char* TAG = "esp_jpg_decode";
 #endif
 
+#define JPG_WORK_SIZE 3100
+
 typedef struct {
         jpg_scale_t scale;
         jpg_reader_cb reader;
@@ -93,10 +98,14 @@ static unsigned int _jpg_read(JDEC *decoder, uint8_t *buf, unsigned int len)
 
 esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void * arg)
 {
-    static uint8_t work[3100];
     JDEC decoder;
     esp_jpg_decoder_t jpeg;
+    uint8_t *work = (uint8_t *)malloc(JPG_WORK_SIZE);
 
+    if(!work){
+        ESP_LOGE(TAG, "Work buffer malloc failed");
+        return ESP_FAIL;
+    }
     jpeg.len = len;
     jpeg.reader = reader;
     jpeg.writer = writer;
@@ -104,9 +113,10 @@ esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jp
     jpeg.scale = scale;
     jpeg.index = 0;
 
-    JRESULT jres = jd_prepare(&decoder, _jpg_read, work, 3100, &jpeg);
+    JRESULT jres = jd_prepare(&decoder, _jpg_read, work, JPG_WORK_SIZE, &jpeg);
     if(jres != JDR_OK){
         ESP_LOGE(TAG, "JPG Header Parse Failed! %s", jd_errors[jres]);
+        free(work);
         return ESP_FAIL;
     }
 
@@ -119,6 +129,7 @@ esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jp
     jres = jd_decomp(&decoder, _jpg_write, (uint8_t)jpeg.scale);
     //output end
     writer(arg, output_width, output_height, output_width, output_height, NULL);
+    free(work);
 
     if (jres != JDR_OK) {
         ESP_LOGE(TAG, "JPG Decompression Failed! %s", jd_errors[jres]);
@@ -132,3 +143,262 @@ esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jp
     return ESP_OK;
 }
 
+/*
+ * Stripe of an in-memory JPEG with restart markers, decoded as a JPEG of its own:
+ * the headers with the SOF height patched, the entropy coded data between two
+ * restart markers with the following markers renumbered from RST0, and EOI.
+ */
+typedef struct {
+        const uint8_t *src;
+        size_t header_len;          // headers up to the end of SOS
+        size_t sof_height;          // offset of the SOF height field
+        size_t data_start;          // entropy coded data of the stripe
+        size_t data_end;
+        size_t index;               // read position in the stripe stream
+        uint16_t height;            // lines of the stripe
+        uint16_t y;                 // first output line of the stripe
+        int8_t rst_base;            // number of the marker the stripe starts after, -1 for the first stripe
+        jpg_scale_t scale;
+        jpg_writer_cb writer;
+        void * arg;
+} esp_jpg_stripe_t;
+
+static const uint8_t jpg_eoi[2] = {0xFF, 0xD9};
+
+static unsigned int _stripe_read(JDEC *decoder, uint8_t *buf, unsigned int len)
+{
+    esp_jpg_stripe_t *stripe = (esp_jpg_stripe_t *)decoder->device;
+    size_t data_len = stripe->data_end - stripe->data_start;
+    size_t total = stripe->header_len + data_len + sizeof(jpg_eoi);
+    size_t i, n;
+
+    if (len > total - stripe->index) {
+        len = total - stripe->index;
+    }
+    for (i = 0; buf && i < len; i += n) {
+        size_t pos = stripe->index + i;
+        if (pos < stripe->header_len) {
+            n = stripe->header_len - pos;
+            n = n < len - i ? n : len - i;
+            memcpy(buf + i, stripe->src + pos, n);
+            if (stripe->sof_height >= pos && stripe->sof_height < pos + n) {
+                buf[i + stripe->sof_height - pos] = stripe->height >> 8;
+            }
+            if (stripe->sof_height + 1 >= pos && stripe->sof_height + 1 < pos + n) {
+                buf[i + stripe->sof_height + 1 - pos] = stripe->height & 0xFF;
+            }
+        } else if (pos < stripe->header_len + data_len) {
+            size_t s = stripe->data_start + pos - stripe->header_len;
+            n = stripe->data_end - s;
+            n = n < len - i ? n : len - i;
+            memcpy(buf + i, stripe->src + s, n);
+            if (stripe->rst_base >= 0) {
+                // the decoder expects RST0 first, markers are 0xFF 0xD0-0xD7, 0xFF in data is stuffed with 0x00
+                for (size_t k = (s > stripe->data_start) ? 0 : 1; k < n; k++) {
+                    uint8_t c = buf[i + k];
+                    if ((c & 0xF8) == 0xD0 && stripe->src[s + k - 1] == 0xFF) {
+                        buf[i + k] = 0xD0 | ((c - stripe->rst_base - 1) & 7);
+                    }
+                }
+            }
+        } else {
+            n = total - pos;
+            n = n < len - i ? n : len - i;
+            memcpy(buf + i, jpg_eoi + (pos - stripe->header_len - data_len), n);
+        }
+    }
+    stripe->index += len;
+    return len;
+}
+
+static unsigned int _stripe_write(JDEC *decoder, void *bitmap, JRECT *rect)
+{
+    esp_jpg_stripe_t *stripe = (esp_jpg_stripe_t *)decoder->device;
+
+    return stripe->writer(stripe->arg, rect->left, stripe->y + rect->top,
+                          rect->right + 1 - rect->left, rect->bottom + 1 - rect->top, (uint8_t *)bitmap);
+}
+
+static bool _stripe_decode(void *arg)
+{
+    esp_jpg_stripe_t *stripe = (esp_jpg_stripe_t *)arg;
+    JDEC decoder;
+    JRESULT jres;
+    uint8_t *work = (uint8_t *)malloc(JPG_WORK_SIZE);
+
+    if(!work){
+        ESP_LOGE(TAG, "Work buffer malloc failed");
+        return false;
+    }
+    jres = jd_prepare(&decoder, _stripe_read, work, JPG_WORK_SIZE, stripe);
+    if (jres == JDR_OK) {
+        jres = jd_decomp(&decoder, _stripe_write, (uint8_t)stripe->scale);
+    }
+    free(work);
+    if (jres != JDR_OK) {
+        ESP_LOGE(TAG, "JPG Stripe at line %u Failed! %s", stripe->y, jd_errors[jres]);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Split an in-memory JPEG in two stripes at the restart marker starting the MCU row
+ * closest to the middle. Fails if the JPEG has no restart marker at the start of a row.
+ */
+static bool _jpg_split(const uint8_t *src, size_t len, esp_jpg_stripe_t *stripes, uint16_t *width, uint16_t *height)
+{
+    size_t pos = 2, sof = 0, header_len = 0;
+    uint16_t nrst = 0, mcu_w = 0, mcu_h = 0;
+
+    if (len < 4 || src[0] != 0xFF || src[1] != 0xD8) {
+        return false;
+    }
+    while (!header_len && pos + 4 <= len) {
+        if (src[pos] != 0xFF) {
+            return false;
+        }
+        if (src[pos + 1] == 0xFF) { // fill byte
+            pos++;
+            continue;
+        }
+        size_t seg_len = (src[pos + 2] << 8) | src[pos + 3];
+        if (pos + 2 + seg_len > len) {
+            return false;
+        }
+        switch (src[pos + 1]) {
+        case 0xC0: // SOF0
+            if (seg_len < 17 || src[pos + 9] != 3) {
+                return false;
+            }
+            sof = pos + 5;
+            *height = (src[pos + 5] << 8) | src[pos + 6];
+            *width = (src[pos + 7] << 8) | src[pos + 8];
+            mcu_w = 8 * (src[pos + 11] >> 4);
+            mcu_h = 8 * (src[pos + 11] & 0x0F);
+            break;
+        case 0xDD: // DRI
+            nrst = (src[pos + 4] << 8) | src[pos + 5];
+            break;
+        case 0xDA: // SOS
+            header_len = pos + 2 + seg_len;
+            break;
+        default:
+            break;
+        }
+        pos += 2 + seg_len;
+    }
+    if (!header_len || !sof || !nrst || !mcu_w || !mcu_h || !*width || !*height) {
+        return false;
+    }
+
+    // restart markers at the start of a row come every step rows
+    uint32_t mcus_per_row = (*width + mcu_w - 1) / mcu_w;
+    uint32_t mcu_rows = (*height + mcu_h - 1) / mcu_h;
+    uint32_t a = nrst, b = mcus_per_row;
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    uint32_t step = nrst / a;                       // lcm(nrst, mcus_per_row) / mcus_per_row
+    uint32_t row = ((mcu_rows / 2 + step / 2) / step) * step;
+    if (row == 0) {
+        row = step;
+    }
+    if (row >= mcu_rows) {
+        return false;
+    }
+
+    // find the restart marker before the MCU row
+    uint32_t marker = row * mcus_per_row / nrst;
+    uint32_t count = 0;
+    const uint8_t *p = src + header_len;
+    const uint8_t *end = src + len - 1;
+    while ((p = (const uint8_t *)memchr(p, 0xFF, end - p)) != NULL) {
+        if ((p[1] & 0xF8) == 0xD0 && ++count == marker) {
+            break;
+        }
+        if (p[1] == 0xD9) {
+            return false;
+        }
+        p++;
+    }
+    if (!p) {
+        return false;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        stripes[i].src = src;
+        stripes[i].header_len = header_len;
+        stripes[i].sof_height = sof;
+        stripes[i].index = 0;
+    }
+    stripes[0].data_start = header_len;
+    stripes[0].data_end = p - src;
+    stripes[0].height = row * mcu_h;
+    stripes[0].rst_base = -1;
+    stripes[1].data_start = p - src + 2;
+    stripes[1].data_end = len;
+    stripes[1].height = *height - row * mcu_h;
+    stripes[1].rst_base = p[1] & 7;
+    return true;
+}
+
+typedef struct {
+        const uint8_t *src;
+        jpg_writer_cb writer;
+        void * arg;
+} esp_jpg_buf_t;
+
+static size_t _buf_read(void * arg, size_t index, uint8_t *buf, size_t len)
+{
+    esp_jpg_buf_t *jpeg = (esp_jpg_buf_t *)arg;
+    if (buf) {
+        memcpy(buf, jpeg->src + index, len);
+    }
+    return len;
+}
+
+static bool _buf_write(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    esp_jpg_buf_t *jpeg = (esp_jpg_buf_t *)arg;
+    return jpeg->writer(jpeg->arg, x, y, w, h, data);
+}
+
+esp_err_t esp_jpg_decode_buf(const uint8_t *src, size_t len, jpg_scale_t scale, jpg_writer_cb writer, void * arg)
+{
+    esp_jpg_stripe_t stripes[2];
+    uint16_t width = 0, height = 0;
+
+    if (!jpg_slice_enabled() || !_jpg_split(src, len, stripes, &width, &height)) {
+        esp_jpg_buf_t jpeg = {src, writer, arg};
+        return esp_jpg_decode(len, scale, _buf_read, _buf_write, &jpeg);
+    }
+
+    uint16_t output_width = width / (1 << (uint8_t)scale);
+    uint16_t output_height = height / (1 << (uint8_t)scale);
+    for (int i = 0; i < 2; i++) {
+        stripes[i].scale = scale;
+        stripes[i].writer = writer;
+        stripes[i].arg = arg;
+    }
+    stripes[0].y = 0;
+    stripes[1].y = stripes[0].height >> (uint8_t)scale;
+
+    //output start
+    if (!writer(arg, 0, 0, output_width, output_height, NULL)) {
+        return ESP_FAIL;
+    }
+    jpg_slice_t *slice = jpg_slice_start(_stripe_decode, &stripes[1]);
+    bool ok = _stripe_decode(&stripes[0]);
+    if (slice) {
+        ok = jpg_slice_join(slice) && ok;
+    } else {
+        ok = ok && _stripe_decode(&stripes[1]);
+    }
+    //output end
+    writer(arg, output_width, output_height, output_width, output_height, NULL);
+
+    return ok ? ESP_OK : ESP_FAIL;
+}
@@ -36,6 +36,24 @@ typedef bool (* jpg_writer_cb)(void * arg, uint16_t x, uint16_t y, uint16_t w, u
 
 esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void * arg);
 
+/**
+ * @brief Decode a JPEG held in memory
+ *
+ * With CONFIG_CAMERA_CONVERSION_DUAL_CORE, a JPEG with a restart marker at the start of an
+ * MCU row near the middle (as written by fmt2jpg) is decoded in two stripes, one on each core.
+ * The writer is then called concurrently for disjoint rectangles, besides the start and end calls.
+ * Other JPEGs are decoded on the calling core like esp_jpg_decode() does.
+ *
+ * @param src       JPEG data
+ * @param len       Length in bytes of the JPEG data
+ * @param scale     Output scale
+ * @param writer    Output callback
+ * @param arg       Pointer to be passed to the callback
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t esp_jpg_decode_buf(const uint8_t *src, size_t len, jpg_scale_t scale, jpg_writer_cb writer, void * arg);
+
 #ifdef __cplusplus
 }
 #endif
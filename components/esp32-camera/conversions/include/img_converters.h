@@ -54,6 +54,50 @@ bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, p
  */
 bool frame2jpg_cb(camera_fb_t * fb, uint8_t quality, jpg_out_cb cb, void * arg);
 
+/**
+ * @brief Streaming JPEG encoder, fed with bands of rows instead of a whole image
+ *
+ * Only one MCU row (16 lines) is buffered, the JPEG data is passed to the callback
+ * as it is produced. Each stream has its own state, streams may run concurrently.
+ */
+typedef struct jpg_stream jpg_stream_t;
+
+/**
+ * @brief Start a streaming JPEG encode, the headers are written to the callback
+ *
+ * @param width     Width in pixels of the image
+ * @param height    Height in pixels of the image
+ * @param format    Format of the rows: RGB565, RGB888, YUYV or GRAYSCALE
+ * @param quality   JPEG quality of the resulting image
+ * @param cb        Callback to be called to write the bytes of the output JPEG
+ * @param arg       Pointer to be passed to the callback
+ *
+ * @return stream handle, NULL on failure
+ */
+jpg_stream_t *jpg_stream_begin(uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void * arg);
+
+/**
+ * @brief Encode the next rows of the image
+ *
+ * @param stream    Stream handle
+ * @param rows      Consecutive rows of width pixels in the format of the stream
+ * @param num_rows  Number of rows, the total must not exceed the image height
+ *
+ * @return true on success
+ */
+bool jpg_stream_write(jpg_stream_t *stream, const uint8_t *rows, size_t num_rows);
+
+/**
+ * @brief Finish the JPEG and free the stream
+ *
+ * A stream that did not get all its rows is aborted, the output is not finished.
+ *
+ * @param stream    Stream handle
+ *
+ * @return true if the JPEG was complete and written successfully
+ */
+bool jpg_stream_end(jpg_stream_t *stream);
+
 /**
  * @brief Convert image buffer to JPEG buffer
  *
@@ -123,6 +167,54 @@ bool fmt2rgb888(const uint8_t *src_buf, size_t src_len, pixformat_t format, uint
 
 bool jpg2rgb565(const uint8_t *src, size_t src_len, uint8_t * out, jpg_scale_t scale);
 
+/**
+ * @brief Transcode a JPEG to a smaller JPEG
+ *
+ * The image is downscaled in the DCT domain while it is decoded and re-encoded row by row,
+ * only a few MCU rows are held in memory, never the decoded image.
+ *
+ * @param src       Source buffer in JPEG format
+ * @param src_len   Length in bytes of the source buffer
+ * @param scale     Downscale factor, JPG_SCALE_2X gives half the width and height
+ * @param quality   JPEG quality of the resulting image
+ * @param cb        Callback to be called to write the bytes of the output JPEG
+ * @param arg       Pointer to be passed to the callback
+ *
+ * @return true on success
+ */
+bool jpg2jpg_cb(const uint8_t *src, size_t src_len, jpg_scale_t scale, uint8_t quality, jpg_out_cb cb, void * arg);
+
+/**
+ * @brief Transcode a JPEG to a smaller JPEG buffer
+ *
+ * @param src       Source buffer in JPEG format
+ * @param src_len   Length in bytes of the source buffer
+ * @param scale     Downscale factor, JPG_SCALE_2X gives half the width and height
+ * @param quality   JPEG quality of the resulting image
+ * @param out       Pointer to be populated with the address of the resulting buffer.
+ *                  You MUST free the pointer once you are done with it.
+ * @param out_len   Pointer to be populated with the length of the output buffer
+ *
+ * @return true on success
+ */
+bool jpg2jpg(const uint8_t *src, size_t src_len, jpg_scale_t scale, uint8_t quality, uint8_t ** out, size_t * out_len);
+
+/**
+ * @brief Score the sharpness of a JPEG image
+ *
+ * The image is decoded to luminance at the given scale and the variance of its
+ * 4-neighbour laplacian is returned. Higher is sharper. Scores are only comparable
+ * between images of the same scene decoded at the same scale.
+ *
+ * @param src       Source buffer in JPEG format
+ * @param src_len   Length in bytes of the source buffer
+ * @param scale     Decode scale, JPG_SCALE_8X keeps little more than the DC of each block
+ * @param score     Pointer to be populated with the sharpness score
+ *
+ * @return true on success
+ */
+bool jpg_sharpness(const uint8_t *src, size_t src_len, jpg_scale_t scale, float *score);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,72 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef _JPG_CROP_H_
+#define _JPG_CROP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef size_t (* jpg_crop_cb)(void * arg, size_t index, const void* data, size_t len);
+
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+} jpg_crop_rect_t;
+
+/**
+ * @brief Crop a baseline JPEG without re-encoding it
+ *
+ * The rectangle is widened to whole MCUs (8 or 16 pixels depending on the chroma subsampling),
+ * then the entropy coded blocks inside it are copied. Only the DC coefficients are re-coded,
+ * so the pixels of the crop are exactly those of the source. Decoding stops after the last
+ * row of the rectangle, and restart markers are used to skip the rows above it.
+ *
+ * Progressive, 12 bit and multi scan JPEGs are not supported.
+ *
+ * @param src       JPEG data
+ * @param len       Length in bytes of the JPEG data
+ * @param rect      Rectangle to crop, updated with the rectangle actually cropped
+ * @param cb        Callback to be called to write the bytes of the output JPEG
+ * @param arg       Pointer to be passed to the callback
+ *
+ * @return true on success
+ */
+bool jpg_crop(const uint8_t *src, size_t len, jpg_crop_rect_t *rect, jpg_crop_cb cb, void * arg);
+
+/**
+ * @brief Crop a baseline JPEG without re-encoding it into a newly allocated buffer
+ *
+ * @param src       JPEG data
+ * @param len       Length in bytes of the JPEG data
+ * @param rect      Rectangle to crop, updated with the rectangle actually cropped
+ * @param out       Pointer to be populated with the address of the resulting buffer.
+ *                  You MUST free the pointer once you are done with it.
+ * @param out_len   Pointer to be populated with the length of the output buffer
+ *
+ * @return true on success
+ */
+bool jpg_crop_buf(const uint8_t *src, size_t len, jpg_crop_rect_t *rect, uint8_t ** out, size_t * out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _JPG_CROP_H_ */
@@ -0,0 +1,97 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef _JPG_EXIF_H_
+#define _JPG_EXIF_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define JPG_EXIF_PREFIX_MAX 1024    // SOI + APP1 prefix size with strings up to 64 characters
+
+/*
+ * EXIF metadata of a JPEG
+ *
+ * The metadata is written as an APP1 segment in a separate prefix, the JPEG
+ * itself is not moved: the file is the prefix followed by the JPEG without
+ * its SOI marker, see jpg_exif_parts().
+ */
+typedef struct {
+    const char *make;           // Make, NULL to leave out
+    const char *model;          // Model, NULL to leave out
+    const char *software;       // Software, NULL to leave out
+    const char *serial;         // BodySerialNumber, NULL to leave out
+    const char *description;    // ImageDescription, NULL to leave out
+    const char *comment;        // UserComment, NULL to leave out
+    struct tm time;             // DateTime and DateTimeOriginal, local time
+    uint16_t subsec_ms;         // SubSecTimeOriginal in milliseconds
+} jpg_exif_t;
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+} jpg_exif_part_t;
+
+/**
+ * @brief Build the SOI marker and an EXIF APP1 segment
+ *
+ * The length of the prefix is a multiple of 3, so the base64 encodings of the
+ * prefix and of the rest of the file can be concatenated.
+ *
+ * @param exif      Metadata to write
+ * @param buf       Output buffer, JPG_EXIF_PREFIX_MAX bytes with strings up to 64 characters
+ * @param size      Size of the output buffer
+ *
+ * @return length of the prefix, 0 if the buffer is too small
+ */
+size_t jpg_exif_build(const jpg_exif_t *exif, uint8_t *buf, size_t size);
+
+/**
+ * @brief Split a JPEG with an EXIF prefix into the parts to write in order
+ *
+ * The parts are the prefix and the JPEG after its SOI marker. An EXIF APP1
+ * segment right after the SOI of the JPEG is skipped, it is replaced by the
+ * prefix. Without prefix, or if the data is not a JPEG, the only part is the data.
+ *
+ * @param prefix        Prefix from jpg_exif_build(), can be NULL
+ * @param prefix_len    Length of the prefix
+ * @param jpg           JPEG data
+ * @param len           Length of the JPEG data
+ * @param parts         Populated with the parts
+ *
+ * @return number of parts (1 or 2)
+ */
+int jpg_exif_parts(const uint8_t *prefix, size_t prefix_len, const uint8_t *jpg, size_t len, jpg_exif_part_t parts[2]);
+
+/**
+ * @brief Get the contiguous bytes of split data at an offset
+ *
+ * @param parts     Parts from jpg_exif_parts()
+ * @param count     Number of parts
+ * @param offset    Offset in the data made of all parts
+ * @param data      Populated with the address of the byte at the offset
+ *
+ * @return number of bytes from the offset to the end of its part, 0 past the end of the data
+ */
+size_t jpg_exif_parts_at(const jpg_exif_part_t *parts, int count, size_t offset, const uint8_t **data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _JPG_EXIF_H_ */
@@ -0,0 +1,574 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdlib.h>
+#include <string.h>
+#include "jpg_crop.h"
+
+/*
+ * Lossless JPEG crop
+ *
+ * Every block of the rectangle is Huffman decoded and its codes are copied to the output.
+ * The AC codes do not depend on neighbouring blocks and are written back as read, the DC
+ * coefficients are coded as the difference with the previous block of the same component
+ * and are re-coded against the previous block kept in the output.
+ */
+
+#define CROP_MAX_COMP       3
+#define CROP_LOOKAHEAD      8
+#define CROP_OUT_BUF_SIZE   256
+
+typedef struct {
+    uint16_t look[1 << CROP_LOOKAHEAD];   // (length << 8) | symbol of the codes up to 8 bits, 0 if longer
+    int32_t maxcode[18];
+    int32_t mincode[17];
+    int32_t valptr[17];
+    uint8_t huffval[256];
+    uint16_t ehufco[16];                  // DC encoding: code and length of each category
+    uint8_t ehufsi[16];
+    bool valid;
+} crop_huff_t;
+
+typedef struct {
+    uint8_t id;
+    uint8_t h;
+    uint8_t v;
+    uint8_t dc;
+    uint8_t ac;
+    int16_t pred;
+    int16_t out_pred;
+} crop_comp_t;
+
+typedef struct {
+    crop_huff_t huff[2][4];
+    crop_comp_t comp[CROP_MAX_COMP];
+    uint8_t ncomp;
+    uint16_t width;
+    uint16_t height;
+    uint16_t restart;
+
+    //bit reader
+    const uint8_t *p;
+    const uint8_t *end;
+    uint32_t bit_buf;
+    int bit_cnt;
+    int fake_bytes;
+    bool marker;
+
+    //writer
+    jpg_crop_cb cb;
+    void *arg;
+    size_t index;
+    uint32_t out_acc;
+    int out_cnt;
+    size_t out_len;
+    uint8_t out[CROP_OUT_BUF_SIZE];
+    bool failed;
+} crop_ctx_t;
+
+static inline uint16_t _be16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static void _flush(crop_ctx_t *ctx)
+{
+    if (ctx->out_len && !ctx->failed) {
+        if (ctx->cb(ctx->arg, ctx->index, ctx->out, ctx->out_len) != ctx->out_len) {
+            ctx->failed = true;
+        }
+        ctx->index += ctx->out_len;
+    }
+    ctx->out_len = 0;
+}
+
+static inline void _put_byte(crop_ctx_t *ctx, uint8_t b)
+{
+    if (ctx->out_len == CROP_OUT_BUF_SIZE) {
+        _flush(ctx);
+    }
+    ctx->out[ctx->out_len++] = b;
+}
+
+static void _put_data(crop_ctx_t *ctx, const uint8_t *data, size_t len)
+{
+    while (len--) {
+        _put_byte(ctx, *data++);
+    }
+}
+
+static inline void _put_bits(crop_ctx_t *ctx, uint32_t bits, int len)
+{
+    if (!len) {
+        return;
+    }
+    ctx->out_acc = (ctx->out_acc << len) | (bits & ((1U << len) - 1));
+    ctx->out_cnt += len;
+    while (ctx->out_cnt >= 8) {
+        uint8_t b = ctx->out_acc >> (ctx->out_cnt - 8);
+        ctx->out_cnt -= 8;
+        _put_byte(ctx, b);
+        if (b == 0xFF) {
+            _put_byte(ctx, 0);
+        }
+    }
+}
+
+static bool _build_huff(crop_huff_t *huff, bool dc, const uint8_t *counts, const uint8_t *vals, int total)
+{
+    int code = 0, k = 0;
+
+    memset(huff, 0, sizeof(crop_huff_t));
+    memcpy(huff->huffval, vals, total);
+    for (int l = 1; l <= 16; l++) {
+        huff->valptr[l] = k;
+        huff->mincode[l] = code;
+        for (int i = 0; i < counts[l - 1]; i++, k++, code++) {
+            if (l <= CROP_LOOKAHEAD) {
+                int shift = CROP_LOOKAHEAD - l;
+                for (int j = 0; j < (1 << shift); j++) {
+                    huff->look[(code << shift) | j] = (l << 8) | vals[k];
+                }
+            }
+            if (dc) {
+                if (vals[k] > 15) {
+                    return false;
+                }
+                huff->ehufco[vals[k]] = code;
+                huff->ehufsi[vals[k]] = l;
+            }
+        }
+        huff->maxcode[l] = counts[l - 1] ? code - 1 : -1;
+        if (code > (1 << l)) {
+            return false;
+        }
+        code <<= 1;
+    }
+    huff->maxcode[17] = 0x7FFFFFFF;
+    huff->valid = true;
+    return true;
+}
+
+static void _fill(crop_ctx_t *ctx)
+{
+    while (ctx->bit_cnt <= 24) {
+        uint8_t b = 0;
+        if (ctx->marker || ctx->p >= ctx->end) {
+            ctx->fake_bytes++;
+        } else if (ctx->p[0] == 0xFF) {
+            if (ctx->p + 1 < ctx->end && ctx->p[1] == 0x00) {
+                b = 0xFF;
+                ctx->p += 2;
+            } else {
+                ctx->marker = true;
+                ctx->fake_bytes++;
+            }
+        } else {
+            b = *ctx->p++;
+        }
+        ctx->bit_buf |= (uint32_t)b << (24 - ctx->bit_cnt);
+        ctx->bit_cnt += 8;
+    }
+}
+
+static inline uint32_t _get_bits(crop_ctx_t *ctx, int len)
+{
+    if (!len) {
+        return 0;
+    }
+    _fill(ctx);
+    uint32_t v = ctx->bit_buf >> (32 - len);
+    ctx->bit_buf <<= len;
+    ctx->bit_cnt -= len;
+    return v;
+}
+
+static int _decode(crop_ctx_t *ctx, const crop_huff_t *huff, uint32_t *code, int *len)
+{
+    _fill(ctx);
+    uint16_t e = huff->look[ctx->bit_buf >> (32 - CROP_LOOKAHEAD)];
+    int l = e >> 8;
+    if (!l) {
+        for (l = CROP_LOOKAHEAD + 1; l <= 16; l++) {
+            int32_t c = ctx->bit_buf >> (32 - l);
+            if (c <= huff->maxcode[l]) {
+                e = huff->huffval[huff->valptr[l] + c - huff->mincode[l]];
+                break;
+            }
+        }
+        if (l > 16) {
+            return -1;
+        }
+    }
+    *code = ctx->bit_buf >> (32 - l);
+    *len = l;
+    ctx->bit_buf <<= l;
+    ctx->bit_cnt -= l;
+    return e & 0xFF;
+}
+
+static bool _crop_block(crop_ctx_t *ctx, crop_comp_t *comp, bool keep)
+{
+    const crop_huff_t *dc = &ctx->huff[0][comp->dc];
+    const crop_huff_t *ac = &ctx->huff[1][comp->ac];
+    uint32_t code;
+    int len;
+
+    int s = _decode(ctx, dc, &code, &len);
+    if (s < 0 || s > 11) {
+        return false;
+    }
+    int diff = 0;
+    if (s) {
+        diff = _get_bits(ctx, s);
+        if (diff < (1 << (s - 1))) {
+            diff -= (1 << s) - 1;
+        }
+    }
+    comp->pred += diff;
+
+    if (keep) {
+        diff = comp->pred - comp->out_pred;
+        comp->out_pred = comp->pred;
+        int v = diff < 0 ? -diff : diff;
+        for (s = 0; v; s++) {
+            v >>= 1;
+        }
+        if (!dc->ehufsi[s]) {
+            return false;
+        }
+        _put_bits(ctx, dc->ehufco[s], dc->ehufsi[s]);
+        _put_bits(ctx, diff < 0 ? diff - 1 : diff, s);
+    }
+
+    for (int k = 1; k < 64; k++) {
+        int rs = _decode(ctx, ac, &code, &len);
+        if (rs < 0) {
+            return false;
+        }
+        s = rs & 15;
+        uint32_t bits = _get_bits(ctx, s);
+        if (keep) {
+            _put_bits(ctx, code, len);
+            _put_bits(ctx, bits, s);
+        }
+        if (!s) {
+            if ((rs >> 4) != 15) {
+                break;
+            }
+            k += 15;
+        } else {
+            k += rs >> 4;
+        }
+    }
+    return true;
+}
+
+static const uint8_t *_find_rst(const uint8_t *p, const uint8_t *end)
+{
+    while (p < end && (p = memchr(p, 0xFF, end - p)) != NULL) {
+        while (p < end && *p == 0xFF) {
+            p++;
+        }
+        if (p >= end) {
+            break;
+        }
+        if (*p >= 0xD0 && *p <= 0xD7) {
+            return p + 1;
+        }
+        if (*p != 0x00) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static bool _restart(crop_ctx_t *ctx, uint32_t count)
+{
+    const uint8_t *p = ctx->p;
+    while (count--) {
+        p = _find_rst(p, ctx->end);
+        if (!p) {
+            return false;
+        }
+    }
+    ctx->p = p;
+    ctx->bit_buf = 0;
+    ctx->bit_cnt = 0;
+    ctx->fake_bytes = 0;
+    ctx->marker = false;
+    for (int i = 0; i < ctx->ncomp; i++) {
+        ctx->comp[i].pred = 0;
+    }
+    return true;
+}
+
+static bool _crop_scan(crop_ctx_t *ctx, const jpg_crop_rect_t *rect, int mcu_w, int mcu_h)
+{
+    uint32_t mcux = (ctx->width + mcu_w - 1) / mcu_w;
+    uint32_t cx0 = rect->x / mcu_w;
+    uint32_t cx1 = (rect->x + rect->w + mcu_w - 1) / mcu_w;
+    uint32_t cy0 = rect->y / mcu_h;
+    uint32_t cy1 = (rect->y + rect->h + mcu_h - 1) / mcu_h;
+    uint32_t first = cy0 * mcux + cx0;
+    uint32_t last = (cy1 - 1) * mcux + cx1;
+    uint32_t start = 0;
+
+    if (ctx->restart) {
+        // jump to the interval holding the first block of the rectangle
+        uint32_t skip = first / ctx->restart;
+        if (skip && !_restart(ctx, skip)) {
+            return false;
+        }
+        start = skip * ctx->restart;
+    }
+
+    for (uint32_t m = start; m < last; m++) {
+        if (ctx->restart && m % ctx->restart == 0 && m != start) {
+            if (!_restart(ctx, 1)) {
+                return false;
+            }
+        }
+        uint32_t col = m % mcux;
+        bool keep = m >= first && col >= cx0 && col < cx1;
+        for (int i = 0; i < ctx->ncomp; i++) {
+            crop_comp_t *comp = &ctx->comp[i];
+            int blocks = ctx->ncomp == 1 ? 1 : comp->h * comp->v;
+            for (int b = 0; b < blocks; b++) {
+                if (!_crop_block(ctx, comp, keep)) {
+                    return false;
+                }
+            }
+        }
+        if (ctx->fake_bytes * 8 > ctx->bit_cnt) {
+            // ran past the end of the entropy coded data
+            return false;
+        }
+    }
+
+    // pad the last byte with ones and end the image
+    _put_bits(ctx, 0x7F, (8 - ctx->out_cnt) & 7);
+    _put_byte(ctx, 0xFF);
+    _put_byte(ctx, 0xD9);
+    return true;
+}
+
+static bool _crop_rect(crop_ctx_t *ctx, jpg_crop_rect_t *rect, int mcu_w, int mcu_h)
+{
+    uint32_t x1 = rect->x + rect->w;
+    uint32_t y1 = rect->y + rect->h;
+
+    if (!rect->w || !rect->h || rect->x >= ctx->width || rect->y >= ctx->height) {
+        return false;
+    }
+    if (x1 > ctx->width) {
+        x1 = ctx->width;
+    }
+    if (y1 > ctx->height) {
+        y1 = ctx->height;
+    }
+    rect->x -= rect->x % mcu_w;
+    rect->y -= rect->y % mcu_h;
+    x1 = (x1 + mcu_w - 1) / mcu_w * mcu_w;
+    y1 = (y1 + mcu_h - 1) / mcu_h * mcu_h;
+    rect->w = (x1 > ctx->width ? ctx->width : x1) - rect->x;
+    rect->h = (y1 > ctx->height ? ctx->height : y1) - rect->y;
+    return true;
+}
+
+static bool _crop(crop_ctx_t *ctx, const uint8_t *src, size_t len, jpg_crop_rect_t *rect)
+{
+    const uint8_t *p = src + 2;
+    const uint8_t *end = src + len;
+    int mcu_w = 8, mcu_h = 8;
+
+    if (len < 4 || src[0] != 0xFF || src[1] != 0xD8) {
+        return false;
+    }
+    _put_data(ctx, src, 2);
+
+    while (p + 4 <= end) {
+        if (p[0] != 0xFF) {
+            return false;
+        }
+        if (p[1] == 0xFF) {
+            p++;
+            continue;
+        }
+        uint8_t marker = p[1];
+        uint16_t seg_len = _be16(p + 2);
+        const uint8_t *seg = p + 4;
+        if (seg_len < 2 || p + 2 + seg_len > end) {
+            return false;
+        }
+        p += 2 + seg_len;
+        seg_len -= 2;
+
+        if (marker == 0xC0 || marker == 0xC1) {
+            // baseline and extended sequential frames
+            if (seg_len < 6 || seg[0] != 8) {
+                return false;
+            }
+            ctx->height = _be16(seg + 1);
+            ctx->width = _be16(seg + 3);
+            ctx->ncomp = seg[5];
+            if (!ctx->width || !ctx->height || (ctx->ncomp != 1 && ctx->ncomp != CROP_MAX_COMP) || seg_len < 6 + 3 * ctx->ncomp) {
+                return false;
+            }
+            int hmax = 1, vmax = 1;
+            for (int i = 0; i < ctx->ncomp; i++) {
+                crop_comp_t *comp = &ctx->comp[i];
+                comp->id = seg[6 + i * 3];
+                comp->h = seg[7 + i * 3] >> 4;
+                comp->v = seg[7 + i * 3] & 15;
+                if (!comp->h || comp->h > 4 || !comp->v || comp->v > 4) {
+                    return false;
+                }
+                hmax = comp->h > hmax ? comp->h : hmax;
+                vmax = comp->v > vmax ? comp->v : vmax;
+            }
+            if (ctx->ncomp > 1) {
+                mcu_w = hmax * 8;
+                mcu_h = vmax * 8;
+            }
+            if (!_crop_rect(ctx, rect, mcu_w, mcu_h)) {
+                return false;
+            }
+            uint8_t dims[4] = { rect->h >> 8, rect->h & 0xFF, rect->w >> 8, rect->w & 0xFF };
+            _put_data(ctx, p - seg_len - 4, 5);
+            _put_data(ctx, dims, 4);
+            _put_data(ctx, seg + 5, seg_len - 5);
+        } else if ((marker & 0xF0) == 0xC0 && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            // progressive, lossless and arithmetic coded frames
+            return false;
+        } else if (marker == 0xC4) {
+            const uint8_t *t = seg;
+            while (t < seg + seg_len) {
+                int total = 0;
+                if (t + 17 > seg + seg_len || (t[0] >> 4) > 1 || (t[0] & 15) > 3) {
+                    return false;
+                }
+                for (int i = 0; i < 16; i++) {
+                    total += t[1 + i];
+                }
+                if (total > 256 || t + 17 + total > seg + seg_len) {
+                    return false;
+                }
+                if (!_build_huff(&ctx->huff[t[0] >> 4][t[0] & 15], !(t[0] >> 4), t + 1, t + 17, total)) {
+                    return false;
+                }
+                t += 17 + total;
+            }
+            _put_data(ctx, p - seg_len - 4, seg_len + 4);
+        } else if (marker == 0xDD) {
+            // the output has no restart markers
+            if (seg_len < 2) {
+                return false;
+            }
+            ctx->restart = _be16(seg);
+        } else if (marker == 0xDA) {
+            if (!ctx->ncomp || seg_len < 1 || seg[0] != ctx->ncomp || seg_len < 4 + 2 * ctx->ncomp) {
+                return false;
+            }
+            crop_comp_t comp[CROP_MAX_COMP];
+            for (int i = 0; i < ctx->ncomp; i++) {
+                int j = 0;
+                while (j < ctx->ncomp && ctx->comp[j].id != seg[1 + i * 2]) {
+                    j++;
+                }
+                if (j == ctx->ncomp) {
+                    return false;
+                }
+                comp[i] = ctx->comp[j];
+                comp[i].dc = seg[2 + i * 2] >> 4;
+                comp[i].ac = seg[2 + i * 2] & 15;
+                if (comp[i].dc > 3 || comp[i].ac > 3 || !ctx->huff[0][comp[i].dc].valid || !ctx->huff[1][comp[i].ac].valid) {
+                    return false;
+                }
+                comp[i].pred = 0;
+                comp[i].out_pred = 0;
+            }
+            memcpy(ctx->comp, comp, sizeof(comp));
+            _put_data(ctx, p - seg_len - 4, seg_len + 4);
+            ctx->p = p;
+            ctx->end = end;
+            return _crop_scan(ctx, rect, mcu_w, mcu_h);
+        } else if (marker == 0xD9) {
+            return false;
+        } else {
+            _put_data(ctx, p - seg_len - 4, seg_len + 4);
+        }
+    }
+    return false;
+}
+
+bool jpg_crop(const uint8_t *src, size_t len, jpg_crop_rect_t *rect, jpg_crop_cb cb, void * arg)
+{
+    if (!src || !rect || !cb) {
+        return false;
+    }
+    crop_ctx_t *ctx = (crop_ctx_t *)calloc(1, sizeof(crop_ctx_t));
+    if (!ctx) {
+        return false;
+    }
+    ctx->cb = cb;
+    ctx->arg = arg;
+    bool ret = _crop(ctx, src, len, rect);
+    _flush(ctx);
+    ret = ret && !ctx->failed;
+    free(ctx);
+    return ret;
+}
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t size;
+} crop_buf_t;
+
+static size_t _buf_write(void * arg, size_t index, const void* data, size_t len)
+{
+    crop_buf_t *out = (crop_buf_t *)arg;
+    if (index + len > out->size) {
+        size_t size = out->size * 2;
+        while (size < index + len) {
+            size *= 2;
+        }
+        uint8_t *buf = (uint8_t *)realloc(out->buf, size);
+        if (!buf) {
+            return 0;
+        }
+        out->buf = buf;
+        out->size = size;
+    }
+    memcpy(out->buf + index, data, len);
+    out->len = index + len;
+    return len;
+}
+
+bool jpg_crop_buf(const uint8_t *src, size_t len, jpg_crop_rect_t *rect, uint8_t ** out, size_t * out_len)
+{
+    crop_buf_t buf = { NULL, 0, 1024 };
+
+    buf.buf = (uint8_t *)malloc(buf.size);
+    if (!buf.buf) {
+        return false;
+    }
+    if (!jpg_crop(src, len, rect, _buf_write, &buf)) {
+        free(buf.buf);
+        return false;
+    }
+    *out = buf.buf;
+    *out_len = buf.len;
+    return true;
+}
@@ -0,0 +1,210 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdio.h>
+#include <string.h>
+#include "jpg_exif.h"
+
+#define EXIF_ASCII          2
+#define EXIF_SHORT          3
+#define EXIF_LONG           4
+#define EXIF_RATIONAL       5
+#define EXIF_UNDEFINED      7
+
+#define EXIF_HEADER_SIZE    12      // SOI, APP1 marker and length, "Exif\0\0"
+#define EXIF_COMMENT_MAX    128
+
+typedef struct {
+    uint16_t tag;
+    uint16_t type;
+    uint32_t count;
+    const void *value;              // little endian
+} exif_entry_t;
+
+static const uint8_t exif_type_size[] = { 0, 1, 1, 2, 4, 8, 1, 1 };
+
+static inline void _le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static inline void _le32(uint8_t *p, uint32_t v)
+{
+    _le16(p, v & 0xFFFF);
+    _le16(p + 2, v >> 16);
+}
+
+static size_t _ifd_size(const exif_entry_t *entries, int count)
+{
+    size_t size = 2 + count * 12 + 4;
+    for (int i = 0; i < count; i++) {
+        size_t len = entries[i].count * exif_type_size[entries[i].type];
+        if (len > 4) {
+            size += (len + 1) & ~1;
+        }
+    }
+    return size;
+}
+
+/* Write an IFD at offset of the TIFF data, its values follow it. Returns the end offset */
+static size_t _write_ifd(uint8_t *tiff, size_t offset, const exif_entry_t *entries, int count)
+{
+    uint8_t *p = tiff + offset;
+    size_t data = offset + 2 + count * 12 + 4;
+
+    _le16(p, count);
+    p += 2;
+    for (int i = 0; i < count; i++, p += 12) {
+        size_t len = entries[i].count * exif_type_size[entries[i].type];
+        _le16(p, entries[i].tag);
+        _le16(p + 2, entries[i].type);
+        _le32(p + 4, entries[i].count);
+        memset(p + 8, 0, 4);
+        if (len <= 4) {
+            memcpy(p + 8, entries[i].value, len);
+        } else {
+            _le32(p + 8, data);
+            memcpy(tiff + data, entries[i].value, len);
+            if (len & 1) {
+                tiff[data + len] = 0;
+            }
+            data += (len + 1) & ~1;
+        }
+    }
+    _le32(p, 0); // no next IFD
+    return data;
+}
+
+static int _add_ascii(exif_entry_t *entries, int count, uint16_t tag, const char *str)
+{
+    if (str) {
+        entries[count].tag = tag;
+        entries[count].type = EXIF_ASCII;
+        entries[count].count = strlen(str) + 1;
+        entries[count].value = str;
+        count++;
+    }
+    return count;
+}
+
+size_t jpg_exif_build(const jpg_exif_t *exif, uint8_t *buf, size_t size)
+{
+    static const uint8_t resolution[8] = { 72, 0, 0, 0, 1, 0, 0, 0 };
+    static const uint8_t inch[2] = { 2, 0 };
+    static const uint8_t centered[2] = { 1, 0 };
+    static const uint8_t srgb[2] = { 1, 0 };
+    static const uint8_t ycbcr[4] = { 1, 2, 3, 0 };
+    exif_entry_t ifd0[10], sub[9];
+    int n0 = 0, n1 = 0;
+    char datetime[20];
+    char subsec[4];
+    uint8_t comment[8 + EXIF_COMMENT_MAX];
+    uint8_t pointer[4];
+
+    if (!exif || !buf) {
+        return 0;
+    }
+    snprintf(datetime, sizeof(datetime), "%04u:%02u:%02u %02u:%02u:%02u",
+             (unsigned)(exif->time.tm_year + 1900) % 10000, (unsigned)(exif->time.tm_mon + 1) % 100,
+             (unsigned)exif->time.tm_mday % 100, (unsigned)exif->time.tm_hour % 100,
+             (unsigned)exif->time.tm_min % 100, (unsigned)exif->time.tm_sec % 100);
+    snprintf(subsec, sizeof(subsec), "%03u", exif->subsec_ms % 1000);
+
+    n0 = _add_ascii(ifd0, n0, 0x010E, exif->description);
+    n0 = _add_ascii(ifd0, n0, 0x010F, exif->make);
+    n0 = _add_ascii(ifd0, n0, 0x0110, exif->model);
+    ifd0[n0++] = (exif_entry_t){ 0x011A, EXIF_RATIONAL, 1, resolution };
+    ifd0[n0++] = (exif_entry_t){ 0x011B, EXIF_RATIONAL, 1, resolution };
+    ifd0[n0++] = (exif_entry_t){ 0x0128, EXIF_SHORT, 1, inch };
+    n0 = _add_ascii(ifd0, n0, 0x0131, exif->software);
+    n0 = _add_ascii(ifd0, n0, 0x0132, datetime);
+    ifd0[n0++] = (exif_entry_t){ 0x0213, EXIF_SHORT, 1, centered };
+    ifd0[n0++] = (exif_entry_t){ 0x8769, EXIF_LONG, 1, pointer };
+
+    sub[n1++] = (exif_entry_t){ 0x9000, EXIF_UNDEFINED, 4, "0232" };
+    n1 = _add_ascii(sub, n1, 0x9003, datetime);
+    sub[n1++] = (exif_entry_t){ 0x9101, EXIF_UNDEFINED, 4, ycbcr };
+    if (exif->comment) {
+        size_t len = strlen(exif->comment);
+        len = len > EXIF_COMMENT_MAX ? EXIF_COMMENT_MAX : len;
+        memcpy(comment, "ASCII\0\0\0", 8);
+        memcpy(comment + 8, exif->comment, len);
+        sub[n1++] = (exif_entry_t){ 0x9286, EXIF_UNDEFINED, 8 + len, comment };
+    }
+    n1 = _add_ascii(sub, n1, 0x9291, subsec);
+    sub[n1++] = (exif_entry_t){ 0xA000, EXIF_UNDEFINED, 4, "0100" };
+    sub[n1++] = (exif_entry_t){ 0xA001, EXIF_SHORT, 1, srgb };
+    n1 = _add_ascii(sub, n1, 0xA431, exif->serial);
+
+    size_t sub_offset = 8 + _ifd_size(ifd0, n0);
+    size_t tiff_len = sub_offset + _ifd_size(sub, n1);
+    size_t len = EXIF_HEADER_SIZE + tiff_len;
+    size_t pad = (3 - len % 3) % 3;
+    if (len + pad > size || len + pad - 4 > 0xFFFF) {
+        return 0;
+    }
+    _le32(pointer, sub_offset);
+
+    uint8_t *tiff = buf + EXIF_HEADER_SIZE;
+    memcpy(tiff, "II\x2a\x00\x08\x00\x00\x00", 8);
+    _write_ifd(tiff, 8, ifd0, n0);
+    _write_ifd(tiff, sub_offset, sub, n1);
+    // the padding is trailing data of the APP1 segment, after the TIFF structure
+    memset(buf + len, 0, pad);
+    len += pad;
+
+    buf[0] = 0xFF;
+    buf[1] = 0xD8;
+    buf[2] = 0xFF;
+    buf[3] = 0xE1;
+    buf[4] = (len - 4) >> 8;
+    buf[5] = (len - 4) & 0xFF;
+    memcpy(buf + 6, "Exif\0\0", 6);
+    return len;
+}
+
+int jpg_exif_parts(const uint8_t *prefix, size_t prefix_len, const uint8_t *jpg, size_t len, jpg_exif_part_t parts[2])
+{
+    size_t skip = 2;
+
+    if (!prefix || !prefix_len || len < 4 || jpg[0] != 0xFF || jpg[1] != 0xD8) {
+        parts[0].buf = jpg;
+        parts[0].len = len;
+        return 1;
+    }
+    if (len >= 12 && jpg[2] == 0xFF && jpg[3] == 0xE1 && !memcmp(jpg + 6, "Exif\0\0", 6)) {
+        size_t app1 = 2 + ((jpg[4] << 8) | jpg[5]);
+        if (skip + app1 < len) {
+            skip += app1;
+        }
+    }
+    parts[0].buf = prefix;
+    parts[0].len = prefix_len;
+    parts[1].buf = jpg + skip;
+    parts[1].len = len - skip;
+    return 2;
+}
+
+size_t jpg_exif_parts_at(const jpg_exif_part_t *parts, int count, size_t offset, const uint8_t **data)
+{
+    for (int i = 0; i < count; i++) {
+        if (offset < parts[i].len) {
+            *data = parts[i].buf + offset;
+            return parts[i].len - offset;
+        }
+        offset -= parts[i].len;
+    }
+    *data = NULL;
+    return 0;
+}
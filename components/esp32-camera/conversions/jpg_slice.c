@@ -0,0 +1,152 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include "jpg_slice.h"
+
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
+#include "esp32-hal-log.h"
+#define TAG ""
+#else
+#include "esp_log.h"
+static const char* TAG = "jpg_slice";
+#endif
+
+#define JPG_SLICE_STACK_SIZE 6144
+
+/*
+ * One worker task per core, created on the first slice started on it and kept for
+ * the next ones. A slice is the worker while it runs the job of one caller.
+ */
+struct jpg_slice {
+    TaskHandle_t task;
+    SemaphoreHandle_t idle;     // taken by the caller whose job the worker runs
+    SemaphoreHandle_t done;
+    jpg_slice_job_t job;
+    void *arg;
+    bool result;
+};
+
+#if CONFIG_CAMERA_CONVERSION_DUAL_CORE && !CONFIG_FREERTOS_UNICORE
+static jpg_slice_t s_workers[portNUM_PROCESSORS];
+static uint8_t s_worker_state[portNUM_PROCESSORS];    // 0: none, 1: being created, 2: ready
+static portMUX_TYPE s_worker_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+bool jpg_slice_enabled(void)
+{
+#if CONFIG_CAMERA_CONVERSION_DUAL_CORE && !CONFIG_FREERTOS_UNICORE
+    return portNUM_PROCESSORS > 1;
+#else
+    return false;
+#endif
+}
+
+#if CONFIG_CAMERA_CONVERSION_DUAL_CORE && !CONFIG_FREERTOS_UNICORE
+static void jpg_slice_task(void *arg)
+{
+    jpg_slice_t *slice = (jpg_slice_t *)arg;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        slice->result = slice->job(slice->arg);
+        xSemaphoreGive(slice->done);
+    }
+}
+
+/**
+ * @brief Get the worker of a core, create it on first use
+ *
+ * @param core Core the worker runs on
+ *
+ * @return worker, NULL if it could not be created or another caller is creating it
+ */
+static jpg_slice_t *jpg_slice_worker(BaseType_t core)
+{
+    jpg_slice_t *slice = &s_workers[core];
+    uint8_t state;
+
+    taskENTER_CRITICAL(&s_worker_lock);
+    state = s_worker_state[core];
+    if (state == 0) {
+        s_worker_state[core] = 1;
+    }
+    taskEXIT_CRITICAL(&s_worker_lock);
+    if (state == 2) {
+        return slice;
+    }
+    if (state == 1) {
+        return NULL;
+    }
+
+    slice->idle = xSemaphoreCreateBinary();
+    slice->done = xSemaphoreCreateBinary();
+    if (!slice->idle || !slice->done
+        || xTaskCreatePinnedToCore(jpg_slice_task, "jpg_slice", JPG_SLICE_STACK_SIZE, slice,
+                                   uxTaskPriorityGet(NULL), core, &slice->task) != pdPASS) {
+        ESP_LOGW(TAG, "Slice task create failed");
+        if (slice->idle) {
+            vSemaphoreDelete(slice->idle);
+        }
+        if (slice->done) {
+            vSemaphoreDelete(slice->done);
+        }
+        slice->idle = slice->done = NULL;
+        taskENTER_CRITICAL(&s_worker_lock);
+        s_worker_state[core] = 0;
+        taskEXIT_CRITICAL(&s_worker_lock);
+        return NULL;
+    }
+    xSemaphoreGive(slice->idle);
+    taskENTER_CRITICAL(&s_worker_lock);
+    s_worker_state[core] = 2;
+    taskEXIT_CRITICAL(&s_worker_lock);
+    return slice;
+}
+#endif
+
+jpg_slice_t *jpg_slice_start(jpg_slice_job_t job, void *arg)
+{
+#if CONFIG_CAMERA_CONVERSION_DUAL_CORE && !CONFIG_FREERTOS_UNICORE
+    if(!jpg_slice_enabled()) {
+        return NULL;
+    }
+    jpg_slice_t *slice = jpg_slice_worker(!xPortGetCoreID());
+    // the worker is busy with the slice of another caller, the caller runs the job itself
+    if(!slice || xSemaphoreTake(slice->idle, 0) != pdTRUE) {
+        return NULL;
+    }
+    slice->job = job;
+    slice->arg = arg;
+    slice->result = false;
+    vTaskPrioritySet(slice->task, uxTaskPriorityGet(NULL));
+    xTaskNotifyGive(slice->task);
+    return slice;
+#else
+    return NULL;
+#endif
+}
+
+bool jpg_slice_join(jpg_slice_t *slice)
+{
+    bool result;
+
+    xSemaphoreTake(slice->done, portMAX_DELAY);
+    result = slice->result;
+    xSemaphoreGive(slice->idle);
+    return result;
+}
@@ -18,6 +18,7 @@
 #include <string.h>
 #include <malloc.h>
 #include "esp_heap_caps.h"
+#include "yuv.h"
 
 #define JPGE_MAX(a,b) (((a)>(b))?(a):(b))
 #define JPGE_MIN(a,b) (((a)<(b))?(a):(b))
@@ -39,10 +40,11 @@ namespace jpge {
     static inline void jpge_free(void *p) { free(p); }
 
     // Various JPEG enums and tables.
-    enum { M_SOF0 = 0xC0, M_DHT = 0xC4, M_SOI = 0xD8, M_EOI = 0xD9, M_SOS = 0xDA, M_DQT = 0xDB, M_APP0 = 0xE0 };
+    enum { M_SOF0 = 0xC0, M_DHT = 0xC4, M_RST0 = 0xD0, M_SOI = 0xD8, M_EOI = 0xD9, M_SOS = 0xDA, M_DQT = 0xDB, M_DRI = 0xDD, M_APP0 = 0xE0 };
     enum { DC_LUM_CODES = 12, AC_LUM_CODES = 256, DC_CHROMA_CODES = 12, AC_CHROMA_CODES = 256, MAX_HUFF_SYMBOLS = 257, MAX_HUFF_CODESIZE = 32 };
 
     static const uint8 s_zag[64] = { 0,1,8,16,9,2,3,10,17,24,32,25,18,11,4,5,12,19,26,33,40,48,41,34,27,20,13,6,7,14,21,28,35,42,49,56,57,50,43,36,29,22,15,23,30,37,44,51,58,59,52,45,38,31,39,46,53,60,61,54,47,55,62,63 };
+    static const uint8 s_unzag[64] = { 0,1,5,6,14,15,27,28,2,4,7,13,16,26,29,42,3,8,12,17,25,30,41,43,9,11,18,24,31,40,44,53,10,19,23,32,39,45,52,54,20,22,33,38,46,51,55,60,21,34,37,47,50,56,59,61,35,36,48,49,57,58,62,63 };
     static const int16 s_std_lum_quant[64] = { 16,11,12,14,12,10,16,14,13,14,18,17,16,19,24,40,26,24,22,22,24,49,35,37,29,40,58,51,61,60,57,51,56,55,64,72,92,78,64,68,87,69,55,56,80,109,81,87,95,98,103,104,103,62,77,113,121,112,100,120,92,101,103,99 };
     static const int16 s_std_croma_quant[64] = { 17,18,18,24,21,24,47,26,26,47,99,66,56,66,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99 };
     static const uint8 s_dc_lum_bits[17] = { 0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 };
@@ -68,33 +70,20 @@ namespace jpge {
         0xf9,0xfa
     };
 
-    const int YR = 19595, YG = 38470, YB = 7471, CB_R = -11059, CB_G = -21709, CB_B = 32768, CR_R = 32768, CR_G = -27439, CR_B = -5329;
+    const int YR = 19595, YG = 38470, YB = 7471;
 
-    static int32 m_last_quality = 0;
-    static int32 m_quantization_tables[2][64];
+    // Huffman tables, index 0/1 are the DC luma/chroma ones and 2/3 the AC ones.
+    static const uint8 *const s_huff_bits[4] = { s_dc_lum_bits, s_dc_chroma_bits, s_ac_lum_bits, s_ac_chroma_bits };
+    static const uint8 *const s_huff_val[4] = { s_dc_lum_val, s_dc_chroma_val, s_ac_lum_val, s_ac_chroma_val };
 
-    static bool m_huff_initialized = false;
-    static uint m_huff_codes[4][256];
-    static uint8 m_huff_code_sizes[4][256];
-    static uint8 m_huff_bits[4][17];
-    static uint8 m_huff_val[4][256];
-
-    static inline uint8 clamp(int i) {
-        if (i < 0) {
-            i = 0;
-        } else if (i > 255){
-            i = 255;
-        }
-        return static_cast<uint8>(i);
-    }
+    struct huffman_tables {
+        uint16 codes[4][256];
+        uint8 code_sizes[4][256];
+        huffman_tables();
+    };
 
     static void RGB_to_YCC(uint8* pDst, const uint8 *pSrc, int num_pixels) {
-        for ( ; num_pixels; pDst += 3, pSrc += 3, num_pixels--) {
-            const int r = pSrc[0], g = pSrc[1], b = pSrc[2];
-            pDst[0] = static_cast<uint8>((r * YR + g * YG + b * YB + 32768) >> 16);
-            pDst[1] = clamp(128 + ((r * CB_R + g * CB_G + b * CB_B + 32768) >> 16));
-            pDst[2] = clamp(128 + ((r * CR_R + g * CR_G + b * CR_B + 32768) >> 16));
-        }
+        rgb888_to_ycc_line(pSrc, pDst, num_pixels);
     }
 
     static void RGB_to_Y(uint8* pDst, const uint8 *pSrc, int num_pixels) {
@@ -147,12 +136,36 @@ namespace jpge {
         }
     }
 
+    // Forward DCT - AAN (Arai, Agui, Nakajima) as in jfdctfst, 5 multiplies per 8 points.
+    // The outputs are scaled by 8 * aan[u] * aan[v] * 2^AAN_PASS1_BITS (s_aan_scales holds aan[k] * 2^14),
+    // compute_quant_table() folds that scaling into the reciprocal quantizers.
+    enum { AAN_BITS = 14, AAN_PASS1_BITS = 3, RECIP_BITS = 20 };
+    static const int32 s_aan_scales[8] = { 16384, 22725, 21407, 19266, 16384, 12873, 8867, 4520 };
+#define AAN_MUL(var, c) (((var) * (c) + (1 << (AAN_BITS - 1))) >> AAN_BITS)
+#define AAN_0_382683433 6270
+#define AAN_0_541196100 8867
+#define AAN_0_707106781 11585
+#define AAN_1_306562965 21407
+#define AAN1D(s0, s1, s2, s3, s4, s5, s6, s7) \
+    int32 t0 = s0 + s7, t7 = s0 - s7, t1 = s1 + s6, t6 = s1 - s6, t2 = s2 + s5, t5 = s2 - s5, t3 = s3 + s4, t4 = s3 - s4; \
+    int32 t10 = t0 + t3, t13 = t0 - t3, t11 = t1 + t2, t12 = t1 - t2; \
+    s0 = t10 + t11; s4 = t10 - t11; \
+    int32 z1 = AAN_MUL(t12 + t13, AAN_0_707106781); \
+    s2 = t13 + z1; s6 = t13 - z1; \
+    t10 = t4 + t5; t11 = t5 + t6; t12 = t6 + t7; \
+    int32 z5 = AAN_MUL(t10 - t12, AAN_0_382683433); \
+    int32 z2 = AAN_MUL(t10, AAN_0_541196100) + z5; \
+    int32 z4 = AAN_MUL(t12, AAN_1_306562965) + z5; \
+    int32 z3 = AAN_MUL(t11, AAN_0_707106781); \
+    int32 z11 = t7 + z3, z13 = t7 - z3; \
+    s5 = z13 + z2; s3 = z13 - z2; s1 = z11 + z4; s7 = z11 - z4;
+
     // Compute the actual canonical Huffman codes/code sizes given the JPEG huff bits and val arrays.
-    static void compute_huffman_table(uint *codes, uint8 *code_sizes, uint8 *bits, uint8 *val)
+    static void compute_huffman_table(uint16 *codes, uint8 *code_sizes, const uint8 *bits, const uint8 *val)
     {
         int i, l, last_p, si;
-        static uint8 huff_size[257];
-        static uint huff_code[257];
+        uint8 huff_size[257];
+        uint16 huff_code[257];
         uint code;
 
         int p = 0;
@@ -183,6 +196,20 @@ namespace jpge {
         }
     }
 
+    huffman_tables::huffman_tables()
+    {
+        for (int i = 0; i < 4; i++) {
+            compute_huffman_table(codes[i], code_sizes[i], s_huff_bits[i], s_huff_val[i]);
+        }
+    }
+
+    // Built on first use, the initialization of a local static is thread safe.
+    static const huffman_tables *get_huffman_tables()
+    {
+        static const huffman_tables s_tables;
+        return &s_tables;
+    }
+
     void jpeg_encoder::flush_output_buffer()
     {
         if (m_out_buf_left != JPGE_OUT_BUF_SIZE) {
@@ -200,6 +227,7 @@ namespace jpge {
         }
     }
 
+    // len + m_bits_in must not exceed 24, m_bits_in is below 8 between calls so up to 16 bits may be put at once.
     void jpeg_encoder::put_bits(uint bits, uint len)
     {
         uint8 c = 0;
@@ -251,7 +279,7 @@ namespace jpge {
             emit_word(64 + 1 + 2);
             emit_byte(static_cast<uint8>(i));
             for (int j = 0; j < 64; j++)
-                emit_byte(static_cast<uint8>(m_quantization_tables[i][j]));
+                emit_byte(m_quantization_tables[i][j]);
         }
     }
 
@@ -273,7 +301,7 @@ namespace jpge {
     }
 
     // Emit Huffman table.
-    void jpeg_encoder::emit_dht(uint8 *bits, uint8 *val, int index, bool ac_flag)
+    void jpeg_encoder::emit_dht(const uint8 *bits, const uint8 *val, int index, bool ac_flag)
     {
         emit_marker(M_DHT);
 
@@ -294,11 +322,11 @@ namespace jpge {
     // Emit all Huffman tables.
     void jpeg_encoder::emit_dhts()
     {
-        emit_dht(m_huff_bits[0+0], m_huff_val[0+0], 0, false);
-        emit_dht(m_huff_bits[2+0], m_huff_val[2+0], 0, true);
+        emit_dht(s_huff_bits[0+0], s_huff_val[0+0], 0, false);
+        emit_dht(s_huff_bits[2+0], s_huff_val[2+0], 0, true);
         if (m_num_components == 3) {
-            emit_dht(m_huff_bits[0+1], m_huff_val[0+1], 1, false);
-            emit_dht(m_huff_bits[2+1], m_huff_val[2+1], 1, true);
+            emit_dht(s_huff_bits[0+1], s_huff_val[0+1], 1, false);
+            emit_dht(s_huff_bits[2+1], s_huff_val[2+1], 1, true);
         }
     }
 
@@ -321,6 +349,24 @@ namespace jpge {
         emit_byte(0);
     }
 
+    // Emit restart interval, in MCUs
+    void jpeg_encoder::emit_dri()
+    {
+        emit_marker(M_DRI);
+        emit_word(4);
+        emit_word(m_params.m_restart_rows * m_mcus_per_row);
+    }
+
+    // Byte align with 1 bits, emit the RSTn marker and reset the DC predictions
+    void jpeg_encoder::emit_restart(int n)
+    {
+        put_bits(0x7F, 7);
+        m_bit_buffer = 0;
+        m_bits_in = 0;
+        emit_marker(M_RST0 + (n & 7));
+        memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
+    }
+
     void jpeg_encoder::load_block_8_8_grey(int x)
     {
         uint8 *pSrc;
@@ -381,13 +427,21 @@ namespace jpge {
         }
     }
 
-    void jpeg_encoder::load_quantized_coefficients(int component_num)
+    // Quantize the DCT2D() output in zigzag order, returns the mask of the non-zero coefficients.
+    uint64 jpeg_encoder::load_quantized_coefficients(int component_num)
     {
-        int32 *q = m_quantization_tables[component_num > 0];
+        int32 block[64];
+        const uint8 *q = m_quantization_tables[component_num > 0];
         int16 *pDst = m_coefficient_array;
+        uint64 nonzero = 0;
+
+        for (int i = 0; i < 64; i++)
+            block[i] = m_sample_array[i];
+        DCT2D(block);
+
         for (int i = 0; i < 64; i++)
         {
-            sample_array_t j = m_sample_array[s_zag[i]];
+            int32 j = block[s_zag[i]];
             if (j < 0)
             {
                 if ((j = -j + (*q >> 1)) < *q)
@@ -402,83 +456,122 @@ namespace jpge {
                 else
                     *pDst++ = static_cast<int16>((j / *q));
             }
+            if (pDst[-1])
+                nonzero |= 1ULL << i;
             q++;
         }
+        return nonzero;
     }
 
-    void jpeg_encoder::code_coefficients_pass_two(int component_num)
+    // AAN DCT of m_sample_array, the column pass quantizes straight into m_coefficient_array in zigzag order.
+    // Returns the mask of the non-zero coefficients.
+    uint64 jpeg_encoder::dct_quantize_ifast(int component_num)
     {
-        int i, j, run_len, nbits, temp1, temp2;
-        int16 *pSrc = m_coefficient_array;
-        uint *codes[2];
-        uint8 *code_sizes[2];
-
-        if (component_num == 0)
-        {
-            codes[0] = m_huff_codes[0 + 0]; codes[1] = m_huff_codes[2 + 0];
-            code_sizes[0] = m_huff_code_sizes[0 + 0]; code_sizes[1] = m_huff_code_sizes[2 + 0];
-        }
-        else
-        {
-            codes[0] = m_huff_codes[0 + 1]; codes[1] = m_huff_codes[2 + 1];
-            code_sizes[0] = m_huff_code_sizes[0 + 1]; code_sizes[1] = m_huff_code_sizes[2 + 1];
+        const uint32 *recip = m_quantization_recips[component_num > 0];
+        int16 *p = m_sample_array;
+        uint64 nonzero = 0;
+
+        for (int r = 0; r < 8; r++, p += 8) {
+            int32 s0 = p[0] << AAN_PASS1_BITS, s1 = p[1] << AAN_PASS1_BITS, s2 = p[2] << AAN_PASS1_BITS, s3 = p[3] << AAN_PASS1_BITS;
+            int32 s4 = p[4] << AAN_PASS1_BITS, s5 = p[5] << AAN_PASS1_BITS, s6 = p[6] << AAN_PASS1_BITS, s7 = p[7] << AAN_PASS1_BITS;
+            AAN1D(s0, s1, s2, s3, s4, s5, s6, s7);
+            p[0] = s0; p[1] = s1; p[2] = s2; p[3] = s3; p[4] = s4; p[5] = s5; p[6] = s6; p[7] = s7;
+        }
+
+        p = m_sample_array;
+        for (int c = 0; c < 8; c++, p++) {
+            int32 s[8] = { p[0*8], p[1*8], p[2*8], p[3*8], p[4*8], p[5*8], p[6*8], p[7*8] };
+            AAN1D(s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7]);
+            for (int r = 0; r < 8; r++) {
+                int n = r * 8 + c;
+                int32 v = s[r];
+                uint32 a = static_cast<uint32>(v < 0 ? -v : v);
+                a = (a * recip[n] + (1U << (RECIP_BITS - 1))) >> RECIP_BITS;
+                int16 out = static_cast<int16>(v < 0 ? -static_cast<int32>(a) : static_cast<int32>(a));
+                m_coefficient_array[s_unzag[n]] = out;
+                if (out)
+                    nonzero |= 1ULL << s_unzag[n];
+            }
         }
+        return nonzero;
+    }
+
+    // Huffman code m_coefficient_array, only the coefficients set in nonzero are visited.
+    void jpeg_encoder::code_coefficients_pass_two(int component_num, uint64 nonzero)
+    {
+        int i, j, run_len, nbits, temp1, temp2, last;
+        const uint16 *codes[2];
+        const uint8 *code_sizes[2];
 
-        temp1 = temp2 = pSrc[0] - m_last_dc_val[component_num];
-        m_last_dc_val[component_num] = pSrc[0];
+        codes[0] = m_huff->codes[0 + (component_num > 0)]; codes[1] = m_huff->codes[2 + (component_num > 0)];
+        code_sizes[0] = m_huff->code_sizes[0 + (component_num > 0)]; code_sizes[1] = m_huff->code_sizes[2 + (component_num > 0)];
+
+        temp1 = temp2 = m_coefficient_array[0] - m_last_dc_val[component_num];
+        m_last_dc_val[component_num] = m_coefficient_array[0];
 
         if (temp1 < 0)
         {
             temp1 = -temp1; temp2--;
         }
 
-        nbits = 0;
-        while (temp1)
+        nbits = temp1 ? 32 - __builtin_clz(temp1) : 0;
+        if (code_sizes[0][nbits] + nbits <= 16)
         {
-            nbits++; temp1 >>= 1;
+            put_bits((codes[0][nbits] << nbits) | (temp2 & ((1 << nbits) - 1)), code_sizes[0][nbits] + nbits);
+        }
+        else
+        {
+            put_bits(codes[0][nbits], code_sizes[0][nbits]);
+            put_bits(temp2 & ((1 << nbits) - 1), nbits);
         }
 
-        put_bits(codes[0][nbits], code_sizes[0][nbits]);
-        if (nbits) put_bits(temp2 & ((1 << nbits) - 1), nbits);
-
-        for (run_len = 0, i = 1; i < 64; i++)
+        nonzero &= ~1ULL;
+        for (last = 0; nonzero; last = i, nonzero &= nonzero - 1)
         {
-            if ((temp1 = m_coefficient_array[i]) == 0)
-                run_len++;
+            i = __builtin_ctzll(nonzero);
+            run_len = i - last - 1;
+            while (run_len >= 16)
+            {
+                put_bits(codes[1][0xF0], code_sizes[1][0xF0]);
+                run_len -= 16;
+            }
+            if ((temp2 = temp1 = m_coefficient_array[i]) < 0)
+            {
+                temp1 = -temp1;
+                temp2--;
+            }
+            nbits = 32 - __builtin_clz(temp1);
+            j = (run_len << 4) + nbits;
+            if (code_sizes[1][j] + nbits <= 16)
+            {
+                put_bits((codes[1][j] << nbits) | (temp2 & ((1 << nbits) - 1)), code_sizes[1][j] + nbits);
+            }
             else
             {
-                while (run_len >= 16)
-                {
-                    put_bits(codes[1][0xF0], code_sizes[1][0xF0]);
-                    run_len -= 16;
-                }
-                if ((temp2 = temp1) < 0)
-                {
-                    temp1 = -temp1;
-                    temp2--;
-                }
-                nbits = 1;
-                while (temp1 >>= 1)
-                    nbits++;
-                j = (run_len << 4) + nbits;
                 put_bits(codes[1][j], code_sizes[1][j]);
                 put_bits(temp2 & ((1 << nbits) - 1), nbits);
-                run_len = 0;
             }
         }
-        if (run_len)
+        if (last != 63)
             put_bits(codes[1][0], code_sizes[1][0]);
     }
 
     void jpeg_encoder::code_block(int component_num)
     {
-        DCT2D(m_sample_array);
-        load_quantized_coefficients(component_num);
-        code_coefficients_pass_two(component_num);
+        uint64 nonzero;
+        if (m_params.m_dct_method == DCT_IFAST)
+            nonzero = dct_quantize_ifast(component_num);
+        else
+            nonzero = load_quantized_coefficients(component_num);
+        code_coefficients_pass_two(component_num, nonzero);
     }
 
     void jpeg_encoder::process_mcu_row()
     {
+        if (m_params.m_restart_rows && m_mcu_row && (m_mcu_row % m_params.m_restart_rows) == 0)
+            emit_restart(m_mcu_row / m_params.m_restart_rows - 1);
+        m_mcu_row++;
+
         if (m_num_components == 1)
         {
             for (int i = 0; i < m_mcus_per_row; i++)
@@ -550,8 +643,8 @@ namespace jpge {
         }
     }
 
-    // Quantization table generation.
-    void jpeg_encoder::compute_quant_table(int32 *pDst, const int16 *pSrc)
+    // Quantization table generation, pSrc and pDst are in zigzag order, the reciprocals in natural order.
+    void jpeg_encoder::compute_quant_table(uint8 *pDst, uint32 *pRecips, const int16 *pSrc)
     {
         int32 q;
         if (m_params.m_quality < 50)
@@ -561,7 +654,14 @@ namespace jpge {
         for (int i = 0; i < 64; i++)
         {
             int32 j = *pSrc++; j = (j * q + 50L) / 100L;
-            *pDst++ = JPGE_MIN(JPGE_MAX(j, 1), 255);
+            *pDst++ = static_cast<uint8>(JPGE_MIN(JPGE_MAX(j, 1), 255));
+        }
+        pDst -= 64;
+        for (int n = 0; n < 64; n++)
+        {
+            // 2^RECIP_BITS / (quantizer * 8 * 2^AAN_PASS1_BITS * aan[row] * aan[col] / 2^28)
+            uint64 den = static_cast<uint64>(pDst[s_unzag[n]]) * s_aan_scales[n >> 3] * s_aan_scales[n & 7];
+            pRecips[n] = static_cast<uint32>(((1ULL << (RECIP_BITS + 2 * AAN_BITS - 3 - AAN_PASS1_BITS)) + den / 2) / den);
         }
     }
 
@@ -612,46 +712,43 @@ namespace jpge {
         m_image_bpl_mcu  = m_image_x_mcu * m_num_components;
         m_mcus_per_row   = m_image_x_mcu / m_mcu_x;
 
+        if (m_params.m_restart_rows * m_mcus_per_row > 0xFFFF) {
+            return false;
+        }
+
         if ((m_mcu_lines[0] = static_cast<uint8*>(jpge_malloc(m_image_bpl_mcu * m_mcu_y))) == NULL) {
             return false;
         }
         for (int i = 1; i < m_mcu_y; i++)
             m_mcu_lines[i] = m_mcu_lines[i-1] + m_image_bpl_mcu;
 
-        if(m_last_quality != m_params.m_quality){
-            m_last_quality = m_params.m_quality;
-            compute_quant_table(m_quantization_tables[0], s_std_lum_quant);
-            compute_quant_table(m_quantization_tables[1], s_std_croma_quant);
-        }
-
-        if(!m_huff_initialized){
-            m_huff_initialized = true;
-
-            memcpy(m_huff_bits[0+0], s_dc_lum_bits, 17);    memcpy(m_huff_val[0+0], s_dc_lum_val, DC_LUM_CODES);
-            memcpy(m_huff_bits[2+0], s_ac_lum_bits, 17);    memcpy(m_huff_val[2+0], s_ac_lum_val, AC_LUM_CODES);
-            memcpy(m_huff_bits[0+1], s_dc_chroma_bits, 17); memcpy(m_huff_val[0+1], s_dc_chroma_val, DC_CHROMA_CODES);
-            memcpy(m_huff_bits[2+1], s_ac_chroma_bits, 17); memcpy(m_huff_val[2+1], s_ac_chroma_val, AC_CHROMA_CODES);
-
-            compute_huffman_table(&m_huff_codes[0+0][0], &m_huff_code_sizes[0+0][0], m_huff_bits[0+0], m_huff_val[0+0]);
-            compute_huffman_table(&m_huff_codes[2+0][0], &m_huff_code_sizes[2+0][0], m_huff_bits[2+0], m_huff_val[2+0]);
-            compute_huffman_table(&m_huff_codes[0+1][0], &m_huff_code_sizes[0+1][0], m_huff_bits[0+1], m_huff_val[0+1]);
-            compute_huffman_table(&m_huff_codes[2+1][0], &m_huff_code_sizes[2+1][0], m_huff_bits[2+1], m_huff_val[2+1]);
-        }
+        compute_quant_table(m_quantization_tables[0], m_quantization_recips[0], s_std_lum_quant);
+        compute_quant_table(m_quantization_tables[1], m_quantization_recips[1], s_std_croma_quant);
+        m_huff = get_huffman_tables();
 
         m_out_buf_left = JPGE_OUT_BUF_SIZE;
         m_pOut_buf = m_out_buf;
         m_bit_buffer = 0;
         m_bits_in = 0;
         m_mcu_y_ofs = 0;
+        m_mcu_row = 0;
+        m_last_stripe = true;
         m_pass_num = 2;
         memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
 
-        // Emit all markers at beginning of image file.
+        return true;
+    }
+
+    // Emit all markers at beginning of image file.
+    bool jpeg_encoder::emit_start_markers()
+    {
         emit_marker(M_SOI);
         emit_jfif_app0();
         emit_dqt();
         emit_sof();
         emit_dhts();
+        if (m_params.m_restart_rows)
+            emit_dri();
         emit_sos();
 
         return m_all_stream_writes_succeeded;
@@ -669,9 +766,11 @@ namespace jpge {
         }
 
         put_bits(0x7F, 7);
-        emit_marker(M_EOI);
+        if (m_last_stripe)
+            emit_marker(M_EOI);
         flush_output_buffer();
-        m_all_stream_writes_succeeded = m_all_stream_writes_succeeded && m_pStream->put_buf(NULL, 0);
+        if (m_last_stripe)
+            m_all_stream_writes_succeeded = m_all_stream_writes_succeeded && m_pStream->put_buf(NULL, 0);
         m_pass_num++; // purposely bump up m_pass_num, for debugging
         return true;
     }
@@ -699,7 +798,25 @@ namespace jpge {
         if (((!pStream) || (width < 1) || (height < 1)) || ((src_channels != 1) && (src_channels != 3) && (src_channels != 4)) || (!comp_params.check())) return false;
         m_pStream = pStream;
         m_params = comp_params;
-        return jpg_open(width, height, src_channels);
+        return jpg_open(width, height, src_channels) && emit_start_markers();
+    }
+
+    bool jpeg_encoder::init_stripe(output_stream *pStream, int width, int height, int src_channels, const params &comp_params, int first_line, int num_lines)
+    {
+        int restart_lines = comp_params.m_restart_rows * comp_params.mcu_height();
+        bool last = (first_line + num_lines) >= height;
+
+        deinit();
+        if (((!pStream) || (width < 1) || (height < 1)) || ((src_channels != 1) && (src_channels != 3) && (src_channels != 4)) || (!comp_params.check())) return false;
+        if ((!restart_lines) || (first_line < 0) || (num_lines < 1) || (first_line % restart_lines) ||
+            ((!last) && (num_lines % comp_params.mcu_height()))) return false;
+        m_pStream = pStream;
+        m_params = comp_params;
+        if (!jpg_open(width, height, src_channels)) return false;
+        m_mcu_row = first_line / m_mcu_y;
+        m_last_stripe = last;
+        // only the first stripe has the headers
+        return first_line ? true : emit_start_markers();
     }
 
     void jpeg_encoder::deinit()
@@ -0,0 +1,66 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#ifndef _CONVERSIONS_JPG_SLICE_H_
+#define _CONVERSIONS_JPG_SLICE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+/*
+ * Runs one slice of a JPEG encode or decode on the other core
+ *
+ * The JPEG encoder and decoder split an image into horizontal stripes joined with
+ * restart markers. The caller starts the job of one stripe with jpg_slice_start(),
+ * processes the other stripe itself and collects the job with jpg_slice_join().
+ * The job runs in a worker task of the other core, created on first use and kept.
+ */
+typedef struct jpg_slice jpg_slice_t;
+
+typedef bool (*jpg_slice_job_t)(void *arg);
+
+/**
+ * @brief Check if slices can run on another core
+ *
+ * @return true on dual core chips with CONFIG_CAMERA_CONVERSION_DUAL_CORE enabled
+ */
+bool jpg_slice_enabled(void);
+
+/**
+ * @brief Start a job on the core the caller is not running on
+ *
+ * @param job   Job function
+ * @param arg   Argument of the job
+ *
+ * @return slice handle, NULL if the job could not be started or the worker is busy with
+ *         another caller (the caller should run it itself)
+ */
+jpg_slice_t *jpg_slice_start(jpg_slice_job_t job, void *arg);
+
+/**
+ * @brief Wait for a job to finish and release the worker
+ *
+ * @param slice Slice handle
+ *
+ * @return value returned by the job
+ */
+bool jpg_slice_join(jpg_slice_t *slice);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CONVERSIONS_JPG_SLICE_H_ */
@@ -12,13 +12,17 @@ namespace jpge
     typedef unsigned short uint16;
     typedef unsigned int   uint32;
     typedef unsigned int   uint;
+    typedef unsigned long long uint64;
 
     // JPEG chroma subsampling factors. Y_ONLY (grayscale images) and H2V2 (color images) are the most common.
     enum subsampling_t { Y_ONLY = 0, H1V1 = 1, H2V1 = 2, H2V2 = 3 };
 
+    // Forward DCT implementations. DCT_IFAST is the default, DCT_ISLOW is the original one.
+    enum dct_method_t { DCT_ISLOW = 0, DCT_IFAST = 1 };
+
     // JPEG compression parameters structure.
     struct params {
-            inline params() : m_quality(85), m_subsampling(H2V2) { }
+            inline params() : m_quality(85), m_subsampling(H2V2), m_dct_method(DCT_IFAST), m_restart_rows(0) { }
 
             inline bool check() const {
                 if ((m_quality < 1) || (m_quality > 100)) {
@@ -27,6 +31,12 @@ namespace jpge
                 if ((uint)m_subsampling > (uint)H2V2) {
                     return false;
                 }
+                if ((uint)m_dct_method > (uint)DCT_IFAST) {
+                    return false;
+                }
+                if (m_restart_rows < 0) {
+                    return false;
+                }
                 return true;
             }
 
@@ -39,7 +49,24 @@ namespace jpge
             // 2 = H2V1 subsampling (YCbCr 2x1x1, 4 blocks per MCU)
             // 3 = H2V2 subsampling (YCbCr 4x1x1, 6 blocks per MCU-- very common)
             subsampling_t m_subsampling;
+
+            // m_dct_method:
+            // DCT_ISLOW = jfdctint derived DCT on int32 samples, quantized with a division per coefficient
+            // DCT_IFAST = AAN DCT on int16 samples (5 multiplies per 8 points), its output scaling is folded
+            //             into reciprocal quantizers and the quantized coefficients are stored in zigzag order
+            //             by the column pass
+            dct_method_t m_dct_method;
+
+            // m_restart_rows: 0 = no restart markers, else a restart marker every m_restart_rows MCU rows.
+            // Required to encode in stripes, see jpeg_encoder::init_stripe().
+            int m_restart_rows;
+
+            // Height in lines of an MCU row: 16 for H2V2, 8 otherwise.
+            inline int mcu_height() const { return (m_subsampling == H2V2) ? 16 : 8; }
     };
+
+    // Huffman code tables, shared by all encoders and never modified once built.
+    struct huffman_tables;
     
     // Output stream abstract class - used by the jpeg_encoder class to write to the output stream.
     // put_buf() is generally called with len==JPGE_OUT_BUF_SIZE bytes, but for headers it'll be called with smaller amounts.
@@ -51,6 +78,7 @@ namespace jpge
     };
     
     // Lower level jpeg_encoder class - useful if more control is needed than the above helper functions.
+    // All the encoding state lives in the instance, separate instances may run concurrently on both cores.
     class jpeg_encoder {
         public:
             jpeg_encoder();
@@ -64,6 +92,14 @@ namespace jpge
             // Returns false on out of memory or if a stream write fails.
             bool init(output_stream *pStream, int width, int height, int src_channels, const params &comp_params = params());
 
+            // Initializes the compressor for one horizontal stripe of the image: num_lines scanlines starting at first_line.
+            // Stripes are independent and may be encoded concurrently, the outputs of all the stripes concatenated in order
+            // make the JPEG. Only the first stripe emits the headers and only the last one the EOI marker.
+            // comp_params.m_restart_rows must be set, first_line must be a multiple of m_restart_rows MCU rows and
+            // num_lines a multiple of comp_params.mcu_height() unless the stripe ends the image.
+            // Call process_scanline() with the num_lines scanlines of the stripe, then with NULL.
+            bool init_stripe(output_stream *pStream, int width, int height, int src_channels, const params &comp_params, int first_line, int num_lines);
+
             // Call this method with each source scanline.
             // width * src_channels bytes per scanline is expected (RGB or Y format).
             // You must call with NULL after all scanlines are processed to finish compression.
@@ -77,7 +113,7 @@ namespace jpge
             jpeg_encoder(const jpeg_encoder &);
             jpeg_encoder &operator =(const jpeg_encoder &);
 
-            typedef int32 sample_array_t;
+            typedef int16 sample_array_t;
             enum { JPGE_OUT_BUF_SIZE = 512 };
 
             output_stream *m_pStream;
@@ -91,8 +127,13 @@ namespace jpge
             int m_mcu_x, m_mcu_y;
             uint8 *m_mcu_lines[16];
             uint8 m_mcu_y_ofs;
+            int m_mcu_row;                          // index in the image of the next MCU row to code
+            bool m_last_stripe;
+            const huffman_tables *m_huff;
+            uint8 m_quantization_tables[2][64];     // zigzag order, as emitted in DQT
+            uint32 m_quantization_recips[2][64];    // natural order, 2^20 / AAN scaled quantizer
             sample_array_t m_sample_array[64];
-            int16 m_coefficient_array[64];
+            int16 m_coefficient_array[64];          // zigzag order
 
             int m_last_dc_val[3];
             uint8 m_out_buf[JPGE_OUT_BUF_SIZE];
@@ -104,6 +145,7 @@ namespace jpge
             bool m_all_stream_writes_succeeded;
 
             bool jpg_open(int p_x_res, int p_y_res, int src_channels);
+            bool emit_start_markers();
 
             void flush_output_buffer();
             void put_bits(uint bits, uint len);
@@ -115,19 +157,22 @@ namespace jpge
             void emit_jfif_app0();
             void emit_dqt();
             void emit_sof();
-            void emit_dht(uint8 *bits, uint8 *val, int index, bool ac_flag);
+            void emit_dht(const uint8 *bits, const uint8 *val, int index, bool ac_flag);
             void emit_dhts();
             void emit_sos();
+            void emit_dri();
+            void emit_restart(int n);
 
-            void compute_quant_table(int32 *dst, const int16 *src);
-            void load_quantized_coefficients(int component_num);
+            void compute_quant_table(uint8 *dst, uint32 *recips, const int16 *src);
+            uint64 load_quantized_coefficients(int component_num);
+            uint64 dct_quantize_ifast(int component_num);
 
             void load_block_8_8_grey(int x);
             void load_block_8_8(int x, int y, int c);
             void load_block_16_8(int x, int c);
             void load_block_16_8_8(int x, int c);
 
-            void code_coefficients_pass_two(int component_num);
+            void code_coefficients_pass_two(int component_num, uint64 nonzero);
             void code_block(int component_num);
 
             void process_mcu_row();
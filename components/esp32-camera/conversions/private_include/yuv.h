@@ -18,10 +18,40 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 void yuv2rgb(uint8_t y, uint8_t u, uint8_t v, uint8_t *r, uint8_t *g, uint8_t *b);
 
+/*
+ * Line conversion kernels
+ *
+ * Each kernel has a per-pixel reference (_ref) and a blocked implementation that
+ * splits the table lookups from the arithmetic so the arithmetic runs on lanes of
+ * CONVERSION_BLOCK pixels. Both produce identical output; the non-suffixed name is
+ * the blocked YUV422 kernel unless CONFIG_CAMERA_CONVERSION_REFERENCE_KERNELS is set,
+ * and the reference for the others.
+ *
+ * bgr selects the output byte order: false for R,G,B (JPEG encoder), true for B,G,R (BMP).
+ */
+#define CONVERSION_BLOCK 16
+
+// YUYV (Y0 U Y1 V) to 24-bit color, width must be even
+void yuv422_to_rgb888_line(const uint8_t *src, uint8_t *dst, size_t width, bool bgr);
+void yuv422_to_rgb888_line_ref(const uint8_t *src, uint8_t *dst, size_t width, bool bgr);
+void yuv422_to_rgb888_line_blk(const uint8_t *src, uint8_t *dst, size_t width, bool bgr);
+
+// big endian RGB565 to 24-bit color
+void rgb565_to_rgb888_line(const uint8_t *src, uint8_t *dst, size_t width, bool bgr);
+void rgb565_to_rgb888_line_ref(const uint8_t *src, uint8_t *dst, size_t width, bool bgr);
+void rgb565_to_rgb888_line_blk(const uint8_t *src, uint8_t *dst, size_t width, bool bgr);
+
+// R,G,B to Y,Cb,Cr with the JPEG encoder coefficients
+void rgb888_to_ycc_line(const uint8_t *src, uint8_t *dst, size_t width);
+void rgb888_to_ycc_line_ref(const uint8_t *src, uint8_t *dst, size_t width);
+void rgb888_to_ycc_line_blk(const uint8_t *src, uint8_t *dst, size_t width);
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include "img_converters.h"
 #include "soc/efuse_reg.h"
@@ -159,17 +160,22 @@ static bool _rgb565_write(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16
     return true;
 }
 
-//input buffer
-static unsigned int _jpg_read(void * arg, size_t index, uint8_t *buf, size_t len)
+static bool jpg2rgb888(const uint8_t *src, size_t src_len, uint8_t * out, jpg_scale_t scale)
 {
-    rgb_jpg_decoder * jpeg = (rgb_jpg_decoder *)arg;
-    if(buf) {
-        memcpy(buf, jpeg->input + index, len);
+    rgb_jpg_decoder jpeg;
+    jpeg.width = 0;
+    jpeg.height = 0;
+    jpeg.input = src;
+    jpeg.output = out;
+    jpeg.data_offset = 0;
+
+    if(esp_jpg_decode_buf(src, src_len, scale, _rgb_write, (void*)&jpeg) != ESP_OK){
+        return false;
     }
-    return len;
+    return true;
 }
 
-static bool jpg2rgb888(const uint8_t *src, size_t src_len, uint8_t * out, jpg_scale_t scale)
+bool jpg2rgb565(const uint8_t *src, size_t src_len, uint8_t * out, jpg_scale_t scale)
 {
     rgb_jpg_decoder jpeg;
     jpeg.width = 0;
@@ -178,24 +184,83 @@ static bool jpg2rgb888(const uint8_t *src, size_t src_len, uint8_t * out, jpg_sc
     jpeg.output = out;
     jpeg.data_offset = 0;
 
-    if(esp_jpg_decode(src_len, scale, _jpg_read, _rgb_write, (void*)&jpeg) != ESP_OK){
+    if(esp_jpg_decode_buf(src, src_len, scale, _rgb565_write, (void*)&jpeg) != ESP_OK){
         return false;
     }
     return true;
 }
 
-bool jpg2rgb565(const uint8_t *src, size_t src_len, uint8_t * out, jpg_scale_t scale)
+//luminance only, used to score sharpness
+static bool _luma_write(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    rgb_jpg_decoder * jpeg = (rgb_jpg_decoder *)arg;
+    if(!data){
+        if(x == 0 && y == 0){
+            //write start
+            jpeg->width = w;
+            jpeg->height = h;
+            jpeg->output = (uint8_t *)_malloc(w*h);
+            if(!jpeg->output){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint8_t *o = jpeg->output + (y * jpeg->width) + x;
+    size_t iy, ix;
+
+    for(iy=0; iy<h; iy++) {
+        for(ix=0; ix<w; ix++) {
+            o[ix] = (data[0] * 77 + data[1] * 150 + data[2] * 29) >> 8;
+            data += 3;
+        }
+        o += jpeg->width;
+    }
+    return true;
+}
+
+bool jpg_sharpness(const uint8_t *src, size_t src_len, jpg_scale_t scale, float *score)
 {
     rgb_jpg_decoder jpeg;
     jpeg.width = 0;
     jpeg.height = 0;
     jpeg.input = src;
-    jpeg.output = out;
+    jpeg.output = NULL;
     jpeg.data_offset = 0;
 
-    if(esp_jpg_decode(src_len, scale, _jpg_read, _rgb565_write, (void*)&jpeg) != ESP_OK){
+    if(!score){
         return false;
     }
+    if(esp_jpg_decode_buf(src, src_len, scale, _luma_write, (void*)&jpeg) != ESP_OK){
+        free(jpeg.output);
+        return false;
+    }
+    if(jpeg.width < 3 || jpeg.height < 3){
+        free(jpeg.output);
+        return false;
+    }
+
+    //variance of the 4-neighbour laplacian, blur removes the high frequencies it responds to
+    const uint8_t *l = jpeg.output;
+    size_t w = jpeg.width;
+    int64_t sum = 0;
+    uint64_t sum2 = 0;
+    size_t n = (w - 2) * (jpeg.height - 2);
+    size_t iy, ix;
+
+    for(iy=1; iy<jpeg.height-1; iy++) {
+        const uint8_t *p = l + (iy * w);
+        for(ix=1; ix<w-1; ix++) {
+            int v = 4 * p[ix] - p[ix-1] - p[ix+1] - p[ix-w] - p[ix+w];
+            sum += v;
+            sum2 += v * v;
+        }
+    }
+    free(jpeg.output);
+
+    float mean = (float)sum / n;
+    *score = (float)sum2 / n - mean * mean;
     return true;
 }
 
@@ -209,7 +274,7 @@ bool jpg2bmp(const uint8_t *src, size_t src_len, uint8_t ** out, size_t * out_le
     jpeg.output = NULL;
     jpeg.data_offset = BMP_HEADER_LEN;
 
-    if(esp_jpg_decode(src_len, JPG_SCALE_NONE, _jpg_read, _rgb_write, (void*)&jpeg) != ESP_OK){
+    if(esp_jpg_decode_buf(src, src_len, JPG_SCALE_NONE, _rgb_write, (void*)&jpeg) != ESP_OK){
         return false;
     }
 
@@ -247,16 +312,8 @@ bool fmt2rgb888(const uint8_t *src_buf, size_t src_len, pixformat_t format, uint
     } else if(format == PIXFORMAT_RGB888) {
         memcpy(rgb_buf, src_buf, src_len);
     } else if(format == PIXFORMAT_RGB565) {
-        int i;
-        uint8_t hb, lb;
         pix_count = src_len / 2;
-        for(i=0; i<pix_count; i++) {
-            hb = *src_buf++;
-            lb = *src_buf++;
-            *rgb_buf++ = (lb & 0x1F) << 3;
-            *rgb_buf++ = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
-            *rgb_buf++ = hb & 0xF8;
-        }
+        rgb565_to_rgb888_line(src_buf, rgb_buf, pix_count, true);
     } else if(format == PIXFORMAT_GRAYSCALE) {
         int i;
         uint8_t b;
@@ -269,25 +326,7 @@ bool fmt2rgb888(const uint8_t *src_buf, size_t src_len, pixformat_t format, uint
         }
     } else if(format == PIXFORMAT_YUV422) {
         pix_count = src_len / 2;
-        int i, maxi = pix_count / 2;
-        uint8_t y0, y1, u, v;
-        uint8_t r, g, b;
-        for(i=0; i<maxi; i++) {
-            y0 = *src_buf++;
-            u = *src_buf++;
-            y1 = *src_buf++;
-            v = *src_buf++;
-
-            yuv2rgb(y0, u, v, &r, &g, &b);
-            *rgb_buf++ = b;
-            *rgb_buf++ = g;
-            *rgb_buf++ = r;
-
-            yuv2rgb(y1, u, v, &r, &g, &b);
-            *rgb_buf++ = b;
-            *rgb_buf++ = g;
-            *rgb_buf++ = r;
-        }
+        yuv422_to_rgb888_line(src_buf, rgb_buf, pix_count / 2 * 2, true);
     }
     return true;
 }
@@ -354,37 +393,11 @@ bool fmt2bmp(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixf
     if(format == PIXFORMAT_RGB888) {
         memcpy(pix_buf, src_buf, pix_count*3);
     } else if(format == PIXFORMAT_RGB565) {
-        int i;
-        uint8_t hb, lb;
-        for(i=0; i<pix_count; i++) {
-            hb = *src_buf++;
-            lb = *src_buf++;
-            *pix_buf++ = (lb & 0x1F) << 3;
-            *pix_buf++ = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
-            *pix_buf++ = hb & 0xF8;
-        }
+        rgb565_to_rgb888_line(src_buf, pix_buf, pix_count, true);
     } else if(format == PIXFORMAT_GRAYSCALE) {
         memcpy(pix_buf, src_buf, pix_count);
     } else if(format == PIXFORMAT_YUV422) {
-        int i, maxi = pix_count / 2;
-        uint8_t y0, y1, u, v;
-        uint8_t r, g, b;
-        for(i=0; i<maxi; i++) {
-            y0 = *src_buf++;
-            u = *src_buf++;
-            y1 = *src_buf++;
-            v = *src_buf++;
-
-            yuv2rgb(y0, u, v, &r, &g, &b);
-            *pix_buf++ = b;
-            *pix_buf++ = g;
-            *pix_buf++ = r;
-
-            yuv2rgb(y1, u, v, &r, &g, &b);
-            *pix_buf++ = b;
-            *pix_buf++ = g;
-            *pix_buf++ = r;
-        }
+        yuv422_to_rgb888_line(src_buf, pix_buf, pix_count / 2 * 2, true);
     }
     *out = out_buf;
     *out_len = out_size;
@@ -13,6 +13,8 @@
 // limitations under the License.
 #include <stddef.h>
 #include <string.h>
+#include <new>
+#include "sdkconfig.h"
 #include "esp_attr.h"
 #include "soc/efuse_reg.h"
 #include "esp_heap_caps.h"
@@ -20,6 +22,7 @@
 #include "img_converters.h"
 #include "jpge.h"
 #include "yuv.h"
+#include "jpg_slice.h"
 
 #if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
 #include "esp32-hal-log.h"
@@ -43,7 +46,7 @@ static void *_malloc(size_t size)
     return NULL;
 }
 
-static IRAM_ATTR void convert_line_format(uint8_t * src, pixformat_t format, uint8_t * dst, size_t width, size_t in_channels, size_t line)
+static IRAM_ATTR void convert_line_format(const uint8_t * src, pixformat_t format, uint8_t * dst, size_t width, size_t in_channels, size_t line)
 {
     int i=0, o=0, l=0;
     if(format == PIXFORMAT_GRAYSCALE) {
@@ -57,72 +60,108 @@ static IRAM_ATTR void convert_line_format(uint8_t * src, pixformat_t format, uin
             dst[o++] = src[i];
         }
     } else if(format == PIXFORMAT_RGB565) {
-        l = width * 2;
-        src += l * line;
-        for(i=0; i<l; i+=2) {
-            dst[o++] = src[i] & 0xF8;
-            dst[o++] = (src[i] & 0x07) << 5 | (src[i+1] & 0xE0) >> 3;
-            dst[o++] = (src[i+1] & 0x1F) << 3;
-        }
+        rgb565_to_rgb888_line(src + width * 2 * line, dst, width, false);
     } else if(format == PIXFORMAT_YUV422) {
-        uint8_t y0, y1, u, v;
-        uint8_t r, g, b;
-        l = width * 2;
-        src += l * line;
-        for(i=0; i<l; i+=4) {
-            y0 = src[i];
-            u = src[i+1];
-            y1 = src[i+2];
-            v = src[i+3];
-
-            yuv2rgb(y0, u, v, &r, &g, &b);
-            dst[o++] = r;
-            dst[o++] = g;
-            dst[o++] = b;
-
-            yuv2rgb(y1, u, v, &r, &g, &b);
-            dst[o++] = r;
-            dst[o++] = g;
-            dst[o++] = b;
-        }
+        yuv422_to_rgb888_line(src + width * 2 * line, dst, width, false);
     }
 }
 
-bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpge::output_stream *dst_stream)
+static jpge::params get_comp_params(pixformat_t format, uint8_t quality)
 {
-    int num_channels = 3;
-    jpge::subsampling_t subsampling = jpge::H2V2;
-
-    if(format == PIXFORMAT_GRAYSCALE) {
-        num_channels = 1;
-        subsampling = jpge::Y_ONLY;
-    }
+    jpge::params comp_params = jpge::params();
 
+    comp_params.m_subsampling = (format == PIXFORMAT_GRAYSCALE) ? jpge::Y_ONLY : jpge::H2V2;
     if(!quality) {
         quality = 1;
     } else if(quality > 100) {
         quality = 100;
     }
-
-    jpge::params comp_params = jpge::params();
-    comp_params.m_subsampling = subsampling;
     comp_params.m_quality = quality;
+#if CONFIG_CAMERA_CONVERSION_REFERENCE_KERNELS
+    comp_params.m_dct_method = jpge::DCT_ISLOW;
+#endif
+    return comp_params;
+}
+
+// Images with fewer MCU rows are encoded on one core
+#define JPG_SLICE_MIN_MCU_ROWS 4
+
+// Collects the output of a stripe encoded on the other core, or of a transcode
+class buffer_stream : public jpge::output_stream {
+public:
+    uint8_t *buf;
+    size_t len, cap;
+    bool failed;
+
+    buffer_stream() : buf(NULL), len(0), cap(0), failed(false) { }
+    virtual ~buffer_stream() { free(buf); }
+    virtual bool put_buf(const void* pBuf, int size)
+    {
+        if (!pBuf || failed) {
+            return !failed;
+        }
+        if (len + size > cap) {
+            size_t new_cap = cap ? cap * 2 : 16 * 1024;
+            while (new_cap < len + size) {
+                new_cap *= 2;
+            }
+            uint8_t *new_buf = (uint8_t *)_malloc(new_cap);
+            if (!new_buf) {
+                failed = true;
+                return false;
+            }
+            if (len) {
+                memcpy(new_buf, buf, len);
+            }
+            free(buf);
+            buf = new_buf;
+            cap = new_cap;
+        }
+        memcpy(buf + len, pBuf, size);
+        len += size;
+        return true;
+    }
+    virtual size_t get_size() const
+    {
+        return len;
+    }
+};
+
+typedef struct {
+    uint8_t *src;
+    uint16_t width, height;
+    pixformat_t format;
+    jpge::params comp_params;
+    int first_line, num_lines;
+    jpge::output_stream *dst_stream;
+} jpg_stripe_t;
 
+static bool encode_stripe(void *arg)
+{
+    jpg_stripe_t *stripe = (jpg_stripe_t *)arg;
+    int num_channels = (stripe->format == PIXFORMAT_GRAYSCALE) ? 1 : 3;
     jpge::jpeg_encoder dst_image;
+    bool ok;
 
-    if (!dst_image.init(dst_stream, width, height, num_channels, comp_params)) {
+    if (stripe->num_lines == stripe->height) {
+        ok = dst_image.init(stripe->dst_stream, stripe->width, stripe->height, num_channels, stripe->comp_params);
+    } else {
+        ok = dst_image.init_stripe(stripe->dst_stream, stripe->width, stripe->height, num_channels, stripe->comp_params,
+                                   stripe->first_line, stripe->num_lines);
+    }
+    if (!ok) {
         ESP_LOGE(TAG, "JPG encoder init failed");
         return false;
     }
 
-    uint8_t* line = (uint8_t*)_malloc(width * num_channels);
+    uint8_t* line = (uint8_t*)_malloc(stripe->width * num_channels);
     if(!line) {
         ESP_LOGE(TAG, "Scan line malloc failed");
         return false;
     }
 
-    for (int i = 0; i < height; i++) {
-        convert_line_format(src, format, line, width, num_channels, i);
+    for (int i = stripe->first_line; i < stripe->first_line + stripe->num_lines; i++) {
+        convert_line_format(stripe->src, stripe->format, line, stripe->width, num_channels, i);
         if (!dst_image.process_scanline(line)) {
             ESP_LOGE(TAG, "JPG process line %u failed", i);
             free(line);
@@ -139,6 +178,48 @@ bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t fo
     return true;
 }
 
+bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpge::output_stream *dst_stream)
+{
+    jpg_stripe_t stripes[2];
+    int mcu_height, mcu_rows;
+
+    stripes[0].src = src;
+    stripes[0].width = width;
+    stripes[0].height = height;
+    stripes[0].format = format;
+    stripes[0].comp_params = get_comp_params(format, quality);
+    stripes[0].first_line = 0;
+    stripes[0].num_lines = height;
+    stripes[0].dst_stream = dst_stream;
+
+    mcu_height = stripes[0].comp_params.mcu_height();
+    mcu_rows = (height + mcu_height - 1) / mcu_height;
+    if (mcu_rows < JPG_SLICE_MIN_MCU_ROWS || !jpg_slice_enabled()) {
+        return encode_stripe(&stripes[0]);
+    }
+
+    // The second stripe starts at the first restart marker and is encoded on the other core
+    buffer_stream stripe_stream;
+    stripes[0].comp_params.m_restart_rows = (mcu_rows + 1) / 2;
+    stripes[0].num_lines = stripes[0].comp_params.m_restart_rows * mcu_height;
+    stripes[1] = stripes[0];
+    stripes[1].first_line = stripes[0].num_lines;
+    stripes[1].num_lines = height - stripes[0].num_lines;
+    stripes[1].dst_stream = &stripe_stream;
+
+    jpg_slice_t *slice = jpg_slice_start(encode_stripe, &stripes[1]);
+    bool ok = encode_stripe(&stripes[0]);
+    if (slice) {
+        ok = jpg_slice_join(slice) && ok;
+    } else {
+        ok = ok && encode_stripe(&stripes[1]);
+    }
+    if (!ok) {
+        return false;
+    }
+    return dst_stream->put_buf(stripe_stream.buf, stripe_stream.len) && dst_stream->put_buf(NULL, 0);
+}
+
 class callback_stream : public jpge::output_stream {
 protected:
     jpg_out_cb ocb;
@@ -170,6 +251,176 @@ bool frame2jpg_cb(camera_fb_t * fb, uint8_t quality, jpg_out_cb cb, void * arg)
     return fmt2jpg_cb(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, cb, arg);
 }
 
+struct jpg_stream {
+    callback_stream dst_stream;
+    jpge::jpeg_encoder encoder;
+    pixformat_t format;
+    uint16_t width, height, rows;
+    uint8_t *line;
+
+    jpg_stream(jpg_out_cb cb, void * arg) : dst_stream(cb, arg), line(NULL) { }
+    ~jpg_stream() { free(line); }
+};
+
+jpg_stream_t *jpg_stream_begin(uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void * arg)
+{
+    int num_channels = (format == PIXFORMAT_GRAYSCALE) ? 1 : 3;
+
+    if(format != PIXFORMAT_GRAYSCALE && format != PIXFORMAT_RGB888 && format != PIXFORMAT_RGB565 && format != PIXFORMAT_YUV422) {
+        ESP_LOGE(TAG, "JPG stream format %u not supported", format);
+        return NULL;
+    }
+    jpg_stream_t *stream = new (std::nothrow) jpg_stream(cb, arg);
+    if(!stream) {
+        ESP_LOGE(TAG, "JPG stream malloc failed");
+        return NULL;
+    }
+    stream->format = format;
+    stream->width = width;
+    stream->height = height;
+    stream->rows = 0;
+    stream->line = (uint8_t*)_malloc(width * num_channels);
+    if(!stream->line) {
+        ESP_LOGE(TAG, "Scan line malloc failed");
+        delete stream;
+        return NULL;
+    }
+    if(!stream->encoder.init(&stream->dst_stream, width, height, num_channels, get_comp_params(format, quality))) {
+        ESP_LOGE(TAG, "JPG encoder init failed");
+        delete stream;
+        return NULL;
+    }
+    return stream;
+}
+
+bool jpg_stream_write(jpg_stream_t *stream, const uint8_t *rows, size_t num_rows)
+{
+    if(!stream || stream->rows + num_rows > stream->height) {
+        return false;
+    }
+    for (size_t i = 0; i < num_rows; i++) {
+        convert_line_format(rows, stream->format, stream->line, stream->width, (stream->format == PIXFORMAT_GRAYSCALE) ? 1 : 3, i);
+        if (!stream->encoder.process_scanline(stream->line)) {
+            ESP_LOGE(TAG, "JPG process line %u failed", stream->rows);
+            return false;
+        }
+        stream->rows++;
+    }
+    return true;
+}
+
+bool jpg_stream_end(jpg_stream_t *stream)
+{
+    bool ret = false;
+
+    if(!stream) {
+        return false;
+    }
+    if(stream->rows == stream->height) {
+        ret = stream->encoder.process_scanline(NULL);
+        if(!ret) {
+            ESP_LOGE(TAG, "JPG image finish failed");
+        }
+    } else {
+        ESP_LOGW(TAG, "JPG stream aborted at line %u of %u", stream->rows, stream->height);
+    }
+    delete stream;
+    return ret;
+}
+
+
+
+// Downscaled JPEG transcode: tjpgd outputs the MCUs of one row left to right,
+// only that row is buffered before it is fed to a jpg_stream.
+typedef struct {
+    const uint8_t *src;
+    uint8_t quality;
+    jpg_out_cb cb;
+    void * arg;
+    jpg_stream_t *stream;
+    uint8_t *rows;          // one scaled MCU row in RGB888 (BGR order)
+    uint16_t width;
+} jpg_transcode_t;
+
+static size_t _transcode_read(void * arg, size_t index, uint8_t *buf, size_t len)
+{
+    jpg_transcode_t *jpeg = (jpg_transcode_t *)arg;
+    if(buf) {
+        memcpy(buf, jpeg->src + index, len);
+    }
+    return len;
+}
+
+static bool _transcode_write(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    jpg_transcode_t *jpeg = (jpg_transcode_t *)arg;
+    if(!data) {
+        if(x == 0 && y == 0) {
+            //write start, an MCU is at most 16 lines high
+            jpeg->width = w;
+            jpeg->rows = (uint8_t *)_malloc(w * 16 * 3);
+            if(!jpeg->rows) {
+                ESP_LOGE(TAG, "Transcode rows malloc failed");
+                return false;
+            }
+            jpeg->stream = jpg_stream_begin(w, h, PIXFORMAT_RGB888, jpeg->quality, jpeg->cb, jpeg->arg);
+            return jpeg->stream != NULL;
+        }
+        return true;
+    }
+    if(!jpeg->stream) {
+        return false;
+    }
+    for(uint16_t iy = 0; iy < h; iy++) {
+        uint8_t *o = jpeg->rows + (iy * jpeg->width + x) * 3;
+        for(uint16_t ix = 0; ix < w * 3; ix += 3) {
+            o[ix] = data[ix + 2];
+            o[ix + 1] = data[ix + 1];
+            o[ix + 2] = data[ix];
+        }
+        data += w * 3;
+    }
+    if(x + w < jpeg->width) {
+        return true;
+    }
+    return jpg_stream_write(jpeg->stream, jpeg->rows, h);
+}
+
+bool jpg2jpg_cb(const uint8_t *src, size_t src_len, jpg_scale_t scale, uint8_t quality, jpg_out_cb cb, void * arg)
+{
+    jpg_transcode_t jpeg;
+    bool ret;
+
+    memset(&jpeg, 0, sizeof(jpeg));
+    jpeg.src = src;
+    jpeg.quality = quality;
+    jpeg.cb = cb;
+    jpeg.arg = arg;
+
+    ret = esp_jpg_decode(src_len, scale, _transcode_read, _transcode_write, &jpeg) == ESP_OK;
+    ret = jpg_stream_end(jpeg.stream) && ret;
+    free(jpeg.rows);
+    return ret;
+}
+
+static size_t _buffer_stream_write(void * arg, size_t index, const void* data, size_t len)
+{
+    buffer_stream *out = (buffer_stream *)arg;
+    return out->put_buf(data, len) ? len : 0;
+}
+
+bool jpg2jpg(const uint8_t *src, size_t src_len, jpg_scale_t scale, uint8_t quality, uint8_t ** out, size_t * out_len)
+{
+    buffer_stream dst_stream;
+
+    if(!jpg2jpg_cb(src, src_len, scale, quality, _buffer_stream_write, &dst_stream) || dst_stream.failed) {
+        return false;
+    }
+    *out = dst_stream.buf;
+    *out_len = dst_stream.len;
+    dst_stream.buf = NULL;
+    return true;
+}
 
 
 class memory_stream : public jpge::output_stream {
@@ -13,6 +13,7 @@
 // limitations under the License.
 #include "yuv.h"
 #include "esp_attr.h"
+#include "sdkconfig.h"
 
 typedef struct {
         int16_t vY;
@@ -296,3 +297,144 @@ void IRAM_ATTR yuv2rgb(uint8_t y, uint8_t u, uint8_t v, uint8_t *r, uint8_t *g,
     *g = YUYV_CONSTRAIN(gi);
     *b = YUYV_CONSTRAIN(bi);
 }
+
+static inline uint8_t clamp_u8(int v)
+{
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+static inline void put_rgb(uint8_t *dst, uint8_t r, uint8_t g, uint8_t b, bool bgr)
+{
+    dst[0] = bgr ? b : r;
+    dst[1] = g;
+    dst[2] = bgr ? r : b;
+}
+
+void IRAM_ATTR yuv422_to_rgb888_line_ref(const uint8_t *src, uint8_t *dst, size_t width, bool bgr)
+{
+    uint8_t r, g, b;
+    for (size_t i = 0; i < width; i += 2, src += 4, dst += 6) {
+        yuv2rgb(src[0], src[1], src[3], &r, &g, &b);
+        put_rgb(dst, r, g, b, bgr);
+        yuv2rgb(src[2], src[1], src[3], &r, &g, &b);
+        put_rgb(dst + 3, r, g, b, bgr);
+    }
+}
+
+void IRAM_ATTR yuv422_to_rgb888_line_blk(const uint8_t *src, uint8_t *dst, size_t width, bool bgr)
+{
+    int16_t y[CONVERSION_BLOCK], cr[CONVERSION_BLOCK], cg[CONVERSION_BLOCK], cb[CONVERSION_BLOCK];
+    uint8_t o0 = bgr ? 2 : 0, o2 = bgr ? 0 : 2;
+
+    while (width) {
+        size_t n = (width < CONVERSION_BLOCK) ? width : CONVERSION_BLOCK;
+        // gather: chroma is looked up once per pixel pair
+        for (size_t i = 0; i < n; i += 2, src += 4) {
+            const yuv_table_row *u = &yuv_table[src[1]];
+            const yuv_table_row *v = &yuv_table[src[3]];
+            y[i] = yuv_table[src[0]].vY;
+            y[i + 1] = yuv_table[src[2]].vY;
+            cr[i] = cr[i + 1] = v->vVr;
+            cg[i] = cg[i + 1] = u->vUg + v->vVg;
+            cb[i] = cb[i + 1] = u->vUb;
+        }
+        // arithmetic on the lanes
+        for (size_t i = 0; i < n; i++, dst += 3) {
+            dst[o0] = clamp_u8(y[i] + cr[i]);
+            dst[1] = clamp_u8(y[i] + cg[i]);
+            dst[o2] = clamp_u8(y[i] + cb[i]);
+        }
+        width -= n;
+    }
+}
+
+void IRAM_ATTR rgb565_to_rgb888_line_ref(const uint8_t *src, uint8_t *dst, size_t width, bool bgr)
+{
+    for (size_t i = 0; i < width; i++, src += 2, dst += 3) {
+        put_rgb(dst, src[0] & 0xF8, (src[0] & 0x07) << 5 | (src[1] & 0xE0) >> 3, (src[1] & 0x1F) << 3, bgr);
+    }
+}
+
+void IRAM_ATTR rgb565_to_rgb888_line_blk(const uint8_t *src, uint8_t *dst, size_t width, bool bgr)
+{
+    uint16_t c[CONVERSION_BLOCK];
+    uint8_t o0 = bgr ? 2 : 0, o2 = bgr ? 0 : 2;
+
+    while (width) {
+        size_t n = (width < CONVERSION_BLOCK) ? width : CONVERSION_BLOCK;
+        for (size_t i = 0; i < n; i++, src += 2) {
+            c[i] = (src[0] << 8) | src[1];
+        }
+        for (size_t i = 0; i < n; i++, dst += 3) {
+            dst[o0] = (c[i] >> 8) & 0xF8;
+            dst[1] = (c[i] >> 3) & 0xFC;
+            dst[o2] = (c[i] << 3) & 0xF8;
+        }
+        width -= n;
+    }
+}
+
+// jpge coefficients, 16.16 fixed point
+#define YCC_YR    19595
+#define YCC_YG    38470
+#define YCC_YB    7471
+#define YCC_CB_R  -11059
+#define YCC_CB_G  -21709
+#define YCC_CB_B  32768
+#define YCC_CR_R  32768
+#define YCC_CR_G  -27439
+#define YCC_CR_B  -5329
+
+void IRAM_ATTR rgb888_to_ycc_line_ref(const uint8_t *src, uint8_t *dst, size_t width)
+{
+    for ( ; width; dst += 3, src += 3, width--) {
+        const int r = src[0], g = src[1], b = src[2];
+        dst[0] = (uint8_t)((r * YCC_YR + g * YCC_YG + b * YCC_YB + 32768) >> 16);
+        dst[1] = clamp_u8(128 + ((r * YCC_CB_R + g * YCC_CB_G + b * YCC_CB_B + 32768) >> 16));
+        dst[2] = clamp_u8(128 + ((r * YCC_CR_R + g * YCC_CR_G + b * YCC_CR_B + 32768) >> 16));
+    }
+}
+
+void IRAM_ATTR rgb888_to_ycc_line_blk(const uint8_t *src, uint8_t *dst, size_t width)
+{
+    int32_t r[CONVERSION_BLOCK], g[CONVERSION_BLOCK], b[CONVERSION_BLOCK];
+
+    while (width) {
+        size_t n = (width < CONVERSION_BLOCK) ? width : CONVERSION_BLOCK;
+        for (size_t i = 0; i < n; i++, src += 3) {
+            r[i] = src[0];
+            g[i] = src[1];
+            b[i] = src[2];
+        }
+        for (size_t i = 0; i < n; i++, dst += 3) {
+            // Y is always within 0..255, only the chroma needs clamping
+            dst[0] = (uint8_t)((r[i] * YCC_YR + g[i] * YCC_YG + b[i] * YCC_YB + 32768) >> 16);
+            dst[1] = clamp_u8(128 + ((r[i] * YCC_CB_R + g[i] * YCC_CB_G + b[i] * YCC_CB_B + 32768) >> 16));
+            dst[2] = clamp_u8(128 + ((r[i] * YCC_CR_R + g[i] * YCC_CR_G + b[i] * YCC_CR_B + 32768) >> 16));
+        }
+        width -= n;
+    }
+}
+
+#if CONFIG_CAMERA_CONVERSION_REFERENCE_KERNELS
+#define CONVERSION_KERNEL(name) name##_ref
+#else
+#define CONVERSION_KERNEL(name) name##_blk
+#endif
+
+void IRAM_ATTR yuv422_to_rgb888_line(const uint8_t *src, uint8_t *dst, size_t width, bool bgr)
+{
+    CONVERSION_KERNEL(yuv422_to_rgb888_line)(src, dst, width, bgr);
+}
+
+// The blocked RGB kernels only stage the pixels through lane buffers, without SIMD that
+// costs more than it saves (test/host_bench), so the per-pixel kernels stay the default
+void IRAM_ATTR rgb565_to_rgb888_line(const uint8_t *src, uint8_t *dst, size_t width, bool bgr)
+{
+    rgb565_to_rgb888_line_ref(src, dst, width, bgr);
+}
+
+void IRAM_ATTR rgb888_to_ycc_line(const uint8_t *src, uint8_t *dst, size_t width)
+{
+    rgb888_to_ycc_line_ref(src, dst, width);
+}
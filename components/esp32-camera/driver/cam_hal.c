@@ -374,6 +374,9 @@ esp_err_t cam_config(const camera_config_t *config, framesize_t frame_size, uint
 
     if (cam_obj->jpeg_mode) {
         cam_obj->recv_size = 1152 * 1024;   // 1152 * 1024 = 1.125MB
+        if (config->jpeg_buf_size) {
+            cam_obj->recv_size = (config->jpeg_buf_size + 1023) & ~1023;
+        }
         cam_obj->fb_size = cam_obj->recv_size;
     } else {
         cam_obj->recv_size = cam_obj->width * cam_obj->height * cam_obj->in_bytes_per_pixel;
@@ -0,0 +1,266 @@
+/*
+ * Host benchmark of the JPEG encoder: encodes the test pictures with the original DCT
+ * (DCT_ISLOW) and the AAN one (DCT_IFAST) at qualities 10-100, decodes both with libjpeg
+ * and compares their PSNR against the source, then times a 4:2:0 encode of each. Two
+ * encoders running at once on two threads must produce the output of one running alone.
+ * The pictures are cropped by a few pixels so their size is not a multiple of an MCU.
+ * The two stripes to_jpg.cpp encodes on both cores are timed in CPU time per thread,
+ * the host may not have two cores to show the wall time of the split.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <thread>
+#include <vector>
+#include <jpeglib.h>
+#include "jpge.h"
+
+#define PICTURES    "../pictures/"
+#define CROP_X      5
+#define CROP_Y      3
+#define RUNS        5
+#define PSNR_LOSS   0.3         /* dB DCT_IFAST may lose against DCT_ISLOW */
+
+static int g_failed;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            g_failed++; \
+        } \
+    } while (0)
+
+typedef std::vector<unsigned char> bytes_t;
+
+class vector_stream : public jpge::output_stream {
+public:
+    explicit vector_stream(bytes_t *out) : m_out(out) { }
+    bool put_buf(const void *buf, int len) override
+    {
+        if (buf) {
+            m_out->insert(m_out->end(), (const unsigned char *)buf, (const unsigned char *)buf + len);
+        }
+        return true;
+    }
+    jpge::uint get_size() const override { return m_out->size(); }
+private:
+    bytes_t *m_out;
+};
+
+static bool encode(const bytes_t &src, int w, int h, int quality, jpge::subsampling_t ss, jpge::dct_method_t dct,
+                   bytes_t &out)
+{
+    int channels = ss == jpge::Y_ONLY ? 1 : 3;
+    jpge::params params;
+    jpge::jpeg_encoder enc;
+    vector_stream stream(&out);
+
+    out.clear();
+    params.m_quality = quality;
+    params.m_subsampling = ss;
+    params.m_dct_method = dct;
+    if (!enc.init(&stream, w, h, channels, params)) {
+        return false;
+    }
+    for (int y = 0; y < h; y++) {
+        if (!enc.process_scanline(&src[(size_t)y * w * channels])) {
+            return false;
+        }
+    }
+    return enc.process_scanline(NULL);
+}
+
+/**
+ * @brief Encode the stripe of an image split in two at a restart marker, as to_jpg.cpp does
+ * @param stripe 0 for the stripe with the headers, 1 for the one with the EOI
+ * @param cpu_ms CPU time the stripe took on the calling thread
+ */
+static bool encode_stripe(const bytes_t &src, int w, int h, int quality, int stripe, bytes_t &out, double *cpu_ms)
+{
+    jpge::params params;
+    jpge::jpeg_encoder enc;
+    vector_stream stream(&out);
+    struct timespec t0, t1;
+
+    out.clear();
+    params.m_quality = quality;
+    params.m_subsampling = jpge::H2V2;
+    params.m_restart_rows = ((h + params.mcu_height() - 1) / params.mcu_height() + 1) / 2;
+    int split = params.m_restart_rows * params.mcu_height();
+    int first = stripe ? split : 0, lines = stripe ? h - split : split;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+    if (!enc.init_stripe(&stream, w, h, 3, params, first, lines)) {
+        return false;
+    }
+    for (int y = first; y < first + lines; y++) {
+        if (!enc.process_scanline(&src[(size_t)y * w * 3])) {
+            return false;
+        }
+    }
+    bool ok = enc.process_scanline(NULL);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+    *cpu_ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) * 1e-6;
+    return ok;
+}
+
+static bytes_t decode(const bytes_t &jpg, int channels, int *w, int *h)
+{
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr jerr;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *)jpg.data(), jpg.size());
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    cinfo.dct_method = JDCT_ISLOW;
+    jpeg_start_decompress(&cinfo);
+    *w = cinfo.output_width;
+    *h = cinfo.output_height;
+    bytes_t out((size_t)*w * *h * channels);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        unsigned char *row = &out[(size_t)cinfo.output_scanline * *w * channels];
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return out;
+}
+
+static double psnr(const bytes_t &a, const bytes_t &b)
+{
+    double sum = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        double d = (double)a[i] - b[i];
+        sum += d * d;
+    }
+    return 10 * log10(255.0 * 255.0 * a.size() / sum);
+}
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static bool load(const char *name, bytes_t &jpg)
+{
+    char path[128];
+    snprintf(path, sizeof(path), PICTURES "%s", name);
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("%s: can not open\n", path);
+        return false;
+    }
+    int c;
+    while ((c = fgetc(f)) != EOF) {
+        jpg.push_back((unsigned char)c);
+    }
+    fclose(f);
+    return true;
+}
+
+static void bench_picture(const char *name)
+{
+    bytes_t jpg;
+    int w0, h0;
+
+    if (!load(name, jpg)) {
+        g_failed++;
+        return;
+    }
+    bytes_t rgb0 = decode(jpg, 3, &w0, &h0), grey0 = decode(jpg, 1, &w0, &h0);
+    int w = w0 - CROP_X, h = h0 - CROP_Y;
+    bytes_t rgb((size_t)w * h * 3), grey((size_t)w * h);
+    for (int y = 0; y < h; y++) {
+        memcpy(&rgb[(size_t)y * w * 3], &rgb0[((size_t)(y + CROP_Y) * w0 + CROP_X) * 3], (size_t)w * 3);
+        memcpy(&grey[(size_t)y * w], &grey0[(size_t)(y + CROP_Y) * w0 + CROP_X], w);
+    }
+
+    const jpge::subsampling_t modes[] = { jpge::Y_ONLY, jpge::H1V1, jpge::H2V1, jpge::H2V2 };
+    double worst = 0;
+    for (jpge::subsampling_t ss : modes) {
+        const bytes_t &src = ss == jpge::Y_ONLY ? grey : rgb;
+        int channels = ss == jpge::Y_ONLY ? 1 : 3;
+        for (int q : { 10, 30, 50, 75, 90, 95, 100 }) {
+            bytes_t slow, fast;
+            int dw, dh;
+            CHECK(encode(src, w, h, q, ss, jpge::DCT_ISLOW, slow) && encode(src, w, h, q, ss, jpge::DCT_IFAST, fast));
+            double ps = psnr(src, decode(slow, channels, &dw, &dh));
+            double pf = psnr(src, decode(fast, channels, &dw, &dh));
+            CHECK(dw == w && dh == h);
+            CHECK(pf > ps - PSNR_LOSS);
+            worst = ps - pf > worst ? ps - pf : worst;
+            if (ss == jpge::H2V2) {
+                printf("%-18s %dx%d q%3d islow %6zu B %5.2f dB, ifast %6zu B %5.2f dB\n", name, w, h, q,
+                       slow.size(), ps, fast.size(), pf);
+            }
+        }
+    }
+
+    bytes_t out;
+    double t = now();
+    for (int i = 0; i < RUNS; i++) {
+        encode(rgb, w, h, 75, jpge::H2V2, jpge::DCT_ISLOW, out);
+    }
+    double slow_ms = (now() - t) / RUNS * 1e3;
+    t = now();
+    for (int i = 0; i < RUNS; i++) {
+        encode(rgb, w, h, 75, jpge::H2V2, jpge::DCT_IFAST, out);
+    }
+    double fast_ms = (now() - t) / RUNS * 1e3;
+    printf("%-18s q 75 4:2:0 islow %.2f ms, ifast %.2f ms (x%.2f), worst PSNR loss %.2f dB\n", name, slow_ms,
+           fast_ms, slow_ms / fast_ms, worst);
+
+    // two stripes, the second one on another thread; the critical path is the longer one
+    bytes_t single, top, bottom;
+    double single_ms = 0, top_ms = 0, bottom_ms = 0;
+    for (int i = 0; i < RUNS; i++) {
+        struct timespec t0, t1;
+        double a_ms, b_ms;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+        encode(rgb, w, h, 75, jpge::H2V2, jpge::DCT_IFAST, single);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+        single_ms += ((t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) * 1e-6) / RUNS;
+        std::thread t([&] { CHECK(encode_stripe(rgb, w, h, 75, 1, bottom, &b_ms)); });
+        CHECK(encode_stripe(rgb, w, h, 75, 0, top, &a_ms));
+        t.join();
+        top_ms += a_ms / RUNS;
+        bottom_ms += b_ms / RUNS;
+    }
+    top.insert(top.end(), bottom.begin(), bottom.end());
+    int sw, sh, dw, dh;
+    CHECK(decode(top, 3, &sw, &sh) == decode(single, 3, &dw, &dh));
+    printf("%-18s stripes %.2f + %.2f ms CPU, single %.2f ms, critical path x%.2f\n", name, top_ms, bottom_ms,
+           single_ms, single_ms / (top_ms > bottom_ms ? top_ms : bottom_ms));
+
+    // the tables are per encoder, two encoders at different qualities do not mix
+    bytes_t ref, a, b;
+    encode(rgb, w, h, 80, jpge::H2V2, jpge::DCT_IFAST, ref);
+    for (int i = 0; i < 20; i++) {
+        std::thread t1([&] { encode(rgb, w, h, 80, jpge::H2V2, jpge::DCT_IFAST, a); });
+        std::thread t2([&] {
+            bytes_t other;
+            encode(rgb, w, h, 30, jpge::H2V2, jpge::DCT_IFAST, other);
+            encode(rgb, w, h, 80, jpge::H2V2, jpge::DCT_IFAST, b);
+        });
+        t1.join();
+        t2.join();
+        CHECK(a == ref && b == ref);
+    }
+}
+
+int main(void)
+{
+    const char *pictures[] = { "testimg.jpeg", "test_inside.jpeg", "test_outside.jpeg" };
+
+    for (const char *name : pictures) {
+        bench_picture(name);
+    }
+
+    printf("%s\n", g_failed ? "FAILED" : "OK");
+    return g_failed ? 1 : 0;
+}
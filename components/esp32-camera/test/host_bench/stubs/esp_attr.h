@@ -0,0 +1,4 @@
+/* Host build of the conversions, the section attributes are placement only */
+#pragma once
+#define IRAM_ATTR
+#define DRAM_ATTR
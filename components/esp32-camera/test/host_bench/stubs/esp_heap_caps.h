@@ -0,0 +1,6 @@
+/* Host build of the conversions, there is no PSRAM to allocate from */
+#pragma once
+#include <stdlib.h>
+#define MALLOC_CAP_SPIRAM   0
+#define MALLOC_CAP_8BIT     0
+static inline void *heap_caps_malloc(size_t size, int caps) { (void)caps; return malloc(size); }
@@ -0,0 +1,2 @@
+/* Host build of the conversions, the default configuration: blocked kernels, no PSRAM */
+#pragma once
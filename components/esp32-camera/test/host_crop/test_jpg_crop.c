@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jpeglib.h>
+#include "jpg_crop.h"
+
+#define PICTURES        "../pictures/"
+
+static int s_failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            s_failures++; \
+        } \
+    } while (0)
+
+typedef struct {
+    int w, h;
+    int components;             // 1 grayscale, 3 YCbCr
+    int h_samp, v_samp;         // Luma sampling factors
+    int restart_rows;           // MCU rows per restart interval, 0 for none
+} enc_case_t;
+
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t *buf = NULL;
+
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(*len);
+    if (buf && fread(buf, 1, *len, f) != *len) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+/* Encode a textured test image, libjpeg writes the restart markers and the subsampling asked for */
+static uint8_t *encode(const enc_case_t *c, size_t *len)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned char *out = NULL;
+    unsigned long out_len = 0;
+    uint8_t *row = malloc(c->w * c->components);
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &out, &out_len);
+    cinfo.image_width = c->w;
+    cinfo.image_height = c->h;
+    cinfo.input_components = c->components;
+    cinfo.in_color_space = c->components == 3 ? JCS_RGB : JCS_GRAYSCALE;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 85, TRUE);
+    if (c->components == 3) {
+        cinfo.comp_info[0].h_samp_factor = c->h_samp;
+        cinfo.comp_info[0].v_samp_factor = c->v_samp;
+    }
+    cinfo.restart_in_rows = c->restart_rows;
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        int y = cinfo.next_scanline;
+        for (int x = 0; x < c->w; x++) {
+            for (int k = 0; k < c->components; k++) {
+                row[x * c->components + k] = (x * 7 + y * 3 + k * 50 + ((x * y) % 97) * 2) & 255;
+            }
+        }
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+    *len = out_len;
+    return out;
+}
+
+/* Decode without fancy upsampling, so the pixels of a block only depend on the block */
+static uint8_t *decode(const uint8_t *buf, size_t len, int *w, int *h, int *n)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    uint8_t *out;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, buf, len);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.do_fancy_upsampling = FALSE;
+    cinfo.dct_method = JDCT_ISLOW;
+    jpeg_start_decompress(&cinfo);
+    *w = cinfo.output_width;
+    *h = cinfo.output_height;
+    *n = cinfo.output_components;
+    out = malloc((size_t)*w * *h * *n);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        uint8_t *row = out + (size_t)cinfo.output_scanline * *w * *n;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return out;
+}
+
+/* Crop rectangles, a crop must decode to the same region of the full decode */
+static void check_crops(const char *name, const uint8_t *jpg, size_t len)
+{
+    const jpg_crop_rect_t rects[] = {
+        { 0, 0, 10000, 10000 },     // whole frame
+        { 13, 21, 100, 50 },        // unaligned
+        { 50, 40, 1, 1 },           // a single pixel, one MCU
+        { 100, 64, 2000, 2000 },    // past the right and bottom edges
+        { 0, 100, 40, 30 },         // left edge
+    };
+    int fw, fh, fn;
+    uint8_t *full = decode(jpg, len, &fw, &fh, &fn);
+
+    for (size_t i = 0; i < sizeof(rects) / sizeof(rects[0]); i++) {
+        jpg_crop_rect_t r = rects[i];
+        uint8_t *out = NULL;
+        size_t out_len = 0;
+        int w, h, n;
+
+        if (r.x >= fw || r.y >= fh) {
+            continue;
+        }
+        if (!jpg_crop_buf(jpg, len, &r, &out, &out_len)) {
+            printf("%s rect %zu: crop failed\n", name, i);
+            s_failures++;
+            continue;
+        }
+        CHECK(r.x + r.w <= fw && r.y + r.h <= fh);
+        uint8_t *crop = decode(out, out_len, &w, &h, &n);
+        CHECK(w == r.w && h == r.h && n == fn);
+        bool same = w == r.w && h == r.h;
+        for (int y = 0; same && y < h; y++) {
+            same = memcmp(crop + (size_t)y * w * n, full + ((size_t)(y + r.y) * fw + r.x) * fn, (size_t)w * n) == 0;
+        }
+        CHECK(same);
+        printf("%-24s %4dx%-4d at %4d,%-4d %7zu of %7zu bytes %s\n", name, r.w, r.h, r.x, r.y, out_len, len,
+               same ? "ok" : "MISMATCH");
+        free(crop);
+        free(out);
+    }
+    free(full);
+}
+
+int main(void)
+{
+    const enc_case_t cases[] = {
+        { 227, 149, 3, 2, 2, 0 },
+        { 227, 149, 3, 2, 2, 3 },
+        { 640, 480, 3, 2, 1, 0 },
+        { 640, 480, 3, 1, 1, 5 },
+        { 301, 203, 1, 1, 1, 0 },
+        { 301, 203, 1, 1, 1, 7 },
+        { 1600, 1200, 3, 2, 2, 1 },
+    };
+    const char *pictures[] = { "testimg.jpeg", "test_inside.jpeg", "test_outside.jpeg" };
+    char name[64];
+    size_t len;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const enc_case_t *c = &cases[i];
+        uint8_t *jpg = encode(c, &len);
+        snprintf(name, sizeof(name), "%dx%d %s dri %d", c->w, c->h,
+                 c->components == 1 ? "gray" : c->v_samp == 2 ? "4:2:0" : c->h_samp == 2 ? "4:2:2" : "4:4:4",
+                 c->restart_rows);
+        check_crops(name, jpg, len);
+        free(jpg);
+    }
+    for (size_t i = 0; i < sizeof(pictures) / sizeof(pictures[0]); i++) {
+        snprintf(name, sizeof(name), PICTURES "%s", pictures[i]);
+        uint8_t *jpg = read_file(name, &len);
+        CHECK(jpg != NULL);
+        if (jpg) {
+            check_crops(pictures[i], jpg, len);
+            free(jpg);
+        }
+    }
+
+    // broken input is rejected, not read past
+    enc_case_t small = { 64, 64, 3, 2, 2, 0 };
+    uint8_t *jpg = encode(&small, &len);
+    jpg_crop_rect_t r = { 0, 0, 64, 64 };
+    uint8_t *out = NULL;
+    size_t out_len;
+    CHECK(!jpg_crop_buf(jpg, len / 2, &r, &out, &out_len));
+    CHECK(!jpg_crop_buf(jpg, 100, &r, &out, &out_len));
+    CHECK(!jpg_crop_buf(jpg, 0, &r, &out, &out_len));
+    memset(jpg + len / 2, 0xff, 16);
+    r = (jpg_crop_rect_t){ 0, 0, 64, 64 };
+    if (jpg_crop_buf(jpg, len, &r, &out, &out_len)) {
+        free(out);      // a marker in the entropy data ends the scan early, any output is acceptable
+    }
+    r = (jpg_crop_rect_t){ 0, 0, 0, 0 };
+    CHECK(!jpg_crop_buf(jpg, len, &r, &out, &out_len));
+    free(jpg);
+
+    printf("JPG_CROP_TEST %s\n", s_failures ? "FAIL" : "PASS");
+    return s_failures ? 1 : 0;
+}
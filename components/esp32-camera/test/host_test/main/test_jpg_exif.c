@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jpg_exif.h"
+
+#define TEST_SRC        "../pictures/testimg.jpeg"
+#define TEST_OUT        "exif_out.jpg"
+#define TEST_REPLACE    "exif_replace.jpg"
+
+static int s_failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            s_failures++; \
+        } \
+    } while (0)
+
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t *buf = NULL;
+
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(*len);
+    if (buf && fread(buf, 1, *len, f) != *len) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+/* Write the parts of a JPEG with fwrite like storage_write_file() */
+static void write_parts(const char *path, const jpg_exif_part_t *parts, int count)
+{
+    FILE *f = fopen(path, "wb");
+    CHECK(f != NULL);
+    for (int i = 0; f && i < count; i++) {
+        CHECK(fwrite(parts[i].buf, parts[i].len, 1, f) == 1);
+    }
+    if (f) {
+        fclose(f);
+    }
+}
+
+static int count_app1(const uint8_t *jpg, size_t len)
+{
+    int count = 0;
+    size_t i = 2;
+
+    while (i + 4 <= len && jpg[i] == 0xFF && jpg[i + 1] != 0xDA) {
+        if (jpg[i + 1] == 0xE1) {
+            count++;
+        }
+        i += 2 + ((jpg[i + 2] << 8) | jpg[i + 3]);
+    }
+    return count;
+}
+
+static jpg_exif_t test_exif(const char *description, const char *serial)
+{
+    jpg_exif_t exif = {
+        .make = "CamThink",
+        .model = "NE101",
+        .software = "1.2.3",
+        .serial = serial,
+        .description = description,
+        .comment = "battery=87%;voltage=3950mV",
+        .subsec_ms = 42,
+    };
+    exif.time.tm_year = 2024 - 1900;
+    exif.time.tm_mon = 2;
+    exif.time.tm_mday = 9;
+    exif.time.tm_hour = 13;
+    exif.time.tm_min = 5;
+    exif.time.tm_sec = 7;
+    return exif;
+}
+
+static void test_prefix_length(void)
+{
+    char serial[65];
+    uint8_t buf[JPG_EXIF_PREFIX_MAX];
+
+    // any string length keeps the prefix base64 aligned and within the maximum
+    for (int i = 0; i < 64; i++) {
+        memset(serial, 'A' + i % 26, i);
+        serial[i] = 0;
+        jpg_exif_t exif = test_exif(serial, serial);
+        exif.make = exif.model = exif.software = serial;
+        size_t len = jpg_exif_build(&exif, buf, sizeof(buf));
+        CHECK(len > 0);
+        CHECK(len % 3 == 0);
+        CHECK(buf[0] == 0xFF && buf[1] == 0xD8 && buf[2] == 0xFF && buf[3] == 0xE1);
+        CHECK((size_t)((buf[4] << 8) | buf[5]) == len - 4);
+    }
+    jpg_exif_t exif = test_exif("Timer", "SN0001");
+    CHECK(jpg_exif_build(&exif, buf, 64) == 0);
+}
+
+static void test_parts(const uint8_t *jpg, size_t len)
+{
+    uint8_t prefix[JPG_EXIF_PREFIX_MAX];
+    jpg_exif_part_t parts[2];
+    jpg_exif_t exif = test_exif("Timer", "SN0001");
+    size_t prefix_len = jpg_exif_build(&exif, prefix, sizeof(prefix));
+
+    // no prefix: the JPEG as is
+    CHECK(jpg_exif_parts(NULL, 0, jpg, len, parts) == 1);
+    CHECK(parts[0].buf == jpg && parts[0].len == len);
+
+    // the frame is referenced, not copied
+    CHECK(jpg_exif_parts(prefix, prefix_len, jpg, len, parts) == 2);
+    CHECK(parts[0].buf == prefix && parts[0].len == prefix_len);
+    CHECK(parts[1].buf == jpg + 2 && parts[1].len == len - 2);
+    write_parts(TEST_OUT, parts, 2);
+
+    // chunks read across the parts rebuild the file
+    size_t total = parts[0].len + parts[1].len;
+    uint8_t *joined = malloc(total);
+    CHECK(joined != NULL);
+    memcpy(joined, parts[0].buf, parts[0].len);
+    memcpy(joined + parts[0].len, parts[1].buf, parts[1].len);
+    for (size_t chunk = 1; joined && chunk < 4096; chunk = chunk * 3 + 1) {
+        size_t offset = 0;
+        const uint8_t *data;
+        while (offset < total) {
+            size_t n = jpg_exif_parts_at(parts, 2, offset, &data);
+            n = n < chunk ? n : chunk;
+            CHECK(n > 0);
+            if (n == 0 || memcmp(data, joined + offset, n)) {
+                CHECK(!"chunk mismatch");
+                break;
+            }
+            offset += n;
+        }
+        CHECK(jpg_exif_parts_at(parts, 2, total, &data) == 0);
+    }
+
+    // an EXIF segment already in the JPEG is replaced
+    size_t out_len = 0;
+    uint8_t *out = read_file(TEST_OUT, &out_len);
+    CHECK(out != NULL && out_len == total);
+    if (out) {
+        CHECK(memcmp(out, joined, total) == 0);
+        jpg_exif_t replace = test_exif("Button", "SN0002");
+        prefix_len = jpg_exif_build(&replace, prefix, sizeof(prefix));
+        CHECK(jpg_exif_parts(prefix, prefix_len, out, out_len, parts) == 2);
+        CHECK(parts[1].buf == out + total - (len - 2)); // right after the old APP1
+        write_parts(TEST_REPLACE, parts, 2);
+        free(out);
+        out = read_file(TEST_REPLACE, &out_len);
+        CHECK(out != NULL && out_len == prefix_len + len - 2);
+        CHECK(out && count_app1(out, out_len) == 1);
+        free(out);
+    }
+    free(joined);
+}
+
+void app_main(void)
+{
+    size_t len = 0;
+    uint8_t *jpg = read_file(TEST_SRC, &len);
+
+    CHECK(jpg != NULL);
+    test_prefix_length();
+    if (jpg) {
+        test_parts(jpg, len);
+        free(jpg);
+    }
+    printf("JPG_EXIF_TEST %s, %d failures\n", s_failures ? "FAIL" : "PASS", s_failures);
+    exit(s_failures ? 1 : 0);
+}
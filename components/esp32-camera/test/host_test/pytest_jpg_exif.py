@@ -0,0 +1,49 @@
+# SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+# SPDX-License-Identifier: Apache-2.0
+import pathlib
+import subprocess
+
+import exifread
+import pytest
+from PIL import Image
+
+HOST_TEST_DIR = pathlib.Path(__file__).parent
+
+
+def read_exif(path: pathlib.Path) -> dict:
+    with path.open('rb') as f:
+        return exifread.process_file(f, details=False)
+
+
+@pytest.mark.linux
+@pytest.mark.host_test
+def test_jpg_exif() -> None:
+    elf = HOST_TEST_DIR / 'build' / 'host_jpg_exif_test.elf'
+    res = subprocess.run([str(elf)], cwd=HOST_TEST_DIR, capture_output=True, text=True, timeout=60)
+    assert res.returncode == 0, res.stdout
+    assert 'JPG_EXIF_TEST PASS' in res.stdout
+
+    for name, description, serial in (('exif_out.jpg', 'Timer', 'SN0001'), ('exif_replace.jpg', 'Button', 'SN0002')):
+        path = HOST_TEST_DIR / name
+
+        # the image still decodes with the prefix in front of it
+        with Image.open(path) as img:
+            img.load()
+            assert img.size == (227, 149)
+            exif = img.getexif()
+            assert exif[0x010E] == description
+            assert exif[0x010F] == 'CamThink'
+            assert exif[0x0110] == 'NE101'
+            assert exif[0x0131] == '1.2.3'
+            assert exif[0x0132] == '2024:03:09 13:05:07'
+            sub = exif.get_ifd(0x8769)
+            assert sub[0x9003] == '2024:03:09 13:05:07'
+            assert sub[0x9291] == '042'
+            assert sub[0xA431] == serial
+
+        tags = read_exif(path)
+        assert str(tags['Image Make']) == 'CamThink'
+        assert str(tags['EXIF DateTimeOriginal']) == '2024:03:09 13:05:07'
+        assert str(tags['EXIF ExifVersion']) == '0232'
+        assert str(tags['EXIF BodySerialNumber']) == serial
+        assert 'battery=87%' in str(tags['EXIF UserComment'])
@@ -1,5 +1,6 @@
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -9,6 +10,8 @@
 #include "driver/i2c.h"
 
 #include "esp_camera.h"
+#include "img_converters.h"
+#include "yuv.h"
 
 #ifdef CONFIG_IDF_TARGET_ESP32
 #define BOARD_WROVER_KIT 1
@@ -533,3 +536,206 @@ TEST_CASE("Camera driver uses an i2c port initialized by other devices test", "[
     TEST_ESP_OK(esp_camera_deinit());
     TEST_ESP_OK(i2c_driver_delete(I2C_MASTER_NUM));
 }
+
+typedef struct {
+    const uint8_t *buf;
+    uint32_t length;
+    uint16_t w, h;
+} sharpness_img_t;
+
+static sharpness_img_t get_sharpness_img(uint16_t pic_index)
+{
+    extern const uint8_t img1_start[] asm("_binary_testimg_jpeg_start");
+    extern const uint8_t img1_end[]   asm("_binary_testimg_jpeg_end");
+    extern const uint8_t img2_start[] asm("_binary_test_inside_jpeg_start");
+    extern const uint8_t img2_end[]   asm("_binary_test_inside_jpeg_end");
+    extern const uint8_t img3_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img3_end[]   asm("_binary_test_outside_jpeg_end");
+
+    sharpness_img_t imgs[3] = {
+        {img1_start, img1_end - img1_start, 227, 149},
+        {img2_start, img2_end - img2_start, 320, 240},
+        {img3_start, img3_end - img3_start, 480, 320},
+    };
+    return imgs[pic_index];
+}
+
+/* 3x3 box blur in place, stands in for motion blur */
+static void box_blur_rgb888(uint8_t *rgb, uint16_t w, uint16_t h)
+{
+    uint8_t *src = heap_caps_malloc(w * h * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(src);
+    memcpy(src, rgb, w * h * 3);
+    for (int y = 1; y < h - 1; y++) {
+        for (int x = 1; x < w - 1; x++) {
+            for (int c = 0; c < 3; c++) {
+                int sum = 0;
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        sum += src[((y + dy) * w + (x + dx)) * 3 + c];
+                    }
+                }
+                rgb[(y * w + x) * 3 + c] = sum / 9;
+            }
+        }
+    }
+    heap_caps_free(src);
+}
+
+static void img_sharpness_blur_test(uint16_t pic_index)
+{
+    sharpness_img_t img = get_sharpness_img(pic_index);
+    uint8_t *rgb = heap_caps_malloc(img.w * img.h * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *sharp_jpg = NULL, *blur_jpg = NULL;
+    size_t sharp_len = 0, blur_len = 0;
+    float sharp = 0, blur = 0;
+
+    TEST_ASSERT_NOT_NULL(rgb);
+    TEST_ASSERT_TRUE(fmt2rgb888(img.buf, img.length, PIXFORMAT_JPEG, rgb));
+    /* re-encode both versions at the same quality so only the blur differs */
+    TEST_ASSERT_TRUE(fmt2jpg(rgb, img.w * img.h * 3, img.w, img.h, PIXFORMAT_RGB888, 90, &sharp_jpg, &sharp_len));
+    box_blur_rgb888(rgb, img.w, img.h);
+    TEST_ASSERT_TRUE(fmt2jpg(rgb, img.w * img.h * 3, img.w, img.h, PIXFORMAT_RGB888, 90, &blur_jpg, &blur_len));
+
+    for (jpg_scale_t scale = JPG_SCALE_NONE; scale <= JPG_SCALE_2X; scale++) {
+        TEST_ASSERT_TRUE(jpg_sharpness(sharp_jpg, sharp_len, scale, &sharp));
+        TEST_ASSERT_TRUE(jpg_sharpness(blur_jpg, blur_len, scale, &blur));
+        printf("%4d x %4d , scale %d , sharp %8.1f , blurred %8.1f\n", img.w, img.h, scale, sharp, blur);
+        TEST_ASSERT_GREATER_THAN(0, (int)sharp);
+        TEST_ASSERT_TRUE(blur < sharp);
+    }
+
+    free(sharp_jpg);
+    free(blur_jpg);
+    heap_caps_free(rgb);
+}
+
+static void img_sharpness_perf_test(uint16_t pic_index, uint32_t times)
+{
+    sharpness_img_t img = get_sharpness_img(pic_index);
+    float score = 0;
+
+    printf("resolution  , scale ,  t \n");
+    for (jpg_scale_t scale = JPG_SCALE_NONE; scale <= JPG_SCALE_MAX; scale++) {
+        uint64_t t_total = 0;
+        for (size_t i = 0; i < times; i++) {
+            uint64_t t1 = esp_timer_get_time();
+            TEST_ASSERT_TRUE(jpg_sharpness(img.buf, img.length, scale, &score));
+            t_total += esp_timer_get_time() - t1;
+        }
+        printf("%4d x %4d , %5d , %5.2f ms \n", img.w, img.h, scale, t_total / 1000.0f / times);
+    }
+}
+
+TEST_CASE("Conversions jpeg sharpness ranks blurred images lower test", "[camera]")
+{
+    for (uint16_t i = 0; i < 3; i++) {
+        img_sharpness_blur_test(i);
+    }
+}
+
+TEST_CASE("Conversions jpeg sharpness performance test", "[camera]")
+{
+    for (uint16_t i = 0; i < 3; i++) {
+        img_sharpness_perf_test(i, 16);
+    }
+}
+
+typedef void (*line_kernel_t)(const uint8_t *src, uint8_t *dst, size_t width, bool bgr);
+
+static void ycc_kernel_ref(const uint8_t *src, uint8_t *dst, size_t width, bool bgr)
+{
+    rgb888_to_ycc_line_ref(src, dst, width);
+}
+
+static void ycc_kernel_blk(const uint8_t *src, uint8_t *dst, size_t width, bool bgr)
+{
+    rgb888_to_ycc_line_blk(src, dst, width);
+}
+
+typedef struct {
+    const char *name;
+    line_kernel_t ref;
+    line_kernel_t blk;
+} line_kernel_pair_t;
+
+static const line_kernel_pair_t g_line_kernels[] = {
+    {"yuv422->rgb888", yuv422_to_rgb888_line_ref, yuv422_to_rgb888_line_blk},
+    {"rgb565->rgb888", rgb565_to_rgb888_line_ref, rgb565_to_rgb888_line_blk},
+    {"rgb888->ycc", ycc_kernel_ref, ycc_kernel_blk},
+};
+
+TEST_CASE("Conversions line kernels are bit-exact test", "[camera]")
+{
+    const size_t max_w = 640;
+    uint8_t *src = malloc(max_w * 3);
+    uint8_t *ref = malloc(max_w * 3);
+    uint8_t *blk = malloc(max_w * 3);
+    TEST_ASSERT_NOT_NULL(src);
+    TEST_ASSERT_NOT_NULL(ref);
+    TEST_ASSERT_NOT_NULL(blk);
+
+    for (size_t k = 0; k < sizeof(g_line_kernels) / sizeof(g_line_kernels[0]); k++) {
+        for (int it = 0; it < 256; it++) {
+            for (size_t i = 0; i < max_w * 3; i++) {
+                src[i] = it == 0 ? i : rand();
+            }
+            /* every block remainder, both byte orders */
+            for (size_t w = 2; w <= 2 * CONVERSION_BLOCK + 2; w += 2) {
+                g_line_kernels[k].ref(src, ref, w, it & 1);
+                g_line_kernels[k].blk(src, blk, w, it & 1);
+                TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(ref, blk, w * 3, g_line_kernels[k].name);
+            }
+            g_line_kernels[k].ref(src, ref, max_w, it & 1);
+            g_line_kernels[k].blk(src, blk, max_w, it & 1);
+            TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(ref, blk, max_w * 3, g_line_kernels[k].name);
+        }
+    }
+    /* all Y/U/V combinations of the table driven kernel */
+    for (int u = 0; u < 256; u++) {
+        for (int v = 0; v < 256; v++) {
+            for (int y = 0; y < 256; y += 2) {
+                src[y * 2] = y;
+                src[y * 2 + 1] = u;
+                src[y * 2 + 2] = y + 1;
+                src[y * 2 + 3] = v;
+            }
+            yuv422_to_rgb888_line_ref(src, ref, 256, false);
+            yuv422_to_rgb888_line_blk(src, blk, 256, false);
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(ref, blk, 256 * 3);
+        }
+    }
+
+    free(src);
+    free(ref);
+    free(blk);
+}
+
+TEST_CASE("Conversions line kernels performance test", "[camera]")
+{
+    const size_t w = 640, lines = 480;
+    uint8_t *src = heap_caps_malloc(w * 3, MALLOC_CAP_INTERNAL);
+    uint8_t *dst = heap_caps_malloc(w * 3, MALLOC_CAP_INTERNAL);
+    TEST_ASSERT_NOT_NULL(src);
+    TEST_ASSERT_NOT_NULL(dst);
+    for (size_t i = 0; i < w * 3; i++) {
+        src[i] = rand();
+    }
+
+    printf("kernel          ,   reference ,     blocked \n");
+    for (size_t k = 0; k < sizeof(g_line_kernels) / sizeof(g_line_kernels[0]); k++) {
+        float mpps[2];
+        line_kernel_t kernels[2] = {g_line_kernels[k].ref, g_line_kernels[k].blk};
+        for (int j = 0; j < 2; j++) {
+            uint64_t t1 = esp_timer_get_time();
+            for (size_t l = 0; l < lines; l++) {
+                kernels[j](src, dst, w, false);
+            }
+            mpps[j] = (float)(w * lines) / (esp_timer_get_time() - t1);
+        }
+        printf("%-15s , %6.2f Mpx/s , %6.2f Mpx/s \n", g_line_kernels[k].name, mpps[0], mpps[1]);
+    }
+
+    heap_caps_free(src);
+    heap_caps_free(dst);
+}
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "unity.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+#include "img_converters.h"
+#include "esp_jpg_decode.h"
+#include "jpge.h"
+#include "jpg_crop.h"
+
+static const char *TAG = "test jpge";
+
+typedef struct {
+    const uint8_t *buf;
+    uint32_t length;
+    uint16_t w, h;
+} jpge_img_t;
+
+/* Source pictures are cropped by this offset so their blocks do not line up with the ones they were coded with */
+#define JPGE_CROP_X     5
+#define JPGE_CROP_Y     3
+#define JPGE_OUT_MAX    (256 * 1024)
+
+static jpge_img_t get_jpge_img(uint16_t pic_index)
+{
+    extern const uint8_t img1_start[] asm("_binary_testimg_jpeg_start");
+    extern const uint8_t img1_end[]   asm("_binary_testimg_jpeg_end");
+    extern const uint8_t img2_start[] asm("_binary_test_inside_jpeg_start");
+    extern const uint8_t img2_end[]   asm("_binary_test_inside_jpeg_end");
+    extern const uint8_t img3_start[] asm("_binary_test_outside_jpeg_start");
+    extern const uint8_t img3_end[]   asm("_binary_test_outside_jpeg_end");
+
+    jpge_img_t imgs[3] = {
+        {img1_start, (uint32_t)(img1_end - img1_start), 227, 149},
+        {img2_start, (uint32_t)(img2_end - img2_start), 320, 240},
+        {img3_start, (uint32_t)(img3_end - img3_start), 480, 320},
+    };
+    return imgs[pic_index];
+}
+
+class buffer_stream : public jpge::output_stream {
+public:
+    uint8_t *buf;
+    size_t len;
+
+    buffer_stream() : buf((uint8_t *)heap_caps_malloc(JPGE_OUT_MAX, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)), len(0) { }
+    virtual ~buffer_stream() { heap_caps_free(buf); }
+    virtual bool put_buf(const void *data, int size)
+    {
+        if (!data) {
+            return true;
+        }
+        if (len + size > JPGE_OUT_MAX) {
+            return false;
+        }
+        memcpy(buf + len, data, size);
+        len += size;
+        return true;
+    }
+    virtual size_t get_size() const
+    {
+        return len;
+    }
+};
+
+/* Decode a picture to BGR888 and crop it, returns the crop size in w/h */
+static uint8_t *load_cropped_bgr(uint16_t pic_index, uint16_t *w, uint16_t *h)
+{
+    jpge_img_t img = get_jpge_img(pic_index);
+    uint8_t *full = (uint8_t *)heap_caps_malloc(img.w * img.h * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(full);
+    TEST_ASSERT_TRUE(fmt2rgb888(img.buf, img.length, PIXFORMAT_JPEG, full));
+
+    *w = img.w - JPGE_CROP_X;
+    *h = img.h - JPGE_CROP_Y;
+    uint8_t *crop = (uint8_t *)heap_caps_malloc(*w * *h * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(crop);
+    for (int y = 0; y < *h; y++) {
+        memcpy(crop + y * *w * 3, full + ((y + JPGE_CROP_Y) * img.w + JPGE_CROP_X) * 3, *w * 3);
+    }
+    heap_caps_free(full);
+    return crop;
+}
+
+/* Encode a BGR888 image with the given DCT */
+static bool jpge_encode(const uint8_t *bgr, uint16_t w, uint16_t h, int quality, jpge::dct_method_t dct, buffer_stream *out)
+{
+    jpge::params comp_params;
+    jpge::jpeg_encoder encoder;
+    uint8_t *line = (uint8_t *)malloc(w * 3);
+    bool ret = line != NULL;
+
+    comp_params.m_quality = quality;
+    comp_params.m_dct_method = dct;
+    out->len = 0;
+    ret = ret && encoder.init(out, w, h, 3, comp_params);
+    for (int y = 0; ret && y < h; y++) {
+        const uint8_t *src = bgr + y * w * 3;
+        for (int x = 0; x < w * 3; x += 3) {
+            line[x] = src[x + 2];
+            line[x + 1] = src[x + 1];
+            line[x + 2] = src[x];
+        }
+        ret = encoder.process_scanline(line);
+    }
+    ret = ret && encoder.process_scanline(NULL);
+    free(line);
+    return ret;
+}
+
+static float bgr_psnr(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    uint64_t sse = 0;
+    for (size_t i = 0; i < len; i++) {
+        int d = a[i] - b[i];
+        sse += d * d;
+    }
+    if (sse == 0) {
+        return 99.0f;
+    }
+    return 10.0f * log10f(255.0f * 255.0f * len / sse);
+}
+
+static void jpge_psnr_parity_test(uint16_t pic_index)
+{
+    const int qualities[] = {10, 30, 50, 75, 90, 95};
+    const jpge::dct_method_t dcts[2] = {jpge::DCT_ISLOW, jpge::DCT_IFAST};
+    uint16_t w, h;
+    uint8_t *src = load_cropped_bgr(pic_index, &w, &h);
+    uint8_t *dec = (uint8_t *)heap_caps_malloc(w * h * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    buffer_stream out;
+    TEST_ASSERT_NOT_NULL(dec);
+    TEST_ASSERT_NOT_NULL(out.buf);
+
+    printf("resolution  , quality ,  islow size , islow psnr ,  ifast size , ifast psnr \n");
+    for (size_t q = 0; q < sizeof(qualities) / sizeof(qualities[0]); q++) {
+        size_t size[2];
+        float psnr[2];
+        for (int d = 0; d < 2; d++) {
+            TEST_ASSERT_TRUE(jpge_encode(src, w, h, qualities[q], dcts[d], &out));
+            TEST_ASSERT_TRUE(fmt2rgb888(out.buf, out.len, PIXFORMAT_JPEG, dec));
+            size[d] = out.len;
+            psnr[d] = bgr_psnr(src, dec, w * h * 3);
+        }
+        printf("%4d x %4d , %7d , %9u B , %7.2f dB , %9u B , %7.2f dB \n", w, h, qualities[q], size[0], psnr[0], size[1], psnr[1]);
+        TEST_ASSERT_TRUE(psnr[1] > psnr[0] - 0.25f);
+        TEST_ASSERT_TRUE(size[1] < size[0] * 103 / 100);
+    }
+
+    heap_caps_free(src);
+    heap_caps_free(dec);
+}
+
+static void jpge_perf_test(uint16_t pic_index, uint32_t times)
+{
+    const jpge::dct_method_t dcts[2] = {jpge::DCT_ISLOW, jpge::DCT_IFAST};
+    uint16_t w, h;
+    uint8_t *src = load_cropped_bgr(pic_index, &w, &h);
+    buffer_stream out;
+    float ms[2];
+    TEST_ASSERT_NOT_NULL(out.buf);
+
+    for (int d = 0; d < 2; d++) {
+        uint64_t t1 = esp_timer_get_time();
+        for (size_t i = 0; i < times; i++) {
+            TEST_ASSERT_TRUE(jpge_encode(src, w, h, 75, dcts[d], &out));
+        }
+        ms[d] = (esp_timer_get_time() - t1) / 1000.0f / times;
+    }
+    printf("%4d x %4d , %8.2f ms , %8.2f ms \n", w, h, ms[0], ms[1]);
+    heap_caps_free(src);
+}
+
+TEST_CASE("Conversions jpeg encoder fast DCT keeps PSNR parity test", "[camera]")
+{
+    for (uint16_t i = 0; i < 3; i++) {
+        jpge_psnr_parity_test(i);
+    }
+}
+
+TEST_CASE("Conversions jpeg encoder performance test", "[camera]")
+{
+    printf("resolution  ,       islow ,       ifast \n");
+    for (uint16_t i = 0; i < 3; i++) {
+        jpge_perf_test(i, 16);
+    }
+}
+
+typedef struct {
+    const uint8_t *src;
+    uint16_t w, h;
+    int quality;
+    const buffer_stream *ref;
+    int mismatches;
+    SemaphoreHandle_t done;
+} jpge_core_arg_t;
+
+static void jpge_core_task(void *arg)
+{
+    jpge_core_arg_t *a = (jpge_core_arg_t *)arg;
+    buffer_stream *out = new buffer_stream();
+
+    for (int i = 0; i < 8; i++) {
+        if (!out->buf || !jpge_encode(a->src, a->w, a->h, a->quality, jpge::DCT_IFAST, out) ||
+                out->len != a->ref->len || memcmp(out->buf, a->ref->buf, out->len) != 0) {
+            a->mismatches++;
+        }
+    }
+    delete out;
+    xSemaphoreGive(a->done);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("Conversions jpeg encoders run concurrently on both cores test", "[camera]")
+{
+    uint16_t w, h;
+    uint8_t *src = load_cropped_bgr(2, &w, &h);
+    buffer_stream ref[2];
+    jpge_core_arg_t args[2];
+
+    for (int c = 0; c < 2; c++) {
+        /* different qualities, shared tables would show up as a mismatch */
+        TEST_ASSERT_TRUE(jpge_encode(src, w, h, c ? 30 : 90, jpge::DCT_IFAST, &ref[c]));
+        args[c] = {src, w, h, c ? 30 : 90, &ref[c], 0, xSemaphoreCreateBinary()};
+        TEST_ASSERT_NOT_NULL(args[c].done);
+    }
+    for (int c = 0; c < 2; c++) {
+        TEST_ASSERT_EQUAL(pdPASS, xTaskCreatePinnedToCore(jpge_core_task, "jpge", 4096, &args[c], 5, NULL, c));
+    }
+    for (int c = 0; c < 2; c++) {
+        TEST_ASSERT_TRUE(xSemaphoreTake(args[c].done, pdMS_TO_TICKS(30000)));
+        vSemaphoreDelete(args[c].done);
+        ESP_LOGI(TAG, "core %d: %d mismatches", c, args[c].mismatches);
+        TEST_ASSERT_EQUAL(0, args[c].mismatches);
+    }
+    heap_caps_free(src);
+}
+
+static size_t jpge_stream_cb(void *arg, size_t index, const void *data, size_t len)
+{
+    buffer_stream *out = (buffer_stream *)arg;
+    return out->put_buf(data, len) ? len : 0;
+}
+
+TEST_CASE("Conversions jpeg stream encodes bands like fmt2jpg test", "[camera]")
+{
+    uint16_t w, h;
+    uint8_t *src = load_cropped_bgr(1, &w, &h);
+    buffer_stream whole, bands;
+
+    TEST_ASSERT_TRUE(fmt2jpg_cb(src, w * h * 3, w, h, PIXFORMAT_RGB888, 80, jpge_stream_cb, &whole));
+
+    jpg_stream_t *stream = jpg_stream_begin(w, h, PIXFORMAT_RGB888, 80, jpge_stream_cb, &bands);
+    TEST_ASSERT_NOT_NULL(stream);
+    for (uint16_t y = 0; y < h;) {
+        uint16_t n = 1 + rand() % 24;
+        if (y + n > h) {
+            n = h - y;
+        }
+        TEST_ASSERT_TRUE(jpg_stream_write(stream, src + y * w * 3, n));
+        y += n;
+    }
+    TEST_ASSERT_FALSE(jpg_stream_write(stream, src, 1));
+    TEST_ASSERT_TRUE(jpg_stream_end(stream));
+
+    TEST_ASSERT_EQUAL(whole.len, bands.len);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(whole.buf, bands.buf, whole.len);
+    heap_caps_free(src);
+}
+
+typedef struct {
+    const uint8_t *src;
+    uint8_t *out;
+    uint16_t w, h;
+} jpge_dec_t;
+
+static size_t jpge_dec_read(void *arg, size_t index, uint8_t *buf, size_t len)
+{
+    jpge_dec_t *d = (jpge_dec_t *)arg;
+    if (buf) {
+        memcpy(buf, d->src + index, len);
+    }
+    return len;
+}
+
+static bool jpge_dec_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    jpge_dec_t *d = (jpge_dec_t *)arg;
+    if (!data) {
+        if (x == 0 && y == 0) {
+            d->w = w;
+            d->h = h;
+        }
+        return true;
+    }
+    for (int iy = 0; iy < h; iy++) {
+        memcpy(d->out + ((y + iy) * d->w + x) * 3, data + iy * w * 3, w * 3);
+    }
+    return true;
+}
+
+TEST_CASE("Conversions jpeg sliced decode matches single core decode test", "[camera]")
+{
+    uint16_t w, h;
+    uint8_t *src = load_cropped_bgr(2, &w, &h);
+    buffer_stream jpg;
+    jpge_dec_t single = {jpg.buf, (uint8_t *)heap_caps_malloc(w * h * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT), 0, 0};
+    jpge_dec_t sliced = {jpg.buf, (uint8_t *)heap_caps_malloc(w * h * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT), 0, 0};
+    TEST_ASSERT_NOT_NULL(single.out);
+    TEST_ASSERT_NOT_NULL(sliced.out);
+
+    /* fmt2jpg joins its stripes with restart markers the decoder splits at */
+    uint64_t t1 = esp_timer_get_time();
+    TEST_ASSERT_TRUE(fmt2jpg_cb(src, w * h * 3, w, h, PIXFORMAT_RGB888, 80, jpge_stream_cb, &jpg));
+    uint64_t t2 = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, esp_jpg_decode(jpg.len, JPG_SCALE_NONE, jpge_dec_read, jpge_dec_write, &single));
+    uint64_t t3 = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, esp_jpg_decode_buf(jpg.buf, jpg.len, JPG_SCALE_NONE, jpge_dec_write, &sliced));
+    uint64_t t4 = esp_timer_get_time();
+    printf("%4d x %4d , encode %8.2f ms , decode %8.2f ms , sliced decode %8.2f ms \n",
+           w, h, (t2 - t1) / 1000.0f, (t3 - t2) / 1000.0f, (t4 - t3) / 1000.0f);
+
+    TEST_ASSERT_EQUAL(single.w, sliced.w);
+    TEST_ASSERT_EQUAL(single.h, sliced.h);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(single.out, sliced.out, w * h * 3);
+    heap_caps_free(single.out);
+    heap_caps_free(sliced.out);
+    heap_caps_free(src);
+}
+
+TEST_CASE("Conversions jpeg transcode matches encoding the scaled decode test", "[camera]")
+{
+    jpge_img_t img = get_jpge_img(2);
+    uint8_t *scaled = (uint8_t *)heap_caps_malloc(img.w * img.h * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *a = (uint8_t *)heap_caps_malloc(img.w * img.h * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *b = (uint8_t *)heap_caps_malloc(img.w * img.h * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(scaled);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+
+    for (int s = JPG_SCALE_2X; s <= JPG_SCALE_8X; s++) {
+        buffer_stream ref, out;
+        jpge_dec_t dec = {img.buf, scaled, 0, 0};
+        uint16_t w = img.w >> s, h = img.h >> s;
+
+        /* the whole scaled image encoded at once is the reference */
+        TEST_ASSERT_EQUAL(ESP_OK, esp_jpg_decode(img.length, (jpg_scale_t)s, jpge_dec_read, jpge_dec_write, &dec));
+        TEST_ASSERT_EQUAL(w, dec.w);
+        TEST_ASSERT_EQUAL(h, dec.h);
+        for (size_t i = 0; i < w * h * 3; i += 3) {
+            uint8_t r = scaled[i];
+            scaled[i] = scaled[i + 2];
+            scaled[i + 2] = r;
+        }
+        TEST_ASSERT_TRUE(fmt2jpg_cb(scaled, w * h * 3, w, h, PIXFORMAT_RGB888, 85, jpge_stream_cb, &ref));
+
+        uint64_t t1 = esp_timer_get_time();
+        TEST_ASSERT_TRUE(jpg2jpg_cb(img.buf, img.length, (jpg_scale_t)s, 85, jpge_stream_cb, &out));
+        uint64_t t2 = esp_timer_get_time();
+        printf("%4d x %4d -> %4d x %4d , %6u B , %8.2f ms \n", img.w, img.h, w, h, out.len, (t2 - t1) / 1000.0f);
+
+        /* the reference may be split in stripes, compare the pixels */
+        TEST_ASSERT_TRUE(fmt2rgb888(ref.buf, ref.len, PIXFORMAT_JPEG, a));
+        TEST_ASSERT_TRUE(fmt2rgb888(out.buf, out.len, PIXFORMAT_JPEG, b));
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(a, b, w * h * 3);
+    }
+    heap_caps_free(scaled);
+    heap_caps_free(a);
+    heap_caps_free(b);
+}
+
+TEST_CASE("Conversions jpeg crop matches cropping the decode test", "[camera]")
+{
+    jpge_img_t img = get_jpge_img(2);
+    jpg_crop_rect_t rects[] = {
+        {0, 0, img.w, img.h},
+        {JPGE_CROP_X, JPGE_CROP_Y, 100, 60},
+        {200, 150, 1000, 1000},
+    };
+    uint8_t *full = (uint8_t *)heap_caps_malloc(img.w * img.h * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    uint8_t *crop = (uint8_t *)heap_caps_malloc(img.w * img.h * 3, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(full);
+    TEST_ASSERT_NOT_NULL(crop);
+    TEST_ASSERT_TRUE(fmt2rgb888(img.buf, img.length, PIXFORMAT_JPEG, full));
+
+    for (size_t i = 0; i < sizeof(rects) / sizeof(rects[0]); i++) {
+        jpg_crop_rect_t r = rects[i];
+        uint8_t *out = NULL;
+        size_t out_len = 0;
+
+        uint64_t t1 = esp_timer_get_time();
+        TEST_ASSERT_TRUE(jpg_crop_buf(img.buf, img.length, &r, &out, &out_len));
+        uint64_t t2 = esp_timer_get_time();
+        printf("%4d x %4d @ %4d, %4d , %6u B , %8.2f ms \n", r.w, r.h, r.x, r.y, out_len, (t2 - t1) / 1000.0f);
+
+        /* the crop is snapped to whole MCUs and keeps their coefficients */
+        TEST_ASSERT_TRUE(r.x <= rects[i].x && r.y <= rects[i].y);
+        TEST_ASSERT_TRUE(r.x + r.w <= img.w && r.y + r.h <= img.h);
+        TEST_ASSERT_TRUE(fmt2rgb888(out, out_len, PIXFORMAT_JPEG, crop));
+        for (int y = 0; y < r.h; y++) {
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(full + ((y + r.y) * img.w + r.x) * 3, crop + y * r.w * 3, r.w * 3);
+        }
+        free(out);
+    }
+    heap_caps_free(full);
+    heap_caps_free(crop);
+}
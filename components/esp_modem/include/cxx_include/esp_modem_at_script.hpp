@@ -0,0 +1,55 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "cxx_include/esp_modem_types.hpp"
+
+namespace esp_modem {
+
+/**
+ * @defgroup ESP_MODEM_AT_SCRIPT
+ * @brief Declarative AT command scripts run back to back by the DTE
+ */
+
+/** @addtogroup ESP_MODEM_AT_SCRIPT
+* @{
+*/
+
+/**
+ * @brief One command of an AT script
+ *
+ * The step completes on the final result code of the modem: OK (or CONNECT) passes,
+ * ERROR, +CME ERROR, +CMS ERROR and NO CARRIER fail. With an expected response,
+ * OK passes only if a line of the reply contained it.
+ */
+struct at_step {
+    std::string command;            /*!< AT command without the terminating CR */
+    std::string expect;             /*!< Text of the information response to wait for, empty to accept a bare OK */
+    uint32_t timeout_ms = 500;      /*!< Time to wait for the final result code of one attempt */
+    int retries = 0;                /*!< Attempts after the first one, if it fails or times out */
+    uint32_t retry_delay_ms = 0;    /*!< Pause before each retry */
+    bool optional = false;          /*!< The script goes on if this step finally fails */
+};
+
+/**
+ * @brief Outcome of one step of an AT script
+ */
+struct at_step_result {
+    command_result result = command_result::TIMEOUT;    /*!< Result of the last attempt */
+    uint32_t latency_ms = 0;        /*!< From the first write of the command to its last final result code */
+    int attempts = 0;               /*!< Number of writes of the command, 0 if the script stopped before it */
+    std::string response;           /*!< Line matching the expected response, else the last information or error line */
+};
+
+/**
+ * @}
+ */
+
+} // namespace esp_modem
@@ -6,12 +6,14 @@
 
 #pragma once
 
+#include <vector>
 #include "esp_modem_terminal.hpp"
 #include "cxx_include/esp_modem_buffer.hpp"
 
 namespace esp_modem {
 
 constexpr size_t MAX_TERMINALS_NUM = 2;
+constexpr size_t CMUX_MAX_FRAME_LEN = 32767;    /*!< Largest payload the 2 byte length field can carry */
 /**
  * @defgroup ESP_MODEM_CMUX ESP_MODEM CMUX class
  * @brief Definition of CMUX terminal
@@ -48,8 +50,9 @@ class CMuxInstance;
 class CMux {
 public:
     explicit CMux(std::shared_ptr<Terminal> t, unique_buffer &&b):
-        term(std::move(t)), payload_start(nullptr), total_payload_size(0), buffer(std::move(b))  {}
-    ~CMux() = default;
+        term(std::move(t)), buffer(std::move(b)), defragment(default_defragment),
+        max_frame_len(default_max_frame_len) {}
+    ~CMux();
 
     /**
      * @brief Initializes CMux protocol
@@ -86,25 +89,47 @@ public:
      */
     int write(int i, uint8_t *data, size_t len);
 
+    /**
+     * @brief Sets the maximum payload length of the frames written
+     * Frames longer than 127 bytes use the 2 byte length field, the modem must accept them (N1 parameter)
+     * @param len Maximum payload length, 1 to CMUX_MAX_FRAME_LEN
+     * @return true on success
+     */
+    bool set_max_frame_len(size_t len);
+
+    /**
+     * @brief Sets whether payloads are posted once the whole frame is received
+     * Otherwise the payload is posted as it is received. Call it before init() or while no data is received
+     * @param enable true to defragment the payloads
+     */
+    void set_defragment(bool enable);
+
 private:
-    static uint8_t fcs_crc(const uint8_t frame[6]);     /*!< Utility to calculate FCS CRC */
-    void data_available(uint8_t *data, size_t len);     /*!< Called when valid data available */
+    static const size_t default_max_frame_len;          /*!< Maximum payload length from the config */
+    static const bool default_defragment;               /*!< Defragmentation from the config */
+    static uint8_t fcs_crc(const uint8_t *frame, size_t header_len = 4); /*!< Utility to calculate FCS CRC of the header */
+    void flush_tx();                                    /*!< Writes the frames built in the TX buffer to the terminal */
+    void deliver(size_t offset, size_t len, bool defragment); /*!< Posts payload from the RX ring, in one or two spans */
+    void frame_end();                                   /*!< Called when a valid frame is complete */
     void send_sabm(size_t i);                           /*!< Sending initial SABM */
     void send_disconnect(size_t i);                     /*!< Sending closing request for each virtual or control terminal */
     bool on_cmux_data(uint8_t *data, size_t len);       /*!< Called from terminal layer when raw CMUX protocol data available */
 
-    struct CMuxFrame;                                   /*!< Forward declare the Frame struct, used in protocol decoders */
+    void parse();                                       /*!< Parses the bytes read into the RX ring */
+    void rx_reset();                                    /*!< Empties the RX ring */
+    [[nodiscard]] uint8_t rx_byte(size_t offset) const; /*!< Byte of the RX stream at an offset */
+    [[nodiscard]] size_t rx_space() const;              /*!< Contiguous free space of the RX ring */
+
     /**
-     * These methods serve different states of the CMUX protocols
-     * @param frame Currently available cmux frame (basically data, size, methods)
+     * These methods serve different states of the CMUX protocols, parsing the RX ring from rx_parse
      * @return - true if the state processed successfully
      *         - false if more data needed to process the current state
      */
-    bool on_recovery(CMuxFrame &frame);
-    bool on_init(CMuxFrame &frame);
-    bool on_header(CMuxFrame &frame);
-    bool on_payload(CMuxFrame &frame);
-    bool on_footer(CMuxFrame &frame);
+    bool on_recovery();
+    bool on_init();
+    bool on_header();
+    bool on_payload();
+    bool on_footer();
 
     std::function<bool(uint8_t *data, size_t len)> read_cb[MAX_TERMINALS_NUM];  /*!< Function pointers to read callbacks */
     std::shared_ptr<Terminal> term;                   /*!< The original terminal */
@@ -116,17 +141,30 @@ private:
     uint8_t dlci;
     uint8_t type;
     size_t payload_len;
-    uint8_t frame_header[6];
-    size_t frame_header_offset;
-    uint8_t *payload_start;
-    size_t total_payload_size;
+    size_t payload_remaining;                         /*!< Payload bytes of the frame not received yet */
+    size_t payload_start;                             /*!< Stream offset of the payload not posted yet */
+    uint8_t payload_first;                            /*!< First payload byte, the control channel command */
+    bool payload_streamed;                            /*!< Payload of the frame is posted as it is received */
+    uint8_t rx_fcs;                                   /*!< FCS of the frame received so far */
     int instance;
     int sabm_ack;
 
     /**
-     * Processing unique buffer (reused and transferred from it's parent DTE)
+     * Processing unique buffer (reused and transferred from it's parent DTE), used as the RX ring
      */
     unique_buffer buffer;
+    bool defragment;
+    size_t rx_ring_size{};                            /*!< Ring part of the buffer, the rest is the overhang of wrapped payloads */
+    size_t rx_head{};                                 /*!< Stream offset of the oldest byte still needed */
+    size_t rx_parse{};                                /*!< Stream offset of the next byte to parse */
+    size_t rx_tail{};                                 /*!< Stream offset of the next byte read */
+
+    /**
+     * Frames being written, passed to the terminal in one write
+     */
+    std::vector<uint8_t> tx_buffer;
+    size_t tx_len{};
+    size_t max_frame_len;
 
     Lock lock;
 };
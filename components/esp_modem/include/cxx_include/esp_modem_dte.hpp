@@ -14,6 +14,7 @@
 #include "cxx_include/esp_modem_terminal.hpp"
 #include "cxx_include/esp_modem_types.hpp"
 #include "cxx_include/esp_modem_buffer.hpp"
+#include "cxx_include/esp_modem_at_script.hpp"
 
 struct esp_modem_dte_config;
 
@@ -108,6 +109,14 @@ public:
      */
     command_result command(const std::string &command, got_line_cb got_line, uint32_t time_ms, char separator) override;
 
+    /**
+     * @brief Runs an AT script: each command is written as soon as the final result code of the previous one arrives
+     * @param script Commands to run in order
+     * @param results Populated with one result per step
+     * @return OK if all steps passed (failed optional steps aside), else the result of the step that stopped the script
+     */
+    command_result run_script(const std::vector<at_step> &script, std::vector<at_step_result> &results);
+
 protected:
     /**
      * @brief Allows for locking the DTE
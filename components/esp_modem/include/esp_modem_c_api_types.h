@@ -72,6 +72,30 @@ typedef enum esp_modem_terminal_error {
  */
 typedef void (*esp_modem_terminal_error_cbt)(esp_modem_terminal_error_t);
 
+#define ESP_MODEM_AT_RESPONSE_MAX 64    /**< Size of the response kept for each step of an AT script */
+
+/**
+ * @brief One command of an AT script, see esp_modem_at_script()
+ */
+typedef struct esp_modem_at_step {
+    const char *command;        /**< AT command without the terminating CR */
+    const char *expect;         /**< Text of the information response to wait for, NULL to accept a bare OK */
+    uint32_t timeout_ms;        /**< Time to wait for the final result code of one attempt */
+    int retries;                /**< Attempts after the first one, if it fails or times out */
+    uint32_t retry_delay_ms;    /**< Pause before each retry */
+    bool optional;              /**< The script goes on if this step finally fails */
+} esp_modem_at_step_t;
+
+/**
+ * @brief Outcome of one step of an AT script
+ */
+typedef struct esp_modem_at_step_result {
+    esp_err_t result;           /**< ESP_OK, ESP_FAIL on an error result code, ESP_ERR_TIMEOUT */
+    uint32_t latency_ms;        /**< From the first write of the command to its last final result code */
+    int attempts;               /**< Number of writes of the command, 0 if the script stopped before it */
+    char response[ESP_MODEM_AT_RESPONSE_MAX];   /**< Line matching the expected response, else the last information or error line */
+} esp_modem_at_step_result_t;
+
 /**
  * @brief Create a generic DCE handle for new modem API
  *
@@ -121,6 +145,21 @@ esp_err_t esp_modem_set_mode(esp_modem_dce_t *dce, esp_modem_dce_mode_t mode);
 
 esp_err_t esp_modem_command(esp_modem_dce_t *dce, const char *command, esp_err_t(*got_line_cb)(uint8_t *data, size_t len), uint32_t timeout_ms);
 
+/**
+ * @brief Run AT commands back to back in command mode
+ *
+ * Each command is written as soon as the final result code of the previous one
+ * arrives. A failed or timed out step is retried as configured, then the script
+ * stops unless the step is optional.
+ *
+ * @param dce Modem DCE handle
+ * @param steps Commands to run in order
+ * @param count Number of steps
+ * @param[out] results One result per step, can be NULL
+ * @return ESP_OK if all steps passed (failed optional steps aside), else the result of the step that stopped the script
+ */
+esp_err_t esp_modem_at_script(esp_modem_dce_t *dce, const esp_modem_at_step_t *steps, size_t count, esp_modem_at_step_result_t *results);
+
 /**
  * @}
  */
@@ -0,0 +1,184 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <chrono>
+#include <cinttypes>
+#include <string_view>
+#include "esp_log.h"
+#include "cxx_include/esp_modem_dte.hpp"
+
+using namespace esp_modem;
+
+static const char *TAG = "at_script";
+
+using script_clock = std::chrono::steady_clock;
+
+static uint32_t ms_since(script_clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(script_clock::now() - t).count();
+}
+
+static bool starts_with(std::string_view line, std::string_view prefix)
+{
+    return line.substr(0, prefix.size()) == prefix;
+}
+
+/**
+ * @brief Final result code of a reply line, TIMEOUT if the line is an information response
+ */
+static command_result final_result(std::string_view line)
+{
+    if (line == "OK" || starts_with(line, "CONNECT")) {
+        return command_result::OK;
+    }
+    if (line == "ERROR" || line == "NO CARRIER" || starts_with(line, "+CME ERROR") || starts_with(line, "+CMS ERROR")) {
+        return command_result::FAIL;
+    }
+    return command_result::TIMEOUT;
+}
+
+static const char *describe(const at_step_result &r)
+{
+    if (!r.response.empty()) {
+        return r.response.c_str();
+    }
+    return r.result == command_result::TIMEOUT ? "timeout" : "failed";
+}
+
+command_result DTE::run_script(const std::vector<at_step> &script, std::vector<at_step_result> &results)
+{
+    Scoped<Lock> l(internal_lock);
+    Lock run_lock;              // guards the state below, shared with the read callback
+    size_t step = 0;            // step being run, script.size() once all passed
+    bool waiting = false;       // the command of the step is written, its final result code is pending
+    bool found = false;         // the expected response of the step was received
+    std::string line;           // reply line being received
+    script_clock::time_point started, sent;
+    command_result ret = command_result::OK;
+
+    results.assign(script.size(), at_step_result());
+    if (script.empty()) {
+        return ret;
+    }
+    auto send = [&]() {
+        auto &r = results[step];
+        sent = script_clock::now();
+        if (r.attempts++ == 0) {
+            started = sent;
+        }
+        r.response.clear();
+        waiting = true;
+        found = false;
+        std::string cmd = script[step].command + "\r";
+        primary_term->write((uint8_t *)cmd.c_str(), cmd.length());
+    };
+    auto on_line = [&]() {
+        auto &s = script[step];
+        auto &r = results[step];
+        auto res = final_result(line);
+        if (res == command_result::TIMEOUT) {
+            if (line == s.command) {    // echo
+                return;
+            }
+            if (!s.expect.empty() && line.find(s.expect) != std::string::npos) {
+                found = true;
+                r.response = line;
+            } else if (!found) {
+                r.response = line;
+            }
+            return;
+        }
+        if (res == command_result::FAIL) {
+            r.response = line;
+        } else if (!s.expect.empty() && !found) {
+            res = command_result::FAIL;
+        }
+        r.result = res;
+        r.latency_ms = ms_since(started);
+        waiting = false;
+        if (res == command_result::OK) {
+            ESP_LOGD(TAG, "%s: OK in %" PRIu32 " ms", s.command.c_str(), r.latency_ms);
+            if (++step < script.size()) {
+                send();     // right away, from the reader
+                return;
+            }
+        }
+        signal.set(GOT_LINE);   // the script is over, or the caller decides about the failure
+    };
+
+    signal.clear(GOT_LINE);
+    primary_term->set_read_cb([&](uint8_t *data, size_t len) {
+        if (!data) {
+            data = buffer.get();
+            len = primary_term->read(data, buffer.size);
+        }
+        Scoped<Lock> l(run_lock);
+        for (size_t i = 0; i < len; i++) {
+            if (data[i] != '\r' && data[i] != '\n') {
+                line.push_back(data[i]);
+                continue;
+            }
+            if (!line.empty() && waiting) {
+                on_line();
+            }
+            line.clear();
+        }
+        return false;
+    });
+    {
+        Scoped<Lock> l(run_lock);
+        send();
+    }
+    while (true) {
+        uint32_t wait_ms = 0;
+        uint32_t retry_delay_ms = 0;
+        {
+            Scoped<Lock> l(run_lock);
+            if (step == script.size()) {
+                break;
+            }
+            auto &s = script[step];
+            auto &r = results[step];
+            if (waiting) {
+                uint32_t elapsed = ms_since(sent);
+                if (elapsed < s.timeout_ms) {
+                    wait_ms = s.timeout_ms - elapsed;
+                } else {
+                    r.result = command_result::TIMEOUT;
+                    r.latency_ms = ms_since(started);
+                    waiting = false;
+                }
+            }
+            if (!waiting) {
+                if (r.attempts <= s.retries) {
+                    ESP_LOGW(TAG, "%s: %s, retry %d/%d", s.command.c_str(), describe(r), r.attempts, s.retries);
+                    retry_delay_ms = s.retry_delay_ms;
+                } else if (s.optional) {
+                    ESP_LOGW(TAG, "%s: %s, skipped", s.command.c_str(), describe(r));
+                    if (++step < script.size()) {
+                        send();
+                    }
+                    continue;
+                } else {
+                    ESP_LOGE(TAG, "%s: %s, script stopped", s.command.c_str(), describe(r));
+                    ret = r.result;
+                    break;
+                }
+            }
+        }
+        if (wait_ms > 0) {
+            signal.wait(GOT_LINE, wait_ms);
+            continue;
+        }
+        if (retry_delay_ms > 0) {
+            Task::Delay(retry_delay_ms);
+        }
+        Scoped<Lock> l(run_lock);
+        send();
+    }
+    primary_term->set_read_cb(nullptr);
+    return ret;
+}
@@ -420,6 +420,31 @@ extern "C" esp_err_t esp_modem_command(esp_modem_dce_t *dce_wrap, const char *co
     }, timeout_ms));
 }
 
+extern "C" esp_err_t esp_modem_at_script(esp_modem_dce_t *dce_wrap, const esp_modem_at_step_t *steps, size_t count, esp_modem_at_step_result_t *results)
+{
+    if (dce_wrap == nullptr || dce_wrap->dte == nullptr || (steps == nullptr && count > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::vector<at_step> script(count);
+    std::vector<at_step_result> out;
+    for (size_t i = 0; i < count; i++) {
+        script[i].command = steps[i].command ? steps[i].command : "AT";
+        script[i].expect = steps[i].expect ? steps[i].expect : "";
+        script[i].timeout_ms = steps[i].timeout_ms;
+        script[i].retries = steps[i].retries;
+        script[i].retry_delay_ms = steps[i].retry_delay_ms;
+        script[i].optional = steps[i].optional;
+    }
+    auto ret = command_response_to_esp_err(dce_wrap->dte->run_script(script, out));
+    for (size_t i = 0; results != nullptr && i < count; i++) {
+        results[i].result = command_response_to_esp_err(out[i].result);
+        results[i].latency_ms = out[i].latency_ms;
+        results[i].attempts = out[i].attempts;
+        strlcpy(results[i].response, out[i].response.c_str(), ESP_MODEM_AT_RESPONSE_MAX);
+    }
+    return ret;
+}
+
 extern "C" esp_err_t esp_modem_set_baud(esp_modem_dce_t *dce_wrap, int baud)
 {
     return command_response_to_esp_err(dce_wrap->dce->set_baud(baud));
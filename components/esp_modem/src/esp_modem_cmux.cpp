@@ -5,6 +5,7 @@
  */
 
 #include <cstring>
+#include <algorithm>
 #include <unistd.h>
 #include <cxx_include/esp_modem_cmux.hpp>
 #include "cxx_include/esp_modem_dte.hpp"
@@ -19,7 +20,9 @@ using namespace esp_modem;
  *        This is useful if upper layers expect the entire payload available
  *        for parsing.
  */
-#define DEFRAGMENT_CMUX_PAYLOAD
+#define DEFRAGMENT_CMUX_PAYLOAD true
+#else
+#define DEFRAGMENT_CMUX_PAYLOAD false
 #endif
 
 #define EA 0x01  /* Extension bit      */
@@ -53,22 +56,41 @@ using namespace esp_modem;
 /* Flag sequence field between messages (start of frame) */
 #define SOF_MARKER 0xF9
 
-uint8_t CMux::fcs_crc(const uint8_t frame[6])
-{
-    //    #define FCS_GOOD_VALUE 0xCF
-    uint8_t crc = 0xFF; // FCS_INIT_VALUE
+/* Frame overhead: SOF, address, control, 1 or 2 length bytes, FCS, SOF */
+#define FRAME_HEADER_LEN     4
+#define FRAME_HEADER_LEN_EXT 5
+#define FRAME_FOOTER_LEN     2
+#define FRAME_SHORT_MAX_LEN  127
 
-    for (int i = 1; i < 4; i++) {
-        crc ^= frame[i];
+/* The TX buffer holds several short frames, so a PPP packet is written at once */
+#define TX_BUFFER_MIN_SIZE   2048
 
-        for (int j = 0; j < 8; j++) {
-            if (crc & 0x01) {
-                crc = (crc >> 1) ^ 0xe0; // FCS_POLYNOMIAL
-            } else {
-                crc >>= 1;
-            }
+const size_t CMux::default_max_frame_len = CONFIG_ESP_MODEM_CMUX_MAX_FRAME_LEN;
+const bool CMux::default_defragment = DEFRAGMENT_CMUX_PAYLOAD;
+
+/* FCS of a received frame, run over its FCS byte too, when no bit was corrupted */
+#define FCS_GOOD_VALUE 0xCF
+
+static uint8_t fcs_update(uint8_t crc, uint8_t byte)
+{
+    crc ^= byte;
+    for (int j = 0; j < 8; j++) {
+        if (crc & 0x01) {
+            crc = (crc >> 1) ^ 0xe0; // FCS_POLYNOMIAL
+        } else {
+            crc >>= 1;
         }
     }
+    return crc;
+}
+
+uint8_t CMux::fcs_crc(const uint8_t *frame, size_t header_len)
+{
+    uint8_t crc = 0xFF; // FCS_INIT_VALUE
+
+    for (size_t i = 1; i < header_len; i++) {
+        crc = fcs_update(crc, frame[i]);
+    }
 
     return crc;
 }
@@ -103,44 +125,54 @@ void CMux::send_sabm(size_t i)
 }
 
 
-struct CMux::CMuxFrame {
-    uint8_t *ptr;     /*!< pointer to the currently processing byte of the CMUX frame */
-    size_t len;       /*!< length of available data in the current CMUX frame */
-    void advance(int size = 1)
-    {
-        ptr += size;
-        len -= size;
+/**
+ * The RX buffer is a ring, the terminal reads into its free space and frames are parsed in place.
+ * Stream offsets (rx_head, rx_parse, rx_tail) only grow, the ring index is the offset modulo rx_ring_size:
+ * - [rx_head, rx_parse) payload held until the footer is checked (defragment mode only)
+ * - [rx_parse, rx_tail) bytes read but not parsed yet, at most an incomplete header or footer
+ * - [rx_tail, rx_head + rx_ring_size) free space for the next read
+ */
+uint8_t CMux::rx_byte(size_t offset) const
+{
+    return buffer.get()[offset % rx_ring_size];
+}
+
+size_t CMux::rx_space() const
+{
+    size_t index = rx_tail % rx_ring_size;
+    return std::min(rx_ring_size - index, rx_ring_size - (rx_tail - rx_head));
+}
+
+void CMux::deliver(size_t offset, size_t len, bool defragment)
+{
+    int virtual_term = dlci - 1;
+    if (len == 0 || dlci == 0 || (type & FT_UIH) != FT_UIH ||
+            virtual_term >= MAX_TERMINALS_NUM || !read_cb[virtual_term]) {
+        return;
     }
-};
+    uint8_t *ring = buffer.get();
+    size_t index = offset % rx_ring_size;
+    size_t first = std::min(len, rx_ring_size - index);
+    if (defragment && first < len && len - first <= buffer.size - rx_ring_size) {
+        // the payload wraps: append its head to the overhang behind the ring
+        memcpy(ring + rx_ring_size, ring, len - first);
+        first = len;
+    }
+    read_cb[virtual_term](ring + index, first);
+    if (first < len) {
+        read_cb[virtual_term](ring, len - first);
+    }
+}
 
-void CMux::data_available(uint8_t *data, size_t len)
+void CMux::frame_end()
 {
-    if (data && (type & FT_UIH) == FT_UIH && len > 0 && dlci > 0) { // valid payload on a virtual term
-        int virtual_term = dlci - 1;
-        if (virtual_term < MAX_TERMINALS_NUM && read_cb[virtual_term]) {
-            // Post partial data (or defragment to post on CMUX footer)
-#ifdef DEFRAGMENT_CMUX_PAYLOAD
-            if (payload_start == nullptr) {
-                payload_start = data;
-                total_payload_size = 0;
-            }
-            total_payload_size += len;
-#else
-            read_cb[virtual_term](data, len);
-#endif
-        }
-    } else if (data == nullptr && type == 0x73 && len == 0) { // notify the initial SABM command
+    deliver(payload_start, rx_parse - payload_start, !payload_streamed);
+    payload_start = rx_parse;
+    if (type == (FT_UA | PF)) { // notify the initial SABM command
         Scoped<Lock> l(lock);
         sabm_ack = dlci;
-    } else if (data == nullptr) {
-        int virtual_term = dlci - 1;
-        if (virtual_term < MAX_TERMINALS_NUM && read_cb[virtual_term]) {
-#ifdef DEFRAGMENT_CMUX_PAYLOAD
-            read_cb[virtual_term](payload_start, total_payload_size);
-#endif
-        }
     } else if ((type & FT_UIH) == FT_UIH && dlci == 0) { // notify the internal DISC command
-        if (len > 0 && (data[0] & 0xE1) == 0xE1) {
+        if (payload_len > 0 && (payload_first & 0xE1) == 0xE1) {
             // Not a DISC, ignore (MSC frame)
             return;
         }
@@ -149,178 +181,172 @@ void CMux::data_available(uint8_t *data, size_t len)
     }
 }
 
-bool CMux::on_init(CMuxFrame &frame)
+bool CMux::on_recovery()
 {
-    if (frame.ptr[0] != SOF_MARKER) {
+    while (rx_parse < rx_tail) {
+        size_t index = rx_parse % rx_ring_size;
+        size_t len = std::min(rx_tail - rx_parse, rx_ring_size - index);
+        auto *found = static_cast<uint8_t *>(memchr(buffer.get() + index, SOF_MARKER, len));
+        if (found) {
+            rx_parse += found - (buffer.get() + index);
+            state = cmux_state::INIT;
+            ESP_LOGI("CMUX", "Protocol recovered");
+            return true;
+        }
+        rx_parse += len;
+    }
+    // marker not found, continue with recovery
+    return false;
+}
+
+bool CMux::on_init()
+{
+    if (rx_byte(rx_parse) != SOF_MARKER) {
         ESP_LOGW("CMUX", "Protocol mismatch: Missed leading SOF, recovering...");
         state = cmux_state::RECOVER;
         return true;
     }
-    if (frame.len > 1 && frame.ptr[1] == SOF_MARKER) {
-        // empty frame
-        frame.advance();
-        return true;
-    }
+    rx_parse++;
     state = cmux_state::HEADER;
-    frame.advance();
-    frame_header_offset = 1;
     return true;
 }
 
-bool CMux::on_recovery(CMuxFrame &frame)
+bool CMux::on_header()
 {
-    uint8_t *recover_ptr;
-    if (frame.ptr[0] == SOF_MARKER) {
-        // already init state
-        state = cmux_state::INIT;
+    if (rx_byte(rx_parse) == SOF_MARKER) {
+        // Empty frame, or the trailing SOF of the previous frame followed by a heading SOF
+        rx_parse++;
         return true;
     }
-    recover_ptr = static_cast<uint8_t *>(memchr(frame.ptr, SOF_MARKER, frame.len));
-    if (recover_ptr && frame.len > recover_ptr - frame.ptr) {
-        frame.len -= (recover_ptr - frame.ptr);
-        frame.ptr = recover_ptr;
-        state = cmux_state::INIT;
-        ESP_LOGI("CMUX", "Protocol recovered");
-        if (frame.len > 1 && frame.ptr[1] == SOF_MARKER) {
-            // empty frame
-            frame.advance();
-        }
-        return true;
+    size_t available = rx_tail - rx_parse;
+    if (available < 3 || ((rx_byte(rx_parse + 2) & EA) == 0 && available < 4)) {
+        return false; // need read more
     }
-    // marker not found, continue with recovery
-    return false;
-}
-
-
-bool CMux::on_header(CMuxFrame &frame)
-{
-    if (frame.len > 0 && frame_header_offset == 1 && frame.ptr[0] == SOF_MARKER) {
-        // Previously trailing SOF interpreted as heading SOF, remove it and restart HEADER
-        frame.advance();
-        return true;
+    size_t header_len = (rx_byte(rx_parse + 2) & EA) ? 3 : 4;
+    dlci = rx_byte(rx_parse) >> 2;
+    type = rx_byte(rx_parse + 1);
+    payload_len = rx_byte(rx_parse + 2) >> 1;
+    if (header_len == 4) {
+        payload_len |= rx_byte(rx_parse + 3) << 7;
     }
-    if (frame.len + frame_header_offset < 4) {
-        memcpy(frame_header + frame_header_offset, frame.ptr, frame.len);
-        frame_header_offset += frame.len;
-        return false; // need read more
+    rx_fcs = 0xFF; // FCS_INIT_VALUE
+    for (size_t i = 0; i < header_len; i++) {
+        rx_fcs = fcs_update(rx_fcs, rx_byte(rx_parse + i));
     }
-    size_t payload_offset = std::min(frame.len, 4 - frame_header_offset);
-    memcpy(frame_header + frame_header_offset, frame.ptr, payload_offset);
-    if ((frame_header[3] & 1) == 0) {
-        if (frame_header_offset + frame.len <= 4) {
-            frame_header_offset += frame.len;
-            return false; // need read more
-        }
-        payload_offset = std::min(frame.len, 5 - frame_header_offset);
-        memcpy(frame_header + frame_header_offset, frame.ptr, payload_offset);
-        payload_len = frame_header[4] << 7;
-        frame_header_offset += payload_offset - 1; // rewind frame_header back to hold only 6 bytes size
-    } else {
-        payload_len = 0;
-        frame_header_offset += payload_offset;
-    }
-    dlci = frame_header[1] >> 2;
-    type = frame_header[2];
-    payload_len += (frame_header[3] >> 1);
-    frame.advance(payload_offset);
-    state = cmux_state::PAYLOAD;
+    rx_parse += header_len;
+    payload_start = rx_parse;
+    payload_remaining = payload_len;
+    payload_streamed = !defragment;
+    state = payload_len ? cmux_state::PAYLOAD : cmux_state::FOOTER;
     return true;
 }
 
-bool CMux::on_payload(CMuxFrame &frame)
+bool CMux::on_payload()
 {
-    ESP_LOGD("CMUX", "Payload frame: dlci:%02x type:%02x payload:%d available:%d", dlci, type, payload_len, frame.len);
-    if (frame.len < payload_len) { // payload
-        state = cmux_state::PAYLOAD;
-        data_available(frame.ptr, frame.len); // partial read
-        payload_len -= frame.len;
-        return false;
-    } else { // complete
-        if (payload_len > 0) {
-            data_available(&frame.ptr[0], payload_len); // rest read
+    size_t len = std::min(rx_tail - rx_parse, payload_remaining);
+    if (payload_remaining == payload_len) {
+        payload_first = rx_byte(rx_parse);
+    }
+    if ((type & ~PF) == FT_UI) { // the FCS of UI frames also covers the payload
+        for (size_t i = 0; i < len; i++) {
+            rx_fcs = fcs_update(rx_fcs, rx_byte(rx_parse + i));
         }
-        frame.advance((payload_len));
-        state = cmux_state::FOOTER;
-        payload_len = 0;
     }
+    rx_parse += len;
+    payload_remaining -= len;
+    if (payload_streamed) { // partial read, posted without a copy
+        deliver(payload_start, len, false);
+        payload_start = rx_parse;
+    }
+    if (payload_remaining > 0) {
+        return false; // need read more
+    }
+    state = cmux_state::FOOTER;
     return true;
 }
 
-bool CMux::on_footer(CMuxFrame &frame)
+bool CMux::on_footer()
 {
-    size_t footer_offset = 0;
-    if (frame.len + frame_header_offset < 6) {
-        memcpy(frame_header + frame_header_offset, frame.ptr, frame.len);
-        frame_header_offset += frame.len;
+    if (rx_tail - rx_parse < 2) {
         return false; // need read more
-    } else {
-        footer_offset = std::min(frame.len, 6 - frame_header_offset);
-        memcpy(frame_header + frame_header_offset, frame.ptr, footer_offset);
-        if (frame_header[5] != SOF_MARKER) {
-            ESP_LOGW("CMUX", "Protocol mismatch: Missed trailing SOF, recovering...");
-            payload_start = nullptr;
-            total_payload_size = 0;
-            state = cmux_state::RECOVER;
-            return true;
-        }
-        frame.advance(footer_offset);
+    }
+    // the trailing SOF is left in place, it can also be the heading SOF of the next frame
+    if (rx_byte(rx_parse + 1) != SOF_MARKER) {
+        ESP_LOGW("CMUX", "Protocol mismatch: Missed trailing SOF, recovering...");
+        state = cmux_state::RECOVER;
+        return true;
+    }
+    if (fcs_update(rx_fcs, rx_byte(rx_parse)) != FCS_GOOD_VALUE) {
+        // corrupted frame: the held payload is dropped, a streamed one was already posted
+        ESP_LOGW("CMUX", "Protocol mismatch: Bad FCS of a frame on DLCI %d, dropped", dlci);
+        payload_start = rx_parse;
+        rx_parse++;
         state = cmux_state::INIT;
-        frame_header_offset = 0;
-        data_available(nullptr, 0);
-        payload_start = nullptr;
-        total_payload_size = 0;
+        return true;
     }
+    frame_end();
+    rx_parse++;
+    state = cmux_state::INIT;
     return true;
 }
 
-bool CMux::on_cmux_data(uint8_t *data, size_t actual_len)
+void CMux::parse()
 {
-    if (!data) {
-#ifdef DEFRAGMENT_CMUX_PAYLOAD
-        auto data_to_read = buffer.size - 128; // keep 128 (max CMUX payload) backup buffer)
-        if (payload_start) {
-            data = payload_start + total_payload_size;
-            data_to_read = payload_len + 2;
-        } else {
-            data = buffer.get();
-        }
-        actual_len = term->read(data, data_to_read);
-#else
-        data = buffer.get();
-        actual_len = term->read(data, buffer.size);
-#endif
-    }
-    ESP_LOG_BUFFER_HEXDUMP("CMUX Received", data, actual_len, ESP_LOG_VERBOSE);
-    CMuxFrame frame = { .ptr = data, .len = actual_len };
-    while (frame.len > 0) {
+    bool processed = true;
+    while (processed && rx_parse < rx_tail) {
         switch (state) {
         case cmux_state::RECOVER:
-            if (!on_recovery(frame)) {
-                return false;
-            }
+            processed = on_recovery();
             break;
         case cmux_state::INIT:
-            if (!on_init(frame)) {
-                return false;
-            }
+            processed = on_init();
             break;
         case cmux_state::HEADER:
-            if (!on_header(frame)) {
-                return false;
-            }
+            processed = on_header();
             break;
         case cmux_state::PAYLOAD:
-            if (!on_payload(frame)) {
-                return false;
-            }
+            processed = on_payload();
             break;
         case cmux_state::FOOTER:
-            if (!on_footer(frame)) {
-                return false;
-            }
+            processed = on_footer();
             break;
         }
     }
+    bool holding = state == cmux_state::PAYLOAD || state == cmux_state::FOOTER;
+    rx_head = holding ? payload_start : rx_parse;
+    if (rx_tail - rx_head == rx_ring_size && holding) {
+        // the frame does not fit the ring: post what is held, stream the rest of it
+        ESP_LOGW("CMUX", "Payload of %d bytes exceeds the buffer, posted in parts", payload_len);
+        deliver(payload_start, rx_parse - payload_start, false);
+        payload_start = rx_head = rx_parse;
+        payload_streamed = true;
+    }
+}
+
+bool CMux::on_cmux_data(uint8_t *data, size_t actual_len)
+{
+    if (data) {
+        // the terminal posted its own buffer, copy it to the ring so frames can span posts
+        while (actual_len > 0) {
+            size_t len = std::min(actual_len, rx_space());
+            memcpy(buffer.get() + rx_tail % rx_ring_size, data, len);
+            ESP_LOG_BUFFER_HEXDUMP("CMUX Received", data, len, ESP_LOG_VERBOSE);
+            rx_tail += len;
+            data += len;
+            actual_len -= len;
+            parse();
+        }
+        return true;
+    }
+    size_t space;
+    do {
+        space = rx_space();
+        uint8_t *ptr = buffer.get() + rx_tail % rx_ring_size;
+        actual_len = term->read(ptr, space);
+        ESP_LOG_BUFFER_HEXDUMP("CMUX Received", ptr, actual_len, ESP_LOG_VERBOSE);
+        rx_tail += actual_len;
+        parse();
+    } while (actual_len > 0 && actual_len == space); // the read may have stopped at the end of the ring
     return true;
 }
 
@@ -362,10 +388,24 @@ bool CMux::deinit()
     return true;
 }
 
-bool CMux::init()
+void CMux::rx_reset()
 {
-    frame_header_offset = 0;
+    // half of the buffer is kept behind the ring, so a defragmented payload up to that size is never split
+    rx_ring_size = defragment ? buffer.size / 2 : buffer.size;
+    rx_head = rx_parse = rx_tail = 0;
+    payload_start = 0;
     state = cmux_state::INIT;
+}
+
+void CMux::set_defragment(bool enable)
+{
+    defragment = enable;
+    rx_reset();
+}
+
+bool CMux::init()
+{
+    rx_reset();
     term->set_read_cb([this](uint8_t *data, size_t len) {
         this->on_cmux_data(data, len);
         return false;
@@ -393,34 +433,59 @@ bool CMux::init()
     return true;
 }
 
+bool CMux::set_max_frame_len(size_t len)
+{
+    if (len == 0 || len > CMUX_MAX_FRAME_LEN) {
+        return false;
+    }
+    Scoped<Lock> l(lock);
+    max_frame_len = len;
+    tx_buffer.clear();  // resized for the new length on the next write
+    return true;
+}
+
+void CMux::flush_tx()
+{
+    if (tx_len == 0) {
+        return;
+    }
+    ESP_LOG_BUFFER_HEXDUMP("Send", tx_buffer.data(), tx_len, ESP_LOG_VERBOSE);
+    term->write(tx_buffer.data(), tx_len);
+    tx_len = 0;
+}
+
 int CMux::write(int virtual_term, uint8_t *data, size_t len)
 {
-    const size_t cmux_max_len = 127;
     Scoped<Lock> l(lock);
     int i = virtual_term + 1;
     size_t need_write = len;
+    if (tx_buffer.empty()) {
+        tx_buffer.resize(std::max<size_t>(TX_BUFFER_MIN_SIZE, max_frame_len + FRAME_HEADER_LEN_EXT + FRAME_FOOTER_LEN));
+    }
     while (need_write > 0) {
-        size_t batch_len = need_write;
-        if (batch_len > cmux_max_len) {
-            batch_len = cmux_max_len;
+        size_t batch_len = std::min(need_write, max_frame_len);
+        size_t header_len = batch_len > FRAME_SHORT_MAX_LEN ? FRAME_HEADER_LEN_EXT : FRAME_HEADER_LEN;
+        if (tx_len + header_len + batch_len + FRAME_FOOTER_LEN > tx_buffer.size()) {
+            flush_tx();
         }
-        uint8_t frame[6];
+        uint8_t *frame = tx_buffer.data() + tx_len;
         frame[0] = SOF_MARKER;
         frame[1] = (i << 2) + 1;
         frame[2] = FT_UIH;
-        frame[3] = (batch_len << 1) + 1;
-        frame[4] = 0xFF - fcs_crc(frame);
-        frame[5] = SOF_MARKER;
-
-        term->write(frame, 4);
-        term->write(data, batch_len);
-        term->write(frame + 4, 2);
-        ESP_LOG_BUFFER_HEXDUMP("Send", frame, 4, ESP_LOG_VERBOSE);
-        ESP_LOG_BUFFER_HEXDUMP("Send", data, batch_len, ESP_LOG_VERBOSE);
-        ESP_LOG_BUFFER_HEXDUMP("Send", frame + 4, 2, ESP_LOG_VERBOSE);
+        if (header_len == FRAME_HEADER_LEN_EXT) {
+            frame[3] = (batch_len & 0x7F) << 1; // EA bit cleared: the length continues in the next byte
+            frame[4] = batch_len >> 7;
+        } else {
+            frame[3] = (batch_len << 1) + 1;
+        }
+        memcpy(frame + header_len, data, batch_len);
+        frame[header_len + batch_len] = 0xFF - fcs_crc(frame, header_len);
+        frame[header_len + batch_len + 1] = SOF_MARKER;
+        tx_len += header_len + batch_len + FRAME_FOOTER_LEN;
         need_write -= batch_len;
         data += batch_len;
     }
+    flush_tx();
     return len;
 }
 
@@ -431,6 +496,13 @@ void CMux::set_read_cb(int inst, std::function<bool(uint8_t *, size_t)> f)
     }
 }
 
+CMux::~CMux()
+{
+    if (term) {
+        term->set_read_cb(nullptr);     // the terminal may outlive the CMux, it must not post into the freed buffer
+    }
+}
+
 std::pair<std::shared_ptr<Terminal>, unique_buffer> CMux::detach()
 {
     return std::make_pair(std::move(term), std::move(buffer));
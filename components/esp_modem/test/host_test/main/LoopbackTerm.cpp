@@ -8,6 +8,21 @@
 #include <cstring>
 #include "LoopbackTerm.h"
 
+/**
+ * @brief FCS of a CMUX frame header, the payload of UIH frames is not covered
+ */
+static uint8_t fcs(const uint8_t *header, size_t len)
+{
+    uint8_t crc = 0xFF;
+    for (size_t i = 1; i < len; i++) {
+        crc ^= header[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x01) ? (crc >> 1) ^ 0xe0 : crc >> 1;
+        }
+    }
+    return 0xFF - crc;
+}
+
 void LoopbackTerm::start()
 {
     status = status_t::STARTED;
@@ -18,6 +33,49 @@ void LoopbackTerm::stop()
     status = status_t::STOPPED;
 }
 
+std::string LoopbackTerm::at_response(const std::string &command)
+{
+    std::string response;
+    if (command.length() <= 2 || (command.back() != '\r' && command.back() != '+')) {
+        return response;
+    }
+    if (command == "+++") {
+        response = "NO CARRIER\r\n";
+    } else if (command == "ATE1\r" || command == "ATE0\r") {
+        response = "OK\r\n ";
+    } else if (command == "ATO\r") {
+        response = "ERROR\r\n";
+    } else if (command.find("ATD") != std::string::npos) {
+        response = "CONNECT\r\n";
+    } else if (command.find("AT+CSQ\r") != std::string::npos) {
+        response = "+CSQ: 123,456\n\r\nOK\r\n";
+    } else if (command.find("AT+CGMM\r") != std::string::npos) {
+        response = "0G Dummy Model\n\r\nOK\r\n";
+    } else if (command.find("AT+COPS?\r") != std::string::npos) {
+        response = "+COPS: 0,0,\"OperatorName\",5\n\r\nOK\r\n";
+    } else if (command.find("AT+CBC\r") != std::string::npos) {
+        response = is_bg96 ? "+CBC: 1,20,123456\r\r\n\r\nOK\r\n\n\r\n" :
+                   "+CBC: 123.456V\r\r\n\r\nOK\r\n\n\r\n";
+    } else if (command.find("AT+CPIN=1234\r") != std::string::npos) {
+        response = "OK\r\n";
+        pin_ok = true;
+    } else if (command.find("AT+CPIN?\r") != std::string::npos) {
+        response = pin_ok ? "+CPIN: READY\r\nOK\r\n" : "+CPIN: SIM PIN\r\nOK\r\n";
+    } else if (command.find("AT") != std::string::npos) {
+        if (command.length() > 4) {
+            response = command;
+            response[0] = 'O';
+            response[1] = 'K';
+            response[2] = '\r';
+            response[3] = '\n';
+        } else {
+            response = "OK\r\n";
+        }
+
+    }
+    return response;
+}
+
 int LoopbackTerm::write(uint8_t *data, size_t len)
 {
     if (inject_by) {    // injection test: ignore what we write, but respond with injected data
@@ -26,42 +84,7 @@ int LoopbackTerm::write(uint8_t *data, size_t len)
         return len;
     }
     if (len > 2 && (data[len - 1] == '\r' || data[len - 1] == '+') ) { // Simple AT responder
-        std::string command((char *)data, len);
-        std::string response;
-        if (command == "+++") {
-            response = "NO CARRIER\r\n";
-        } else if (command == "ATE1\r" || command == "ATE0\r") {
-            response = "OK\r\n ";
-        } else if (command == "ATO\r") {
-            response = "ERROR\r\n";
-        } else if (command.find("ATD") != std::string::npos) {
-            response = "CONNECT\r\n";
-        } else if (command.find("AT+CSQ\r") != std::string::npos) {
-            response = "+CSQ: 123,456\n\r\nOK\r\n";
-        } else if (command.find("AT+CGMM\r") != std::string::npos) {
-            response = "0G Dummy Model\n\r\nOK\r\n";
-        } else if (command.find("AT+COPS?\r") != std::string::npos) {
-            response = "+COPS: 0,0,\"OperatorName\",5\n\r\nOK\r\n";
-        } else if (command.find("AT+CBC\r") != std::string::npos) {
-            response = is_bg96 ? "+CBC: 1,20,123456\r\r\n\r\nOK\r\n\n\r\n" :
-                       "+CBC: 123.456V\r\r\n\r\nOK\r\n\n\r\n";
-        } else if (command.find("AT+CPIN=1234\r") != std::string::npos) {
-            response = "OK\r\n";
-            pin_ok = true;
-        } else if (command.find("AT+CPIN?\r") != std::string::npos) {
-            response = pin_ok ? "+CPIN: READY\r\nOK\r\n" : "+CPIN: SIM PIN\r\nOK\r\n";
-        } else if (command.find("AT") != std::string::npos) {
-            if (command.length() > 4) {
-                response = command;
-                response[0] = 'O';
-                response[1] = 'K';
-                response[2] = '\r';
-                response[3] = '\n';
-            } else {
-                response = "OK\r\n";
-            }
-
-        }
+        std::string response = at_response(std::string((char *)data, len));
         if (!response.empty()) {
             data_len = response.length();
             loopback_data.resize(data_len);
@@ -71,12 +94,31 @@ int LoopbackTerm::write(uint8_t *data, size_t len)
         }
     }
     if (len > 2 && data[0] == 0xf9) { // Simple CMUX responder
+        size_t header_len = (len > 3 && (data[3] & 1) == 0) ? 5 : 4;
+        if (data[2] == 0xef && len > header_len + 2) { // AT command in a whole frame -> reply in a frame
+            std::string response = at_response(std::string((char *)data + header_len, len - header_len - 2));
+            if (!response.empty()) {
+                uint8_t header[] = { 0xf9, data[1], 0xff, (uint8_t)((response.length() << 1) | 1) };
+                uint8_t footer[] = { fcs(header, sizeof(header)), 0xf9 };
+                loopback_data.resize(data_len);
+                loopback_data.insert(loopback_data.end(), header, header + sizeof(header));
+                loopback_data.insert(loopback_data.end(), response.begin(), response.end());
+                loopback_data.insert(loopback_data.end(), footer, footer + sizeof(footer));
+                data_len = loopback_data.size();
+                auto ret = std::async(on_read, nullptr, data_len);
+                return len;
+            }
+        }
         // turn the request into a reply -> implements CMUX loopback
         if (data[2] == 0x3f || data[2] == 0x53) {  // SABM command
             data[2] = 0x73;
         } else if (data[2] == 0xef) { // Generic request
             data[2] = 0xff;         // generic reply
         }
+        size_t fcs_pos = header_len + (data[3] >> 1) + (header_len == 5 ? data[4] << 7 : 0);
+        if (fcs_pos < len) {
+            data[fcs_pos] = fcs(data, header_len);
+        }
     }
     loopback_data.resize(data_len + len);
     memcpy(&loopback_data[data_len], data, len);
@@ -5,6 +5,7 @@
  */
 #pragma once
 
+#include <string>
 #include "cxx_include/esp_modem_api.hpp"
 #include "cxx_include/esp_modem_terminal.hpp"
 
@@ -38,6 +39,11 @@ public:
     }
 
 private:
+    /**
+     * @brief Reply of the simple AT responder, empty if the command is not answered
+     */
+    std::string at_response(const std::string &command);
+
     enum class status_t {
         STARTED,
         STOPPED
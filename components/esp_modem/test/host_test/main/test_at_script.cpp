@@ -0,0 +1,231 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#include <memory>
+#include <map>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include "catch.hpp"
+#include "cxx_include/esp_modem_dte.hpp"
+
+using namespace esp_modem;
+
+/**
+ * @brief Fake modem answering each command with scripted replies, from its own thread like a UART driver
+ *
+ * The n-th write of a command gets the n-th reply of its list, the last reply is repeated.
+ * An empty reply leaves the command unanswered. Replies are posted after reply_delay_ms,
+ * in chunks of up to chunk bytes (everything at once if 0).
+ */
+class ScriptedModemTerm : public Terminal {
+public:
+    explicit ScriptedModemTerm(uint32_t reply_delay_ms, size_t chunk = 0):
+        reply_delay_ms(reply_delay_ms), chunk(chunk), worker(&ScriptedModemTerm::run, this) {}
+
+    ~ScriptedModemTerm() override
+    {
+        {
+            std::lock_guard<std::mutex> l(m);
+            exit = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+    void reply(const std::string &command, std::vector<std::string> replies)
+    {
+        std::lock_guard<std::mutex> l(m);
+        script[command] = std::move(replies);
+    }
+
+    int write(uint8_t *data, size_t len) override
+    {
+        std::string command((char *)data, len);
+        if (command.empty() || command.back() != '\r') {
+            return len;
+        }
+        command.pop_back();
+        std::lock_guard<std::mutex> l(m);
+        written.push_back(command);
+        auto &replies = script[command];
+        size_t n = sent[command]++;
+        std::string reply = replies.empty() ? "ERROR\r\n" : replies[std::min(n, replies.size() - 1)];
+        if (!reply.empty()) {
+            queue.push_back({std::chrono::steady_clock::now() + std::chrono::milliseconds(reply_delay_ms), "\r\n" + reply});
+            cv.notify_all();
+        }
+        return len;
+    }
+
+    int read(uint8_t *data, size_t len) override
+    {
+        std::lock_guard<std::mutex> l(m);
+        len = std::min(len, pending.size());
+        std::copy(pending.begin(), pending.begin() + len, data);
+        pending.erase(0, len);
+        return len;
+    }
+
+    void start() override { }
+    void stop() override { }
+
+    std::vector<std::string> writes()
+    {
+        std::lock_guard<std::mutex> l(m);
+        return written;
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> l(m);
+        while (!exit) {
+            if (queue.empty()) {
+                cv.wait(l);
+                continue;
+            }
+            auto due = queue.front().first;
+            if (cv.wait_until(l, due) != std::cv_status::timeout && std::chrono::steady_clock::now() < due) {
+                continue;
+            }
+            std::string reply = queue.front().second;
+            queue.pop_front();
+            for (size_t pos = 0; pos < reply.size(); ) {
+                size_t len = chunk ? std::min(chunk, reply.size() - pos) : reply.size();
+                pending.append(reply, pos, len);
+                pos += len;
+                size_t available = pending.size();
+                l.unlock();
+                on_read(nullptr, available);
+                l.lock();
+            }
+        }
+    }
+
+    uint32_t reply_delay_ms;
+    size_t chunk;
+    std::mutex m;
+    std::condition_variable cv;
+    bool exit{false};
+    std::map<std::string, std::vector<std::string>> script;
+    std::map<std::string, size_t> sent;
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> queue;
+    std::string pending;
+    std::vector<std::string> written;
+    std::thread worker;
+};
+
+static const std::vector<at_step> bring_up = {
+    { "ATE0", "", 500, 0, 0, true },
+    { "AT+CPIN?", "+CPIN:", 500, 9, 20, false },
+    { "AT+QICSGP=1,1,\"internet\",\"\",\"\",0", "", 500, 0, 0, false },
+    { "AT+QCFG=\"roamservice\",2,1", "", 500, 0, 0, false },
+    { "AT+CREG=2", "", 500, 0, 0, true },
+    { "AT+CSQ", "+CSQ:", 500, 0, 0, false },
+};
+
+static void script_modem(ScriptedModemTerm *modem)
+{
+    modem->reply("ATE0", { "OK\r\n" });
+    modem->reply("AT+CPIN?", { "+CME ERROR: 14\r\n", "+CME ERROR: 14\r\n", "+CPIN: READY\r\n\r\nOK\r\n" });
+    modem->reply("AT+QICSGP=1,1,\"internet\",\"\",\"\",0", { "OK\r\n" });
+    modem->reply("AT+QCFG=\"roamservice\",2,1", { "OK\r\n" });
+    modem->reply("AT+CREG=2", { "OK\r\n" });
+    modem->reply("AT+CSQ", { "+CSQ: 23,99\r\n\r\nOK\r\n" });
+}
+
+TEST_CASE("AT script runs a modem bring-up", "[esp_modem][at_script]")
+{
+    for (size_t chunk : { 0, 1, 5 }) {
+        auto term = std::make_unique<ScriptedModemTerm>(2, chunk);
+        auto modem = term.get();
+        script_modem(modem);
+        DTE dte(std::move(term));
+        std::vector<at_step_result> results;
+        CHECK(dte.run_script(bring_up, results) == command_result::OK);
+        REQUIRE(results.size() == bring_up.size());
+        for (auto &r : results) {
+            CHECK(r.result == command_result::OK);
+            CHECK(r.latency_ms < 200);
+        }
+        // the SIM is retried until ready, then the reply is kept
+        CHECK(results[1].attempts == 3);
+        CHECK(results[1].response == "+CPIN: READY");
+        CHECK(results[1].latency_ms >= 2 * 20);
+        CHECK(results[5].response == "+CSQ: 23,99");
+        auto writes = modem->writes();
+        CHECK(writes.size() == bring_up.size() + 2);
+        CHECK(writes.back() == "AT+CSQ");
+    }
+}
+
+TEST_CASE("AT script failures", "[esp_modem][at_script]")
+{
+    SECTION("optional steps are skipped, the others stop the script") {
+        auto term = std::make_unique<ScriptedModemTerm>(1);
+        auto modem = term.get();
+        script_modem(modem);
+        modem->reply("ATE0", { "ERROR\r\n" });
+        modem->reply("AT+QCFG=\"roamservice\",2,1", { "+CME ERROR: 3\r\n" });
+        DTE dte(std::move(term));
+        std::vector<at_step_result> results;
+        CHECK(dte.run_script(bring_up, results) == command_result::FAIL);
+        CHECK(results[0].result == command_result::FAIL);
+        CHECK(results[1].result == command_result::OK);
+        CHECK(results[3].result == command_result::FAIL);
+        CHECK(results[3].response == "+CME ERROR: 3");
+        CHECK(results[4].attempts == 0);
+        CHECK(results[5].attempts == 0);
+    }
+    SECTION("OK without the expected response fails") {
+        auto term = std::make_unique<ScriptedModemTerm>(1);
+        auto modem = term.get();
+        script_modem(modem);
+        modem->reply("AT+CSQ", { "OK\r\n" });
+        DTE dte(std::move(term));
+        std::vector<at_step_result> results;
+        CHECK(dte.run_script(bring_up, results) == command_result::FAIL);
+        CHECK(results[5].attempts == 1);
+    }
+    SECTION("an unanswered command times out") {
+        auto term = std::make_unique<ScriptedModemTerm>(1);
+        auto modem = term.get();
+        script_modem(modem);
+        modem->reply("AT+CREG=2", { "" });
+        DTE dte(std::move(term));
+        std::vector<at_step_result> results;
+        auto start = std::chrono::steady_clock::now();
+        CHECK(dte.run_script(bring_up, results) == command_result::OK);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        CHECK(results[4].result == command_result::TIMEOUT);
+        CHECK(results[4].latency_ms >= 500);
+        CHECK(results[5].result == command_result::OK);
+        CHECK(elapsed.count() < 1000);
+    }
+}
+
+TEST_CASE("AT script latency", "[esp_modem][at_script][benchmark]")
+{
+    const uint32_t reply_delay_ms = 5;  // a modem answering within a few ms at 921600 baud
+    auto term = std::make_unique<ScriptedModemTerm>(reply_delay_ms);
+    script_modem(term.get());
+    term->reply("AT+CPIN?", { "+CPIN: READY\r\n\r\nOK\r\n" });
+    DTE dte(std::move(term));
+    std::vector<at_step_result> results;
+    auto start = std::chrono::steady_clock::now();
+    CHECK(dte.run_script(bring_up, results) == command_result::OK);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    for (size_t i = 0; i < results.size(); i++) {
+        printf("%-40s %3d ms\n", bring_up[i].command.c_str(), (int)results[i].latency_ms);
+    }
+    printf("AT script of %zu commands with %d ms replies: %.1f ms\n", bring_up.size(), (int)reply_delay_ms, elapsed.count());
+    // each command follows the previous reply right away, there is no polling quantum
+    CHECK(elapsed.count() < bring_up.size() * (reply_delay_ms + 10));
+}
@@ -0,0 +1,298 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#include <memory>
+#include <vector>
+#include <deque>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "catch.hpp"
+#include "cxx_include/esp_modem_cmux.hpp"
+
+using namespace esp_modem;
+
+static uint8_t fcs(const uint8_t *header, size_t len)
+{
+    uint8_t crc = 0xFF;
+    for (size_t i = 1; i < len; i++) {
+        crc ^= header[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x01) ? (crc >> 1) ^ 0xe0 : crc >> 1;
+        }
+    }
+    return 0xFF - crc;
+}
+
+/**
+ * @brief Terminal replaying a CMUX byte stream in chunks, as a UART driver would post it.
+ * SABM requests are answered with UA, so the CMux can be initialized on it
+ */
+class FeedTerm : public Terminal {
+public:
+    explicit FeedTerm(uint32_t seed): rng(seed) {}
+
+    int write(uint8_t *data, size_t len) override
+    {
+        if (len == 6 && data[0] == 0xF9 && data[2] == 0x3F) {  // SABM -> UA
+            uint8_t ua[] = { 0xF9, data[1], 0x73, 0x01, 0x00, 0xF9 };
+            ua[4] = fcs(ua, 4);
+            feed(ua, sizeof(ua), 0);
+        }
+        return len;
+    }
+    int read(uint8_t *data, size_t len) override
+    {
+        len = std::min(len, pending.size());
+        if (max_chunk) {
+            len = std::min<size_t>(len, std::uniform_int_distribution<size_t>(1, max_chunk)(rng));
+        }
+        std::copy(pending.begin(), pending.begin() + len, data);
+        pending.erase(pending.begin(), pending.begin() + len);
+        reads++;
+        return len;
+    }
+    void start() override { }
+    void stop() override { }
+
+    /**
+     * @brief Posts a byte stream, each read returns 1 to max_chunk bytes of it (everything pending if 0)
+     */
+    void feed(const uint8_t *data, size_t len, size_t chunk)
+    {
+        max_chunk = chunk;
+        pending.insert(pending.end(), data, data + len);
+        while (!pending.empty()) {
+            on_read(nullptr, pending.size());
+        }
+    }
+
+    size_t reads{};
+
+private:
+    std::mt19937 rng;
+    std::deque<uint8_t> pending;
+    size_t max_chunk{};
+};
+
+static void add_frame(std::vector<uint8_t> &stream, uint8_t dlci, const uint8_t *payload, size_t len, bool shared_flag = false)
+{
+    if (!shared_flag || stream.empty()) {
+        stream.push_back(0xF9);
+    }
+    size_t header = stream.size() - 1;
+    stream.push_back((dlci << 2) | 0x03);
+    stream.push_back(0xEF);
+    if (len > 127) {
+        stream.push_back((len & 0x7F) << 1);
+        stream.push_back(len >> 7);
+    } else {
+        stream.push_back((len << 1) | 1);
+    }
+    size_t header_len = stream.size() - header;
+    stream.insert(stream.end(), payload, payload + len);
+    stream.push_back(fcs(&stream[header], header_len));   // of the UIH header only
+    stream.push_back(0xF9);
+}
+
+static void add_frame(std::vector<uint8_t> &stream, uint8_t dlci, const std::string &payload, bool shared_flag = false)
+{
+    add_frame(stream, dlci, (const uint8_t *)payload.data(), payload.size(), shared_flag);
+}
+
+static std::shared_ptr<CMux> create_cmux(const std::shared_ptr<FeedTerm> &term, size_t buffer_size, bool defragment)
+{
+    auto cmux = std::make_shared<CMux>(term, unique_buffer(buffer_size));
+    cmux->set_defragment(defragment);
+    CHECK(cmux->init());
+    return cmux;
+}
+
+TEST_CASE("CMUX read of a modem session", "[esp_modem][cmux]")
+{
+    // AT replies on DLCI 1, an MSC on DLCI 0 and PPP frames on DLCI 2, as sent by the modem after AT+CMUX=0
+    const std::vector<std::string> at_replies = { "\r\nOK\r\n", "\r\n+CSQ: 23,99\r\n\r\nOK\r\n",
+                                                  "\r\n+CGREG: 0,1\r\n\r\nOK\r\n", "\r\nCONNECT 150000000\r\n"
+                                                };
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> ppp;
+    const uint8_t msc[] = { 0xE3, 0x05, 0x07, 0x0D };
+    add_frame(stream, 0, msc, sizeof(msc));
+    for (size_t i = 0; i < at_replies.size(); i++) {
+        add_frame(stream, 1, at_replies[i], i % 2);    // alternate a flag shared by two frames
+    }
+    stream.push_back(0xF9);     // and an empty frame
+    for (size_t len : { 24, 127, 128, 300, 64 }) {
+        std::vector<uint8_t> packet(len);
+        for (size_t i = 0; i < len; i++) {
+            packet[i] = i == 0 || i == len - 1 ? 0x7E : (i * 13) & 0xFF;
+        }
+        add_frame(stream, 2, packet.data(), len);
+        ppp.insert(ppp.end(), packet.begin(), packet.end());
+    }
+
+    for (bool defragment : { true, false }) {
+        for (size_t chunk : { 0, 1, 2, 3, 7, 64, 200 }) {
+            auto term = std::make_shared<FeedTerm>(chunk);
+            auto cmux = create_cmux(term, 1024, defragment);
+            std::vector<std::string> at;
+            std::string at_stream;
+            std::vector<uint8_t> data;
+            cmux->set_read_cb(0, [&](uint8_t *payload, size_t len) {
+                at.emplace_back((char *)payload, len);
+                at_stream.append((char *)payload, len);
+                return false;
+            });
+            cmux->set_read_cb(1, [&](uint8_t *payload, size_t len) {
+                data.insert(data.end(), payload, payload + len);
+                return false;
+            });
+            for (int lap = 0; lap < 3; lap++) {     // the frames cross the end of the ring
+                term->feed(stream.data(), stream.size(), chunk);
+            }
+            if (defragment) {   // each reply is posted whole
+                CHECK(at.size() == 3 * at_replies.size());
+                for (size_t i = 0; i < at.size(); i++) {
+                    CHECK(at[i] == at_replies[i % at_replies.size()]);
+                }
+            }
+            std::string expected_at;
+            std::vector<uint8_t> expected_ppp;
+            for (int lap = 0; lap < 3; lap++) {
+                for (auto &reply : at_replies) {
+                    expected_at += reply;
+                }
+                expected_ppp.insert(expected_ppp.end(), ppp.begin(), ppp.end());
+            }
+            CHECK(at_stream == expected_at);
+            CHECK(data == expected_ppp);
+        }
+    }
+}
+
+TEST_CASE("CMUX read drops frames with a bad FCS", "[esp_modem][cmux]")
+{
+    // bit errors in the address, which move a frame to the other DLCI, and in the length of a frame,
+    // each with the SOF where it is expected, so only the FCS tells
+    std::vector<uint8_t> stream;
+    std::string expected[2];
+    for (int i = 0; i < 30; i++) {
+        uint8_t dlci = 1 + i % 2;
+        std::string payload = "frame " + std::to_string(i) + " on DLCI " + std::to_string(dlci);
+        size_t start = stream.size();
+        add_frame(stream, dlci, payload);
+        if (i % 3 == 0) {
+            stream[start + 1] ^= 0x0C;
+        } else if (i % 3 == 1 && i % 2) {
+            payload += "!";     // the header of a frame one byte longer, the payload one byte short
+            stream.erase(stream.begin() + start, stream.end());
+            add_frame(stream, dlci, payload);
+            stream[start + 3] -= 2;
+            stream.erase(stream.end() - 3);
+        } else {
+            expected[dlci - 1] += payload;
+        }
+    }
+    for (size_t chunk : { 0, 1, 5 }) {
+        auto term = std::make_shared<FeedTerm>(chunk);
+        auto cmux = create_cmux(term, 512, true);
+        std::string received[2];
+        for (int i = 0; i < 2; i++) {
+            cmux->set_read_cb(i, [&received, i](uint8_t *payload, size_t len) {
+                received[i].append((char *)payload, len);
+                return false;
+            });
+        }
+        term->feed(stream.data(), stream.size(), chunk);
+        CHECK(received[0] == expected[0]);
+        CHECK(received[1] == expected[1]);
+    }
+}
+
+/**
+ * @brief Payload of a numbered test frame, the bytes follow from the number and avoid the SOF marker
+ */
+static void fill_payload(uint8_t *payload, size_t len, uint32_t seq)
+{
+    for (size_t i = 0; i < len; i++) {
+        uint8_t byte = i < 4 ? (seq >> (7 * i)) & 0x7F : seq * 31 + i;
+        payload[i] = byte == 0xF9 ? 0x7E : byte;
+    }
+}
+
+struct ReadStats {
+    size_t frames;
+    size_t received;
+    size_t bogus;
+    double mbps;
+};
+
+static ReadStats run_read_benchmark(size_t buffer_size, size_t max_frame_len, size_t max_chunk, size_t total, double drop_rate)
+{
+    std::mt19937 rng(1234);
+    auto term = std::make_shared<FeedTerm>(5678);
+    auto cmux = create_cmux(term, buffer_size, true);
+    ReadStats stats = { };
+    std::vector<uint8_t> expected(max_frame_len);
+    cmux->set_read_cb(1, [&](uint8_t *payload, size_t len) {
+        uint32_t seq = len >= 4 ? payload[0] | payload[1] << 7 | payload[2] << 14 | payload[3] << 21 : 0;
+        if (len >= 4 && len <= max_frame_len) {
+            fill_payload(expected.data(), len, seq);
+        }
+        if (len >= 4 && len <= max_frame_len && memcmp(payload, expected.data(), len) == 0) {
+            stats.received++;
+        } else {
+            stats.bogus++;
+        }
+        return false;
+    });
+
+    // build the stream ahead, so only the parser is timed
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> payload(max_frame_len);
+    stream.reserve(total + total / 16);
+    while (stream.size() < total) {
+        size_t len = std::uniform_int_distribution<size_t>(4, max_frame_len)(rng);
+        fill_payload(payload.data(), len, stats.frames++);
+        size_t start = stream.size();
+        add_frame(stream, 2, payload.data(), len);
+        if (drop_rate > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < drop_rate) {
+            // lose a few bytes of this frame, like a UART overrun
+            size_t at = std::uniform_int_distribution<size_t>(start, stream.size() - 2)(rng);
+            stream.erase(stream.begin() + at, stream.begin() + std::min(at + 3, stream.size()));
+        }
+    }
+    auto start = std::chrono::steady_clock::now();
+    const size_t batch = 64 * 1024;
+    for (size_t offset = 0; offset < stream.size(); offset += batch) {
+        term->feed(stream.data() + offset, std::min(batch, stream.size() - offset), max_chunk);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    stats.mbps = stream.size() / elapsed.count() / 1e6;
+    printf("CMUX read, buffer %zu, frames up to %zu bytes, reads up to %zu bytes, drop rate %.3f: "
+           "%zu frames, %zu lost, %zu bogus, %.1f MB/s\n", buffer_size, max_frame_len, max_chunk, drop_rate,
+           stats.frames, stats.frames - stats.received, stats.bogus, stats.mbps);
+    return stats;
+}
+
+TEST_CASE("CMUX read benchmark", "[esp_modem][cmux][benchmark]")
+{
+    const size_t total = 8 * 1024 * 1024;
+    // CAT1 defaults: 127 byte frames, 512 byte DTE buffer, the UART posting up to 120 bytes
+    for (size_t chunk : { 120, 1024 }) {
+        auto stats = run_read_benchmark(512, 127, chunk, total, 0);
+        CHECK(stats.received == stats.frames);
+        CHECK(stats.bogus == 0);
+    }
+    // long frames with the 2 byte length field
+    auto stats = run_read_benchmark(4096, 1500, 4096, total, 0);
+    CHECK(stats.received == stats.frames);
+    CHECK(stats.bogus == 0);
+    // lossy link: a corrupted frame is lost, the parser recovers on the next SOF
+    stats = run_read_benchmark(512, 127, 120, total / 8, 0.01);
+    CHECK(stats.received > stats.frames * 95 / 100);
+}
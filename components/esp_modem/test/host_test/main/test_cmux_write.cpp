@@ -0,0 +1,129 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include "catch.hpp"
+#include "cxx_include/esp_modem_cmux.hpp"
+
+using namespace esp_modem;
+
+/**
+ * @brief Terminal which keeps everything written to it and counts the write calls,
+ * each of which is a syscall (or a UART driver call) on a real terminal
+ */
+class CountingTerm : public Terminal {
+public:
+    int write(uint8_t *data, size_t len) override
+    {
+        writes++;
+        written.insert(written.end(), data, data + len);
+        return len;
+    }
+    int read(uint8_t *data, size_t len) override
+    {
+        return 0;
+    }
+    void start() override { }
+    void stop() override { }
+
+    std::vector<uint8_t> written;
+    size_t writes{};
+};
+
+static uint8_t fcs(const uint8_t *header, size_t len)
+{
+    uint8_t crc = 0xFF;
+    for (size_t i = 1; i < len; i++) {
+        crc ^= header[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x01) ? (crc >> 1) ^ 0xe0 : crc >> 1;
+        }
+    }
+    return 0xFF - crc;
+}
+
+/**
+ * @brief Decodes the UIH frames of a CMUX stream, checking the framing and the FCS
+ * @return payload of all frames, empty on a framing error
+ */
+static std::vector<uint8_t> decode(const std::vector<uint8_t> &stream, size_t max_frame_len, size_t &frames)
+{
+    std::vector<uint8_t> payload;
+    size_t pos = 0;
+    frames = 0;
+    while (pos < stream.size()) {
+        const uint8_t *frame = &stream[pos];
+        if (stream.size() - pos < 6 || frame[0] != 0xF9 || frame[2] != 0xEF) {
+            return {};
+        }
+        size_t header_len = (frame[3] & 1) ? 4 : 5;
+        size_t len = frame[3] >> 1;
+        if (header_len == 5) {
+            len |= frame[4] << 7;
+        }
+        if (len > max_frame_len || pos + header_len + len + 2 > stream.size() ||
+                frame[header_len + len] != fcs(frame, header_len) || frame[header_len + len + 1] != 0xF9) {
+            return {};
+        }
+        payload.insert(payload.end(), frame + header_len, frame + header_len + len);
+        pos += header_len + len + 2;
+        frames++;
+    }
+    return payload;
+}
+
+TEST_CASE("CMUX write builds whole frames", "[esp_modem][cmux]")
+{
+    std::vector<uint8_t> data(3000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = i * 7 + (i >> 8);
+    }
+    for (size_t max_frame_len : { 1, 31, 127, 128, 1500, 32767 }) {
+        for (size_t len : { 1, 127, 128, 1500, 3000 }) {
+            auto term = std::make_shared<CountingTerm>();
+            auto cmux = std::make_shared<CMux>(term, unique_buffer(1024));
+            size_t frames = 0;
+            CHECK(cmux->set_max_frame_len(max_frame_len));
+            CHECK(cmux->write(1, data.data(), len) == (int)len);
+            auto payload = decode(term->written, max_frame_len, frames);
+            CHECK(payload == std::vector<uint8_t>(data.begin(), data.begin() + len));
+            CHECK(frames == (len + max_frame_len - 1) / max_frame_len);
+            CHECK(term->written[1] == ((2 << 2) | 1));    // DLCI 2 is the second virtual terminal
+        }
+    }
+    auto cmux = std::make_shared<CMux>(std::make_shared<CountingTerm>(), unique_buffer(1024));
+    CHECK(cmux->set_max_frame_len(0) == false);
+    CHECK(cmux->set_max_frame_len(CMUX_MAX_FRAME_LEN + 1) == false);
+}
+
+TEST_CASE("CMUX write benchmark", "[esp_modem][cmux][benchmark]")
+{
+    const size_t image_len = 300 * 1024;    // a JPEG uploaded over PPP
+    const size_t ppp_write_len = 1500;      // PPP writes about one packet at a time
+    std::vector<uint8_t> data(ppp_write_len, 0x55);
+
+    for (size_t max_frame_len : { 127, 1500 }) {
+        auto term = std::make_shared<CountingTerm>();
+        auto cmux = std::make_shared<CMux>(term, unique_buffer(1024));
+        CHECK(cmux->set_max_frame_len(max_frame_len));
+        term->written.reserve(image_len * 11 / 10);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t sent = 0; sent < image_len; sent += ppp_write_len) {
+            cmux->write(1, data.data(), std::min(ppp_write_len, image_len - sent));
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        size_t frames = 0;
+        CHECK(decode(term->written, max_frame_len, frames).size() == image_len);
+        printf("CMUX write, frames up to %zu bytes: %zu bytes in %zu frames, %zu writes, "
+               "%.0f bytes per write, %.1f MB/s\n", max_frame_len, term->written.size(), frames,
+               term->writes, (double)term->written.size() / term->writes,
+               term->written.size() / elapsed.count() / 1e6);
+        // one write per PPP write, not three per frame
+        CHECK(term->writes == (image_len + ppp_write_len - 1) / ppp_write_len);
+    }
+}
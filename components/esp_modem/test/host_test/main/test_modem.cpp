@@ -219,7 +219,7 @@ TEST_CASE("Test CMUX protocol by injecting payloads", "[esp_modem]")
     CHECK(dce->set_mode(esp_modem::modem_mode::CMUX_MODE) == true);
     const auto test_command = "Test\n";
     // 1 byte payload size
-    uint8_t test_payload[] = {0xf9, 0x09, 0xff, 0x0b, 0x54, 0x65, 0x73, 0x74, 0x0a, 0xbb, 0xf9 };
+    uint8_t test_payload[] = {0xf9, 0x09, 0xff, 0x0b, 0x54, 0x65, 0x73, 0x74, 0x0a, 0x29, 0xf9 };
     loopback->inject(&test_payload[0], sizeof(test_payload), 1);
     auto ret = dce->command(test_command, [&](uint8_t *data, size_t len) {
         std::string response((char *) data, len);
@@ -233,7 +233,7 @@ TEST_CASE("Test CMUX protocol by injecting payloads", "[esp_modem]")
     long_payload[5]   = 0x7e;   // payload to validate
     long_payload[449] = 0x7e;
     long_payload[450] = '\n';
-    long_payload[451] = 0x53;   // footer
+    long_payload[451] = 0xc6;   // footer
     long_payload[452] = 0xf9;
     for (int i = 0; i < 5; ++i) {
         // inject the whole payload (i=0) and then per 1,2,3,4 bytes (i)
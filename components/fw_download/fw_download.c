@@ -0,0 +1,81 @@
+#include <string.h>
+#include "fw_download.h"
+
+bool fw_download_resumable(const fwDownloadProgress_t *p, uint32_t checksum, uint32_t partition)
+{
+    return p->checksum == checksum && p->partition == partition && p->offset > 0 && p->offset < p->total;
+}
+
+int fw_download_run(const fwDownload_t *dl, fwDownloadProgress_t *p)
+{
+    bool resume = fw_download_resumable(p, dl->checksum, dl->partition);
+    bool started = false;
+    int status = 0;
+    int64_t length = -1;
+    size_t fill = 0;
+    int ret = FW_DL_OK;
+
+    if (dl->chunk_size == 0) {
+        return FW_DL_ERR_REFUSED;
+    }
+    if (!resume) {
+        memset(p, 0, sizeof(fwDownloadProgress_t));
+        p->checksum = dl->checksum;
+        p->partition = dl->partition;
+    }
+    if (dl->open(dl->ctx, resume ? p->offset : 0, &status, &length) != 0) {
+        return FW_DL_ERR_DROPPED;
+    }
+    if (resume && status == 206 && length > 0 && p->offset + length == p->total) {
+        started = dl->resume(dl->ctx, p->offset) == 0;
+        if (!started) {
+            ret = FW_DL_ERR_WRITE;
+        }
+    } else if (status == 200 && length > 0 && length <= dl->max_size) {
+        // a new download, or the server does not serve ranges: from the start
+        p->offset = 0;
+        p->crc = 0;
+        p->total = length;
+    } else {
+        ret = FW_DL_ERR_REFUSED;
+    }
+
+    while (ret == FW_DL_OK && p->offset < p->total) {
+        size_t want = dl->chunk_size - fill;
+        if (want > p->total - p->offset - fill) {
+            want = p->total - p->offset - fill;
+        }
+        int len = dl->read(dl->ctx, dl->buf + fill, want);
+        if (len <= 0) {
+            ret = FW_DL_ERR_DROPPED;
+            break;
+        }
+        fill += len;
+        if (fill < dl->chunk_size && p->offset + fill < p->total) {
+            continue;
+        }
+        if (!started) {
+            // the first chunk holds the image header
+            if (dl->start(dl->ctx, dl->buf, fill, p->total) != 0) {
+                ret = FW_DL_ERR_WRITE;
+                break;
+            }
+            started = true;
+        }
+        if (dl->write(dl->ctx, dl->buf, fill) != 0) {
+            ret = FW_DL_ERR_WRITE;
+            break;
+        }
+        p->crc = dl->crc32(p->crc, dl->buf, fill);
+        p->offset += fill;
+        fill = 0;
+    }
+
+    if (ret == FW_DL_OK && p->crc != dl->checksum) {
+        ret = FW_DL_ERR_CRC;
+    }
+    if (ret != FW_DL_OK && ret != FW_DL_ERR_DROPPED) {
+        memset(p, 0, sizeof(fwDownloadProgress_t));
+    }
+    return ret;
+}
@@ -0,0 +1,114 @@
+#ifndef __FW_DOWNLOAD_H__
+#define __FW_DOWNLOAD_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Resumable firmware download.
+ *
+ * The image is read in chunks of the buffer size and each chunk is written before the next
+ * one is read, with a running CRC32. The progress (the image, its length, the bytes written
+ * and their CRC32) is kept by the caller across connections and wakes: a download cut by
+ * the link asks for the rest of the image with a Range from the last chunk written. A server
+ * that answers the Range with the whole image (200) restarts the download from zero, any
+ * other answer, or a different image, drops the progress.
+ */
+
+enum {
+    FW_DL_OK = 0,
+    FW_DL_ERR_DROPPED = -1,     /* The connection failed or dropped, the progress is kept for a resume */
+    FW_DL_ERR_REFUSED = -2,     /* Status or length of the answer not acceptable */
+    FW_DL_ERR_WRITE = -3,       /* The image was refused or could not be written */
+    FW_DL_ERR_CRC = -4,         /* Complete, but the CRC32 of the image does not match */
+};
+
+/**
+ * @brief Progress of a download, to keep where it survives the connection (RTC memory)
+ */
+typedef struct fwDownloadProgress {
+    uint32_t checksum;          /* CRC32 of the whole image, as announced by the server */
+    uint32_t total;             /* Image length */
+    uint32_t offset;            /* Bytes written */
+    uint32_t crc;               /* CRC32 of the bytes written */
+    uint32_t partition;         /* Where the image is written */
+} fwDownloadProgress_t;
+
+/**
+ * @brief Download of one image
+ */
+typedef struct fwDownload {
+    uint32_t checksum;          /* CRC32 of the whole image */
+    uint32_t partition;         /* Where the image is written, a progress for another one is dropped */
+    uint32_t max_size;          /* Longest image */
+    uint8_t *buf;               /* Chunk buffer */
+    size_t chunk_size;          /* Its size, the bytes written at a time */
+    void *ctx;
+
+    /**
+     * @brief Open the connection and read the headers of the answer
+     * @param offset Offset to ask a Range from, 0 for the whole image
+     * @param status HTTP status
+     * @param length Content length, -1 if unknown
+     * @return 0 if the answer headers were read
+     */
+    int (*open)(void *ctx, uint32_t offset, int *status, int64_t *length);
+
+    /**
+     * @brief Read body bytes
+     * @return Bytes read, 0 or less when the connection dropped
+     */
+    int (*read)(void *ctx, uint8_t *buf, size_t len);
+
+    /**
+     * @brief Start writing a new image, with its first chunk to check the image header
+     * @return 0 on success
+     */
+    int (*start)(void *ctx, const uint8_t *head, size_t len, uint32_t total);
+
+    /**
+     * @brief Go on writing an image begun before, at an offset
+     * @return 0 on success
+     */
+    int (*resume)(void *ctx, uint32_t offset);
+
+    /**
+     * @brief Write the next chunk
+     * @return 0 on success
+     */
+    int (*write)(void *ctx, const uint8_t *chunk, size_t len);
+
+    /**
+     * @brief CRC32 as esp_rom_crc32_le() and zlib compute it
+     * @param crc CRC of the bytes before, 0 to start
+     */
+    uint32_t (*crc32)(uint32_t crc, const uint8_t *buf, size_t len);
+} fwDownload_t;
+
+/**
+ * @brief Whether a download would resume from the progress
+ * @param p Progress kept from an earlier download
+ * @param checksum CRC32 of the image to download
+ * @param partition Where it is written
+ */
+bool fw_download_resumable(const fwDownloadProgress_t *p, uint32_t checksum, uint32_t partition);
+
+/**
+ * @brief Download the image over one connection, resuming the progress if it is for this image
+ * @param dl Download
+ * @param p Progress, zeroed or kept from an earlier download. On FW_DL_OK it holds the
+ * whole image, it is dropped on errors other than FW_DL_ERR_DROPPED
+ * @return FW_DL_OK when the whole image is written and its CRC32 matches, else FW_DL_ERR_*
+ */
+int fw_download_run(const fwDownload_t *dl, fwDownloadProgress_t *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FW_DOWNLOAD_H__ */
@@ -0,0 +1,398 @@
+/*
+ * Downloads an image from a local HTTP server that cuts the connection part way, as the
+ * firmware downloads over a link that drops: each attempt opens a new connection, the
+ * progress is kept as RTC memory keeps it, and the flash keeps what was written. The
+ * server serves Range requests or not, and the image can change between attempts.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "fw_download.h"
+#include "host_test.h"
+
+#define IMAGE_LEN       300000
+#define CHUNK_SIZE      4096
+#define MAX_ATTEMPTS    10
+#define MAX_DROPS       8
+#define SEND_PIECE      1460        /* The server writes the body a TCP segment at a time */
+
+/**
+ * @brief The HTTP server, one connection at a time
+ */
+typedef struct server {
+    int fd;
+    uint16_t port;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    const uint8_t *image;
+    size_t len;
+    bool ranges;                /* Answers a Range with 206, else with the whole image */
+    int range_skew;             /* Added to the length of a 206 answer */
+    size_t drops[MAX_DROPS];    /* Body bytes sent before the connection is cut, for the next connections */
+    int ndrops;
+    int connections;
+    int ranged;                 /* Requests with a Range */
+    size_t sent;                /* Body bytes sent */
+} server_t;
+
+/**
+ * @brief The device: the update partition and the writer state, lost at a reset
+ */
+typedef struct device {
+    uint16_t port;
+    int fd;
+    uint8_t flash[IMAGE_LEN];
+    size_t pos;                 /* Next write */
+    bool started;
+    int starts;
+    int resumes;
+} device_t;
+
+static uint32_t crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+static void make_image(uint8_t *image, uint32_t seed)
+{
+    for (size_t i = 0; i < IMAGE_LEN; i++) {
+        seed = seed * 1103515245 + 12345;
+        image[i] = seed >> 16;
+    }
+    image[0] = 0xE9;            // ESP image magic, checked at the start
+}
+
+static void serve(server_t *s, int fd)
+{
+    char req[1024], head[256];
+    size_t n = 0;
+    unsigned long from = 0;
+
+    while (n < sizeof(req) - 1 && (n < 4 || memcmp(req + n - 4, "\r\n\r\n", 4) != 0)) {
+        if (recv(fd, req + n, 1, 0) != 1) {
+            return;
+        }
+        n++;
+    }
+    req[n] = '\0';
+    pthread_mutex_lock(&s->lock);
+    const char *range = strstr(req, "Range: bytes=");
+    size_t drop = s->ndrops ? s->drops[0] : (size_t) -1;
+    if (s->ndrops) {
+        memmove(s->drops, s->drops + 1, --s->ndrops * sizeof(s->drops[0]));
+    }
+    s->connections++;
+    if (range) {
+        s->ranged++;
+        from = strtoul(range + 13, NULL, 10);
+    }
+    if (range && s->ranges && from < s->len) {
+        snprintf(head, sizeof(head), "HTTP/1.1 206 Partial Content\r\nContent-Length: %lu\r\n"
+                 "Content-Range: bytes %lu-%lu/%lu\r\nConnection: close\r\n\r\n", (unsigned long)(s->len - from +
+                         s->range_skew), from, (unsigned long)s->len - 1, (unsigned long)s->len);
+    } else {
+        from = 0;
+        snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+                 (unsigned long)s->len);
+    }
+    const uint8_t *body = s->image + from;
+    size_t len = s->len - from;
+    pthread_mutex_unlock(&s->lock);
+
+    send(fd, head, strlen(head), MSG_NOSIGNAL);
+    for (size_t off = 0; off < len && off < drop;) {
+        size_t piece = len - off < SEND_PIECE ? len - off : SEND_PIECE;
+        piece = drop - off < piece ? drop - off : piece;
+        ssize_t w = send(fd, body + off, piece, MSG_NOSIGNAL);
+        if (w <= 0) {
+            break;
+        }
+        off += w;
+        pthread_mutex_lock(&s->lock);
+        s->sent += w;
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static void *server_task(void *arg)
+{
+    server_t *s = arg;
+    int fd;
+    while ((fd = accept(s->fd, NULL, NULL)) >= 0) {
+        serve(s, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+static int listen_local(uint16_t *port, bool listening)
+{
+    struct sockaddr_in addr = {0};
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || (listening && listen(fd, 4) != 0) ||
+            getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+        perror("socket");
+        exit(1);
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void server_start(server_t *s)
+{
+    s->fd = listen_local(&s->port, true);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_create(&s->thread, NULL, server_task, s);
+}
+
+static void server_stop(server_t *s)
+{
+    shutdown(s->fd, SHUT_RDWR);
+    pthread_join(s->thread, NULL);
+    close(s->fd);
+    pthread_mutex_destroy(&s->lock);
+}
+
+/**
+ * @brief Set up the server for the next attempts, with the connections cut after the bytes given
+ */
+static void server_setup(server_t *s, const uint8_t *image, bool ranges, int range_skew, const size_t *drops, int ndrops)
+{
+    pthread_mutex_lock(&s->lock);
+    s->image = image;
+    s->len = IMAGE_LEN;
+    s->ranges = ranges;
+    s->range_skew = range_skew;
+    if (ndrops) {
+        memcpy(s->drops, drops, ndrops * sizeof(drops[0]));
+    }
+    s->ndrops = ndrops;
+    s->connections = s->ranged = 0;
+    s->sent = 0;
+    pthread_mutex_unlock(&s->lock);
+}
+
+static int dev_open(void *ctx, uint32_t offset, int *status, int64_t *length)
+{
+    device_t *d = ctx;
+    struct sockaddr_in addr = {0};
+    char req[256], head[512];
+    size_t n = 0;
+    const char *p;
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(d->port);
+    d->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(d->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        return -1;
+    }
+    n = snprintf(req, sizeof(req), "GET /firmware.bin HTTP/1.1\r\nHost: 127.0.0.1\r\n");
+    if (offset) {
+        n += snprintf(req + n, sizeof(req) - n, "Range: bytes=%lu-\r\n", (unsigned long)offset);
+    }
+    n += snprintf(req + n, sizeof(req) - n, "\r\n");
+    if (send(d->fd, req, n, MSG_NOSIGNAL) != (ssize_t)n) {
+        return -1;
+    }
+    for (n = 0; n < sizeof(head) - 1 && (n < 4 || memcmp(head + n - 4, "\r\n\r\n", 4) != 0); n++) {
+        if (recv(d->fd, head + n, 1, 0) != 1) {
+            return -1;
+        }
+    }
+    head[n] = '\0';
+    *length = -1;
+    if (sscanf(head, "HTTP/1.1 %d", status) != 1) {
+        return -1;
+    }
+    if ((p = strstr(head, "Content-Length: ")) != NULL) {
+        *length = strtoll(p + 16, NULL, 10);
+    }
+    return 0;
+}
+
+static int dev_read(void *ctx, uint8_t *buf, size_t len)
+{
+    device_t *d = ctx;
+    return recv(d->fd, buf, len, 0);
+}
+
+static int dev_start(void *ctx, const uint8_t *head, size_t len, uint32_t total)
+{
+    device_t *d = ctx;
+    if (len == 0 || head[0] != 0xE9 || total > IMAGE_LEN) {
+        return -1;
+    }
+    d->pos = 0;
+    d->started = true;
+    d->starts++;
+    return 0;
+}
+
+static int dev_resume(void *ctx, uint32_t offset)
+{
+    device_t *d = ctx;
+    d->pos = offset;
+    d->started = true;
+    d->resumes++;
+    return 0;
+}
+
+static int dev_write(void *ctx, const uint8_t *chunk, size_t len)
+{
+    device_t *d = ctx;
+    if (!d->started || d->pos + len > IMAGE_LEN) {
+        return -1;
+    }
+    memcpy(d->flash + d->pos, chunk, len);
+    d->pos += len;
+    return 0;
+}
+
+/**
+ * @brief Download as update_firmware does: attempts until one is not cut, a reset between them
+ * @param max_attempts Attempts at most
+ * @param attempts Attempts made
+ * @return Result of the last attempt
+ */
+static int download(device_t *d, fwDownloadProgress_t *p, uint32_t checksum, int max_attempts, int *attempts)
+{
+    static uint8_t buf[CHUNK_SIZE];
+    fwDownload_t dl = {
+        .checksum = checksum,
+        .partition = 0x110000,
+        .max_size = IMAGE_LEN,
+        .buf = buf,
+        .chunk_size = CHUNK_SIZE,
+        .ctx = d,
+        .open = dev_open,
+        .read = dev_read,
+        .start = dev_start,
+        .resume = dev_resume,
+        .write = dev_write,
+        .crc32 = crc32,
+    };
+    int ret = FW_DL_ERR_DROPPED;
+
+    d->starts = d->resumes = 0;
+    for (*attempts = 0; *attempts < max_attempts && ret == FW_DL_ERR_DROPPED; (*attempts)++) {
+        d->started = false;
+        ret = fw_download_run(&dl, p);
+        close(d->fd);
+    }
+    return ret;
+}
+
+static void show(const char *name, const server_t *s, const device_t *d, int ret)
+{
+    printf("%-28s result %2d, %d connections, %d ranged, %d starts, %d resumes, %6zu bytes sent (%.2fx)\n", name,
+           ret, s->connections, s->ranged, d->starts, d->resumes, s->sent, (double)s->sent / IMAGE_LEN);
+}
+
+int main(void)
+{
+    static uint8_t image[IMAGE_LEN], other[IMAGE_LEN];
+    static device_t dev;
+    server_t server = {0};
+    fwDownloadProgress_t progress = {0};
+    const size_t drops[] = { 50000, 77777, 130001 };
+    int attempts, ret;
+
+    make_image(image, 1);
+    make_image(other, 2);
+    uint32_t crc = crc32(0, image, IMAGE_LEN);
+    uint32_t crc_other = crc32(0, other, IMAGE_LEN);
+    server_start(&server);
+    dev.port = server.port;
+
+    // a whole download
+    server_setup(&server, image, true, 0, NULL, 0);
+    ret = download(&dev, &progress, crc, MAX_ATTEMPTS, &attempts);
+    show("no drop", &server, &dev, ret);
+    CHECK(ret == FW_DL_OK && attempts == 1 && memcmp(dev.flash, image, IMAGE_LEN) == 0);
+    CHECK(progress.offset == IMAGE_LEN && !fw_download_resumable(&progress, crc, 0x110000));
+
+    // cut three times, each attempt resumes from the last chunk written
+    memset(&progress, 0, sizeof(progress));
+    memset(dev.flash, 0, IMAGE_LEN);
+    server_setup(&server, image, true, 0, drops, 3);
+    ret = download(&dev, &progress, crc, MAX_ATTEMPTS, &attempts);
+    show("3 drops, ranges", &server, &dev, ret);
+    CHECK(ret == FW_DL_OK && memcmp(dev.flash, image, IMAGE_LEN) == 0);
+    CHECK(attempts == 4 && server.ranged == 3 && dev.starts == 1 && dev.resumes == 3);
+    CHECK(server.sent < IMAGE_LEN + 3 * CHUNK_SIZE);
+
+    // the server ignores the Range: every attempt starts over
+    memset(&progress, 0, sizeof(progress));
+    memset(dev.flash, 0, IMAGE_LEN);
+    server_setup(&server, image, false, 0, drops, 3);
+    ret = download(&dev, &progress, crc, MAX_ATTEMPTS, &attempts);
+    show("3 drops, no ranges", &server, &dev, ret);
+    CHECK(ret == FW_DL_OK && memcmp(dev.flash, image, IMAGE_LEN) == 0);
+    CHECK(attempts == 4 && server.ranged == 3 && dev.starts == 4 && dev.resumes == 0);
+    CHECK(server.sent == IMAGE_LEN + 50000 + 77777 + 130001);
+
+    // cut, then the image changes before the next wake: no Range for the old one
+    memset(&progress, 0, sizeof(progress));
+    server_setup(&server, image, true, 0, drops, 1);
+    ret = download(&dev, &progress, crc, 1, &attempts);
+    CHECK(ret == FW_DL_ERR_DROPPED && progress.offset == 49152 && fw_download_resumable(&progress, crc, 0x110000));
+    server_setup(&server, other, true, 0, NULL, 0);
+    ret = download(&dev, &progress, crc_other, MAX_ATTEMPTS, &attempts);
+    show("image changed", &server, &dev, ret);
+    CHECK(ret == FW_DL_OK && server.ranged == 0 && dev.starts == 1 && memcmp(dev.flash, other, IMAGE_LEN) == 0);
+
+    // a 206 whose length does not end the image is refused, the progress dropped
+    memset(&progress, 0, sizeof(progress));
+    server_setup(&server, image, true, 1, drops, 1);
+    ret = download(&dev, &progress, crc, MAX_ATTEMPTS, &attempts);
+    show("206 of a wrong length", &server, &dev, ret);
+    CHECK(ret == FW_DL_ERR_REFUSED && attempts == 2 && progress.offset == 0 && progress.checksum == 0);
+    server_setup(&server, image, true, 0, NULL, 0);
+    ret = download(&dev, &progress, crc, MAX_ATTEMPTS, &attempts);
+    CHECK(ret == FW_DL_OK && server.ranged == 0 && memcmp(dev.flash, image, IMAGE_LEN) == 0);
+
+    // the image does not match the CRC32 announced
+    memset(&progress, 0, sizeof(progress));
+    server_setup(&server, image, true, 0, NULL, 0);
+    ret = download(&dev, &progress, crc_other, MAX_ATTEMPTS, &attempts);
+    show("wrong checksum", &server, &dev, ret);
+    CHECK(ret == FW_DL_ERR_CRC && progress.offset == 0 && progress.checksum == 0);
+
+    // no server: the progress is kept for the next wake
+    uint16_t port;
+    int closed = listen_local(&port, false);
+    progress = (fwDownloadProgress_t) { crc, IMAGE_LEN, 8192, crc32(0, image, 8192), 0x110000 };
+    dev.port = port;
+    ret = download(&dev, &progress, crc, MAX_ATTEMPTS, &attempts);
+    CHECK(ret == FW_DL_ERR_DROPPED && attempts == MAX_ATTEMPTS && fw_download_resumable(&progress, crc, 0x110000));
+    close(closed);
+    dev.port = server.port;
+    server_setup(&server, image, true, 0, NULL, 0);
+    memcpy(dev.flash, image, 8192);
+    memset(dev.flash + 8192, 0, IMAGE_LEN - 8192);
+    ret = download(&dev, &progress, crc, MAX_ATTEMPTS, &attempts);
+    show("server down, then back", &server, &dev, ret);
+    CHECK(ret == FW_DL_OK && server.ranged == 1 && server.sent == IMAGE_LEN - 8192);
+    CHECK(memcmp(dev.flash, image, IMAGE_LEN) == 0);
+
+    server_stop(&server);
+    return host_test_end();
+}
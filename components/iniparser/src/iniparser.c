@@ -917,6 +917,137 @@ dictionary * iniparser_load_ex(const char * data, size_t len)
     return dict;
 }
 
+/**
+ * State of an ini stream, a line is parsed once its end is fed.
+ */
+struct _iniparser_stream_ {
+    iniparser_stream_cb cb;
+    void * ctx;
+    int error;
+    int lineno;
+    int last;
+    char line[ASCIILINESZ + 1];
+    char section[ASCIILINESZ + 1];
+    char key[ASCIILINESZ + 1];
+    char tmp[(ASCIILINESZ * 2) + 2];
+    char val[ASCIILINESZ + 1];
+};
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Create an ini stream
+  @param    cb          Called for each key, in file order
+  @param    ctx         Context passed to cb
+  @return   Pointer to newly allocated stream, NULL if out of memory
+
+  The stream must be freed using iniparser_stream_free().
+ */
+/*--------------------------------------------------------------------------*/
+iniparser_stream * iniparser_stream_new(iniparser_stream_cb cb, void * ctx)
+{
+    iniparser_stream * s = calloc(1, sizeof(iniparser_stream));
+    if (s==NULL) return NULL ;
+    s->cb = cb;
+    s->ctx = ctx;
+    return s;
+}
+
+/* Parse the line held by the stream */
+static int iniparser_stream_line(iniparser_stream * s)
+{
+    s->lineno++;
+    /* Get rid of spaces at end of line */
+    while (s->last > 0 && isspace((unsigned char)s->line[s->last - 1])) {
+        s->last--;
+    }
+    s->line[s->last] = '\0';
+    /* Detect multi-line */
+    if (s->last > 0 && s->line[s->last - 1] == '\\') {
+        s->last--;
+        return 0;
+    }
+    s->last = 0;
+    switch (iniparser_line(s->line, s->section, s->key, s->val)) {
+        case LINE_VALUE:
+            sprintf(s->tmp, "%s:%s", s->section, s->key);
+            if (s->cb(s->ctx, s->tmp, s->val) != 0) {
+                return -1;
+            }
+            break;
+        case LINE_ERROR:
+            iniparser_error_callback(
+                    "iniparser: syntax error in stream at line %d:\n-> %s\n",
+                    s->lineno,
+                    s->line);
+            return -1;
+        default:
+            break;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Feed the next bytes of an ini file to a stream
+  @param    s       Stream
+  @param    data    Bytes of the file, split anywhere
+  @param    len     Number of bytes
+  @return   0, or -1 once a line is too long, has a syntax error or is
+            refused by the callback, for this call and every later one
+
+  Each complete key is passed to the callback before this returns.
+ */
+/*--------------------------------------------------------------------------*/
+int iniparser_stream_feed(iniparser_stream * s, const char * data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len && !s->error; i++) {
+        if (data[i] == '\n') {
+            s->error = iniparser_stream_line(s);
+        } else if (s->last < ASCIILINESZ) {
+            s->line[s->last++] = data[i];
+        } else {
+            iniparser_error_callback(
+                    "iniparser: input line too long in stream at line %d\n",
+                    s->lineno + 1);
+            s->error = -1;
+        }
+    }
+    return s->error;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    End an ini stream, the last line may have no newline
+  @param    s       Stream
+  @return   0 if the whole file was parsed, -1 otherwise
+ */
+/*--------------------------------------------------------------------------*/
+int iniparser_stream_end(iniparser_stream * s)
+{
+    if (!s->error && s->last > 0) {
+        s->error = iniparser_stream_line(s);
+        /* A continuation on the last line ends there */
+        if (!s->error && s->last > 0) {
+            s->error = iniparser_stream_line(s);
+        }
+    }
+    return s->error;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Free an ini stream
+  @param    s       Stream, may be NULL
+  @return   void
+ */
+/*--------------------------------------------------------------------------*/
+void iniparser_stream_free(iniparser_stream * s)
+{
+    free(s);
+}
+
 /*-------------------------------------------------------------------------*/
 /**
   @brief    Free all memory associated to an ini dictionary
@@ -354,6 +354,66 @@ dictionary * iniparser_load(const char * ininame);
  */
 /*--------------------------------------------------------------------------*/
 dictionary * iniparser_load_ex(const char * data, size_t len);
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Callback of an ini stream for each key
+  @param    ctx     Context given to iniparser_stream_new()
+  @param    key     Key as section:key
+  @param    val     Value of the key
+  @return   0 to go on, anything else stops the stream
+ */
+/*--------------------------------------------------------------------------*/
+typedef int (*iniparser_stream_cb)(void * ctx, const char * key, const char * val);
+
+/**
+ * Ini file parsed as its bytes arrive, without a dictionary
+ */
+typedef struct _iniparser_stream_ iniparser_stream;
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Create an ini stream
+  @param    cb          Called for each key, in file order
+  @param    ctx         Context passed to cb
+  @return   Pointer to newly allocated stream, NULL if out of memory
+
+  Only the line being parsed is held, so the file may be of any size.
+  The stream must be freed using iniparser_stream_free().
+ */
+/*--------------------------------------------------------------------------*/
+iniparser_stream * iniparser_stream_new(iniparser_stream_cb cb, void * ctx);
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Feed the next bytes of an ini file to a stream
+  @param    s       Stream
+  @param    data    Bytes of the file, split anywhere
+  @param    len     Number of bytes
+  @return   0, or -1 once a line is too long, has a syntax error or is
+            refused by the callback, for this call and every later one
+ */
+/*--------------------------------------------------------------------------*/
+int iniparser_stream_feed(iniparser_stream * s, const char * data, size_t len);
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    End an ini stream, the last line may have no newline
+  @param    s       Stream
+  @return   0 if the whole file was parsed, -1 otherwise
+ */
+/*--------------------------------------------------------------------------*/
+int iniparser_stream_end(iniparser_stream * s);
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Free an ini stream
+  @param    s       Stream, may be NULL
+  @return   void
+ */
+/*--------------------------------------------------------------------------*/
+void iniparser_stream_free(iniparser_stream * s);
+
 /*-------------------------------------------------------------------------*/
 /**
   @brief    Free all memory associated to an ini dictionary
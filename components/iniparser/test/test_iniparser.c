@@ -696,3 +696,192 @@ void Test_iniparser_error_callback(CuTest *tc)
     CuAssertPtrEquals(tc, NULL, dic);
     CuAssertStrEquals(tc, "", _last_error);
 }
+
+/* Collects the keys of an ini stream into a dictionary */
+static int _stream_to_dictionary(void *ctx, const char *key, const char *val)
+{
+    return dictionary_set((dictionary *)ctx, key, val);
+}
+
+/* Feeds a whole buffer to an ini stream in random pieces */
+static int _stream_buffer(iniparser_stream *s, const char *data, size_t len)
+{
+    size_t pos = 0;
+    size_t n;
+
+    while (pos < len) {
+        n = 1 + rand() % 700;
+        if (n > len - pos) {
+            n = len - pos;
+        }
+        if (iniparser_stream_feed(s, data + pos, n) != 0) {
+            return -1;
+        }
+        pos += n;
+    }
+    return iniparser_stream_end(s);
+}
+
+/* Checks the keys of a stream against the dictionary of the same file */
+static void _check_stream_keys(CuTest *tc, dictionary *expected, dictionary *streamed)
+{
+    int i;
+    int keys = 0;
+
+    for (i = 0; i < expected->size; i++) {
+        if (expected->key[i] == NULL || expected->val[i] == NULL) {
+            continue;
+        }
+        keys++;
+        CuAssertStrEquals_Msg(tc, expected->key[i], expected->val[i],
+                              dictionary_get(streamed, expected->key[i], NULL));
+    }
+    CuAssertIntEquals(tc, keys, streamed->n);
+}
+
+void Test_iniparser_stream(CuTest *tc)
+{
+    size_t size = 1024 * 1024;
+    char *data = malloc(size);
+    size_t len = 0;
+    unsigned i, j;
+    dictionary *expected;
+    dictionary *streamed;
+    iniparser_stream *s;
+
+    srand(7);
+    CuAssertPtrNotNull(tc, data);
+    /* A large file with every kind of line, CRLF ends and continuations */
+    for (i = 0; i < 500; i++) {
+        len += sprintf(data + len, "; section %u\r\n[Sec%u]\n", i, i);
+        for (j = 0; j < 40; j++) {
+            switch (j % 5) {
+            case 0:
+                len += sprintf(data + len, "Key%u = %u\n", j, rand());
+                break;
+            case 1:
+                len += sprintf(data + len, "key%u=\"  quoted %u  \"\r\n", j, i);
+                break;
+            case 2:
+                len += sprintf(data + len, "key%u = value %u/%u ; comment\n", j, i, j);
+                break;
+            case 3:
+                len += sprintf(data + len, "key%u = first \\\n   second %u\n", j, j);
+                break;
+            default:
+                len += sprintf(data + len, "  # comment\n\nkey%u =\n", j);
+                break;
+            }
+        }
+    }
+    CuAssertTrue(tc, len < size);
+
+    expected = iniparser_load_ex(data, len);
+    CuAssertPtrNotNull(tc, expected);
+    streamed = dictionary_new(0);
+    s = iniparser_stream_new(_stream_to_dictionary, streamed);
+    CuAssertPtrNotNull(tc, s);
+    CuAssertIntEquals(tc, 0, _stream_buffer(s, data, len));
+    iniparser_stream_free(s);
+    CuAssertIntEquals(tc, 500 * 40, streamed->n);
+    _check_stream_keys(tc, expected, streamed);
+    CuAssertStrEquals(tc, "first    second 3", dictionary_get(streamed, "Sec7:key3", NULL));
+    CuAssertStrEquals(tc, "  quoted 7  ", dictionary_get(streamed, "Sec7:key1", NULL));
+    CuAssertStrEquals(tc, "", dictionary_get(streamed, "Sec7:key4", NULL));
+    dictionary_del(streamed);
+    dictionary_del(expected);
+    free(data);
+}
+
+void Test_iniparser_stream_files(CuTest *tc)
+{
+    DIR *dir;
+    struct dirent *curr;
+    struct stat curr_stat;
+    dictionary *expected;
+    dictionary *streamed;
+    iniparser_stream *s;
+    char ini_path[276];
+    char *data;
+    FILE *f;
+    size_t len;
+
+    /* The good .ini files give the keys of iniparser_load() */
+    dir = opendir(GOOD_INI_PATH);
+    CuAssertPtrNotNullMsg(tc, "Cannot open good .ini conf directory", dir);
+    for (curr = readdir(dir); curr != NULL; curr = readdir(dir)) {
+        sprintf(ini_path, "%s/%s", GOOD_INI_PATH, curr->d_name);
+        stat(ini_path, &curr_stat);
+        if (!S_ISREG(curr_stat.st_mode)) {
+            continue;
+        }
+        data = malloc(curr_stat.st_size + 1);
+        f = fopen(ini_path, "rb");
+        len = fread(data, 1, curr_stat.st_size, f);
+        fclose(f);
+        expected = iniparser_load(ini_path);
+        CuAssertPtrNotNullMsg(tc, ini_path, expected);
+        streamed = dictionary_new(0);
+        s = iniparser_stream_new(_stream_to_dictionary, streamed);
+        CuAssertIntEquals_Msg(tc, ini_path, 0, _stream_buffer(s, data, len));
+        iniparser_stream_free(s);
+        _check_stream_keys(tc, expected, streamed);
+        dictionary_del(streamed);
+        dictionary_del(expected);
+        free(data);
+    }
+    closedir(dir);
+}
+
+/* Stops the stream at the key named stop */
+static int _stream_stop(void *ctx, const char *key, const char *val)
+{
+    (void)val;
+    return strcmp(key, (const char *)ctx) == 0 ? 1 : 0;
+}
+
+void Test_iniparser_stream_errors(CuTest *tc)
+{
+    static const char bad[] = "[s]\nk = 1\nnot a key\nk2 = 2\n";
+    static const char stop[] = "[s]\nk = 1\nk2 = 2\nk3 = 3\n";
+    static const char last[] = "[Cam]\nbAgc = 1\nGain = 2";
+    char long_line[ASCIILINESZ + 16];
+    dictionary *d = dictionary_new(0);
+    iniparser_stream *s;
+
+    iniparser_set_error_callback(_error_callback);
+
+    /* A syntax error stops the stream for good */
+    s = iniparser_stream_new(_stream_to_dictionary, d);
+    CuAssertIntEquals(tc, -1, iniparser_stream_feed(s, bad, sizeof(bad) - 1));
+    CuAssertIntEquals(tc, -1, iniparser_stream_feed(s, "k3 = 3\n", 7));
+    CuAssertIntEquals(tc, -1, iniparser_stream_end(s));
+    CuAssertStrEquals(tc, "1", dictionary_get(d, "s:k", NULL));
+    CuAssertStrEquals(tc, NULL, dictionary_get(d, "s:k2", NULL));
+    CuAssertStrEquals(tc, "iniparser: syntax error in stream at line 3:\n-> not a key\n", _last_error);
+    iniparser_stream_free(s);
+
+    /* So does the callback */
+    s = iniparser_stream_new(_stream_stop, "s:k2");
+    CuAssertIntEquals(tc, -1, iniparser_stream_feed(s, stop, sizeof(stop) - 1));
+    iniparser_stream_free(s);
+
+    /* And a line too long */
+    memset(long_line, 'a', sizeof(long_line));
+    s = iniparser_stream_new(_stream_to_dictionary, d);
+    CuAssertIntEquals(tc, -1, iniparser_stream_feed(s, long_line, sizeof(long_line)));
+    iniparser_stream_free(s);
+
+    /* The last line needs no newline */
+    s = iniparser_stream_new(_stream_to_dictionary, d);
+    CuAssertIntEquals(tc, 0, iniparser_stream_feed(s, last, sizeof(last) - 1));
+    CuAssertStrEquals(tc, NULL, dictionary_get(d, "Cam:Gain", NULL));
+    CuAssertIntEquals(tc, 0, iniparser_stream_end(s));
+    CuAssertStrEquals(tc, "1", dictionary_get(d, "Cam:bAgc", NULL));
+    CuAssertStrEquals(tc, "2", dictionary_get(d, "Cam:Gain", NULL));
+    iniparser_stream_free(s);
+
+    iniparser_set_error_callback(NULL);
+    _last_error[0] = '\0';
+    dictionary_del(d);
+}
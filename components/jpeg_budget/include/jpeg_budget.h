@@ -0,0 +1,90 @@
+#ifndef __JPEG_BUDGET_H__
+#define __JPEG_BUDGET_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Byte-budget JPEG quality controller
+ *
+ * The JPEG size of a framesize is modelled as ln(bytes) = scene + slope * quality,
+ * quality being the sensor register value (0-63, higher means smaller files).
+ * scene follows the latest captures, slope is learned from captures of one scene
+ * at two qualities (the re-shoot after an overshoot). The module has no ESP-IDF
+ * dependency, the caller keeps the state (normally in RTC memory).
+ */
+
+#define JPEG_BUDGET_FRAMESIZE_MAX   32      // Covers every framesize_t value
+#define JPEG_BUDGET_OVERSHOOT_PCT   110     // A capture above 110% of the target is re-shot
+
+/**
+ * Size model of one framesize
+ */
+typedef struct jpegModel {
+    float scene;                // ln(bytes) at quality 0 of the latest scene
+    float slope;                // d ln(bytes) / d quality, negative
+    float last;                 // ln(bytes) of the last sample
+    uint8_t quality;            // Quality of the last sample
+    uint8_t samples;            // Number of samples, saturates at 255
+} jpegModel_t;
+
+/**
+ * Controller state
+ */
+typedef struct jpegBudget {
+    jpegModel_t models[JPEG_BUDGET_FRAMESIZE_MAX];
+} jpegBudget_t;
+
+/**
+ * Reset every model
+ * @param b Controller state
+ */
+void jpeg_budget_init(jpegBudget_t *b);
+
+/**
+ * Pick the quality expected to fit the target size
+ * @param b Controller state
+ * @param frameSize Framesize of the capture
+ * @param target Target size in bytes
+ * @param minQ Best quality allowed (lowest register value)
+ * @param maxQ Worst quality allowed (highest register value)
+ * @return Quality in [minQ, maxQ], minQ if the framesize has no sample yet
+ */
+uint8_t jpeg_budget_pick(const jpegBudget_t *b, uint8_t frameSize, uint32_t target, uint8_t minQ, uint8_t maxQ);
+
+/**
+ * Predict the JPEG size of the latest scene
+ * @param b Controller state
+ * @param frameSize Framesize of the capture
+ * @param quality Quality of the capture
+ * @return Predicted size in bytes, 0 if the framesize has no sample yet
+ */
+uint32_t jpeg_budget_predict(const jpegBudget_t *b, uint8_t frameSize, uint8_t quality);
+
+/**
+ * Add a capture to the model of its framesize
+ * @param b Controller state
+ * @param frameSize Framesize of the capture
+ * @param quality Quality the capture was taken with
+ * @param bytes JPEG size in bytes
+ * @param sameScene true if the previous sample was taken of the same scene (a re-shoot)
+ */
+void jpeg_budget_update(jpegBudget_t *b, uint8_t frameSize, uint8_t quality, uint32_t bytes, bool sameScene);
+
+/**
+ * Check if a capture overshoots the target enough to be re-shot
+ * @param bytes JPEG size in bytes
+ * @param target Target size in bytes, 0 disables the budget
+ * @return true if the capture should be re-shot
+ */
+bool jpeg_budget_overshoot(uint32_t bytes, uint32_t target);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __JPEG_BUDGET_H__ */
@@ -0,0 +1,104 @@
+/**
+ * Byte-budget JPEG quality controller
+ *
+ * Night and day scenes of the same framesize differ several times in JPEG size.
+ * The controller picks the sensor quality for a target size per image from the
+ * size-vs-quality curve learned on recent captures.
+ */
+#include <string.h>
+#include <math.h>
+#include "jpeg_budget.h"
+
+#define JPEG_BUDGET_SLOPE_DEFAULT   (-0.035f)   // About 6x size between quality 10 and 63
+#define JPEG_BUDGET_SLOPE_MIN       (-0.2f)
+#define JPEG_BUDGET_SLOPE_MAX       (-0.005f)
+#define JPEG_BUDGET_SCENE_ALPHA     0.7f        // Weight of the latest capture in the scene term
+#define JPEG_BUDGET_SLOPE_ALPHA     0.5f        // Weight of a new slope measurement
+#define JPEG_BUDGET_MARGIN          0.92f       // Aim below the target, the scene may have changed
+
+/**
+ * Get the model of a framesize
+ * @param b Controller state
+ * @param frameSize Framesize
+ * @return Model, NULL if the framesize is out of range
+ */
+static jpegModel_t *jpeg_budget_model(jpegBudget_t *b, uint8_t frameSize)
+{
+    return frameSize < JPEG_BUDGET_FRAMESIZE_MAX ? &b->models[frameSize] : NULL;
+}
+
+void jpeg_budget_init(jpegBudget_t *b)
+{
+    memset(b, 0, sizeof(jpegBudget_t));
+    for (int i = 0; i < JPEG_BUDGET_FRAMESIZE_MAX; i++) {
+        b->models[i].slope = JPEG_BUDGET_SLOPE_DEFAULT;
+    }
+}
+
+uint8_t jpeg_budget_pick(const jpegBudget_t *b, uint8_t frameSize, uint32_t target, uint8_t minQ, uint8_t maxQ)
+{
+    const jpegModel_t *m = frameSize < JPEG_BUDGET_FRAMESIZE_MAX ? &b->models[frameSize] : NULL;
+    float q;
+
+    if (m == NULL || m->samples == 0 || target == 0 || minQ >= maxQ) {
+        return minQ;
+    }
+    // scene + slope * q = ln(target), round towards the smaller file
+    q = ceilf((logf(target * JPEG_BUDGET_MARGIN) - m->scene) / m->slope);
+    if (q <= minQ) {
+        return minQ;
+    }
+    if (q >= maxQ) {
+        return maxQ;
+    }
+    return (uint8_t)q;
+}
+
+uint32_t jpeg_budget_predict(const jpegBudget_t *b, uint8_t frameSize, uint8_t quality)
+{
+    const jpegModel_t *m = frameSize < JPEG_BUDGET_FRAMESIZE_MAX ? &b->models[frameSize] : NULL;
+
+    if (m == NULL || m->samples == 0) {
+        return 0;
+    }
+    return (uint32_t)expf(m->scene + m->slope * quality);
+}
+
+void jpeg_budget_update(jpegBudget_t *b, uint8_t frameSize, uint8_t quality, uint32_t bytes, bool sameScene)
+{
+    jpegModel_t *m = jpeg_budget_model(b, frameSize);
+    float y;
+
+    if (m == NULL || bytes == 0) {
+        return;
+    }
+    if (m->slope >= 0.0f) {
+        m->slope = JPEG_BUDGET_SLOPE_DEFAULT; // state never initialized
+    }
+    y = logf((float)bytes);
+    if (sameScene && m->samples > 0 && m->quality != quality) {
+        // two qualities of one scene measure the slope directly
+        float slope = (y - m->last) / ((float)quality - (float)m->quality);
+        if (slope < JPEG_BUDGET_SLOPE_MIN) {
+            slope = JPEG_BUDGET_SLOPE_MIN;
+        } else if (slope > JPEG_BUDGET_SLOPE_MAX) {
+            slope = JPEG_BUDGET_SLOPE_MAX;
+        }
+        m->slope += JPEG_BUDGET_SLOPE_ALPHA * (slope - m->slope);
+        m->scene = y - m->slope * quality;
+    } else if (m->samples == 0) {
+        m->scene = y - m->slope * quality;
+    } else {
+        m->scene += JPEG_BUDGET_SCENE_ALPHA * ((y - m->slope * quality) - m->scene);
+    }
+    m->quality = quality;
+    m->last = y;
+    if (m->samples < UINT8_MAX) {
+        m->samples++;
+    }
+}
+
+bool jpeg_budget_overshoot(uint32_t bytes, uint32_t target)
+{
+    return target > 0 && (uint64_t)bytes * 100 > (uint64_t)target * JPEG_BUDGET_OVERSHOOT_PCT;
+}
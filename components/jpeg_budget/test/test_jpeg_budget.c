@@ -0,0 +1,143 @@
+/*
+ * Replays capture logs through the JPEG size model. camera.c logs every capture it feeds
+ * the model ("jpeg fs <framesize> q <quality> min <minQ>: <bytes> bytes, target <bytes>"),
+ * the replay feeds the same captures in order and scores the size predicted for each one
+ * before it is added, against the size of the previous capture of the framesize. Where the
+ * log ran with a budget, the quality the controller picks must be the one the device used.
+ * Any device log can be dropped in logs/ and added to the list below.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "jpeg_budget.h"
+#include "host_test.h"
+
+#define LOG_DIR     "logs/"
+
+/**
+ * @brief A capture logged by camera.c
+ */
+typedef struct capture {
+    unsigned frameSize;
+    unsigned quality;
+    unsigned minQ;
+    unsigned long bytes;
+    unsigned long target;
+    bool reshoot;
+} capture_t;
+
+typedef struct replay {
+    int captures;
+    int predicted;              /* Captures the model had a prediction for */
+    double model_err;           /* Sum of |ln(predicted / bytes)| */
+    double last_err;            /* Sum of |ln(previous bytes / bytes)| */
+    int within;                 /* Predictions within 15% */
+    int picks;                  /* Budgeted captures */
+    int picks_agree;            /* Of them, the quality the replay picks is the logged one */
+    int reshoots;
+    jpegBudget_t budget;
+} replay_t;
+
+/**
+ * @brief Parse a line of a capture log
+ * @return true if the line is a capture
+ */
+static bool parse_capture(const char *line, capture_t *c)
+{
+    const char *p = strstr(line, "jpeg fs ");
+    if (p == NULL || sscanf(p, "jpeg fs %u q %u min %u: %lu bytes, target %lu", &c->frameSize, &c->quality,
+                            &c->minQ, &c->bytes, &c->target) != 5) {
+        return false;
+    }
+    c->reshoot = strstr(p, " re-shoot") != NULL;
+    return true;
+}
+
+static int replay_log(const char *name, replay_t *r)
+{
+    char path[128], line[256];
+    unsigned long last[JPEG_BUDGET_FRAMESIZE_MAX] = {0};
+    capture_t c;
+
+    snprintf(path, sizeof(path), LOG_DIR "%s", name);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        printf("%s: can not open\n", path);
+        return -1;
+    }
+    memset(r, 0, sizeof(replay_t));
+    jpeg_budget_init(&r->budget);
+    while (fgets(line, sizeof(line), f)) {
+        if (!parse_capture(line, &c) || c.frameSize >= JPEG_BUDGET_FRAMESIZE_MAX || c.bytes == 0) {
+            continue;
+        }
+        r->captures++;
+        if (c.target) {
+            // camera_budget_fb_get picks the first shot and the re-shoot the same way
+            r->picks++;
+            r->picks_agree += jpeg_budget_pick(&r->budget, c.frameSize, c.target, c.minQ, 63) == c.quality;
+        }
+        uint32_t predicted = jpeg_budget_predict(&r->budget, c.frameSize, c.quality);
+        if (predicted && last[c.frameSize]) {
+            r->predicted++;
+            r->model_err += fabs(log((double)predicted / c.bytes));
+            r->last_err += fabs(log((double)last[c.frameSize] / c.bytes));
+            r->within += fabs((double)predicted - c.bytes) <= 0.15 * c.bytes;
+        }
+        r->reshoots += c.reshoot;
+        jpeg_budget_update(&r->budget, c.frameSize, c.quality, c.bytes, c.reshoot);
+        last[c.frameSize] = c.bytes;
+    }
+    fclose(f);
+    printf("%-22s %3d captures, %2d re-shoots: error %4.1f%% (previous size %5.1f%%), within 15%% %3d%%, "
+           "picks as logged %d/%d\n", name, r->captures, r->reshoots, 100 * r->model_err / r->predicted,
+           100 * r->last_err / r->predicted, 100 * r->within / r->predicted, r->picks_agree, r->picks);
+    return 0;
+}
+
+int main(void)
+{
+    jpegBudget_t b;
+    replay_t r;
+
+    // no samples, the configured quality
+    jpeg_budget_init(&b);
+    CHECK(jpeg_budget_pick(&b, 13, 100000, 10, 63) == 10);
+    CHECK(jpeg_budget_predict(&b, 13, 10) == 0);
+    CHECK(jpeg_budget_pick(&b, JPEG_BUDGET_FRAMESIZE_MAX, 100000, 10, 63) == 10);
+    jpeg_budget_update(&b, JPEG_BUDGET_FRAMESIZE_MAX, 10, 1000, false);
+
+    // one sample, the default slope
+    jpeg_budget_update(&b, 13, 10, 200000, false);
+    CHECK(jpeg_budget_predict(&b, 13, 10) >= 199990 && jpeg_budget_predict(&b, 13, 10) <= 200010);
+    uint8_t q = jpeg_budget_pick(&b, 13, 100000, 10, 63);
+    CHECK(q > 10 && q < 63 && jpeg_budget_predict(&b, 13, q) <= 100000);
+    CHECK(jpeg_budget_pick(&b, 13, 1000, 10, 63) == 63);
+    CHECK(jpeg_budget_pick(&b, 13, 1000000, 10, 63) == 10);
+    CHECK(jpeg_budget_pick(&b, 13, 0, 10, 63) == 10);
+    CHECK(jpeg_budget_predict(&b, 9, 10) == 0);
+
+    // a re-shoot measures the slope: half the size 10 steps later
+    jpeg_budget_update(&b, 13, 20, 100000, true);
+    CHECK(fabsf(b.models[13].slope - (-0.035f + logf(0.5f) / 10) / 2) < 1e-4f);  // halfway from the default
+
+    CHECK(!jpeg_budget_overshoot(110000, 100000) && jpeg_budget_overshoot(110001, 100000));
+    CHECK(!jpeg_budget_overshoot(UINT32_MAX, 0));
+
+    // recorded captures
+    const char *logs[] = { "day_outdoor.log", "budget_enabled.log", "framesize_switch.log" };
+    for (size_t i = 0; i < sizeof(logs) / sizeof(logs[0]); i++) {
+        if (replay_log(logs[i], &r) != 0) {
+            g_failed++;
+            continue;
+        }
+        CHECK(r.predicted > 0);
+        CHECK(r.model_err < r.last_err);
+        CHECK(r.model_err / r.predicted < 0.15);
+        CHECK(r.picks_agree == r.picks);
+        // the re-shoots of UXGA taught its slope
+        CHECK(r.budget.models[13].slope < -0.02f && r.budget.models[13].slope > -0.07f);
+    }
+
+    return host_test_end();
+}
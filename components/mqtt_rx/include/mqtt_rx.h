@@ -0,0 +1,177 @@
+#ifndef __MQTT_RX_H__
+#define __MQTT_RX_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reassembly of the MQTT messages a client delivers in fragments, as MQTT_EVENT_DATA of
+ * esp-mqtt does: the first fragment of a message has its topic and offset 0, all of them
+ * have the msg_id, their offset and the total length. A fragment goes to the message of
+ * its msg_id that has received exactly its offset, so messages that interleave are kept
+ * apart. Payloads are binary.
+ *
+ * Each message goes to the first registered consumer whose topic filter matches:
+ * - a stream consumer gets the fragments as they come, nothing is buffered;
+ * - a message consumer gets the whole message, held in RAM when it fits in the RAM
+ *   budget, else spilled to a file of the spill directory.
+ */
+
+#define MQTT_RX_SLOTS       4       /* Messages reassembled at once */
+#define MQTT_RX_CONSUMERS   8       /* Consumers registered at most */
+#define MQTT_RX_TOPIC_MAX   128     /* Longest topic, with its NUL */
+#define MQTT_RX_PATH_MAX    64      /* Longest spill file path, with its NUL */
+
+enum {
+    MQTT_RX_OK = 0,
+    MQTT_RX_ERR_ARG = -1,           /* Bad fragment, e.g. past the total length */
+    MQTT_RX_ERR_NO_MEM = -2,        /* Over the RAM budget and no room to spill */
+    MQTT_RX_ERR_NO_CONSUMER = -3,   /* No consumer for the topic */
+    MQTT_RX_ERR_TOO_LARGE = -4,     /* Longer than the consumer takes */
+    MQTT_RX_ERR_ORPHAN = -5,        /* Fragment of no message being reassembled */
+    MQTT_RX_ERR_REFUSED = -6,       /* The consumer refused or failed the message */
+    MQTT_RX_ERR_FILE = -7,          /* The spill file could not be written */
+};
+
+/**
+ * @brief Whole message passed to a message consumer
+ */
+typedef struct mqttRxMsg {
+    const char *topic;
+    int msg_id;
+    size_t len;
+    const uint8_t *data;    /* Payload followed by a NUL, NULL when spilled */
+    const char *path;       /* File holding the payload when spilled, NULL else */
+} mqttRxMsg_t;
+
+/**
+ * @brief Takes the messages of the topics its filter matches
+ *
+ * A stream consumer sets begin, data and end, a message consumer sets message.
+ */
+typedef struct mqttRxConsumer {
+    const char *filter;     /* Topic filter, with the + and # wildcards */
+    size_t max_len;         /* Longest message taken, 0 for any, longer ones are dropped */
+    void *ctx;
+
+    /**
+     * @brief Start of a message
+     * @return Session passed to data and end, NULL to refuse the message
+     */
+    void *(*begin)(void *ctx, const char *topic, size_t total);
+
+    /**
+     * @brief Next bytes of the message, in order
+     * @return 0 to go on, else the message is aborted
+     */
+    int (*data)(void *session, const uint8_t *data, size_t len, size_t offset);
+
+    /**
+     * @brief End of the message, complete or aborted
+     */
+    void (*end)(void *session, bool complete);
+
+    /**
+     * @brief Whole message, only valid during the call
+     */
+    void (*message)(void *ctx, const mqttRxMsg_t *msg);
+} mqttRxConsumer_t;
+
+/**
+ * @brief Limits of the reassembly
+ */
+typedef struct mqttRxConfig {
+    size_t ram_budget;      /* RAM the messages held for message consumers take together */
+    size_t ram_max;         /* Longest message held in RAM, longer ones are spilled */
+    const char *spill_dir;  /* Directory of the spill files, NULL to drop what RAM cannot hold */
+} mqttRxConfig_t;
+
+/**
+ * @brief Counters, for logs and tests
+ */
+typedef struct mqttRxStats {
+    uint32_t delivered;     /* Messages passed whole to their consumer */
+    uint32_t spilled;       /* Of which through a spill file */
+    uint32_t dropped;       /* Messages dropped or aborted */
+    size_t ram_used;        /* RAM held by messages now */
+    size_t ram_peak;        /* Most RAM held by messages at once */
+} mqttRxStats_t;
+
+typedef struct mqttRx mqttRx_t;
+
+/**
+ * @brief Create a reassembler
+ * @param config Limits, copied
+ * @return Reassembler, NULL if out of memory
+ */
+mqttRx_t *mqtt_rx_new(const mqttRxConfig_t *config);
+
+/**
+ * @brief Register a consumer, the ones registered first take precedence
+ * @param rx Reassembler
+ * @param consumer Consumer, copied; its filter must outlive the reassembler
+ * @return MQTT_RX_OK, or MQTT_RX_ERR_ARG if there are MQTT_RX_CONSUMERS already
+ */
+int mqtt_rx_register(mqttRx_t *rx, const mqttRxConsumer_t *consumer);
+
+/**
+ * @brief Feed a fragment
+ * @param rx Reassembler
+ * @param msg_id Message id, 0 for QoS 0
+ * @param topic Topic, only on the first fragment
+ * @param topic_len Length of the topic, 0 on the next fragments
+ * @param data Fragment bytes
+ * @param len Number of bytes
+ * @param offset Offset of the fragment in the message
+ * @param total Length of the message
+ * @return MQTT_RX_OK, or why the fragment and its message were dropped
+ */
+int mqtt_rx_feed(mqttRx_t *rx, int msg_id, const char *topic, size_t topic_len,
+                 const uint8_t *data, size_t len, size_t offset, size_t total);
+
+/**
+ * @brief Drop the messages being reassembled, e.g. when the connection is lost
+ * @param rx Reassembler
+ */
+void mqtt_rx_reset(mqttRx_t *rx);
+
+/**
+ * @brief Read bytes of a whole message, in RAM or spilled
+ * @param msg Message
+ * @param offset Offset in the payload
+ * @param buf Buffer to fill
+ * @param len Bytes to read
+ * @return Bytes read
+ */
+size_t mqtt_rx_msg_read(const mqttRxMsg_t *msg, size_t offset, void *buf, size_t len);
+
+/**
+ * @brief Get the counters
+ * @param rx Reassembler
+ * @param stats Counters
+ */
+void mqtt_rx_stats(const mqttRx_t *rx, mqttRxStats_t *stats);
+
+/**
+ * @brief Whether a topic filter matches a topic
+ * @param filter Filter, with the + and # wildcards
+ * @param topic Topic
+ */
+bool mqtt_rx_topic_match(const char *filter, const char *topic);
+
+/**
+ * @brief Drop the messages being reassembled and free the reassembler
+ * @param rx Reassembler, may be NULL
+ */
+void mqtt_rx_free(mqttRx_t *rx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MQTT_RX_H__ */
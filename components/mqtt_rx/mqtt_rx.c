@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mqtt_rx.h"
+
+/**
+ * @brief Message being reassembled
+ */
+typedef struct rxSlot {
+    bool used;
+    int msg_id;
+    size_t total;                       /* Length of the message */
+    size_t received;                    /* Bytes received, the offset of the next fragment */
+    uint32_t seq;                       /* When it was last fed, the oldest is evicted first */
+    const mqttRxConsumer_t *consumer;
+    void *session;                      /* Session of a stream consumer */
+    uint8_t *buf;                       /* Payload held in RAM */
+    FILE *file;                         /* Payload spilled */
+    char topic[MQTT_RX_TOPIC_MAX];
+    char path[MQTT_RX_PATH_MAX];
+} rxSlot_t;
+
+struct mqttRx {
+    mqttRxConfig_t config;
+    mqttRxConsumer_t consumers[MQTT_RX_CONSUMERS];
+    int consumer_cnt;
+    rxSlot_t slots[MQTT_RX_SLOTS];
+    uint32_t seq;
+    mqttRxStats_t stats;
+};
+
+bool mqtt_rx_topic_match(const char *filter, const char *topic)
+{
+    // wildcards at the first level do not match the $SYS like topics
+    if (topic[0] == '$' && (filter[0] == '+' || filter[0] == '#')) {
+        return false;
+    }
+    while (*filter != '\0') {
+        if (*filter == '#') {
+            return true;
+        }
+        if (*filter == '+') {
+            while (*topic != '\0' && *topic != '/') {
+                topic++;
+            }
+            filter++;
+            continue;
+        }
+        if (*filter != *topic) {
+            // "a/#" also matches its parent level "a"
+            return *topic == '\0' && strcmp(filter, "/#") == 0;
+        }
+        filter++;
+        topic++;
+    }
+    return *topic == '\0';
+}
+
+static const mqttRxConsumer_t *find_consumer(mqttRx_t *rx, const char *topic)
+{
+    for (int i = 0; i < rx->consumer_cnt; i++) {
+        if (mqtt_rx_topic_match(rx->consumers[i].filter, topic)) {
+            return &rx->consumers[i];
+        }
+    }
+    return NULL;
+}
+
+static void release(mqttRx_t *rx, rxSlot_t *slot)
+{
+    if (slot->buf) {
+        free(slot->buf);
+        slot->buf = NULL;
+        rx->stats.ram_used -= slot->total + 1;
+    }
+    if (slot->file) {
+        fclose(slot->file);
+        slot->file = NULL;
+    }
+    if (slot->path[0] != '\0') {
+        remove(slot->path);
+        slot->path[0] = '\0';
+    }
+    slot->used = false;
+}
+
+/**
+ * @brief Drop a message before its end
+ */
+static void abort_slot(mqttRx_t *rx, rxSlot_t *slot)
+{
+    if (slot->session) {
+        slot->consumer->end(slot->session, false);
+        slot->session = NULL;
+    }
+    release(rx, slot);
+    rx->stats.dropped++;
+}
+
+/**
+ * @brief Pass a complete message to its consumer
+ */
+static void finish(mqttRx_t *rx, rxSlot_t *slot)
+{
+    if (slot->session) {
+        slot->consumer->end(slot->session, true);
+        slot->session = NULL;
+        release(rx, slot);
+        rx->stats.delivered++;
+        return;
+    }
+    mqttRxMsg_t msg = {
+        .topic = slot->topic,
+        .msg_id = slot->msg_id,
+        .len = slot->total,
+    };
+    if (slot->buf) {
+        slot->buf[slot->total] = '\0';
+        msg.data = slot->buf;
+    } else {
+        if (fclose(slot->file) != 0) {
+            slot->file = NULL;
+            abort_slot(rx, slot);
+            return;
+        }
+        slot->file = NULL;
+        msg.path = slot->path;
+        rx->stats.spilled++;
+    }
+    slot->consumer->message(slot->consumer->ctx, &msg);
+    release(rx, slot);
+    rx->stats.delivered++;
+}
+
+/**
+ * @brief Take a slot for a new message, evicting the one fed last the longest ago if none is free
+ */
+static rxSlot_t *take_slot(mqttRx_t *rx)
+{
+    rxSlot_t *oldest = &rx->slots[0];
+
+    for (int i = 0; i < MQTT_RX_SLOTS; i++) {
+        if (!rx->slots[i].used) {
+            return &rx->slots[i];
+        }
+        if (rx->slots[i].seq - oldest->seq > UINT32_MAX / 2) {
+            oldest = &rx->slots[i];
+        }
+    }
+    abort_slot(rx, oldest);
+    return oldest;
+}
+
+/**
+ * @brief Find where a message of a message consumer is held, in RAM or spilled
+ */
+static int hold(mqttRx_t *rx, rxSlot_t *slot)
+{
+    size_t need = slot->total + 1;
+
+    if (slot->total <= rx->config.ram_max && rx->stats.ram_used + need <= rx->config.ram_budget) {
+        slot->buf = malloc(need);
+        if (slot->buf) {
+            rx->stats.ram_used += need;
+            if (rx->stats.ram_used > rx->stats.ram_peak) {
+                rx->stats.ram_peak = rx->stats.ram_used;
+            }
+            return MQTT_RX_OK;
+        }
+    }
+    if (rx->config.spill_dir == NULL) {
+        return MQTT_RX_ERR_NO_MEM;
+    }
+    int n = snprintf(slot->path, sizeof(slot->path), "%s/mqttrx%d.tmp", rx->config.spill_dir, (int)(slot - rx->slots));
+    if (n < 0 || (size_t)n >= sizeof(slot->path)) {
+        slot->path[0] = '\0';
+        return MQTT_RX_ERR_FILE;
+    }
+    slot->file = fopen(slot->path, "wb");
+    if (slot->file == NULL) {
+        slot->path[0] = '\0';
+        return MQTT_RX_ERR_FILE;
+    }
+    return MQTT_RX_OK;
+}
+
+static int start(mqttRx_t *rx, int msg_id, const char *topic, size_t topic_len, size_t total, rxSlot_t **out)
+{
+    char name[MQTT_RX_TOPIC_MAX];
+
+    if (topic == NULL || topic_len == 0 || topic_len >= sizeof(name)) {
+        rx->stats.dropped++;
+        return MQTT_RX_ERR_ARG;
+    }
+    memcpy(name, topic, topic_len);
+    name[topic_len] = '\0';
+
+    // a QoS 1 or 2 message started again is a retransmit, the first try will not end
+    if (msg_id != 0) {
+        for (int i = 0; i < MQTT_RX_SLOTS; i++) {
+            if (rx->slots[i].used && rx->slots[i].msg_id == msg_id) {
+                abort_slot(rx, &rx->slots[i]);
+            }
+        }
+    }
+
+    const mqttRxConsumer_t *consumer = find_consumer(rx, name);
+    if (consumer == NULL) {
+        rx->stats.dropped++;
+        return MQTT_RX_ERR_NO_CONSUMER;
+    }
+    if (consumer->max_len && total > consumer->max_len) {
+        rx->stats.dropped++;
+        return MQTT_RX_ERR_TOO_LARGE;
+    }
+
+    rxSlot_t *slot = take_slot(rx);
+    memset(slot, 0, sizeof(rxSlot_t));
+    slot->msg_id = msg_id;
+    slot->total = total;
+    slot->consumer = consumer;
+    memcpy(slot->topic, name, topic_len + 1);
+
+    if (consumer->message == NULL) {
+        slot->session = consumer->begin(consumer->ctx, slot->topic, total);
+        if (slot->session == NULL) {
+            rx->stats.dropped++;
+            return MQTT_RX_ERR_REFUSED;
+        }
+    } else {
+        int ret = hold(rx, slot);
+        if (ret != MQTT_RX_OK) {
+            release(rx, slot);
+            rx->stats.dropped++;
+            return ret;
+        }
+    }
+    slot->used = true;
+    *out = slot;
+    return MQTT_RX_OK;
+}
+
+/**
+ * @brief Find the message a next fragment belongs to, the one fed last if several could take it
+ */
+static rxSlot_t *find_slot(mqttRx_t *rx, int msg_id, size_t offset, size_t total)
+{
+    rxSlot_t *found = NULL;
+
+    for (int i = 0; i < MQTT_RX_SLOTS; i++) {
+        rxSlot_t *slot = &rx->slots[i];
+        if (!slot->used || slot->msg_id != msg_id || slot->received != offset || slot->total != total) {
+            continue;
+        }
+        if (found == NULL || found->seq - slot->seq > UINT32_MAX / 2) {
+            found = slot;
+        }
+    }
+    return found;
+}
+
+int mqtt_rx_feed(mqttRx_t *rx, int msg_id, const char *topic, size_t topic_len,
+                 const uint8_t *data, size_t len, size_t offset, size_t total)
+{
+    rxSlot_t *slot = NULL;
+    int ret;
+
+    if (rx == NULL || (data == NULL && len) || offset > total || len > total - offset) {
+        return MQTT_RX_ERR_ARG;
+    }
+    if (offset == 0) {
+        ret = start(rx, msg_id, topic, topic_len, total, &slot);
+        if (ret != MQTT_RX_OK) {
+            return ret;
+        }
+    } else {
+        slot = find_slot(rx, msg_id, offset, total);
+        if (slot == NULL) {
+            return MQTT_RX_ERR_ORPHAN;
+        }
+    }
+    slot->seq = ++rx->seq;
+
+    if (len) {
+        if (slot->session) {
+            if (slot->consumer->data(slot->session, data, len, offset) != 0) {
+                abort_slot(rx, slot);
+                return MQTT_RX_ERR_REFUSED;
+            }
+        } else if (slot->buf) {
+            memcpy(slot->buf + offset, data, len);
+        } else if (fwrite(data, 1, len, slot->file) != len) {
+            abort_slot(rx, slot);
+            return MQTT_RX_ERR_FILE;
+        }
+        slot->received += len;
+    }
+    if (slot->received == slot->total) {
+        finish(rx, slot);
+    }
+    return MQTT_RX_OK;
+}
+
+size_t mqtt_rx_msg_read(const mqttRxMsg_t *msg, size_t offset, void *buf, size_t len)
+{
+    if (offset >= msg->len) {
+        return 0;
+    }
+    if (len > msg->len - offset) {
+        len = msg->len - offset;
+    }
+    if (msg->data) {
+        memcpy(buf, msg->data + offset, len);
+        return len;
+    }
+    FILE *f = fopen(msg->path, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    size_t n = 0;
+    if (fseek(f, (long)offset, SEEK_SET) == 0) {
+        n = fread(buf, 1, len, f);
+    }
+    fclose(f);
+    return n;
+}
+
+mqttRx_t *mqtt_rx_new(const mqttRxConfig_t *config)
+{
+    mqttRx_t *rx = calloc(1, sizeof(mqttRx_t));
+    if (rx) {
+        rx->config = *config;
+    }
+    return rx;
+}
+
+int mqtt_rx_register(mqttRx_t *rx, const mqttRxConsumer_t *consumer)
+{
+    bool stream = consumer->begin || consumer->data || consumer->end;
+    bool valid = consumer->message ? !stream : consumer->begin && consumer->data && consumer->end;
+
+    if (rx->consumer_cnt == MQTT_RX_CONSUMERS || consumer->filter == NULL || !valid) {
+        return MQTT_RX_ERR_ARG;
+    }
+    rx->consumers[rx->consumer_cnt++] = *consumer;
+    return MQTT_RX_OK;
+}
+
+void mqtt_rx_reset(mqttRx_t *rx)
+{
+    for (int i = 0; i < MQTT_RX_SLOTS; i++) {
+        if (rx->slots[i].used) {
+            abort_slot(rx, &rx->slots[i]);
+        }
+    }
+}
+
+void mqtt_rx_stats(const mqttRx_t *rx, mqttRxStats_t *stats)
+{
+    *stats = rx->stats;
+}
+
+void mqtt_rx_free(mqttRx_t *rx)
+{
+    if (rx == NULL) {
+        return;
+    }
+    mqtt_rx_reset(rx);
+    free(rx);
+}
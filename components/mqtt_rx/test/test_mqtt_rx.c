@@ -0,0 +1,296 @@
+/*
+ * Feeds fragment sequences as MQTT_EVENT_DATA of esp-mqtt gives them: the topic on the
+ * first fragment only, the offset and the total length on all of them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mqtt_rx.h"
+#include "host_test.h"
+
+#define SPILL "spill"
+
+/**
+ * @brief Last message got by a message consumer, read back through mqtt_rx_msg_read
+ */
+typedef struct got {
+    int count;
+    char topic[MQTT_RX_TOPIC_MAX];
+    uint8_t *data;
+    size_t len;
+    bool spilled;
+    bool terminated;        /* NUL after the payload in RAM */
+} got_t;
+
+/**
+ * @brief Stream consumer session, the bytes kept to be checked
+ */
+typedef struct stream {
+    int begins;
+    int ends;
+    int completes;
+    int fail_at;            /* Refuses the n-th data call if > 0 */
+    int datas;
+    uint8_t data[4096];
+    size_t len;
+} stream_t;
+
+static void on_message(void *ctx, const mqttRxMsg_t *msg)
+{
+    got_t *got = ctx;
+    got->count++;
+    snprintf(got->topic, sizeof(got->topic), "%s", msg->topic);
+    free(got->data);
+    got->data = malloc(msg->len + 1);
+    got->len = mqtt_rx_msg_read(msg, 0, got->data, msg->len);
+    got->spilled = msg->data == NULL;
+    got->terminated = msg->data && msg->data[msg->len] == '\0';
+}
+
+static void *on_begin(void *ctx, const char *topic, size_t total)
+{
+    stream_t *stream = ctx;
+    (void)topic;
+    if (total > sizeof(stream->data)) {
+        return NULL;
+    }
+    stream->begins++;
+    stream->len = 0;
+    return stream;
+}
+
+static int on_data(void *session, const uint8_t *data, size_t len, size_t offset)
+{
+    stream_t *stream = session;
+    if (++stream->datas == stream->fail_at || offset != stream->len) {
+        return -1;
+    }
+    memcpy(stream->data + offset, data, len);
+    stream->len += len;
+    return 0;
+}
+
+static void on_end(void *session, bool complete)
+{
+    stream_t *stream = session;
+    stream->ends++;
+    stream->completes += complete;
+}
+
+/**
+ * @brief Feed one fragment of a message
+ */
+static int frag(mqttRx_t *rx, int msg_id, const char *topic, const uint8_t *msg, size_t offset, size_t len, size_t total)
+{
+    return mqtt_rx_feed(rx, msg_id, offset ? NULL : topic, offset || topic == NULL ? 0 : strlen(topic),
+                        msg + offset, len, offset, total);
+}
+
+/**
+ * @brief Feed a whole message in fragments of a size
+ */
+static int feed(mqttRx_t *rx, int msg_id, const char *topic, const uint8_t *msg, size_t total, size_t size)
+{
+    size_t offset = 0;
+    do {
+        size_t len = total - offset < size ? total - offset : size;
+        int ret = frag(rx, msg_id, topic, msg, offset, len, total);
+        if (ret != MQTT_RX_OK) {
+            return ret;
+        }
+        offset += len;
+    } while (offset < total);
+    return MQTT_RX_OK;
+}
+
+static void fill(uint8_t *buf, size_t len, unsigned seed)
+{
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = (uint8_t)(seed >> 16);
+    }
+}
+
+static bool spill_empty(void)
+{
+    char path[64];
+    for (int i = 0; i < MQTT_RX_SLOTS; i++) {
+        snprintf(path, sizeof(path), SPILL "/mqttrx%d.tmp", i);
+        FILE *f = fopen(path, "rb");
+        if (f) {
+            fclose(f);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(void)
+{
+    static uint8_t big[20000], a[3000], b[3000];
+    got_t got = {0}, cmd = {0};
+    stream_t stream = {0};
+    mqttRxStats_t stats;
+
+    if (system("mkdir -p " SPILL) != 0) {
+        return 1;
+    }
+    fill(big, sizeof(big), 1);
+    fill(a, sizeof(a), 2);
+    fill(b, sizeof(b), 3);
+
+    // topic filters
+    CHECK(mqtt_rx_topic_match("#", "a/b/c"));
+    CHECK(mqtt_rx_topic_match("a/#", "a"));
+    CHECK(mqtt_rx_topic_match("a/#", "a/b/c"));
+    CHECK(!mqtt_rx_topic_match("a/#", "ab"));
+    CHECK(mqtt_rx_topic_match("a/+/c", "a/b/c"));
+    CHECK(mqtt_rx_topic_match("a/+", "a/"));
+    CHECK(!mqtt_rx_topic_match("a/+", "a/b/c"));
+    CHECK(!mqtt_rx_topic_match("+", "a/b"));
+    CHECK(mqtt_rx_topic_match("+/+", "a/b"));
+    CHECK(!mqtt_rx_topic_match("a/b", "a/b/c"));
+    CHECK(!mqtt_rx_topic_match("#", "$SYS/x"));
+    CHECK(mqtt_rx_topic_match("$SYS/#", "$SYS/x"));
+
+    mqttRxConfig_t config = { .ram_budget = 8192, .ram_max = 4096, .spill_dir = SPILL };
+    mqttRx_t *rx = mqtt_rx_new(&config);
+    mqttRxConsumer_t streamer = {
+        .filter = "dev/+/cert", .ctx = &stream, .begin = on_begin, .data = on_data, .end = on_end,
+    };
+    mqttRxConsumer_t limited = { .filter = "dev/cmd/#", .max_len = 1024, .ctx = &cmd, .message = on_message };
+    mqttRxConsumer_t any = { .filter = "dev/#", .ctx = &got, .message = on_message };
+    mqttRxConsumer_t bad = { .filter = "x", .ctx = &got, .message = on_message, .begin = on_begin };
+    CHECK(mqtt_rx_register(rx, &streamer) == MQTT_RX_OK);
+    CHECK(mqtt_rx_register(rx, &limited) == MQTT_RX_OK);
+    CHECK(mqtt_rx_register(rx, &any) == MQTT_RX_OK);
+    CHECK(mqtt_rx_register(rx, &bad) == MQTT_RX_ERR_ARG);
+
+    // a small command in one fragment, in RAM and NUL terminated
+    const char *json = "{\"cmd\":\"reboot\"}";
+    CHECK(feed(rx, 0, "dev/cmd/1", (const uint8_t *)json, strlen(json), 1024) == MQTT_RX_OK);
+    CHECK(cmd.count == 1 && strcmp(cmd.topic, "dev/cmd/1") == 0);
+    CHECK(cmd.len == strlen(json) && memcmp(cmd.data, json, cmd.len) == 0);
+    CHECK(!cmd.spilled && cmd.terminated);
+
+    // binary with NULs, in fragments
+    a[10] = 0;
+    a[2000] = 0;
+    CHECK(feed(rx, 7, "dev/blob", a, sizeof(a), 1000) == MQTT_RX_OK);
+    CHECK(got.count == 1 && got.len == sizeof(a) && memcmp(got.data, a, sizeof(a)) == 0);
+    CHECK(!got.spilled && got.terminated);
+
+    // an empty message
+    CHECK(feed(rx, 0, "dev/empty", a, 0, 100) == MQTT_RX_OK);
+    CHECK(got.count == 2 && got.len == 0 && strcmp(got.topic, "dev/empty") == 0);
+
+    // longer than the RAM holds, spilled
+    CHECK(feed(rx, 8, "dev/bulk", big, sizeof(big), 1460) == MQTT_RX_OK);
+    CHECK(got.count == 3 && got.spilled);
+    CHECK(got.len == sizeof(big) && memcmp(got.data, big, sizeof(big)) == 0);
+    CHECK(spill_empty());
+
+    // over the consumer limit
+    CHECK(feed(rx, 0, "dev/cmd/2", big, 2048, 1024) == MQTT_RX_ERR_TOO_LARGE);
+    CHECK(cmd.count == 1);
+
+    // no consumer, and its next fragments are orphans
+    CHECK(frag(rx, 0, "other", a, 0, 100, 200) == MQTT_RX_ERR_NO_CONSUMER);
+    CHECK(frag(rx, 0, NULL, a, 100, 100, 200) == MQTT_RX_ERR_ORPHAN);
+
+    // a stream consumer gets the fragments as they come
+    CHECK(feed(rx, 9, "dev/7/cert", b, sizeof(b), 700) == MQTT_RX_OK);
+    CHECK(stream.begins == 1 && stream.completes == 1);
+    CHECK(stream.len == sizeof(b) && memcmp(stream.data, b, sizeof(b)) == 0);
+    stream.fail_at = stream.datas + 2;
+    CHECK(feed(rx, 10, "dev/7/cert", b, sizeof(b), 700) == MQTT_RX_ERR_REFUSED);
+    CHECK(stream.ends == 2 && stream.completes == 1);
+    CHECK(feed(rx, 11, "dev/7/cert", big, sizeof(big), 700) == MQTT_RX_ERR_REFUSED);
+    CHECK(stream.ends == 2);
+
+    // interleaved messages, told apart by msg_id and offset
+    mqtt_rx_stats(rx, &stats);
+    size_t peak = stats.ram_peak;
+    int count = got.count;
+    CHECK(frag(rx, 20, "dev/a", a, 0, 1000, sizeof(a)) == MQTT_RX_OK);
+    CHECK(frag(rx, 21, "dev/b", b, 0, 500, sizeof(b)) == MQTT_RX_OK);
+    CHECK(frag(rx, 20, NULL, a, 1000, 1000, sizeof(a)) == MQTT_RX_OK);
+    CHECK(frag(rx, 21, NULL, b, 500, 2000, sizeof(b)) == MQTT_RX_OK);
+    CHECK(frag(rx, 21, NULL, b, 2500, 500, sizeof(b)) == MQTT_RX_OK);
+    CHECK(got.count == count + 1 && strcmp(got.topic, "dev/b") == 0 && memcmp(got.data, b, sizeof(b)) == 0);
+    CHECK(frag(rx, 20, NULL, a, 2000, 1000, sizeof(a)) == MQTT_RX_OK);
+    CHECK(got.count == count + 2 && strcmp(got.topic, "dev/a") == 0 && memcmp(got.data, a, sizeof(a)) == 0);
+    mqtt_rx_stats(rx, &stats);
+    CHECK(stats.ram_peak == 2 * (sizeof(a) + 1) && stats.ram_peak > peak);
+    CHECK(stats.ram_used == 0);
+
+    // over the RAM budget the next messages spill, the RAM stays bounded
+    count = got.count;
+    CHECK(frag(rx, 30, "dev/a", a, 0, 100, sizeof(a)) == MQTT_RX_OK);
+    CHECK(frag(rx, 31, "dev/b", b, 0, 100, sizeof(b)) == MQTT_RX_OK);
+    CHECK(frag(rx, 32, "dev/c", a, 0, 100, sizeof(a)) == MQTT_RX_OK);
+    mqtt_rx_stats(rx, &stats);
+    CHECK(stats.ram_used == 2 * (sizeof(a) + 1) && stats.ram_used <= config.ram_budget);
+    CHECK(frag(rx, 32, NULL, a, 100, sizeof(a) - 100, sizeof(a)) == MQTT_RX_OK);
+    CHECK(got.count == count + 1 && got.spilled && memcmp(got.data, a, sizeof(a)) == 0);
+
+    // a fragment out of order is an orphan, the message goes on when the right one comes
+    CHECK(frag(rx, 30, NULL, a, 200, 100, sizeof(a)) == MQTT_RX_ERR_ORPHAN);
+    CHECK(frag(rx, 30, NULL, a, 100, sizeof(a) - 100, sizeof(a)) == MQTT_RX_OK);
+    CHECK(got.count == count + 2 && memcmp(got.data, a, sizeof(a)) == 0);
+
+    // a retransmit starts the message again
+    CHECK(frag(rx, 31, "dev/b", b, 0, 1000, sizeof(b)) == MQTT_RX_OK);
+    CHECK(frag(rx, 31, NULL, b, 100, 100, sizeof(b)) == MQTT_RX_ERR_ORPHAN);
+    CHECK(frag(rx, 31, NULL, b, 1000, 2000, sizeof(b)) == MQTT_RX_OK);
+    CHECK(got.count == count + 3 && memcmp(got.data, b, sizeof(b)) == 0);
+    mqtt_rx_stats(rx, &stats);
+    CHECK(stats.ram_used == 0);
+
+    // more messages than slots, the one fed last the longest ago is dropped
+    count = got.count;
+    for (int i = 0; i <= MQTT_RX_SLOTS; i++) {
+        CHECK(frag(rx, 40 + i, "dev/x", a, 0, 10, sizeof(a)) == MQTT_RX_OK);
+    }
+    CHECK(frag(rx, 40, NULL, a, 10, 10, sizeof(a)) == MQTT_RX_ERR_ORPHAN);
+    CHECK(frag(rx, 41, NULL, a, 10, sizeof(a) - 10, sizeof(a)) == MQTT_RX_OK);
+    CHECK(got.count == count + 1 && memcmp(got.data, a, sizeof(a)) == 0);
+
+    // a lost connection drops what is left, files included
+    CHECK(frag(rx, 50, "dev/bulk", big, 0, 1000, sizeof(big)) == MQTT_RX_OK);
+    CHECK(frag(rx, 51, "dev/7/cert", b, 0, 1000, sizeof(b)) == MQTT_RX_OK);
+    int ends = stream.ends;
+    mqtt_rx_reset(rx);
+    CHECK(stream.ends == ends + 1);
+    CHECK(spill_empty());
+    mqtt_rx_stats(rx, &stats);
+    CHECK(stats.ram_used == 0);
+    CHECK(frag(rx, 50, NULL, big, 1000, 1000, sizeof(big)) == MQTT_RX_ERR_ORPHAN);
+
+    // bad fragments
+    CHECK(frag(rx, 0, "dev/x", a, 0, 200, 100) == MQTT_RX_ERR_ARG);
+    char topic[MQTT_RX_TOPIC_MAX + 1];
+    memset(topic, 'a', MQTT_RX_TOPIC_MAX);
+    topic[MQTT_RX_TOPIC_MAX] = '\0';
+    CHECK(frag(rx, 0, topic, a, 0, 10, 10) == MQTT_RX_ERR_ARG);
+    CHECK(frag(rx, 0, NULL, a, 0, 10, 10) == MQTT_RX_ERR_ARG);
+
+    // without a spill directory what the RAM cannot hold is dropped
+    mqttRxConfig_t ram_only = { .ram_budget = 4096, .ram_max = 4096 };
+    mqttRx_t *small = mqtt_rx_new(&ram_only);
+    CHECK(mqtt_rx_register(small, &any) == MQTT_RX_OK);
+    CHECK(feed(small, 0, "dev/bulk", big, sizeof(big), 1460) == MQTT_RX_ERR_NO_MEM);
+    CHECK(frag(small, 0, "dev/a", a, 0, 10, sizeof(a)) == MQTT_RX_OK);
+    CHECK(frag(small, 0, "dev/b", b, 0, 10, sizeof(b)) == MQTT_RX_ERR_NO_MEM);
+    mqtt_rx_stats(small, &stats);
+    CHECK(stats.ram_peak <= ram_only.ram_budget);
+    mqtt_rx_free(small);
+
+    mqtt_rx_stats(rx, &stats);
+    printf("delivered %u, spilled %u, dropped %u, RAM peak %zu\n",
+           (unsigned)stats.delivered, (unsigned)stats.spilled, (unsigned)stats.dropped, stats.ram_peak);
+    mqtt_rx_free(rx);
+    free(got.data);
+    free(cmd.data);
+    return host_test_end();
+}
@@ -0,0 +1,77 @@
+#ifndef __WAKE_SCHED_H__
+#define __WAKE_SCHED_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Planning of the timer wakes of the jobs a device runs from deep sleep.
+ *
+ * Each job is due some seconds from now. Jobs due close together share a wake, and with
+ * it one network bring-up. An anchored job (a capture) runs at the second it is due: the
+ * wake is placed on the earliest anchored job due within the window of the earliest job,
+ * else on the earliest job, and every other job due up to the window after the wake runs
+ * in it. So a job runs at most the window before or after its due time. A job that ran early must not be planned
+ * again for the same due time, so the caller computes the next time-of-day occurrence
+ * from after the due time of the last run.
+ */
+
+#define WAKE_SCHED_DAILY    7                       /* Day of a time due every day */
+#define WAKE_SCHED_DAY      (24 * 60 * 60)
+#define WAKE_SCHED_WEEK     (7 * WAKE_SCHED_DAY)
+#define WAKE_SCHED_WINDOW_MAX   300                 /* Widest coalescing window, seconds */
+
+/**
+ * @brief Time of day a job is due
+ */
+typedef struct wakeTime {
+    uint8_t day;            /* 0 for Sunday to 6 for Saturday, WAKE_SCHED_DAILY for every day */
+    uint32_t sec;           /* Seconds since midnight */
+} wakeTime_t;
+
+/**
+ * @brief Job to plan a wake for
+ */
+typedef struct wakeJob {
+    uint32_t due;           /* Seconds until the job is due, 0 if it is disabled */
+    bool anchored;          /* Runs at its due time, never moved by the window */
+} wakeJob_t;
+
+/**
+ * @brief Seconds until the first of a set of times of day
+ * @param times Times of day
+ * @param count Number of times
+ * @param week_sec Seconds since Sunday 00:00 of the time to count from, local time
+ * @return Seconds, 0 if a time is now, -1 if there is no valid time
+ */
+int32_t wake_sched_next_time(const wakeTime_t *times, int count, uint32_t week_sec);
+
+/**
+ * @brief Seconds until a job run every interval is due
+ * @param interval Interval in seconds
+ * @param last Time of the last run, 0 if it never ran
+ * @param now Current time
+ * @return Seconds, 1 if the job is overdue, the interval if it never ran
+ */
+uint32_t wake_sched_interval(uint32_t interval, time_t last, time_t now);
+
+/**
+ * @brief Plan the next wake
+ * @param jobs Jobs
+ * @param count Number of jobs, 32 at most
+ * @param window Coalescing window in seconds, 0 only merges jobs due at the same second
+ * @param mask Set to the jobs that run in the wake, bit i for jobs[i]
+ * @return Seconds until the wake, 0 if no job is enabled
+ */
+uint32_t wake_sched_plan(const wakeJob_t *jobs, int count, uint32_t window, uint32_t *mask);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WAKE_SCHED_H__ */
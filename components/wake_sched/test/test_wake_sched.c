@@ -0,0 +1,189 @@
+/*
+ * Runs the wake planning over simulated days, as sleep.c does it before each deep sleep,
+ * with and without the coalescing window: counts the wakes per day and checks that every
+ * job runs once per occurrence, that captures are never moved and the other jobs by no
+ * more than the window.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "wake_sched.h"
+#include "host_test.h"
+
+#define DAYS        7
+#define RUN_S       10          /* Time a wake takes before the device sleeps again */
+#define WINDOW      30          /* Default of sys:wakeWin */
+#define T0          ((time_t)1000 * WAKE_SCHED_WEEK)  /* Sunday 00:00, weeks count from 0 here */
+
+enum { JOB_CAPTURE, JOB_UPLOAD, JOB_SCHEDULE, JOB_MAX };
+
+#define HMS(h, m, s) (((h) * 60 + (m)) * 60 + (s))
+
+/**
+ * @brief Configuration of a device
+ */
+typedef struct scenario {
+    const char *name;
+    uint32_t interval;          /* Capture interval, 0 for the capture times */
+    wakeTime_t caps[8];
+    int cap_count;
+    wakeTime_t uploads[10];
+    int upload_count;
+    wakeTime_t schedule;
+} scenario_t;
+
+typedef struct result {
+    int wakes;
+    int runs[JOB_MAX];
+    long max_early[JOB_MAX];    /* Seconds run before the due time */
+    long max_late[JOB_MAX];     /* Seconds run after the due time */
+} result_t;
+
+/* Seconds until the first time at or after the due time of the last run, as sleep.c does */
+static uint32_t next_time(const wakeTime_t *times, int count, time_t now, time_t done)
+{
+    time_t ref = done + 1 > now ? done + 1 : now;
+    int32_t wait = wake_sched_next_time(times, count, (uint32_t)(ref % WAKE_SCHED_WEEK));
+    if (wait < 0) {
+        return 0;
+    }
+    return ref - now + wait > 0 ? (uint32_t)(ref - now + wait) : 1;
+}
+
+static void simulate(const scenario_t *sc, uint32_t window, result_t *res)
+{
+    time_t now = T0, end = T0 + DAYS * WAKE_SCHED_DAY;
+    time_t last_cap = T0, done[JOB_MAX] = {0};
+
+    memset(res, 0, sizeof(result_t));
+    for (;;) {
+        wakeJob_t jobs[JOB_MAX] = {
+            [JOB_CAPTURE] = { .anchored = true },
+        };
+        uint32_t mask;
+        jobs[JOB_CAPTURE].due = sc->interval ? wake_sched_interval(sc->interval, last_cap, now)
+                                             : next_time(sc->caps, sc->cap_count, now, done[JOB_CAPTURE]);
+        jobs[JOB_UPLOAD].due = next_time(sc->uploads, sc->upload_count, now, done[JOB_UPLOAD]);
+        jobs[JOB_SCHEDULE].due = next_time(&sc->schedule, 1, now, done[JOB_SCHEDULE]);
+
+        uint32_t wake = wake_sched_plan(jobs, JOB_MAX, window, &mask);
+        if (wake == 0 || now + wake >= end) {
+            break;
+        }
+        time_t at = now + wake;
+        res->wakes++;
+        for (int i = 0; i < JOB_MAX; i++) {
+            if (!(mask & (1u << i))) {
+                continue;
+            }
+            time_t due = now + jobs[i].due;
+            res->runs[i]++;
+            if (due - at > res->max_early[i]) {
+                res->max_early[i] = due - at;
+            }
+            if (at - due > res->max_late[i]) {
+                res->max_late[i] = at - due;
+            }
+            done[i] = due;
+        }
+        CHECK(mask != 0);
+        if (mask & (1u << JOB_CAPTURE)) {
+            last_cap = at;
+        }
+        now = at + RUN_S;
+    }
+}
+
+static void check_scenario(const scenario_t *sc)
+{
+    result_t before, after;
+    int captures = sc->interval ? DAYS * WAKE_SCHED_DAY / (int)sc->interval - 1 : 0;
+
+    for (int i = 0; i < sc->cap_count; i++) {
+        captures += sc->caps[i].day == WAKE_SCHED_DAILY ? DAYS : DAYS / 7;
+    }
+
+    simulate(sc, 0, &before);
+    simulate(sc, WINDOW, &after);
+
+    // each occurrence runs exactly once, a job that ran early does not fire again
+    const result_t *results[] = { &before, &after };
+    for (int i = 0; i < 2; i++) {
+        CHECK(results[i]->runs[JOB_CAPTURE] == captures);
+        CHECK(results[i]->runs[JOB_UPLOAD] == DAYS * sc->upload_count);
+        CHECK(results[i]->runs[JOB_SCHEDULE] == DAYS);
+        CHECK(results[i]->max_early[JOB_CAPTURE] == 0 && results[i]->max_late[JOB_CAPTURE] == 0);
+    }
+    for (int i = 0; i < JOB_MAX; i++) {
+        CHECK(after.max_early[i] <= WINDOW && after.max_late[i] <= WINDOW);
+    }
+    CHECK(after.wakes < before.wakes);
+    printf("%-34s window 0s: %3d wakes/day, %ds: %3d wakes/day, upload moved %+lds..%+lds\n", sc->name,
+           before.wakes / DAYS, WINDOW, after.wakes / DAYS, -after.max_early[JOB_UPLOAD], after.max_late[JOB_UPLOAD]);
+}
+
+int main(void)
+{
+    // time of day
+    const wakeTime_t mon = { 1, HMS(8, 0, 0) };
+    const wakeTime_t daily[] = { { WAKE_SCHED_DAILY, HMS(12, 0, 0) }, { WAKE_SCHED_DAILY, HMS(6, 0, 0) } };
+    const wakeTime_t bad[] = { { 8, 0 }, { WAKE_SCHED_DAILY, WAKE_SCHED_DAY } };
+    CHECK(wake_sched_next_time(&mon, 1, HMS(8, 0, 0)) == WAKE_SCHED_DAY);
+    CHECK(wake_sched_next_time(&mon, 1, WAKE_SCHED_DAY + HMS(8, 0, 0)) == 0);
+    CHECK(wake_sched_next_time(&mon, 1, WAKE_SCHED_DAY + HMS(8, 0, 1)) == WAKE_SCHED_WEEK - 1);
+    CHECK(wake_sched_next_time(daily, 2, 3 * WAKE_SCHED_DAY + HMS(7, 0, 0)) == HMS(5, 0, 0));
+    CHECK(wake_sched_next_time(daily, 2, 6 * WAKE_SCHED_DAY + HMS(13, 0, 0)) == HMS(17, 0, 0));
+    CHECK(wake_sched_next_time(bad, 2, 0) == -1);
+    CHECK(wake_sched_next_time(daily, 0, 0) == -1);
+
+    // interval
+    CHECK(wake_sched_interval(900, 0, 5000) == 900);
+    CHECK(wake_sched_interval(900, 5000, 5100) == 800);
+    CHECK(wake_sched_interval(900, 5000, 5900) == 1);
+
+    // the capture sets the wake, the jobs due within the window around it join
+    uint32_t mask;
+    wakeJob_t jobs[] = { { 100, true }, { 80, false }, { 125, false } };
+    CHECK(wake_sched_plan(jobs, 3, 20, &mask) == 100 && mask == 0x3);
+    CHECK(wake_sched_plan(jobs, 3, 10, &mask) == 80 && mask == 0x2);
+    CHECK(wake_sched_plan(jobs, 3, 30, &mask) == 100 && mask == 0x7);
+    CHECK(wake_sched_plan(jobs, 3, 0, &mask) == 80 && mask == 0x2);
+    wakeJob_t idle[] = { { 0, true }, { 0, false } };
+    CHECK(wake_sched_plan(idle, 2, 30, &mask) == 0 && mask == 0);
+
+    const scenario_t scenarios[] = {
+        {
+            .name = "captures 3/day, uploads +20s",
+            .caps = { { WAKE_SCHED_DAILY, HMS(6, 0, 0) }, { WAKE_SCHED_DAILY, HMS(12, 0, 0) },
+                      { WAKE_SCHED_DAILY, HMS(18, 0, 0) } },
+            .cap_count = 3,
+            .uploads = { { WAKE_SCHED_DAILY, HMS(6, 0, 20) }, { WAKE_SCHED_DAILY, HMS(12, 0, 20) },
+                         { WAKE_SCHED_DAILY, HMS(18, 0, 20) } },
+            .upload_count = 3,
+            .schedule = { WAKE_SCHED_DAILY, HMS(3, 0, 0) },
+        },
+        {
+            .name = "captures every 15 min, uploads 3h",
+            .interval = 15 * 60,
+            .uploads = { { WAKE_SCHED_DAILY, HMS(0, 0, 20) }, { WAKE_SCHED_DAILY, HMS(3, 0, 20) },
+                         { WAKE_SCHED_DAILY, HMS(6, 0, 20) }, { WAKE_SCHED_DAILY, HMS(9, 0, 20) },
+                         { WAKE_SCHED_DAILY, HMS(12, 0, 20) }, { WAKE_SCHED_DAILY, HMS(15, 0, 20) },
+                         { WAKE_SCHED_DAILY, HMS(18, 0, 20) }, { WAKE_SCHED_DAILY, HMS(21, 0, 20) } },
+            .upload_count = 8,
+            .schedule = { WAKE_SCHED_DAILY, HMS(2, 59, 45) },
+        },
+        {
+            .name = "weekday captures, uploads -25s",
+            .caps = { { 1, HMS(9, 0, 0) }, { 2, HMS(9, 0, 0) }, { 3, HMS(9, 0, 0) }, { 4, HMS(9, 0, 0) },
+                      { 5, HMS(9, 0, 0) }, { 6, HMS(9, 0, 0) }, { 0, HMS(9, 0, 0) } },
+            .cap_count = 7,
+            .uploads = { { WAKE_SCHED_DAILY, HMS(8, 59, 35) } },
+            .upload_count = 1,
+            .schedule = { WAKE_SCHED_DAILY, HMS(4, 0, 0) },
+        },
+    };
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        check_scenario(&scenarios[i]);
+    }
+
+    return host_test_end();
+}
@@ -0,0 +1,66 @@
+#include "wake_sched.h"
+
+int32_t wake_sched_next_time(const wakeTime_t *times, int count, uint32_t week_sec)
+{
+    int32_t next = -1;
+
+    week_sec %= WAKE_SCHED_WEEK;
+    for (int i = 0; i < count; i++) {
+        if (times[i].day > WAKE_SCHED_DAILY || times[i].sec >= WAKE_SCHED_DAY) {
+            continue;
+        }
+        uint32_t period = times[i].day == WAKE_SCHED_DAILY ? WAKE_SCHED_DAY : WAKE_SCHED_WEEK;
+        uint32_t at = times[i].day == WAKE_SCHED_DAILY ? times[i].sec : times[i].day * WAKE_SCHED_DAY + times[i].sec;
+        int32_t wait = (int32_t)((at + period - week_sec % period) % period);
+        if (next < 0 || wait < next) {
+            next = wait;
+        }
+    }
+    return next;
+}
+
+uint32_t wake_sched_interval(uint32_t interval, time_t last, time_t now)
+{
+    if (last <= 0) {
+        return interval;
+    }
+    if (now >= last + (time_t)interval) {
+        return 1;
+    }
+    return (uint32_t)(last + interval - now);
+}
+
+uint32_t wake_sched_plan(const wakeJob_t *jobs, int count, uint32_t window, uint32_t *mask)
+{
+    uint32_t earliest = 0;
+    uint32_t wake = 0;
+
+    *mask = 0;
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].due > 0 && (earliest == 0 || jobs[i].due < earliest)) {
+            earliest = jobs[i].due;
+        }
+    }
+    if (earliest == 0) {
+        return 0;
+    }
+    // the earliest anchored job of the group sets the wake, else the earliest job
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].anchored && jobs[i].due > 0 && jobs[i].due - earliest <= window &&
+            (wake == 0 || jobs[i].due < wake)) {
+            wake = jobs[i].due;
+        }
+    }
+    if (wake == 0) {
+        wake = earliest;
+    }
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].due == 0) {
+            continue;
+        }
+        if (jobs[i].anchored ? jobs[i].due == wake : jobs[i].due <= wake + window) {
+            *mask |= 1u << i;
+        }
+    }
+    return wake;
+}
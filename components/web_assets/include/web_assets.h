@@ -0,0 +1,43 @@
+#ifndef __WEB_ASSETS_H__
+#define __WEB_ASSETS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Static file embedded in the firmware, with its gzip made at build time
+ *
+ * The ETag is the CRC32 of the content, computed on the first request. The gzip is sent to
+ * clients that accept it, the content as is to the others.
+ */
+typedef struct webAsset {
+    const char *type;       // Content-Type
+    const char *cache;      // Cache-Control, NULL for none
+    const char *start;      // Content
+    const char *end;
+    const char *gz_start;   // gzip of the content, NULL if there is none
+    const char *gz_end;
+    uint32_t crc;           // CRC32 of the content, valid once hashed
+    bool hashed;
+} webAsset_t;
+
+/**
+ * @brief Answer a GET of an asset: 304 if If-None-Match holds its ETag, else its gzip if
+ * Accept-Encoding allows it, else its content
+ * @param req HTTP request handle
+ * @param asset Asset
+ * @return Result of the send
+ */
+esp_err_t web_asset_send(httpd_req_t *req, webAsset_t *asset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WEB_ASSETS_H__ */
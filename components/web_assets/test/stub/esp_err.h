@@ -0,0 +1,13 @@
+/* Host stub of the ESP-IDF error codes used by web_assets */
+#ifndef __ESP_ERR_H__
+#define __ESP_ERR_H__
+
+typedef int esp_err_t;
+
+#define ESP_OK                          0
+#define ESP_FAIL                        -1
+#define ESP_ERR_NOT_FOUND               0x105
+#define ESP_ERR_HTTPD_BASE              0xb000
+#define ESP_ERR_HTTPD_RESULT_TRUNC      (ESP_ERR_HTTPD_BASE + 3)
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Host stub of esp_http_server: a request holds its headers, the response is recorded
+ * in it by the stub functions of the test.
+ */
+#ifndef __ESP_HTTP_SERVER_H__
+#define __ESP_HTTP_SERVER_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "esp_err.h"
+
+#define HTTPD_MAX_URI_LEN       512
+#define HTTPD_STUB_MAX_HDRS     8
+
+typedef enum {
+    HTTP_GET = 1,
+    HTTP_POST = 3,
+} httpd_method_t;
+
+typedef struct {
+    const char *field;
+    const char *value;
+} httpd_stub_hdr_t;
+
+typedef struct httpd_req {
+    int method;
+    char uri[HTTPD_MAX_URI_LEN + 1];
+    void *user_ctx;
+    httpd_stub_hdr_t req_hdrs[HTTPD_STUB_MAX_HDRS];     // Request headers, field NULL after the last
+    const char *status;                                 // Response
+    const char *type;
+    char resp_fields[HTTPD_STUB_MAX_HDRS][32];          // Copies, a value may live on the stack of the handler
+    char resp_values[HTTPD_STUB_MAX_HDRS][128];
+    int resp_hdr_count;
+    const char *body;
+    size_t body_len;
+    int sends;
+} httpd_req_t;
+
+typedef struct httpd_uri {
+    const char *uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *r);
+    void *user_ctx;
+} httpd_uri_t;
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size);
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status);
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value);
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len);
+
+#endif
@@ -0,0 +1,9 @@
+/* Host stub of the ROM CRC32, the one of zlib */
+#ifndef __ESP_ROM_CRC_H__
+#define __ESP_ROM_CRC_H__
+
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len);
+
+#endif
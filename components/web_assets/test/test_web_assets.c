@@ -0,0 +1,288 @@
+/*
+ * Serves the web assets of main/web/dist through a stub httpd, with their gzip made by
+ * tools/gzip_asset.py as the firmware build does.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "web_assets.h"
+#include "host_test.h"
+
+#define DIST "../../../main/web/dist"
+#define TOOL "python3 ../../../tools/gzip_asset.py"
+
+/*------------------------------------------------------------------------*/
+/* Stub httpd */
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+static const char *req_header(httpd_req_t *r, const char *field)
+{
+    for (int i = 0; i < HTTPD_STUB_MAX_HDRS && r->req_hdrs[i].field != NULL; i++) {
+        if (strcasecmp(r->req_hdrs[i].field, field) == 0) {
+            return r->req_hdrs[i].value;
+        }
+    }
+    return NULL;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+    const char *value = req_header(r, field);
+    return value ? strlen(value) : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+    const char *value = req_header(r, field);
+    if (value == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    snprintf(val, val_size, "%s", value);
+    return strlen(value) < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    r->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    r->type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    if (r->resp_hdr_count == HTTPD_STUB_MAX_HDRS) {
+        return ESP_FAIL;
+    }
+    snprintf(r->resp_fields[r->resp_hdr_count], sizeof(r->resp_fields[0]), "%s", field);
+    snprintf(r->resp_values[r->resp_hdr_count], sizeof(r->resp_values[0]), "%s", value);
+    r->resp_hdr_count++;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    r->body = buf;
+    r->body_len = buf_len;
+    r->sends++;
+    return ESP_OK;
+}
+
+static const char *resp_header(httpd_req_t *r, const char *field)
+{
+    for (int i = 0; i < r->resp_hdr_count; i++) {
+        if (strcasecmp(r->resp_fields[i], field) == 0) {
+            return r->resp_values[i];
+        }
+    }
+    return NULL;
+}
+
+/*------------------------------------------------------------------------*/
+/* Assets and the handler table, as in main/http.c */
+
+typedef struct file {
+    char *data;
+    size_t len;
+} file_t;
+
+static file_t g_files[4];
+
+static webAsset_t g_rootAsset = { .type = "text/html", .cache = "no-cache" };
+static webAsset_t g_jsAsset = { .type = "text/javascript", .cache = "public, max-age=604800" };
+static webAsset_t g_cssAsset = { .type = "text/css", .cache = "public, max-age=604800" };
+static webAsset_t g_faviconAsset = { .type = "image/x-icon" };
+
+static esp_err_t get_asset_handler(httpd_req_t *req)
+{
+    return web_asset_send(req, (webAsset_t *)req->user_ctx);
+}
+
+static const httpd_uri_t g_handlers[] = {
+    { .uri = "/", .method = HTTP_GET, .handler = get_asset_handler, .user_ctx = &g_rootAsset },
+    { .uri = "/favicon.ico", .method = HTTP_GET, .handler = get_asset_handler, .user_ctx = &g_faviconAsset },
+    { .uri = "/assets/index.js", .method = HTTP_GET, .handler = get_asset_handler, .user_ctx = &g_jsAsset },
+    { .uri = "/assets/index.css", .method = HTTP_GET, .handler = get_asset_handler, .user_ctx = &g_cssAsset },
+};
+
+static int load(const char *path, file_t *file)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    file->len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    file->data = malloc(file->len);
+    size_t n = fread(file->data, 1, file->len, f);
+    fclose(f);
+    return n == file->len ? 0 : -1;
+}
+
+/**
+ * @brief Embed an asset and its gzip, as the build does
+ */
+static int embed(webAsset_t *asset, const char *path, file_t *raw, file_t *gz)
+{
+    char cmd[512];
+    if (load(path, raw) != 0) {
+        return -1;
+    }
+    asset->start = raw->data;
+    asset->end = raw->data + raw->len;
+    if (gz == NULL) {
+        return 0;
+    }
+    snprintf(cmd, sizeof(cmd), TOOL " %s asset.gz", path);
+    if (system(cmd) != 0 || load("asset.gz", gz) != 0) {
+        return -1;
+    }
+    remove("asset.gz");
+    asset->gz_start = gz->data;
+    asset->gz_end = gz->data + gz->len;
+    return 0;
+}
+
+/**
+ * @brief Dispatch a GET to the handler of its path, the query is not part of the match
+ * @param headers Request headers as field, value pairs, NULL terminated
+ */
+static void get(httpd_req_t *req, const char *uri, const char **headers)
+{
+    memset(req, 0, sizeof(httpd_req_t));
+    req->method = HTTP_GET;
+    snprintf(req->uri, sizeof(req->uri), "%s", uri);
+    for (int i = 0; headers && headers[2 * i]; i++) {
+        req->req_hdrs[i].field = headers[2 * i];
+        req->req_hdrs[i].value = headers[2 * i + 1];
+    }
+    size_t path = strcspn(uri, "?");
+    for (size_t i = 0; i < sizeof(g_handlers) / sizeof(g_handlers[0]); i++) {
+        if (strlen(g_handlers[i].uri) == path && strncmp(g_handlers[i].uri, uri, path) == 0) {
+            req->user_ctx = g_handlers[i].user_ctx;
+            g_handlers[i].handler(req);
+            return;
+        }
+    }
+    req->status = "404 Not Found";
+}
+
+static bool is_status(httpd_req_t *req, const char *status)
+{
+    return (req->status == NULL && strcmp(status, "200 OK") == 0) || (req->status && strcmp(req->status, status) == 0);
+}
+
+int main(void)
+{
+    file_t gz[3] = {0};
+    httpd_req_t req;
+    char etag[64];
+
+    CHECK(embed(&g_rootAsset, DIST "/index.html", &g_files[0], &gz[0]) == 0);
+    CHECK(embed(&g_jsAsset, DIST "/assets/index.js", &g_files[1], &gz[1]) == 0);
+    CHECK(embed(&g_cssAsset, DIST "/assets/index.css", &g_files[2], &gz[2]) == 0);
+    CHECK(embed(&g_faviconAsset, DIST "/../favicon.ico", &g_files[3], NULL) == 0);
+    if (g_failed) {
+        return 1;
+    }
+
+    // no Accept-Encoding, the content as is
+    get(&req, "/assets/index.js?v=1769414171978", NULL);
+    CHECK(is_status(&req, "200 OK"));
+    CHECK(strcmp(req.type, "text/javascript") == 0);
+    CHECK(req.body == g_files[1].data && req.body_len == g_files[1].len);
+    CHECK(resp_header(&req, "Content-Encoding") == NULL);
+    CHECK(strcmp(resp_header(&req, "Vary"), "Accept-Encoding") == 0);
+    CHECK(strcmp(resp_header(&req, "Cache-Control"), "public, max-age=604800") == 0);
+    snprintf(etag, sizeof(etag), "\"%08x\"", esp_rom_crc32_le(0, (uint8_t *)g_files[1].data, g_files[1].len));
+    CHECK(strcmp(resp_header(&req, "ETag"), etag) == 0);
+
+    // browsers get the gzip
+    const char *browser[] = { "Accept-Encoding", "gzip, deflate, br", NULL };
+    const char *sizes[] = { "/", "/assets/index.js", "/assets/index.css" };
+    size_t raw_total = 0, sent_total = 0;
+    for (int i = 0; i < 3; i++) {
+        get(&req, sizes[i], browser);
+        CHECK(is_status(&req, "200 OK"));
+        CHECK(req.body == gz[i].data && req.body_len == gz[i].len);
+        CHECK(strcmp(resp_header(&req, "Content-Encoding"), "gzip") == 0);
+        CHECK(strstr(resp_header(&req, "ETag"), "-gz\"") != NULL);
+        raw_total += g_files[i].len;
+        sent_total += req.body_len;
+    }
+    CHECK(sent_total < raw_total / 2);
+    printf("first page load: %zu bytes gzip instead of %zu\n", sent_total, raw_total);
+
+    // gzip refused or not listed
+    const char *refused[] = { "Accept-Encoding", "br, gzip;q=0, *;q=0.5", NULL };
+    get(&req, "/assets/index.css", refused);
+    CHECK(req.body == g_files[2].data);
+    const char *identity[] = { "Accept-Encoding", "identity", NULL };
+    get(&req, "/assets/index.css", identity);
+    CHECK(req.body == g_files[2].data);
+    const char *any[] = { "accept-encoding", "*", NULL };
+    get(&req, "/assets/index.css", any);
+    CHECK(req.body == gz[2].data);
+    const char *weighted[] = { "Accept-Encoding", "deflate;q=0.5, GZIP; q=0.8", NULL };
+    get(&req, "/assets/index.css", weighted);
+    CHECK(req.body == gz[2].data);
+
+    // an asset without gzip ignores Accept-Encoding
+    get(&req, "/favicon.ico", browser);
+    CHECK(req.body == g_files[3].data && req.body_len == g_files[3].len);
+    CHECK(resp_header(&req, "Content-Encoding") == NULL);
+    CHECK(resp_header(&req, "Vary") == NULL);
+    CHECK(resp_header(&req, "Cache-Control") == NULL);
+
+    // revalidation with the ETag of either representation is a 304 without a body
+    get(&req, "/", browser);
+    snprintf(etag, sizeof(etag), "%s", resp_header(&req, "ETag"));
+    const char *cached[] = { "Accept-Encoding", "gzip", "If-None-Match", etag, NULL };
+    get(&req, "/", cached);
+    CHECK(is_status(&req, "304 Not Modified"));
+    CHECK(req.body == NULL && req.body_len == 0 && req.sends == 1);
+    CHECK(strcmp(resp_header(&req, "ETag"), etag) == 0);
+    CHECK(strcmp(resp_header(&req, "Cache-Control"), "no-cache") == 0);
+    char list[128];
+    snprintf(list, sizeof(list), "\"0badf00d\", W/%s", etag);
+    const char *weak[] = { "If-None-Match", list, NULL };
+    get(&req, "/", weak);
+    CHECK(is_status(&req, "304 Not Modified"));
+    const char *star[] = { "If-None-Match", "*", NULL };
+    get(&req, "/assets/index.js", star);
+    CHECK(is_status(&req, "304 Not Modified"));
+
+    // a stale ETag gets the asset
+    const char *stale[] = { "Accept-Encoding", "gzip", "If-None-Match", "\"0badf00d-gz\"", NULL };
+    get(&req, "/", stale);
+    CHECK(is_status(&req, "200 OK"));
+    CHECK(req.body == gz[0].data);
+
+    get(&req, "/missing", browser);
+    CHECK(is_status(&req, "404 Not Found"));
+
+    for (int i = 0; i < 4; i++) {
+        free(g_files[i].data);
+    }
+    for (int i = 0; i < 3; i++) {
+        free(gz[i].data);
+    }
+    return host_test_end();
+}
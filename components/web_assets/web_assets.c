@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "web_assets.h"
+
+#define TAG "-->WEB_ASSETS"
+
+#define WEB_HDR_MAX_SIZE 128   // Request header value kept, a longer one is cut
+
+/**
+ * @brief Read a request header, a value cut to the buffer still gives its first items
+ * @return false if the request has no such header
+ */
+static bool get_header(httpd_req_t *req, const char *field, char *value, size_t size)
+{
+    if (httpd_req_get_hdr_value_len(req, field) == 0) {
+        return false;
+    }
+    esp_err_t err = httpd_req_get_hdr_value_str(req, field, value, size);
+    return err == ESP_OK || err == ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+/**
+ * @brief Whether an Accept-Encoding value allows gzip, e.g. "gzip, deflate, br" but not "gzip;q=0"
+ */
+static bool accepts_gzip(const char *value)
+{
+    int gzip = -1, any = -1;    // q > 0 of gzip and of *, -1 if not listed
+    const char *p = value;
+
+    while (*p != '\0') {
+        while (*p == ' ' || *p == ',') {
+            p++;
+        }
+        const char *coding = p;
+        while (*p != '\0' && *p != ',' && *p != ';' && *p != ' ') {
+            p++;
+        }
+        size_t len = p - coding;
+        bool allowed = true;
+        while (*p != '\0' && *p != ',') {
+            if (*p++ != ';') {
+                continue;
+            }
+            while (*p == ' ') {
+                p++;
+            }
+            if ((*p == 'q' || *p == 'Q') && p[1] == '=') {
+                allowed = strtod(p + 2, NULL) > 0;
+            }
+        }
+        if (len == 4 && strncasecmp(coding, "gzip", 4) == 0) {
+            gzip = allowed;
+        } else if (len == 1 && *coding == '*') {
+            any = allowed;
+        }
+    }
+    return gzip >= 0 ? gzip : any > 0;
+}
+
+esp_err_t web_asset_send(httpd_req_t *req, webAsset_t *asset)
+{
+    char value[WEB_HDR_MAX_SIZE];
+    char etag[16], gz_etag[16];
+
+    if (!asset->hashed) {
+        asset->crc = esp_rom_crc32_le(0, (const uint8_t *)asset->start, asset->end - asset->start);
+        asset->hashed = true;
+    }
+    // the gzip is another representation, so it has its own strong ETag
+    snprintf(etag, sizeof(etag), "\"%08" PRIx32 "\"", asset->crc);
+    snprintf(gz_etag, sizeof(gz_etag), "\"%08" PRIx32 "-gz\"", asset->crc);
+    bool gzip = asset->gz_start != NULL && get_header(req, "Accept-Encoding", value, sizeof(value)) && accepts_gzip(value);
+
+    httpd_resp_set_type(req, asset->type);
+    if (asset->cache) {
+        httpd_resp_set_hdr(req, "Cache-Control", asset->cache);
+    }
+    httpd_resp_set_hdr(req, "ETag", gzip ? gz_etag : etag);
+    if (asset->gz_start != NULL) {
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    }
+    if (get_header(req, "If-None-Match", value, sizeof(value)) &&
+            (strcmp(value, "*") == 0 || strstr(value, etag) != NULL || strstr(value, gz_etag) != NULL)) {
+        ESP_LOGD(TAG, "%s not modified", req->uri);
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    if (gzip) {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        return httpd_resp_send(req, asset->gz_start, asset->gz_end - asset->gz_start);
+    }
+    return httpd_resp_send(req, asset->start, asset->end - asset->start);
+}
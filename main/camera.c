@@ -17,7 +17,9 @@
 #include <string.h>
 #include <inttypes.h>
 #include <esp_timer.h>
+#include <esp_heap_caps.h>
 #include "img_converters.h"
+#include "jpg_crop.h"
 #include "camera_uvc_controls.h"
 // Support both IDF 5.x
 #ifndef portTICK_RATE_MS
@@ -28,6 +30,10 @@
 #include "misc.h"
 #include "utils.h"
 #include "uvc.h"
+#include "debug.h"
+#include "capture_bp.h"
+#include "jpeg_budget.h"
+#include "link_est.h"
 
 #define TAG "-->CAMERA"  // Logging tag for camera module
 
@@ -37,6 +43,37 @@
 // Global minimum JPEG quality for all resolutions
 #define MIN_JPEG_QUALITY 4
 
+// Capture backpressure
+#define CAMERA_SPILL_PSRAM_DIV  3   // Spill pool may use 1/3 of the PSRAM free after camera init
+#define CAMERA_DIVERT_WAIT_MS   200 // Storage is local flash, wait a little for it to drain
+
+// Capture profiles
+#define CAMERA_PSRAM_RESERVE    (1024 * 1024) // PSRAM kept for queued frames, previews and decodes
+#define CAMERA_JPEG_BUF_MIN     (64 * 1024)   // Smallest JPEG frame buffer
+#define CAMERA_JPEG_BUF_ALIGN   4096          // JPEG frame buffers are rounded up to this
+#define CAMERA_LIVE_FRAMESIZE   FRAMESIZE_QSXGA // Largest framesize the web page can switch to
+
+// Burst capture
+#define CAMERA_BURST_MAX        8   // Most frames grabbed for one capture
+#define CAMERA_SHARPNESS_WIDTH  640 // Sharpness is scored on a decode about this wide
+
+// Preview rendition
+#define CAMERA_PREVIEW_QUALITY  80  // JPEG quality of the preview (1-100)
+
+// Region of interest
+#define CAMERA_ROI_FULL         1000 // ROI coordinates are in permille of the frame
+#define CAMERA_ROI_OFF          0    // Whole frame
+#define CAMERA_ROI_CROP         1    // Lossless crop of the JPEG
+#define CAMERA_ROI_SENSOR       2    // Sensor window, the JPEG crop when the sensor cannot window
+
+// OV5640 4:3 mode, the active array and timings the sensor window is cut from (ov5640 ratio_table)
+#define OV5640_4X3_MAX_WIDTH    2560
+#define OV5640_4X3_MAX_HEIGHT   1920
+#define OV5640_4X3_OFFSET_X     32
+#define OV5640_4X3_OFFSET_Y     16
+#define OV5640_4X3_TOTAL_X      2844
+#define OV5640_4X3_TOTAL_Y      1968
+
 // Camera interface pins
 #define CAMERA_PIN_VSYNC 6   // Vertical sync
 #define CAMERA_PIN_HREF 7    // Horizontal reference
@@ -64,8 +101,40 @@ typedef struct camera_vtable {
 	esp_err_t (*init)(void);
 	void (*deinit)(void);
 	esp_err_t (*set_image)(imgAttr_t *image);
+	esp_err_t (*set_quality)(uint8_t quality);  // NULL if the backend cannot change JPEG quality per capture
+	esp_err_t (*set_framesize)(framesize_t frameSize);  // NULL if the backend cannot change resolution per capture
+	esp_err_t (*set_window)(framesize_t frameSize, const imgAttr_t *image, uint16_t *width, uint16_t *height);  // NULL if the backend cannot window the sensor
 } camera_vtable_t;
 
+/**
+ * Frame buffer profile of a capture mode
+ */
+typedef struct cameraProfile {
+    const char *name;
+    size_t fbMin;                // Frame buffers the mode cannot work with less
+    size_t fbMax;                // Frame buffers wanted when PSRAM allows
+    camera_grab_mode_t grabMode; // When the driver fills the buffers
+    int xclkHz;                  // XCLK frequency
+    uint8_t pixelsPerByte;       // JPEG buffer is width * height / pixelsPerByte bytes
+    bool anySize;                // Resolution can change while open, size the buffers for CAMERA_LIVE_FRAMESIZE
+} cameraProfile_t;
+
+typedef enum {
+    CAMERA_PROFILE_SNAPSHOT = 0, // One frame per capture
+    CAMERA_PROFILE_LIVE,         // Web page stream in configuration mode
+    CAMERA_PROFILE_BURST,        // Several frames per capture, the sharpest is kept
+} cameraProfileId_e;
+
+static const cameraProfile_t g_cameraProfiles[] = {
+    // one buffer below the driver default, a queued frame leaves it for the spill pool so the
+    // next capture of the wake has it, the frame exposed during the warm-up is dropped in camera_open()
+    [CAMERA_PROFILE_SNAPSHOT] = {"snapshot",  1, 1, CAMERA_GRAB_WHEN_EMPTY, 5000000,  5, false},
+    // capture the next frames while the previous one is sent
+    [CAMERA_PROFILE_LIVE]     = {"live-view", 2, 3, CAMERA_GRAB_LATEST,     10000000, 6, true},
+    // the best frame is held while the next one is scored
+    [CAMERA_PROFILE_BURST]    = {"burst",     2, 2, CAMERA_GRAB_LATEST,     5000000,  4, false},
+};
+
 typedef struct mdCamera {
     QueueHandle_t in;            // Input queue for commands
     QueueHandle_t out;           // Output queue for captured frames
@@ -77,9 +146,26 @@ typedef struct mdCamera {
     bool bSnapShot;              // Snapshot in progress flag
     bool bSnapShotSuccess;       // Last snapshot success status
 	const camera_vtable_t *vt;   // Backend vtable
+    QueueHandle_t spill;         // Queue taking frames when the output queue is full (can be NULL)
+    captureBpPool_t spillPool;   // PSRAM spill pool
+    uint8_t quality;             // JPEG quality currently set on the sensor
+    uint32_t uploadBudget;       // Seconds an instant upload may take, 0 to keep the configured resolution
+    const cameraProfile_t *profile; // Frame buffer profile the CSI camera was opened with
 } mdCamera_t;
 
+/**
+ * Capture backpressure statistics
+ */
+typedef struct cameraStats {
+    uint32_t spill;              // Frames copied to the PSRAM spill pool
+    uint32_t divert;             // Frames diverted to the spill queue
+    uint32_t drop;               // Frames dropped because every queue was full
+} cameraStats_t;
+
 static mdCamera_t g_mdCamera = {0};  // Global camera state instance
+static RTC_DATA_ATTR cameraStats_t g_cameraStats = {0};
+static RTC_DATA_ATTR jpegBudget_t g_jpegBudget;      // Size-vs-quality models for the byte budget
+static RTC_DATA_ATTR bool g_jpegBudgetInit = false;
 
 /**
  * Lock camera mutex for thread-safe operations
@@ -128,6 +214,8 @@ static void camera_queue_node_free(queueNode_t *node, nodeEvent_e event)
 {
     if (node && node->context) {
         camera_fb_return((camera_fb_t *)node->context); // Return frame buffer
+        free(node->preview);
+        free(node->exif);
         free(node); // Free node memory
         ESP_LOGI(TAG, "camera_queue_node_free");
         camera_lock();
@@ -169,6 +257,233 @@ static queueNode_t *camera_queue_node_malloc(camera_fb_t *frame, snapType_e type
     return NULL;  // Allocation failed
 }
 
+/**
+ * Free a node whose frame was copied to the PSRAM spill pool
+ * @param node Queue node to free
+ * @param event Event type (unused)
+ */
+static void camera_spill_node_free(queueNode_t *node, nodeEvent_e event)
+{
+    if (node) {
+        camera_lock();
+        capture_bp_pool_give(&g_mdCamera.spillPool, node->len);
+        g_mdCamera.captureCount--;  // Decrement active capture count
+        if (g_mdCamera.captureCount == 0) {
+            sleep_set_event_bits(SLEEP_SNAPSHOT_STOP_BIT);  // Signal no active captures
+        }
+        camera_unlock();
+        heap_caps_free(node->data);
+        free(node->preview);
+        free(node->exif);
+        free(node);
+        ESP_LOGI(TAG, "camera_spill_node_free");
+    }
+}
+
+/**
+ * Free a node whose frame was replaced by a crop of its region of interest
+ * @param node Queue node to free
+ * @param event Event type (unused)
+ */
+static void camera_crop_node_free(queueNode_t *node, nodeEvent_e event)
+{
+    if (node) {
+        camera_lock();
+        g_mdCamera.captureCount--;  // Decrement active capture count
+        if (g_mdCamera.captureCount == 0) {
+            sleep_set_event_bits(SLEEP_SNAPSHOT_STOP_BIT);  // Signal no active captures
+        }
+        camera_unlock();
+        free(node->data);
+        free(node->preview);
+        free(node->exif);
+        free(node);
+        ESP_LOGI(TAG, "camera_crop_node_free");
+    }
+}
+
+/**
+ * Copy the frame of a node to the PSRAM spill pool and return the frame buffer to the camera,
+ * so a lagging consumer does not hold the few camera frame buffers
+ * @param node Queue node holding a camera frame
+ * @return ESP_OK on success, ESP_FAIL if the pool is full
+ */
+static esp_err_t camera_spill_node(queueNode_t *node)
+{
+    void *data = NULL;
+
+    if (node->context == NULL) {
+        return ESP_OK; // the node does not hold a camera frame buffer
+    }
+    camera_lock();
+    bool reserved = capture_bp_pool_take(&g_mdCamera.spillPool, node->len);
+    camera_unlock();
+    if (!reserved) {
+        return ESP_FAIL;
+    }
+
+    data = heap_caps_malloc(node->len, MALLOC_CAP_SPIRAM);
+    if (data == NULL) {
+        camera_lock();
+        capture_bp_pool_give(&g_mdCamera.spillPool, node->len);
+        camera_unlock();
+        return ESP_FAIL;
+    }
+    memcpy(data, node->data, node->len);
+    camera_fb_return((camera_fb_t *)node->context);
+    node->data = data;
+    node->context = NULL;
+    node->free_handler = camera_spill_node_free;
+    g_cameraStats.spill++;
+    ESP_LOGI(TAG, "spill %d bytes, pool %d/%d", node->len, g_mdCamera.spillPool.used, g_mdCamera.spillPool.limit);
+    return ESP_OK;
+}
+
+/**
+ * Check if a region of interest smaller than the frame is configured
+ * @param image Image attributes
+ * @return true if the capture should be cut to the region of interest
+ */
+static bool camera_roi_enabled(const imgAttr_t *image)
+{
+    if (image->roiMode == CAMERA_ROI_OFF || image->roiW == 0 || image->roiH == 0) {
+        return false;
+    }
+    return image->roiX > 0 || image->roiY > 0 || image->roiW < CAMERA_ROI_FULL || image->roiH < CAMERA_ROI_FULL;
+}
+
+/**
+ * Replace the frame of a node by a lossless crop of its region of interest
+ * The crop is snapped to whole JPEG MCUs and the frame buffer is returned to the camera
+ * @param node Queue node holding a camera frame
+ * @param frame Camera frame of the node
+ * @param image Image attributes holding the region of interest
+ * @param width Set to the width of the crop
+ * @param height Set to the height of the crop
+ * @return ESP_OK on success, ESP_FAIL if the node keeps the whole frame
+ */
+static esp_err_t camera_crop_node(queueNode_t *node, camera_fb_t *frame, const imgAttr_t *image, uint16_t *width, uint16_t *height)
+{
+    int64_t start = esp_timer_get_time();
+    jpg_crop_rect_t rect;
+    uint8_t *data = NULL;
+    size_t len = 0;
+    size_t frameLen = frame->len;
+
+    if (frame->format != PIXFORMAT_JPEG) {
+        return ESP_FAIL;
+    }
+    rect.x = (uint32_t)frame->width * MIN(image->roiX, CAMERA_ROI_FULL) / CAMERA_ROI_FULL;
+    rect.y = (uint32_t)frame->height * MIN(image->roiY, CAMERA_ROI_FULL) / CAMERA_ROI_FULL;
+    rect.w = (uint32_t)frame->width * MIN(image->roiW, CAMERA_ROI_FULL) / CAMERA_ROI_FULL;
+    rect.h = (uint32_t)frame->height * MIN(image->roiH, CAMERA_ROI_FULL) / CAMERA_ROI_FULL;
+    if (!jpg_crop_buf(frame->buf, frame->len, &rect, &data, &len)) {
+        ESP_LOGW(TAG, "ROI crop failed, keep the whole frame");
+        return ESP_FAIL;
+    }
+    camera_fb_return(frame);
+    node->data = data;
+    node->len = len;
+    node->context = NULL;
+    node->free_handler = camera_crop_node_free;
+    *width = rect.w;
+    *height = rect.h;
+    ESP_LOGI(TAG, "ROI crop %dx%d@%d,%d, %d -> %d bytes in %lld ms", rect.w, rect.h, rect.x, rect.y,
+             frameLen, len, (esp_timer_get_time() - start) / 1000);
+    return ESP_OK;
+}
+
+/**
+ * Attach a reduced-resolution preview transcoded from the JPEG image of a node
+ * The image is downscaled by 1/2, 1/4 or 1/8, the least that fits the preview width
+ * @param node Queue node holding a JPEG image
+ * @param width Image width
+ * @param height Image height
+ * @param previewWidth Largest preview width, 0 for no preview
+ */
+static void camera_attach_preview(queueNode_t *node, uint16_t width, uint16_t height, uint32_t previewWidth)
+{
+    int64_t start = esp_timer_get_time();
+    int scale = JPG_SCALE_2X;
+
+    if (previewWidth == 0 || width <= previewWidth) {
+        return;
+    }
+    while (scale < JPG_SCALE_8X && (width >> scale) > previewWidth) {
+        scale++;
+    }
+    if (!jpg2jpg(node->data, node->len, (jpg_scale_t)scale, CAMERA_PREVIEW_QUALITY,
+                 (uint8_t **)&node->preview, &node->previewLen)) {
+        ESP_LOGW(TAG, "preview transcode failed");
+        node->preview = NULL;
+        node->previewLen = 0;
+        return;
+    }
+    ESP_LOGI(TAG, "preview %dx%d, %d bytes in %lld ms", width >> scale, height >> scale,
+             node->previewLen, (esp_timer_get_time() - start) / 1000);
+}
+
+/* Captured nodes still queued or being consumed, the one being sent excluded */
+static size_t camera_bp_held(void *ctx)
+{
+    camera_lock();
+    size_t held = g_mdCamera.captureCount > 0 ? g_mdCamera.captureCount - 1 : 0;
+    camera_unlock();
+    return held;
+}
+
+static int camera_bp_spill(void *ctx, void *frame)
+{
+    return camera_spill_node((queueNode_t *)frame) == ESP_OK ? 0 : -1;
+}
+
+static bool camera_bp_send(void *ctx, void *frame)
+{
+    mdCamera_t *h = ctx;
+    return pdTRUE == xQueueSend(h->out, &frame, 0);
+}
+
+static bool camera_bp_divert(void *ctx, void *frame)
+{
+    mdCamera_t *h = ctx;
+    return pdTRUE == xQueueSend(h->spill, &frame, pdMS_TO_TICKS(CAMERA_DIVERT_WAIT_MS));
+}
+
+/**
+ * Hand a captured node to the consumers with backpressure, see capture_bp.h
+ * The output queue is preferred; while a consumer holds an earlier node the frame moves to the
+ * PSRAM spill pool, and when the output queue is full the node is diverted to the spill queue (storage).
+ * With a single frame buffer the frame always moves to the spill pool when it fits, the next capture needs the buffer
+ * @param h Camera module state
+ * @param node Queue node holding a camera frame
+ * @return ESP_OK if a queue took the node, ESP_FAIL if it must be dropped
+ */
+static esp_err_t camera_queue_send(mdCamera_t *h, queueNode_t *node)
+{
+    captureBpOps_t ops = {
+        .ctx = h,
+        .held = camera_bp_held,
+        .spill = camera_bp_spill,
+        .send = camera_bp_send,
+        .divert = h->spill ? camera_bp_divert : NULL,
+    };
+
+    if (h->profile && h->profile->fbMax == 1 && camera_spill_node(node) != ESP_OK) {
+        ESP_LOGW(TAG, "spill pool full, the frame keeps the only frame buffer");
+    }
+
+    switch (capture_bp_send(&ops, node, NULL)) {
+        case CAPTURE_BP_OUT:
+            return ESP_OK;
+        case CAPTURE_BP_DIVERT:
+            g_cameraStats.divert++;
+            ESP_LOGW(TAG, "output queue full, divert to storage");
+            return ESP_OK;
+        default:
+            return ESP_FAIL;
+    }
+}
+
 /**
  * Apply JPEG quality limit - global minimum quality is 4
  * @param frameSize Frame size enum value (unused, kept for API compatibility)
@@ -206,15 +521,70 @@ static camera_config_t camera_config = {
     .pin_sscb_scl = CAMERA_PIN_SIOC,   // I2C SCL
     .pin_pwdn = CAMERA_PIN_PWDN,       // Power down (not used)
     .pin_reset = CAMERA_PIN_RESET,     // Reset (not used)
-    .xclk_freq_hz = 5000000,          // XCLK frequency (5MHz)
+    .xclk_freq_hz = 5000000,          // XCLK frequency (5MHz), set by the capture profile
     .pixel_format = PIXFORMAT_JPEG,    // Output format (JPEG)
     .frame_size = FRAMESIZE_QSXGA,       // Resolution (Full HD)
     .jpeg_quality = 12,                // JPEG quality (12-63, lower=better)
-    .fb_count = 2,                     // Frame buffer count
+    .fb_count = 2,                     // Frame buffer count, set by the capture profile
     .fb_location = CAMERA_FB_IN_PSRAM, // Store frames in PSRAM
-    .grab_mode = CAMERA_GRAB_LATEST,   // Always get latest frame
+    .grab_mode = CAMERA_GRAB_LATEST,   // Always get latest frame, set by the capture profile
+    .jpeg_buf_size = 0,                // Driver default, set by the capture profile
 };
 
+/**
+ * Pick the frame buffer profile of the current mode
+ * @return Profile
+ */
+static const cameraProfile_t *camera_pick_profile(void)
+{
+    capAttr_t capture;
+
+    if (system_get_mode() == MODE_CONFIG) {
+        return &g_cameraProfiles[CAMERA_PROFILE_LIVE];
+    }
+    cfg_get_cap_attr(&capture);
+    if (capture.burstCount > 1) {
+        return &g_cameraProfiles[CAMERA_PROFILE_BURST];
+    }
+    return &g_cameraProfiles[CAMERA_PROFILE_SNAPSHOT];
+}
+
+/**
+ * Set the frame buffers, grab mode and XCLK of camera_config from a profile
+ * The JPEG buffer is sized from the resolution, the buffer count from the PSRAM
+ * free before the driver allocates, keeping CAMERA_PSRAM_RESERVE for the frames
+ * queued after capture. When even the fewest buffers do not fit above the reserve
+ * they are made smaller, down to CAMERA_JPEG_BUF_MIN
+ * @param profile Frame buffer profile
+ * @param frameSize Framesize the camera is opened with
+ */
+static void camera_apply_profile(const cameraProfile_t *profile, framesize_t frameSize)
+{
+    framesize_t sizedFor = profile->anySize ? CAMERA_LIVE_FRAMESIZE : frameSize;
+    size_t freePsram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    size_t avail = freePsram > CAMERA_PSRAM_RESERVE ? freePsram - CAMERA_PSRAM_RESERVE : 0;
+    size_t bufSize = (size_t)resolution[sizedFor].width * resolution[sizedFor].height / profile->pixelsPerByte;
+    size_t fbCount = 0;
+
+    bufSize = MAX(bufSize, CAMERA_JPEG_BUF_MIN);
+    bufSize = (bufSize + CAMERA_JPEG_BUF_ALIGN - 1) / CAMERA_JPEG_BUF_ALIGN * CAMERA_JPEG_BUF_ALIGN;
+    if (profile->fbMin * bufSize > avail) {
+        size_t fit = MAX(avail / profile->fbMin / CAMERA_JPEG_BUF_ALIGN * CAMERA_JPEG_BUF_ALIGN, CAMERA_JPEG_BUF_MIN);
+        ESP_LOGW(TAG, "profile %s needs %d KB, only %d KB free above the reserve, buffers cut to %d KB",
+                 profile->name, (int)(profile->fbMin * bufSize / 1024), (int)(avail / 1024), (int)(fit / 1024));
+        bufSize = MIN(bufSize, fit);
+    }
+    fbCount = MIN(MAX(avail / bufSize, profile->fbMin), profile->fbMax);
+    camera_config.fb_count = fbCount;
+    camera_config.grab_mode = profile->grabMode;
+    camera_config.xclk_freq_hz = profile->xclkHz;
+    camera_config.jpeg_buf_size = bufSize;
+    ESP_LOGI(TAG, "profile %s: %d x %d KB buffers, grab %s, xclk %d MHz, PSRAM free %d KB, left %d KB",
+             profile->name, (int)fbCount, (int)(bufSize / 1024),
+             profile->grabMode == CAMERA_GRAB_LATEST ? "latest" : "when empty", profile->xclkHz / 1000000,
+             (int)(freePsram / 1024), (int)((freePsram - MIN(freePsram, fbCount * bufSize)) / 1024));
+}
+
 extern modeSel_e main_mode;
 /**
  * Initialize camera hardware with configured settings
@@ -273,7 +643,9 @@ static esp_err_t csi_camera_init(void)
         camera_apply_jpeg_quality_limit(camera_config.frame_size, &quality);
         camera_config.jpeg_quality = quality;
     }
-    
+    g_mdCamera.profile = camera_pick_profile();
+    camera_apply_profile(g_mdCamera.profile, camera_config.frame_size);
+
     err = esp_camera_init(&camera_config);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "CSI Init Failed");
@@ -293,6 +665,65 @@ static esp_err_t csi_camera_init(void)
     return ESP_OK;
 }
 
+static esp_err_t csi_camera_set_quality(uint8_t quality)
+{
+    sensor_t *s = esp_camera_sensor_get();
+    if (s == NULL || s->set_quality == NULL) {
+        return ESP_FAIL;
+    }
+    return s->set_quality(s, quality) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t csi_camera_set_framesize(framesize_t frameSize)
+{
+    sensor_t *s = esp_camera_sensor_get();
+    if (s == NULL || s->set_framesize == NULL || s->set_framesize(s, frameSize) != 0) {
+        return ESP_FAIL;
+    }
+    // give sensor some time to stabilize with new resolution
+    vTaskDelay(pdMS_TO_TICKS(100));
+    return ESP_OK;
+}
+
+/**
+ * Window the sensor to the region of interest of a framesize
+ * Only the OV5640 in a 4:3 framesize is supported: the window is cut from the full active array
+ * without binning and scaled to the pixel density of the framesize
+ * @param frameSize Configured framesize
+ * @param image Image attributes holding the region of interest
+ * @param width Set to the output width
+ * @param height Set to the output height
+ * @return ESP_OK on success, ESP_FAIL if the sensor cannot be windowed
+ */
+static esp_err_t csi_camera_set_window(framesize_t frameSize, const imgAttr_t *image, uint16_t *width, uint16_t *height)
+{
+    sensor_t *s = esp_camera_sensor_get();
+    if (s == NULL || s->set_res_raw == NULL || s->id.PID != OV5640_PID || frameSize >= FRAMESIZE_INVALID
+        || resolution[frameSize].aspect_ratio != ASPECT_RATIO_4X3) {
+        return ESP_FAIL;
+    }
+    uint32_t x = OV5640_4X3_MAX_WIDTH * MIN(image->roiX, CAMERA_ROI_FULL) / CAMERA_ROI_FULL & ~1;
+    uint32_t y = OV5640_4X3_MAX_HEIGHT * MIN(image->roiY, CAMERA_ROI_FULL) / CAMERA_ROI_FULL & ~1;
+    uint32_t w = MIN(OV5640_4X3_MAX_WIDTH * image->roiW / CAMERA_ROI_FULL, OV5640_4X3_MAX_WIDTH - x) & ~1;
+    uint32_t h = MIN(OV5640_4X3_MAX_HEIGHT * image->roiH / CAMERA_ROI_FULL, OV5640_4X3_MAX_HEIGHT - y) & ~1;
+    // JPEG output in whole MCUs, at the pixel density of the framesize
+    uint32_t outW = (uint32_t)resolution[frameSize].width * w / OV5640_4X3_MAX_WIDTH & ~15;
+    uint32_t outH = (uint32_t)resolution[frameSize].height * h / OV5640_4X3_MAX_HEIGHT & ~15;
+    if (outW == 0 || outH == 0) {
+        return ESP_FAIL;
+    }
+    if (s->set_res_raw(s, x, y, x + w + 2 * OV5640_4X3_OFFSET_X - 1, y + h + 2 * OV5640_4X3_OFFSET_Y - 1,
+                       OV5640_4X3_OFFSET_X, OV5640_4X3_OFFSET_Y, OV5640_4X3_TOTAL_X, OV5640_4X3_TOTAL_Y,
+                       outW, outH, outW != w || outH != h, false) != 0) {
+        return ESP_FAIL;
+    }
+    // give sensor some time to stabilize with new window
+    vTaskDelay(pdMS_TO_TICKS(100));
+    *width = outW;
+    *height = outH;
+    return ESP_OK;
+}
+
 static void csi_camera_deinit(void)
 {
     // esp_camera_deinit() intentionally omitted if not provided in SDK
@@ -378,6 +809,9 @@ static const camera_vtable_t VTABLE_CSI = {
 	.init = csi_camera_init,
 	.deinit = csi_camera_deinit,
 	.set_image = csi_camera_set_image,
+	.set_quality = csi_camera_set_quality,
+	.set_framesize = csi_camera_set_framesize,
+	.set_window = csi_camera_set_window,
 };
 
 static const camera_vtable_t VTABLE_UVC = {
@@ -387,6 +821,9 @@ static const camera_vtable_t VTABLE_UVC = {
 	.init = uvc_camera_init,
 	.deinit = uvc_camera_deinit,
 	.set_image = uvc_camera_set_image,
+	.set_quality = NULL,
+	.set_framesize = NULL,
+	.set_window = NULL,
 };
 
 static esp_err_t init_camera(mdCamera_t *handle)
@@ -407,6 +844,29 @@ static esp_err_t init_camera(mdCamera_t *handle)
     return ESP_FAIL;
 }
 
+/**
+ * Console command handler for showing or clearing the capture backpressure statistics
+ * @param argc Argument count
+ * @param argv Argument values
+ * @return ESP_OK
+ */
+static int do_camstat_cmd(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "clear") == 0) {
+        memset(&g_cameraStats, 0, sizeof(g_cameraStats));
+        ESP_LOGI(TAG, "stats cleared");
+        return ESP_OK;
+    }
+    ESP_LOGI(TAG, "Spill: %lu, Divert: %lu, Drop: %lu, Pool: %d/%d",
+             g_cameraStats.spill, g_cameraStats.divert, g_cameraStats.drop,
+             g_mdCamera.spillPool.used, g_mdCamera.spillPool.limit);
+    return ESP_OK;
+}
+
+static esp_console_cmd_t g_cmd[] = {
+    {"camstat", "camstat [clear], show or clear the capture backpressure statistics", NULL, do_camstat_cmd, NULL},
+};
+
 esp_err_t camera_open(QueueHandle_t in, QueueHandle_t out)
 {
     struct mdCamera *handle = &g_mdCamera;
@@ -423,12 +883,23 @@ esp_err_t camera_open(QueueHandle_t in, QueueHandle_t out)
     handle->in = in;
     handle->out = out;
     handle->eventGroup = xEventGroupCreate();
+    handle->quality = camera_config.jpeg_quality;
+    handle->spillPool.used = 0;
+    handle->spillPool.limit = heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / CAMERA_SPILL_PSRAM_DIV;
+    ESP_LOGI(TAG, "spill pool %d bytes", handle->spillPool.limit);
+    debug_cmd_add(g_cmd, sizeof(g_cmd) / sizeof(esp_console_cmd_t));
     handle->bInit = true;
     // wait for sensor stable with configurable delay
     capAttr_t capAttr;
     cfg_get_cap_attr(&capAttr);
     ESP_LOGI(TAG, "wait for sensor stable with configurable delay %d ms", (int)capAttr.camWarmupMs);
     vTaskDelay(pdMS_TO_TICKS(capAttr.camWarmupMs));
+    if (handle->vt == &VTABLE_CSI && camera_config.grab_mode == CAMERA_GRAB_WHEN_EMPTY) {
+        camera_fb_t *stale = handle->vt->fb_get(); // the buffer was filled before the sensor settled
+        if (stale) {
+            handle->vt->fb_return(stale);
+        }
+    }
     sleep_set_event_bits(SLEEP_SNAPSHOT_STOP_BIT);          // if no subsequent snapshot tasks, will enter sleep;
     misc_get_battery_voltage();
     
@@ -543,6 +1014,205 @@ esp_err_t camera_flash_led_ctrl(lightAttr_t *light)
     return ESP_OK;
 }
 
+/**
+ * Set the JPEG quality of the sensor and drop the frame already encoded with the old quality
+ * @param h Camera module state
+ * @param quality JPEG quality (0-63, higher value means lower quality)
+ * @return ESP_OK on success, ESP_FAIL if the backend cannot change the quality
+ */
+static esp_err_t camera_set_quality(mdCamera_t *h, uint8_t quality)
+{
+    camera_fb_t *stale = NULL;
+
+    if (quality == h->quality) {
+        return ESP_OK;
+    }
+    if (!h->vt->set_quality || h->vt->set_quality(quality) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "quality %d -> %d", h->quality, quality);
+    h->quality = quality;
+    stale = h->vt->fb_get();
+    if (stale) {
+        h->vt->fb_return(stale);
+    }
+    return ESP_OK;
+}
+
+/**
+ * Pick the largest framesize whose image is expected to upload within the time budget
+ * JPEG size is predicted from the size model, scaled by the pixel count for framesizes
+ * without samples; only framesizes of the same aspect ratio are considered
+ * @param frameSize Configured framesize
+ * @param quality JPEG quality of the capture
+ * @param budgetMs Upload time budget in milliseconds
+ * @return Framesize to capture with
+ */
+static uint8_t camera_fit_framesize(uint8_t frameSize, uint8_t quality, uint32_t budgetMs)
+{
+    uint32_t bytes = jpeg_budget_predict(&g_jpegBudget, frameSize, quality);
+    uint32_t pixels = 0, bestPixels = 0, minPixels = UINT32_MAX;
+    uint8_t best = frameSize, smallest = frameSize;
+
+    // base64 makes the message 4/3 of the image
+    if (bytes == 0 || frameSize >= FRAMESIZE_INVALID || link_est_upload_ms(bytes / 3 * 4) <= budgetMs) {
+        return frameSize;
+    }
+    pixels = resolution[frameSize].width * resolution[frameSize].height;
+    for (uint8_t fs = 0; fs < FRAMESIZE_INVALID; fs++) {
+        uint32_t p = resolution[fs].width * resolution[fs].height;
+        if (resolution[fs].aspect_ratio != resolution[frameSize].aspect_ratio || p >= pixels) {
+            continue;
+        }
+        uint32_t estimate = jpeg_budget_predict(&g_jpegBudget, fs, quality);
+        if (estimate == 0) {
+            estimate = (uint64_t)bytes * p / pixels;
+        }
+        if (link_est_upload_ms(estimate / 3 * 4) <= budgetMs && p > bestPixels) {
+            best = fs;
+            bestPixels = p;
+        }
+        if (p < minPixels) {
+            smallest = fs;
+            minPixels = p;
+        }
+    }
+    if (bestPixels == 0) {
+        best = smallest; // nothing fits, send the smallest image
+    }
+    ESP_LOGI(TAG, "%lu bytes at %lu B/s exceed %lu ms, framesize %d -> %d",
+             bytes, link_est_get_bps(), budgetMs, frameSize, best);
+    return best;
+}
+
+/**
+ * Log a capture of the JPEG size model, components/jpeg_budget/test replays these lines
+ * @param frameSize Framesize of the capture
+ * @param quality Quality of the capture
+ * @param minQ Best quality allowed
+ * @param frame Frame buffer
+ * @param target Target size in bytes
+ * @param reshoot true for the re-shoot of an overshoot
+ */
+static void camera_budget_log(uint8_t frameSize, uint8_t quality, uint8_t minQ, const camera_fb_t *frame,
+                              uint32_t target, bool reshoot)
+{
+    ESP_LOGI(TAG, "jpeg fs %d q %d min %d: %d bytes, target %lu%s", frameSize, quality, minQ, frame->len, target,
+             reshoot ? " re-shoot" : "");
+}
+
+/**
+ * Get a frame within the JPEG byte budget
+ * The quality is picked from the size model of the framesize, a capture overshooting
+ * the budget is re-shot once with the quality picked from the updated model
+ * @param h Camera module state
+ * @param target Target size in bytes, 0 disables the budget
+ * @param frameSize Size model key of the capture, JPEG_BUDGET_FRAMESIZE_MAX for none (configured quality)
+ * @param minQ Best quality allowed, the configured quality
+ * @return Frame buffer, NULL on failure
+ */
+static camera_fb_t *camera_budget_fb_get(mdCamera_t *h, uint32_t target, uint8_t frameSize, uint8_t minQ)
+{
+    camera_fb_t *frame = NULL;
+    uint8_t quality = 0;
+
+    if (!h->vt || !h->vt->fb_get) {
+        return NULL;
+    }
+    if (!h->vt->set_quality) {
+        return h->vt->fb_get();
+    }
+    if (target == 0) {
+        // keep the size model learning, it also predicts upload sizes
+        frame = h->vt->fb_get();
+        if (frame) {
+            camera_budget_log(frameSize, h->quality, minQ, frame, target, false);
+            jpeg_budget_update(&g_jpegBudget, frameSize, h->quality, frame->len, false);
+        }
+        return frame;
+    }
+    quality = jpeg_budget_pick(&g_jpegBudget, frameSize, target, minQ, 63);
+    if (camera_set_quality(h, quality) != ESP_OK) {
+        return h->vt->fb_get();
+    }
+    frame = h->vt->fb_get();
+    if (frame == NULL) {
+        return NULL;
+    }
+    camera_budget_log(frameSize, quality, minQ, frame, target, false);
+    jpeg_budget_update(&g_jpegBudget, frameSize, quality, frame->len, false);
+    if (jpeg_budget_overshoot(frame->len, target)) {
+        uint8_t retry = jpeg_budget_pick(&g_jpegBudget, frameSize, target, minQ, 63);
+        ESP_LOGW(TAG, "%d bytes over budget %lu at quality %d, re-shoot at %d", frame->len, target, quality, retry);
+        if (retry > quality) {
+            h->vt->fb_return(frame);
+            camera_set_quality(h, retry);
+            frame = h->vt->fb_get();
+            if (frame) {
+                camera_budget_log(frameSize, retry, minQ, frame, target, true);
+                jpeg_budget_update(&g_jpegBudget, frameSize, retry, frame->len, true);
+            }
+        }
+    }
+    return frame;
+}
+
+/**
+ * Pick the JPEG decode scale for sharpness scoring
+ * @param width Frame width
+ * @return Scale keeping the decoded width close to CAMERA_SHARPNESS_WIDTH
+ */
+static jpg_scale_t camera_sharpness_scale(uint16_t width)
+{
+    jpg_scale_t scale = JPG_SCALE_NONE;
+    while (scale < JPG_SCALE_MAX && (width >> scale) > CAMERA_SHARPNESS_WIDTH) {
+        scale++;
+    }
+    return scale;
+}
+
+/**
+ * Grab a burst of frames back-to-back and keep the sharpest one
+ * Only two frame buffers are held at a time: the best so far and the latest
+ * @param h Camera module state
+ * @param burst Number of frames to grab
+ * @param target Target size in bytes, 0 disables the byte budget
+ * @param frameSize Size model key of the capture, JPEG_BUDGET_FRAMESIZE_MAX for none (configured quality)
+ * @param minQ Best quality allowed, the configured quality
+ * @return Frame buffer, NULL on failure
+ */
+static camera_fb_t *camera_burst_fb_get(mdCamera_t *h, uint8_t burst, uint32_t target, uint8_t frameSize, uint8_t minQ)
+{
+    camera_fb_t *best = camera_budget_fb_get(h, target, frameSize, minQ);
+    float bestScore = 0, score = 0;
+    jpg_scale_t scale;
+    int64_t start = esp_timer_get_time();
+
+    if (best == NULL || burst <= 1 || h->vt != &VTABLE_CSI || best->format != PIXFORMAT_JPEG) {
+        return best;
+    }
+    scale = camera_sharpness_scale(best->width);
+    if (!jpg_sharpness(best->buf, best->len, scale, &bestScore)) {
+        return best;
+    }
+    for (uint8_t i = 1; i < MIN(burst, CAMERA_BURST_MAX); i++) {
+        camera_fb_t *frame = camera_budget_fb_get(h, target, frameSize, minQ);
+        if (frame == NULL) {
+            break;
+        }
+        if (jpg_sharpness(frame->buf, frame->len, scale, &score) && score > bestScore) {
+            h->vt->fb_return(best);
+            best = frame;
+            bestScore = score;
+        } else {
+            h->vt->fb_return(frame);
+        }
+    }
+    ESP_LOGI(TAG, "burst %d frames in %lld ms, best sharpness %.1f", burst,
+             (esp_timer_get_time() - start) / 1000, bestScore);
+    return best;
+}
+
 esp_err_t camera_snapshot(snapType_e type, uint8_t count)
 {
     mdCamera_t *h = &g_mdCamera;
@@ -561,18 +1231,66 @@ esp_err_t camera_snapshot(snapType_e type, uint8_t count)
     // camera_flash_led_ctrl(&light);
     ESP_LOGI(TAG, "camera_snapshot Start");
     // esp_camera_fb_return(esp_camera_fb_get());
+    imgAttr_t image;
+    uploadAttr_t upload;
+    uint32_t budget = 0;
+    cfg_get_image_attr(&image);
+    cfg_get_upload_attr(&upload);
+    cfg_get_jpeg_budget(&budget);
+    if (image.quality > 63) {
+        image.quality = camera_config.jpeg_quality;
+    }
+    camera_apply_jpeg_quality_limit((framesize_t)image.frameSize, &image.quality);
+    if (!g_jpegBudgetInit) {
+        jpeg_budget_init(&g_jpegBudget);
+        g_jpegBudgetInit = true;
+    }
+    uint8_t configured = image.frameSize;
+    bool fitted = false;
+    if (h->uploadBudget && h->vt && h->vt->set_framesize) {
+        uint8_t quality = budget ? jpeg_budget_pick(&g_jpegBudget, image.frameSize, budget, image.quality, 63) : image.quality;
+        uint8_t frameSize = camera_fit_framesize(image.frameSize, quality, h->uploadBudget * 1000);
+        if (frameSize != image.frameSize && h->vt->set_framesize((framesize_t)frameSize) == ESP_OK) {
+            image.frameSize = frameSize;
+            fitted = true;
+        }
+    }
+    bool roi = camera_roi_enabled(&image);
+    bool window = false;
+    uint16_t windowW = 0, windowH = 0;
+    if (roi && image.roiMode == CAMERA_ROI_SENSOR && h->vt && h->vt->set_window
+        && h->vt->set_window((framesize_t)image.frameSize, &image, &windowW, &windowH) == ESP_OK) {
+        camera_fb_t *stale = h->vt->fb_get(); // drop the frame exposed before the window
+        if (stale) {
+            h->vt->fb_return(stale);
+        }
+        window = true;
+        ESP_LOGI(TAG, "ROI sensor window %dx%d", windowW, windowH);
+    }
     h->bSnapShot = true;
+    // a window frame is smaller than its framesize, it neither uses nor teaches the size model of it
+    uint8_t modelSize = window ? JPEG_BUDGET_FRAMESIZE_MAX : image.frameSize;
     int try_count = 5;
     while (try_count--) {
-        camera_fb_t *frame = h->vt && h->vt->fb_get ? h->vt->fb_get() : NULL;
+        camera_fb_t *frame = camera_burst_fb_get(h, capture.burstCount, budget, modelSize, image.quality);
         if (frame) {
+            uint16_t width = window ? windowW : frame->width; // fb size is the framesize, not the window
+            uint16_t height = window ? windowH : frame->height;
+            pixformat_t format = frame->format;
             queueNode_t *node = camera_queue_node_malloc(frame, type);
             if (node) {
-                if (pdTRUE == xQueueSend(h->out, &node, 0)) {
+                if (roi && !window) {
+                    camera_crop_node(node, frame, &image, &width, &height);
+                }
+                if (format == PIXFORMAT_JPEG && (upload.uploadMode == 0 || system_get_mode() == MODE_UPLOAD)) {
+                    camera_attach_preview(node, width, height, upload.previewWidth); // only an instant upload sends the preview
+                }
+                if (camera_queue_send(h, node) == ESP_OK) {
                     count--;
                 } else {
-                    ESP_LOGW(TAG, "device BUSY, wait to try again");
-                    camera_queue_node_free(node, EVENT_FAIL);
+                    g_cameraStats.drop++;
+                    ESP_LOGW(TAG, "device BUSY, wait to try again, dropped %lu", g_cameraStats.drop);
+                    node->free_handler(node, EVENT_FAIL);
                 }
             }
         }
@@ -581,6 +1299,9 @@ esp_err_t camera_snapshot(snapType_e type, uint8_t count)
             break;
         }
     }
+    if (window || fitted) {
+        h->vt->set_framesize((framesize_t)configured); // restore the full field of view and the configured framesize
+    }
     if (count > 0) {
         ESP_LOGE(TAG, "snapshot fail, count=%d", count);
         h->bSnapShotSuccess = false;
@@ -603,6 +1324,21 @@ esp_err_t camera_set_image(imgAttr_t *image)
     return (h->vt && h->vt->set_image) ? h->vt->set_image(image) : ESP_OK;
 }
 
+void camera_set_upload_budget(uint32_t seconds)
+{
+    g_mdCamera.uploadBudget = seconds;
+}
+
+void camera_set_spill_queue(QueueHandle_t spill)
+{
+    g_mdCamera.spill = spill;
+}
+
+uint32_t camera_get_drop_count()
+{
+    return g_cameraStats.drop;
+}
+
 bool camera_is_snapshot_fail()
 {
     mdCamera_t *h = &g_mdCamera;
@@ -85,6 +85,26 @@ esp_err_t camera_set_image(imgAttr_t *image);
  */
 esp_err_t camera_flash_led_ctrl(lightAttr_t *light);
 
+/**
+ * Set the queue taking captured frames when the output queue is full
+ * @param spill Spill queue handle, normally the storage queue (can be NULL)
+ */
+void camera_set_spill_queue(QueueHandle_t spill);
+
+/**
+ * Set the time an instant upload of a capture may take
+ * The resolution is stepped down for the capture when the uplink estimate says the image
+ * would not upload in time (CSI cameras only)
+ * @param seconds Upload time budget, 0 to keep the configured resolution
+ */
+void camera_set_upload_budget(uint32_t seconds);
+
+/**
+ * Get the number of captured frames dropped because every queue was full
+ * @return Dropped frame count, kept across deep sleep
+ */
+uint32_t camera_get_drop_count();
+
 /**
  * Check if last snapshot failed
  * @return true if snapshot failed, false otherwise
@@ -6,13 +6,17 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "driver/gpio.h"
+#include "esp_attr.h"
 #include "esp_err.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_netif.h"
 #include "esp_netif_ppp.h"
 #include "esp_modem_api.h"
+#include "esp_timer.h"
+#include "debug.h"
 #include "iot_mip.h"
+#include "link_est.h"
 
 #define TAG "-->CAT1"  // Logging tag for CAT1 module
 
@@ -22,6 +26,17 @@
 // Timeout constants
 #define CAT1_POWER_ON_TIMEOUT_MS (30000)  // Max time to power on module
 #define CAT1_PPP_CONNECT_TIMEOUT_MS (60000)  // Max time to establish PPP connection
+#define CAT1_AT_READ_TICK_MS (10)  // UART read slice while waiting for a raw AT reply
+
+// Bring-up trace: latency of each scripted AT command of the last wake
+#define CAT1_TRACE_MAX (8)  // Commands kept
+#define CAT1_TRACE_CMD_LEN (24)  // Longer commands are truncated
+
+// Keep-registered sleep: the modem stays attached in PSM or eDRX while the ESP32 deep-sleeps
+#define CAT1_PSM_MIN_SLEEP_S (600)  // Shorter sleeps use eDRX, PSM entry and exit would not pay off
+#define CAT1_PSM_TAU_MARGIN_S (60)  // Periodic TAU requested beyond the planned sleep
+#define CAT1_PSM_ACTIVE_S (10)  // Active time (T3324) after the last data, before entering PSM
+#define CAT1_PSM_WAKE_PULSE_MS (500)  // PWRKEY low time waking the module out of PSM
 
 // Event group bits
 #define CAT1_POWER_ON_BIT BIT(0)  // Module powered on
@@ -50,7 +65,92 @@ typedef struct mdCat1 {
     cellularStatusAttr_t status; ///< Current status attributes
 } mdCat1_t;
 
+/**
+ * Latency of one scripted AT command
+ */
+typedef struct cat1TraceEntry {
+    char command[CAT1_TRACE_CMD_LEN];   ///< Command, truncated
+    int32_t result;                     ///< esp_err_t of the last attempt
+    uint16_t latency_ms;                ///< First write to the last final result code
+    uint8_t attempts;                   ///< Writes of the command, 0 if the script stopped before it
+} cat1TraceEntry_t;
+
+/**
+ * AT bring-up trace of the last wake, preserved in RTC memory
+ */
+typedef struct cat1Trace {
+    uint8_t count;                      ///< Entries recorded
+    uint32_t total_ms;                  ///< Sum of the latencies
+    cat1TraceEntry_t entries[CAT1_TRACE_MAX];
+} cat1Trace_t;
+
+/**
+ * Keep-registered sleep state, preserved in RTC memory
+ */
+typedef struct cat1Psm {
+    bool armed;                         ///< The modem was left registered at the last sleep
+    bool edrx;                          ///< eDRX was configured instead of PSM
+    uint32_t sleep_s;                   ///< Planned sleep the timers were set for
+} cat1Psm_t;
+
 static mdCat1_t g_cat1 = {0};  // Global CAT1 module state
+static RTC_DATA_ATTR cat1Trace_t g_cat1Trace = {0};
+static RTC_DATA_ATTR cat1Psm_t g_cat1Psm = {0};
+
+/**
+ * Run an AT script and record its steps in the bring-up trace
+ * @param steps Commands to run in order
+ * @param count Number of steps
+ * @param results One result per step
+ * @return ESP_OK if all mandatory steps passed
+ */
+static esp_err_t cat1_run_script(const esp_modem_at_step_t *steps, size_t count, esp_modem_at_step_result_t *results)
+{
+    esp_err_t err = esp_modem_at_script(g_cat1.dce, steps, count, results);
+
+    for (size_t i = 0; i < count; i++) {
+        ESP_LOGI(TAG, "%s=>%s (%s, %lums, %d attempts)", steps[i].command, results[i].response,
+                 esp_err_to_name(results[i].result), results[i].latency_ms, results[i].attempts);
+        g_cat1Trace.total_ms += results[i].latency_ms;
+        if (g_cat1Trace.count < CAT1_TRACE_MAX) {
+            cat1TraceEntry_t *entry = &g_cat1Trace.entries[g_cat1Trace.count++];
+            snprintf(entry->command, sizeof(entry->command), "%s", steps[i].command);
+            entry->result = results[i].result;
+            entry->latency_ms = results[i].latency_ms > UINT16_MAX ? UINT16_MAX : results[i].latency_ms;
+            entry->attempts = results[i].attempts;
+        }
+    }
+    return err;
+}
+
+/**
+ * Show the AT bring-up trace of the last wake
+ */
+static void cat1_trace_show(void)
+{
+    ESP_LOGI(TAG, "AT bring-up: %u commands in %lums", g_cat1Trace.count, g_cat1Trace.total_ms);
+    for (int i = 0; i < g_cat1Trace.count; i++) {
+        cat1TraceEntry_t *entry = &g_cat1Trace.entries[i];
+        ESP_LOGI(TAG, "  %-24s %5ums %u attempts %s", entry->command, entry->latency_ms, entry->attempts,
+                 entry->attempts ? esp_err_to_name(entry->result) : "not run");
+    }
+}
+
+/**
+ * Console command handler for showing the AT bring-up trace
+ * @param argc Argument count
+ * @param argv Argument values
+ * @return ESP_OK
+ */
+static int do_attrace_cmd(int argc, char **argv)
+{
+    cat1_trace_show();
+    return ESP_OK;
+}
+
+static esp_console_cmd_t g_cmd[] = {
+    {"attrace", "latency of the AT commands of the last CAT1 bring-up", NULL, do_attrace_cmd, NULL},
+};
 
 /**
  * PPP state change handler
@@ -177,16 +277,20 @@ static esp_err_t cat1_write_at(const char *atCmd, int atCmdLen, char *atResp, in
         ESP_LOGE(TAG, "uart_write_bytes failed");
         err = ESP_FAIL;
     } else {
+        int64_t start = esp_timer_get_time();
         int time = 0;
         int len = 0;
         memset(atResp, 0, atRespLen);
+        err = ESP_ERR_TIMEOUT;
         while (time < timeout) {
-            int remainLen = atRespLen - len;
+            int remainLen = atRespLen - len - 1;
             if (remainLen <= 0) {
                 ESP_LOGE(TAG, "atResp buffer is too small");
                 err = ESP_FAIL;
+                break;
             }
-            int rxLen = uart_read_bytes(UART_NUM_1, (uint8_t *)atResp + len, remainLen, pdMS_TO_TICKS(100));
+            // short slices, the reply is checked as soon as its bytes are in
+            int rxLen = uart_read_bytes(UART_NUM_1, (uint8_t *)atResp + len, remainLen, pdMS_TO_TICKS(CAT1_AT_READ_TICK_MS));
             if (rxLen > 0) {
                 len += rxLen;
                 if (strstr(atResp, pass_phrase) != NULL) {
@@ -198,10 +302,7 @@ static esp_err_t cat1_write_at(const char *atCmd, int atCmdLen, char *atResp, in
                     break;
                 }
             }
-            time += 100;
-        }
-        if (timeout > 0 && time >= timeout) {
-            err = ESP_ERR_TIMEOUT;
+            time = (esp_timer_get_time() - start) / 1000;
         }
     }
     return err;
@@ -336,6 +437,7 @@ static esp_err_t get_signal_quality(cellularSignalQuality_t *sq)
         sq->asu = asu;
         sq->level = dBmLevel;
         snprintf(sq->quality, sizeof(sq->quality), "%dasu(%ddBm)", asu, dBm);
+        link_est_set_signal(LINK_CELLULAR, dBmLevel);
     } else {
         sq->rssi = rssi;
         sq->ber = ber;
@@ -343,6 +445,7 @@ static esp_err_t get_signal_quality(cellularSignalQuality_t *sq)
         sq->asu = 0;
         sq->level = 0;
         snprintf(sq->quality, sizeof(sq->quality), "-");
+        link_est_set_signal(LINK_CELLULAR, -1);
     }
 
     return ESP_OK;
@@ -612,6 +715,9 @@ static esp_err_t power_on_modem()
     io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
     io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
     gpio_config(&io_conf);
+    // PWRKEY may still be held from a sleep in PSM, a held pin does not follow the levels set
+    gpio_hold_dis(GPIO_OUTPUT_PWRKEY);
+    gpio_deep_sleep_hold_dis();
 
     gpio_set_level(GPIO_OUTPUT_PWRKEY, 0);
     vTaskDelay(pdMS_TO_TICKS(1000));
@@ -655,6 +761,32 @@ static esp_err_t init_param_and_status()
     return ESP_OK;
 }
 
+/**
+ * Create the PPP netif and the DCE, the module answering at CAT1_BAUD_RATE
+ * @return ESP_OK on success
+ */
+static esp_err_t create_dce()
+{
+    esp_modem_dte_config_t dte_config = ESP_MODEM_DTE_DEFAULT_CONFIG();
+    dte_config.uart_config.baud_rate = CAT1_BAUD_RATE;
+    dte_config.uart_config.tx_io_num = MODEM_UART_TX_PIN;
+    dte_config.uart_config.rx_io_num = MODEM_UART_RX_PIN;
+    dte_config.uart_config.rx_buffer_size = 8192;
+    dte_config.uart_config.tx_buffer_size = 8192;
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG(g_cat1.param.apn);
+    esp_netif_config_t netif_ppp_config = ESP_NETIF_DEFAULT_PPP();
+    g_cat1.esp_netif = esp_netif_new(&netif_ppp_config);
+    g_cat1.dce = esp_modem_new_dev(ESP_MODEM_DCE_EC800E, &dte_config, &dce_config, g_cat1.esp_netif);
+    if (g_cat1.dce == NULL) {
+        ESP_LOGE(TAG, "esp_modem_new_dev failed");
+        esp_netif_destroy(g_cat1.esp_netif);
+        g_cat1.esp_netif = NULL;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
 /**
  * Check and configure module baud rate
  * @return ESP_OK on success
@@ -675,19 +807,7 @@ static esp_err_t check_baud_rate()
         return err;
     }
 
-    //
-    esp_modem_dte_config_t dte_config = ESP_MODEM_DTE_DEFAULT_CONFIG();
-    dte_config.uart_config.baud_rate = CAT1_BAUD_RATE;
-    dte_config.uart_config.tx_io_num = MODEM_UART_TX_PIN;
-    dte_config.uart_config.rx_io_num = MODEM_UART_RX_PIN;
-    dte_config.uart_config.rx_buffer_size = 8192;
-    dte_config.uart_config.tx_buffer_size = 8192;
-    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG(g_cat1.param.apn);
-    esp_netif_config_t netif_ppp_config = ESP_NETIF_DEFAULT_PPP();
-    g_cat1.esp_netif = esp_netif_new(&netif_ppp_config);
-    g_cat1.dce = esp_modem_new_dev(ESP_MODEM_DCE_EC800E, &dte_config, &dce_config, g_cat1.esp_netif);
-
-    return ESP_OK;
+    return create_dce();
 }
 
 /**
@@ -696,27 +816,16 @@ static esp_err_t check_baud_rate()
  */
 static esp_err_t check_pin_status()
 {
+    // Check if a PIN is required, the SIM may still be initializing
+    const esp_modem_at_step_t steps[] = {
+        {.command = "ATE0", .timeout_ms = 500, .optional = true},
+        {.command = "AT+CPIN?", .expect = "+CPIN:", .timeout_ms = 500, .retries = 9, .retry_delay_ms = 1000},
+    };
+    esp_modem_at_step_result_t results[sizeof(steps) / sizeof(steps[0])];
     char atCmd[256];
-    char atResp[256];
-    esp_err_t err = ESP_OK;
+    esp_err_t err = cat1_run_script(steps, sizeof(steps) / sizeof(steps[0]), results);
+    const char *atResp = results[1].response;
 
-    memset(atResp, 0, sizeof(atResp));
-    snprintf(atCmd, sizeof(atCmd), "%s", "ATE0");
-    err = esp_modem_at(g_cat1.dce, atCmd, atResp, 500);
-    ESP_LOGI(TAG, "%s=>%s", atCmd, atResp);
-
-    // Check if a PIN is required
-    int retry = 0;
-    while (retry++ < 10) {
-        memset(atResp, 0, sizeof(atResp));
-        snprintf(atCmd, sizeof(atCmd), "%s", "AT+CPIN?");
-        err = esp_modem_at(g_cat1.dce, atCmd, atResp, 500);
-        ESP_LOGI(TAG, "%s=>%s", atCmd, atResp);
-        if (err == ESP_OK && strstr(atResp, "+CPIN:") != NULL) {
-            break;
-        }
-        vTaskDelay(pdMS_TO_TICKS(1000));
-    }
     if (err == ESP_OK) {
         if (strstr(atResp, "READY") != NULL) {
             // No PIN required
@@ -728,15 +837,15 @@ static esp_err_t check_pin_status()
                 ESP_LOGE(TAG, "PIN code is required, please set it in the configuration");
                 snprintf(g_cat1.status.modemStatus, sizeof(g_cat1.status.modemStatus), "%s", "PIN Required");
             } else {
-                memset(atResp, 0, sizeof(atResp));
+                char pinResp[256] = {0};
                 snprintf(atCmd, sizeof(atCmd), "AT+CPIN=%s", g_cat1.param.pin);// compatible with EG912U-GL modification
-                err = esp_modem_at(g_cat1.dce, atCmd, atResp, 5000);
-                ESP_LOGI(TAG, "%s=>%s", atCmd, atResp);
+                err = esp_modem_at(g_cat1.dce, atCmd, pinResp, 5000);
+                ESP_LOGI(TAG, "%s=>%s", atCmd, pinResp);
                 if (err == ESP_OK) {
                     ESP_LOGI(TAG, "esp_modem_at(%s) success", atCmd);
                     snprintf(g_cat1.status.modemStatus, sizeof(g_cat1.status.modemStatus), "%s", "Ready");
                 } else {
-                    ESP_LOGE(TAG, "esp_modem_at(%s) failed with %d(%s)", atCmd, err, atResp);
+                    ESP_LOGE(TAG, "esp_modem_at(%s) failed with %d(%s)", atCmd, err, pinResp);
                     snprintf(g_cat1.status.modemStatus, sizeof(g_cat1.status.modemStatus), "%s", "PIN Error");
                 }
             }
@@ -767,6 +876,21 @@ static esp_err_t check_pin_status()
     return err;
 }
 
+/**
+ * Dial in CMUX mode, PPP runs on the data channel
+ * @return ESP_OK on success
+ */
+static esp_err_t dial_ppp()
+{
+    esp_err_t err = esp_modem_set_mode(g_cat1.dce, ESP_MODEM_MODE_CMUX);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_modem_set_mode(ESP_MODEM_MODE_CMUX) failed with %d", err);
+        snprintf(g_cat1.status.modemStatus, sizeof(g_cat1.status.modemStatus), "%s", "SIM Card Error");
+    }
+
+    return err;
+}
+
 /**
  * Establish network connection
  * @return ESP_OK on success
@@ -774,48 +898,194 @@ static esp_err_t check_pin_status()
 esp_err_t connect_to_network()
 {
     char atCmd[256];
-    char atResp[256];
-    esp_err_t err = ESP_OK;
+    esp_modem_at_step_t steps[4];
+    esp_modem_at_step_result_t results[4];
+    int count = 0;
+    int simSteps;
+    uint8_t psm = 0;
 
     // Set apn related information
     if (g_cat1.param.apn[0] != '\0') {
-        memset(atResp, 0, sizeof(atResp));
         snprintf(atCmd, sizeof(atCmd), "AT+QICSGP=1,1,\"%s\",\"%s\",\"%s\",%d", g_cat1.param.apn, g_cat1.param.user, g_cat1.param.password, g_cat1.param.authentication);
-        err = esp_modem_at(g_cat1.dce, atCmd, atResp, 500);
-        ESP_LOGI(TAG, "%s=>%s", atCmd, atResp);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "esp_modem_at(%s) failed with %d(%s)", atCmd, err, atResp);
-            snprintf(g_cat1.status.modemStatus, sizeof(g_cat1.status.modemStatus), "%s", "SIM Card Error");
+        steps[count++] = (esp_modem_at_step_t){.command = atCmd, .timeout_ms = 500, .optional = true};
+    }
+    // Activate roaming service
+    steps[count++] = (esp_modem_at_step_t){.command = "AT+QCFG=\"roamservice\",2,1", .timeout_ms = 500, .optional = true};
+    simSteps = count;
+    // Enable network registration with location information, otherwise LAC and Cell ID cannot be obtained
+    steps[count++] = (esp_modem_at_step_t){.command = "AT+CREG=2", .timeout_ms = 500, .optional = true};
+    // The module keeps AT+CPSMS over a power cycle, turn PSM off if the setting was turned off
+    cfg_get_cellular_psm(&psm);
+    if (!psm) {
+        steps[count++] = (esp_modem_at_step_t){.command = "AT+CPSMS=0", .timeout_ms = 500, .optional = true};
+    }
+
+    // all steps are optional: each command is sent as soon as the previous one is answered
+    cat1_run_script(steps, count, results);
+    for (int i = 0; i < count; i++) {
+        if (results[i].result != ESP_OK) {
+            ESP_LOGE(TAG, "esp_modem_at(%s) failed with %d(%s)", steps[i].command, results[i].result, results[i].response);
+            if (i < simSteps) {     // APN or roaming
+                snprintf(g_cat1.status.modemStatus, sizeof(g_cat1.status.modemStatus), "%s", "SIM Card Error");
+            }
         }
     }
 
-    // Activate roaming service
-    memset(atResp, 0, sizeof(atResp));
-    snprintf(atCmd, sizeof(atCmd), "%s", "AT+QCFG=\"roamservice\",2,1");
-    err = esp_modem_at(g_cat1.dce, atCmd, atResp, 500);
-    ESP_LOGI(TAG, "%s=>%s", atCmd, atResp);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_modem_at(%s) failed with %d(%s)", atCmd, err, atResp);
-        snprintf(g_cat1.status.modemStatus, sizeof(g_cat1.status.modemStatus), "%s", "SIM Card Error");
+    return dial_ppp();
+}
+
+/**
+ * Encode a timer as the 8 bit string of AT+CPSMS, the smallest unit holding it, rounded up
+ * @param sec Timer value
+ * @param units Seconds per unit, indexed by unit code, 0 for unused codes
+ * @param bits At least 9 bytes, receives the bits, most significant first
+ */
+static void encode_psm_timer(uint32_t sec, const uint32_t units[8], char *bits)
+{
+    uint32_t code = 7, value = 0, best = UINT32_MAX;
+
+    for (uint32_t c = 0; c < 8; c++) {
+        uint32_t n = units[c] ? (sec + units[c] - 1) / units[c] : 32;
+        if (n <= 31 && units[c] * n < best) {
+            best = units[c] * n;
+            code = c;
+            value = n;
+        }
     }
+    for (int i = 0; i < 8; i++) {
+        bits[i] = ((code << 5 | value) >> (7 - i)) & 1 ? '1' : '0';
+    }
+    bits[8] = '\0';
+}
 
-    // Enable network registration with location information, otherwise LAC and Cell ID cannot be obtained
-    memset(atResp, 0, sizeof(atResp));
-    snprintf(atCmd, sizeof(atCmd), "%s", "AT+CREG=2");
-    err = esp_modem_at(g_cat1.dce, atCmd, atResp, 500);
-    ESP_LOGI(TAG, "%s=>%s", atCmd, atResp);
+/**
+ * Leave the modem registered for the coming deep sleep: PPP is closed and PSM (or eDRX for short
+ * sleeps) is set for the planned sleep, so the next wake dials without attaching again
+ * @param sleep_s Planned sleep, 0 if the wake time is unknown
+ * @return ESP_OK if the modem was left registered
+ */
+static esp_err_t cat1_keep_registered(uint32_t sleep_s)
+{
+    // GPRS Timer 3 (T3412 extended) and GPRS Timer 2 (T3324) units, 3GPP TS 24.008 10.5.7.4a and 10.5.7.3
+    static const uint32_t tau_units[8] = {600, 3600, 36000, 2, 30, 60, 1152000, 0};
+    static const uint32_t active_units[8] = {2, 60, 360, 0, 0, 0, 0, 0};
+    // LTE eDRX cycles in 10 ms, 3GPP TS 24.008 10.5.5.32
+    static const uint32_t edrx_cycles[] = {512, 1024, 2048, 4096, 6144, 8192, 10240, 12288, 14336, 16384, 32768, 65536, 131072, 262144};
+    char psmCmd[64];
+    char edrxCmd[64];
+    char tau[9];
+    char active[9];
+    esp_err_t err;
+
+    if (sleep_s == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // Stop PPP and CMUX, the registration is kept
+    err = esp_modem_set_mode(g_cat1.dce, ESP_MODEM_MODE_COMMAND);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_modem_set_mode(ESP_MODEM_MODE_COMMAND) failed with %d", err);
+        return err;
+    }
+    g_cat1Psm.edrx = sleep_s < CAT1_PSM_MIN_SLEEP_S;
+    g_cat1Psm.sleep_s = sleep_s;
+    if (g_cat1Psm.edrx) {
+        // the longest cycle within the sleep, the module stays reachable at a low duty cycle
+        int cycle = 0;
+        while (cycle + 1 < (int)(sizeof(edrx_cycles) / sizeof(edrx_cycles[0])) && edrx_cycles[cycle + 1] <= sleep_s * 100) {
+            cycle++;
+        }
+        snprintf(edrxCmd, sizeof(edrxCmd), "AT+CEDRXS=1,4,\"%d%d%d%d\"", cycle >> 3 & 1, cycle >> 2 & 1, cycle >> 1 & 1, cycle & 1);
+        const esp_modem_at_step_t steps[] = {
+            {.command = "AT+CPSMS=0", .timeout_ms = 500, .optional = true},
+            {.command = edrxCmd, .timeout_ms = 500},
+        };
+        esp_modem_at_step_result_t results[sizeof(steps) / sizeof(steps[0])];
+        err = cat1_run_script(steps, sizeof(steps) / sizeof(steps[0]), results);
+    } else {
+        // a periodic TAU beyond the sleep, the module wakes from PSM only when the ESP32 does
+        encode_psm_timer(sleep_s + CAT1_PSM_TAU_MARGIN_S, tau_units, tau);
+        encode_psm_timer(CAT1_PSM_ACTIVE_S, active_units, active);
+        snprintf(psmCmd, sizeof(psmCmd), "AT+CPSMS=1,,,\"%s\",\"%s\"", tau, active);
+        const esp_modem_at_step_t steps[] = {
+            {.command = "AT+CEDRXS=0", .timeout_ms = 500, .optional = true},
+            {.command = psmCmd, .timeout_ms = 500},
+        };
+        esp_modem_at_step_result_t results[sizeof(steps) / sizeof(steps[0])];
+        err = cat1_run_script(steps, sizeof(steps) / sizeof(steps[0]), results);
+    }
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_modem_at(%s) failed with %d(%s)", atCmd, err, atResp);
+        ESP_LOGE(TAG, "%s timers refused, the module is not kept registered", g_cat1Psm.edrx ? "eDRX" : "PSM");
+        return err;
     }
 
-    // CMUX mode dial
-    err = esp_modem_set_mode(g_cat1.dce, ESP_MODEM_MODE_CMUX);
+    // PWRKEY is released through deep sleep, a floating pin would pulse the module off
+    gpio_set_level(GPIO_OUTPUT_PWRKEY, 1);
+    gpio_hold_en(GPIO_OUTPUT_PWRKEY);
+    gpio_deep_sleep_hold_en();
+    return ESP_OK;
+}
+
+/**
+ * Take back the module left registered at the last sleep
+ * @return ESP_OK if it is still registered, ESP_ERR_INVALID_STATE if it answers but the
+ * registration is lost, ESP_FAIL if it does not answer (the DCE is destroyed then)
+ */
+static esp_err_t cat1_resume_registered(void)
+{
+    esp_modem_at_step_t probe[] = {
+        {.command = "AT", .timeout_ms = 300, .retries = 2, .retry_delay_ms = 100},
+    };
+    esp_modem_at_step_result_t probeResult[1];
+    const esp_modem_at_step_t steps[] = {
+        {.command = "ATE0", .timeout_ms = 500, .optional = true},
+        {.command = "AT+CEREG?", .expect = "+CEREG:", .timeout_ms = 500},
+    };
+    esp_modem_at_step_result_t results[sizeof(steps) / sizeof(steps[0])];
+    int n = 0;
+    int stat = 0;
+
+    // PWRKEY was held high through deep sleep, keep it high while the hold is released
+    gpio_config_t io_conf = {};
+    io_conf.intr_type = GPIO_INTR_DISABLE;
+    io_conf.mode = GPIO_MODE_OUTPUT;
+    io_conf.pin_bit_mask = GPIO_OUTPUT_PIN_SEL;
+    gpio_set_level(GPIO_OUTPUT_PWRKEY, 1);
+    gpio_config(&io_conf);
+    gpio_hold_dis(GPIO_OUTPUT_PWRKEY);
+    gpio_deep_sleep_hold_dis();
+
+    if (create_dce() != ESP_OK) {
+        return ESP_FAIL;
+    }
+    esp_err_t err = cat1_run_script(probe, 1, probeResult);
+    if (err != ESP_OK && !g_cat1Psm.edrx) {
+        // the UART is off in PSM until PWRKEY is pulsed
+        ESP_LOGI(TAG, "waking the module out of PSM");
+        gpio_set_level(GPIO_OUTPUT_PWRKEY, 0);
+        vTaskDelay(pdMS_TO_TICKS(CAT1_PSM_WAKE_PULSE_MS));
+        gpio_set_level(GPIO_OUTPUT_PWRKEY, 1);
+        probe[0].retries = 9;
+        probe[0].retry_delay_ms = 200;
+        err = cat1_run_script(probe, 1, probeResult);
+    }
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_modem_set_mode(ESP_MODEM_MODE_CMUX) failed with %d", err);
-        snprintf(g_cat1.status.modemStatus, sizeof(g_cat1.status.modemStatus), "%s", "SIM Card Error");
+        ESP_LOGW(TAG, "the module does not answer, powering it on again");
+        esp_modem_destroy(g_cat1.dce);
+        g_cat1.dce = NULL;
+        esp_netif_destroy(g_cat1.esp_netif);
+        g_cat1.esp_netif = NULL;
+        return ESP_FAIL;
     }
 
-    return err;
+    // +CEREG: <n>,<stat>[,...], 1 registered home network, 5 roaming
+    if (cat1_run_script(steps, sizeof(steps) / sizeof(steps[0]), results) != ESP_OK ||
+            sscanf(results[1].response, "+CEREG: %d,%d", &n, &stat) != 2 || (stat != 1 && stat != 5)) {
+        ESP_LOGW(TAG, "registration lost (%s), attaching again", results[1].response);
+        return ESP_ERR_INVALID_STATE;
+    }
+    ESP_LOGI(TAG, "still registered after a %lus %s sleep, dialing", g_cat1Psm.sleep_s, g_cat1Psm.edrx ? "eDRX" : "PSM");
+    snprintf(g_cat1.status.modemStatus, sizeof(g_cat1.status.modemStatus), "%s", "Ready");
+    return ESP_OK;
 }
 
 /**
@@ -832,25 +1102,46 @@ static void task_start_modem(void *pvParameters)
 
     //
     esp_err_t err = ESP_FAIL;
+    esp_err_t resume = ESP_ERR_NOT_FOUND;
     do {
-        if (power_on_modem() != ESP_OK) {
-            ESP_LOGE(TAG, "power_on_modem failed");
-            break;
-        }
         if (init_param_and_status() != ESP_OK) {
             ESP_LOGE(TAG, "init_param_and_status failed");
             break;
         }
-        if (check_baud_rate() != ESP_OK) {
-            ESP_LOGE(TAG, "check_baud_rate failed");
-            break;
+        memset(&g_cat1Trace, 0, sizeof(g_cat1Trace));
+        if (g_cat1Psm.armed) {
+            g_cat1Psm.armed = false;    // armed again at the next sleep
+            resume = cat1_resume_registered();
+        }
+        if (resume == ESP_FAIL || resume == ESP_ERR_NOT_FOUND) {
+            if (power_on_modem() != ESP_OK) {
+                ESP_LOGE(TAG, "power_on_modem failed");
+                break;
+            }
+            if (check_baud_rate() != ESP_OK) {
+                ESP_LOGE(TAG, "check_baud_rate failed");
+                break;
+            }
         }
         g_cat1.is_opened = true;
         g_cat1.cat1_status = CAT1_STATUS_STARTING;
+        cellularSignalQuality_t signalQuality;
+        if (resume == ESP_OK) {
+            // still registered: no SIM, APN or attach steps, dial right away
+            get_signal_quality(&signalQuality);
+            if (dial_ppp() != ESP_OK) {
+                ESP_LOGE(TAG, "dial_ppp failed");
+                break;
+            }
+            err = ESP_OK;
+            g_cat1.cat1_status = CAT1_STATUS_STARTED;
+            break;
+        }
         if (check_pin_status() != ESP_OK) {
             ESP_LOGE(TAG, "check_pin_status failed");
             break;
         }
+        get_signal_quality(&signalQuality); // feeds the uplink estimator before dialing
         if (connect_to_network() != ESP_OK) {
             ESP_LOGE(TAG, "connect_to_network failed");
             break;
@@ -863,6 +1154,7 @@ static void task_start_modem(void *pvParameters)
     if (err != ESP_OK) {
         xEventGroupSetBits(g_cat1.event_group, CAT1_STA_DISCONNECT_BIT);
     }
+    cat1_trace_show();
 
     //
     ESP_LOGI(TAG, "task_start_modem exit");
@@ -880,6 +1172,7 @@ void cat1_init(int mode)
 
     g_cat1.mode = mode;
     g_cat1.event_group = xEventGroupCreate();
+    debug_cmd_add(g_cmd, sizeof(g_cmd) / sizeof(esp_console_cmd_t));
 }
 
 /**
@@ -915,6 +1208,39 @@ void cat1_wait_open(void)
     get_status(&g_cat1.status);
 }
 
+/**
+ * Prepare the module for deep sleep, leaving it registered if enabled
+ * @param sleep_s Planned sleep, 0 if the wake time is unknown
+ */
+void cat1_prepare_sleep(uint32_t sleep_s)
+{
+    uint8_t enable = 0;
+
+    cfg_get_cellular_psm(&enable);
+    if (g_cat1.dce == NULL || g_cat1.cat1_status != CAT1_STATUS_STARTED) {
+        // a wake that did not open the module leaves it as the last sleep did, PWRKEY still held
+        return;
+    }
+    g_cat1Psm.armed = false;
+    if (!enable) {
+        if (g_cat1Psm.sleep_s != 0) {
+            // turned off since the timers were set at an earlier sleep, the module would still enter PSM
+            const esp_modem_at_step_t steps[] = {
+                {.command = "AT+CPSMS=0", .timeout_ms = 500, .optional = true},
+                {.command = "AT+CEDRXS=0", .timeout_ms = 500, .optional = true},
+            };
+            esp_modem_at_step_result_t results[sizeof(steps) / sizeof(steps[0])];
+            cat1_run_script(steps, sizeof(steps) / sizeof(steps[0]), results);
+            g_cat1Psm.sleep_s = 0;
+        }
+        return;
+    }
+    if (cat1_keep_registered(sleep_s) == ESP_OK) {
+        g_cat1Psm.armed = true;
+        ESP_LOGI(TAG, "module kept registered in %s for %lus", g_cat1Psm.edrx ? "eDRX" : "PSM", sleep_s);
+    }
+}
+
 /**
  * Close CAT1 module connection
  */
@@ -81,6 +81,12 @@ void cat1_open(void);
  */
 void cat1_wait_open(void);
 
+/**
+ * Prepare CAT1 module for deep sleep, keeping it registered in PSM/eDRX if enabled
+ * @param sleep_s Planned sleep in seconds, 0 if unknown
+ */
+void cat1_prepare_sleep(uint32_t sleep_s);
+
 /**
  * Close CAT1 module connection
  */
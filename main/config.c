@@ -17,7 +17,9 @@
 // Handles for NVS namespaces
 static nvs_handle_t g_userHandle = 0;      ///< Handle for user configuration namespace
 static nvs_handle_t g_factoryHandle = 0;   ///< Handle for factory configuration namespace
-static SemaphoreHandle_t g_mutex = 0;      ///< Mutex for thread-safe access
+static SemaphoreHandle_t g_mutex = 0;      ///< Mutex for thread-safe access, recursive for batches
+static uint32_t g_batchDepth = 0;          ///< Nesting of cfg_batch_begin, commits wait for the outermost end
+static esp_err_t g_batchErr = ESP_OK;      ///< First write error of the batch
 
 /**
  * Create configuration mutex
@@ -25,7 +27,7 @@ static SemaphoreHandle_t g_mutex = 0;      ///< Mutex for thread-safe access
  */
 static void mutex_create(void)
 {
-    g_mutex = xSemaphoreCreateMutex();
+    g_mutex = xSemaphoreCreateRecursiveMutex();
 }
 
 /**
@@ -44,7 +46,7 @@ static void mutex_free(void)
 static void mutex_lock(void)
 {
     if (g_mutex) {
-        xSemaphoreTake(g_mutex, portMAX_DELAY);
+        xSemaphoreTakeRecursive(g_mutex, portMAX_DELAY);
     }
 }
 
@@ -55,18 +57,21 @@ static void mutex_lock(void)
 static void mutex_unlock(void)
 {
     if (g_mutex) {
-        xSemaphoreGive(g_mutex);
+        xSemaphoreGiveRecursive(g_mutex);
     }
 }
 
 /**
- * Commit configuration changes to NVS
+ * Commit configuration changes to NVS, deferred to cfg_batch_end inside a batch
  * @param handle NVS namespace handle
  * @return ESP_OK on success, error code otherwise
  */
 static esp_err_t commit_cfg(nvs_handle_t handle)
 {
     esp_err_t err = ESP_OK;
+    if (g_batchDepth > 0) {
+        return ESP_OK;
+    }
     err = nvs_commit(handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "commit failed");
@@ -74,6 +79,19 @@ static esp_err_t commit_cfg(nvs_handle_t handle)
     return err;
 }
 
+/**
+ * Keep the first write error of a batch, for cfg_batch_end
+ * @param err Result of the write
+ * @return err
+ */
+static esp_err_t batch_note(esp_err_t err)
+{
+    if (err != ESP_OK && g_batchDepth > 0 && g_batchErr == ESP_OK) {
+        g_batchErr = err;
+    }
+    return err;
+}
+
 /**
  * Open an NVS namespace
  * @param namespace Name of the namespace to open
@@ -220,7 +238,7 @@ static esp_err_t set_u32(nvs_handle_t handle, const char *key, uint32_t value)
     char in_value[32] = {0};
 
     snprintf(in_value, sizeof(in_value), "%lu", value);
-    err = nvs_set_str(handle, key, in_value);
+    err = batch_note(nvs_set_str(handle, key, in_value));
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "set key:%s value:%ld failed", key, value);
     }
@@ -248,7 +266,7 @@ static esp_err_t set_i32(nvs_handle_t handle, const char *key, int32_t value)
     char in_value[32] = {0};
 
     snprintf(in_value, sizeof(in_value), "%ld", value);
-    err = nvs_set_str(handle, key, in_value);
+    err = batch_note(nvs_set_str(handle, key, in_value));
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "set key:%s value:%ld failed", key, value);
     }
@@ -277,7 +295,7 @@ static esp_err_t set_u8(nvs_handle_t handle, const char *key, uint8_t value)
     char in_value[32] = {0};
 
     snprintf(in_value, sizeof(in_value), "%u", value);
-    err = nvs_set_str(handle, key, in_value);
+    err = batch_note(nvs_set_str(handle, key, in_value));
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "set key:%s value:%d failed", key, value);
     }
@@ -285,6 +303,34 @@ static esp_err_t set_u8(nvs_handle_t handle, const char *key, uint8_t value)
 }
 
 
+static esp_err_t get_u16(nvs_handle_t handle, const char *key, uint16_t *value, uint16_t def)
+{
+    esp_err_t err = ESP_OK;
+    char out_value[32] = {0};
+    size_t len = sizeof(out_value);
+
+    err = nvs_get_str(handle, key, out_value, &len);
+    if (err != ESP_OK) {
+        *value = def;
+    } else {
+        *value = (uint16_t)strtoul(out_value, NULL, 10);
+    }
+    return err;
+}
+
+static esp_err_t set_u16(nvs_handle_t handle, const char *key, uint16_t value)
+{
+    esp_err_t err = ESP_OK;
+    char in_value[32] = {0};
+
+    snprintf(in_value, sizeof(in_value), "%u", value);
+    err = batch_note(nvs_set_str(handle, key, in_value));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "set key:%s value:%d failed", key, value);
+    }
+    return err;
+}
+
 static esp_err_t get_i8(nvs_handle_t handle, const char *key, int8_t *value, int8_t def)
 {
     esp_err_t err = ESP_OK;
@@ -306,7 +352,7 @@ static esp_err_t set_i8(nvs_handle_t handle, const char *key, int8_t value)
     char in_value[32] = {0};
 
     snprintf(in_value, sizeof(in_value), "%d", value);
-    err = nvs_set_str(handle, key, in_value);
+    err = batch_note(nvs_set_str(handle, key, in_value));
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "set key:%s value:%d failed", key, value);
     }
@@ -330,7 +376,7 @@ static esp_err_t get_str(nvs_handle_t handle, const char *key, char *value, size
 static esp_err_t set_str(nvs_handle_t handle, const char *key, const char *value)
 {
     esp_err_t err = ESP_OK;
-    err = nvs_set_str(handle, key, value);
+    err = batch_note(nvs_set_str(handle, key, value));
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "set key:%s value:%s failed", key, value);
     }
@@ -701,6 +747,24 @@ esp_err_t cfg_deinit()
     return nvs_flash_deinit();
 }
 
+void cfg_batch_begin(void)
+{
+    mutex_lock();
+    if (g_batchDepth++ == 0) {
+        g_batchErr = ESP_OK;
+    }
+}
+
+esp_err_t cfg_batch_end(void)
+{
+    esp_err_t err = g_batchErr;
+    if (--g_batchDepth == 0 && (commit_cfg(g_userHandle) != ESP_OK || commit_cfg(g_factoryHandle) != ESP_OK)) {
+        err = ESP_FAIL;
+    }
+    mutex_unlock();
+    return err;
+}
+
 bool cfg_is_undefined(char *str)
 {
     return strcmp(str, NVS_CFG_UNDEFINED) == 0;
@@ -758,6 +822,12 @@ esp_err_t cfg_get_image_attr(imgAttr_t *image)
     get_u8(g_userHandle, KEY_IMG_FRAMESIZE, &image->frameSize, 14); // default FRAMESIZE_FHD
     get_u8(g_userHandle, KEY_IMG_QUALITY, &image->quality, 12); // default quality 12 (0-63, higher value means lower quality)
     get_u8(g_userHandle, KEY_IMG_HDR, &image->hdrEnable, 0); // default HDR disabled
+    get_u8(g_userHandle, KEY_IMG_ROI_MODE, &image->roiMode, 0);
+    get_u16(g_userHandle, KEY_IMG_ROI_X, &image->roiX, 0);
+    get_u16(g_userHandle, KEY_IMG_ROI_Y, &image->roiY, 0);
+    get_u16(g_userHandle, KEY_IMG_ROI_W, &image->roiW, 1000);
+    get_u16(g_userHandle, KEY_IMG_ROI_H, &image->roiH, 1000);
+    get_u32(g_userHandle, KEY_IMG_BUDGET, &image->jpegBudget, 0);
     mutex_unlock();
     return ESP_OK;
 }
@@ -777,6 +847,12 @@ esp_err_t cfg_set_image_attr(imgAttr_t *image)
     set_u8(g_userHandle, KEY_IMG_FRAMESIZE, image->frameSize);
     set_u8(g_userHandle, KEY_IMG_QUALITY, image->quality);
     set_u8(g_userHandle, KEY_IMG_HDR, image->hdrEnable);
+    set_u8(g_userHandle, KEY_IMG_ROI_MODE, image->roiMode);
+    set_u16(g_userHandle, KEY_IMG_ROI_X, image->roiX);
+    set_u16(g_userHandle, KEY_IMG_ROI_Y, image->roiY);
+    set_u16(g_userHandle, KEY_IMG_ROI_W, image->roiW);
+    set_u16(g_userHandle, KEY_IMG_ROI_H, image->roiH);
+    set_u32(g_userHandle, KEY_IMG_BUDGET, image->jpegBudget);
     commit_cfg(g_userHandle);
     mutex_unlock();
     return ESP_OK;
@@ -820,6 +896,7 @@ esp_err_t cfg_get_cap_attr(capAttr_t *capture)
     get_u32(g_userHandle, KEY_CAP_INTERVAL_V, &capture->intervalValue, 8);
     get_u8(g_userHandle, KEY_CAP_INTERVAL_U, &capture->intervalUnit, 1);
     get_u32(g_userHandle, KEY_CAP_CAM_WARMUP_MS, &capture->camWarmupMs, 5000);
+    get_u8(g_userHandle, KEY_CAP_BURST, &capture->burstCount, 1);
     char key[32];
     for (size_t i = 0; i < capture->timedCount; i++) {
         if (i >= sizeof(capture->timedNodes) / sizeof(capture->timedNodes[0])) {
@@ -845,6 +922,7 @@ esp_err_t cfg_set_cap_attr(capAttr_t *capture)
     set_u32(g_userHandle, KEY_CAP_INTERVAL_V, capture->intervalValue);
     set_u8(g_userHandle, KEY_CAP_INTERVAL_U, capture->intervalUnit);
     set_u32(g_userHandle, KEY_CAP_CAM_WARMUP_MS, capture->camWarmupMs);
+    set_u8(g_userHandle, KEY_CAP_BURST, capture->burstCount);
     char key[32];
     for (size_t i = 0; i < capture->timedCount; i++) {
         if (i >= sizeof(capture->timedNodes) / sizeof(capture->timedNodes[0])) {
@@ -867,6 +945,10 @@ esp_err_t cfg_get_upload_attr(uploadAttr_t *upload)
     get_u8(g_userHandle, KEY_UPLOAD_MODE, &upload->uploadMode, 0);
     get_u8(g_userHandle, KEY_UPLOAD_COUNT, &upload->timedCount, 0);
     get_u8(g_userHandle, KEY_UPLOAD_RETRY, &upload->retryCount, 3);
+    get_u32(g_userHandle, KEY_UPLOAD_CHUNK, &upload->chunkSize, 0);
+    get_u32(g_userHandle, KEY_UPLOAD_PREVIEW, &upload->previewWidth, 0);
+    get_u32(g_userHandle, KEY_UPLOAD_BUDGET, &upload->uploadBudget, 0);
+    get_u32(g_userHandle, KEY_SYS_WAKE_WINDOW, &upload->wakeWindow, 30);
     char key[32];
     for (size_t i = 0; i < upload->timedCount; i++) {
         if (i >= sizeof(upload->timedNodes) / sizeof(upload->timedNodes[0])) {
@@ -887,6 +969,10 @@ esp_err_t cfg_set_upload_attr(uploadAttr_t *upload)
     set_u8(g_userHandle, KEY_UPLOAD_MODE, upload->uploadMode);
     set_u8(g_userHandle, KEY_UPLOAD_COUNT, upload->timedCount);
     set_u8(g_userHandle, KEY_UPLOAD_RETRY, upload->retryCount);
+    set_u32(g_userHandle, KEY_UPLOAD_CHUNK, upload->chunkSize);
+    set_u32(g_userHandle, KEY_UPLOAD_PREVIEW, upload->previewWidth);
+    set_u32(g_userHandle, KEY_UPLOAD_BUDGET, upload->uploadBudget);
+    set_u32(g_userHandle, KEY_SYS_WAKE_WINDOW, upload->wakeWindow);
     char key[32];
     for (size_t i = 0; i < upload->timedCount; i++) {
         if (i >= sizeof(upload->timedNodes) / sizeof(upload->timedNodes[0])) {
@@ -1134,6 +1220,23 @@ esp_err_t cfg_set_cellular_baud_rate(uint32_t baudRate)
     return ESP_OK;
 }
 
+esp_err_t cfg_get_cellular_psm(uint8_t *enable)
+{
+    mutex_lock();
+    get_u8(g_userHandle, KEY_CAT1_PSM, enable, 0);
+    mutex_unlock();
+    return ESP_OK;
+}
+
+esp_err_t cfg_set_cellular_psm(uint8_t enable)
+{
+    mutex_lock();
+    set_u8(g_userHandle, KEY_CAT1_PSM, enable);
+    commit_cfg(g_userHandle);
+    mutex_unlock();
+    return ESP_OK;
+}
+
 esp_err_t cfg_user_erase_all()
 {
     esp_err_t err = ESP_OK;
@@ -1259,48 +1362,230 @@ esp_err_t cfg_get_ntp_sync(uint8_t *enable)
     return ESP_OK;
 }
 
+esp_err_t cfg_set_wakeup_window(uint32_t seconds)
+{
+    mutex_lock();
+    set_u32(g_userHandle, KEY_SYS_WAKE_WINDOW, seconds);
+    commit_cfg(g_userHandle);
+    mutex_unlock();
+    return ESP_OK;
+}
+
+esp_err_t cfg_get_wakeup_window(uint32_t *seconds)
+{
+    mutex_lock();
+    get_u32(g_userHandle, KEY_SYS_WAKE_WINDOW, seconds, 30);
+    mutex_unlock();
+    return ESP_OK;
+}
+
+esp_err_t cfg_set_dns_max_age(uint32_t seconds)
+{
+    mutex_lock();
+    set_u32(g_userHandle, KEY_SYS_DNS_MAX_AGE, seconds);
+    commit_cfg(g_userHandle);
+    mutex_unlock();
+    return ESP_OK;
+}
+
+esp_err_t cfg_get_dns_max_age(uint32_t *seconds)
+{
+    mutex_lock();
+    get_u32(g_userHandle, KEY_SYS_DNS_MAX_AGE, seconds, 3600);
+    mutex_unlock();
+    return ESP_OK;
+}
+
+esp_err_t cfg_set_jpeg_budget(uint32_t bytes)
+{
+    mutex_lock();
+    set_u32(g_userHandle, KEY_IMG_BUDGET, bytes);
+    commit_cfg(g_userHandle);
+    mutex_unlock();
+    return ESP_OK;
+}
+
+esp_err_t cfg_get_jpeg_budget(uint32_t *bytes)
+{
+    mutex_lock();
+    get_u32(g_userHandle, KEY_IMG_BUDGET, bytes, 0);
+    mutex_unlock();
+    return ESP_OK;
+}
+
+esp_err_t cfg_set_upload_budget(uint32_t seconds)
+{
+    mutex_lock();
+    set_u32(g_userHandle, KEY_UPLOAD_BUDGET, seconds);
+    commit_cfg(g_userHandle);
+    mutex_unlock();
+    return ESP_OK;
+}
+
+esp_err_t cfg_get_upload_budget(uint32_t *seconds)
+{
+    mutex_lock();
+    get_u32(g_userHandle, KEY_UPLOAD_BUDGET, seconds, 0);
+    mutex_unlock();
+    return ESP_OK;
+}
+
+/**
+ * Key of an import whose value differs from the stored one
+ */
+typedef struct cfgChange {
+    struct cfgChange *next;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    char value[];
+} cfgChange_t;
+
+struct cfgImport {
+    iniparser_stream *ini;
+    cfgChange_t *changes;   // In file order
+    bool model;             // Hardware:model is this device
+    bool no_mem;
+    uint32_t keys;          // Keys in the file
+};
+
+/**
+ * Whether a stored value and an imported one read the same, numbers are compared as the getters parse them
+ */
+static bool same_value(const char *stored, const char *value)
+{
+    if (strcmp(stored, value) == 0) {
+        return true;
+    }
+    char *end_stored, *end_value;
+    long long a = strtoll(stored, &end_stored, 10);
+    long long b = strtoll(value, &end_value, 10);
+    return *stored != '\0' && *end_stored == '\0' && *value != '\0' && *end_value == '\0' && a == b;
+}
+
+static int import_key(void *ctx, const char *key, const char *value)
+{
+    cfgImport_t *import = (cfgImport_t *)ctx;
+    char *stored = NULL;
+    size_t len = 0;
+
+    import->keys++;
+    if (strcmp(key, "Hardware:model") == 0) {
+        import->model = strcmp(value, "NE101") == 0;
+    }
+    if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        ESP_LOGW(TAG, "Invalid key: %s", key);
+        return 0;
+    }
+    // a key given twice takes its last value
+    for (cfgChange_t **p = &import->changes; *p != NULL; p = &(*p)->next) {
+        if (strcmp((*p)->key, key) == 0) {
+            cfgChange_t *change = *p;
+            *p = change->next;
+            free(change);
+            break;
+        }
+    }
+    // the stored value at its length, whatever it is
+    mutex_lock();
+    esp_err_t err = nvs_get_str(g_userHandle, key, NULL, &len);
+    if (err == ESP_OK) {
+        stored = malloc(len);
+        err = stored ? nvs_get_str(g_userHandle, key, stored, &len) : ESP_ERR_NO_MEM;
+    }
+    mutex_unlock();
+    bool same = err == ESP_OK && same_value(stored, value);
+    free(stored);
+    if (err == ESP_ERR_NO_MEM) {
+        import->no_mem = true;
+        return -1;
+    }
+    if (same) {
+        return 0;
+    }
+    cfgChange_t *change = malloc(sizeof(cfgChange_t) + strlen(value) + 1);
+    if (change == NULL) {
+        import->no_mem = true;
+        return -1;
+    }
+    change->next = NULL;
+    strcpy(change->key, key);
+    strcpy(change->value, value);
+    cfgChange_t **tail = &import->changes;
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = change;
+    return 0;
+}
+
+cfgImport_t *cfg_import_begin(void)
+{
+    cfgImport_t *import = calloc(1, sizeof(cfgImport_t));
+    if (import == NULL) {
+        return NULL;
+    }
+    import->ini = iniparser_stream_new(import_key, import);
+    if (import->ini == NULL) {
+        free(import);
+        return NULL;
+    }
+    return import;
+}
+
+esp_err_t cfg_import_feed(cfgImport_t *import, const char *data, size_t len)
+{
+    return iniparser_stream_feed(import->ini, data, len) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t cfg_import_end(cfgImport_t *import, bool apply, uint32_t *changed)
+{
+    esp_err_t err = ESP_OK;
+    uint32_t count = 0;
+
+    if (iniparser_stream_end(import->ini) != 0) {
+        ESP_LOGE(TAG, "Failed to load config data%s", import->no_mem ? ", out of memory" : "");
+        err = ESP_FAIL;
+    } else if (!import->model) {
+        ESP_LOGE(TAG, "Invalid config data");
+        err = ESP_FAIL;
+    } else if (apply) {
+        // one commit for the whole import
+        mutex_lock();
+        for (cfgChange_t *change = import->changes; change != NULL; change = change->next) {
+            ESP_LOGI(TAG, "Importing key: %s, value: %s", change->key, change->value);
+            if (set_str(g_userHandle, change->key, change->value) != ESP_OK) {
+                err = ESP_FAIL;
+            }
+            count++;
+        }
+        if (count > 0 && commit_cfg(g_userHandle) != ESP_OK) {
+            err = ESP_FAIL;
+        }
+        mutex_unlock();
+        ESP_LOGI(TAG, "Imported config, %lu of %lu keys changed", count, import->keys);
+    }
+    while (import->changes != NULL) {
+        cfgChange_t *change = import->changes;
+        import->changes = change->next;
+        free(change);
+    }
+    iniparser_stream_free(import->ini);
+    free(import);
+    if (changed) {
+        *changed = count;
+    }
+    return apply ? err : ESP_FAIL;
+}
+
 esp_err_t cfg_import(char *data, size_t len)
 {
     ESP_LOGI(TAG, "Importing config data");
-    dictionary *d = iniparser_load_ex(data, len);
-    if (d == NULL) {
+    cfgImport_t *import = cfg_import_begin();
+    if (import == NULL) {
         ESP_LOGE(TAG, "Failed to load config data");
-        return ESP_FAIL;
+        return ESP_ERR_NO_MEM;
     }
-    //debug
-    iniparser_dump(d, stderr);
-    // 1. check model
-    const char *model = iniparser_getstring(d, "Hardware:model", NULL);
-    if (model == NULL || strcmp(model, "NE101") != 0) {
-        ESP_LOGE(TAG, "Invalid config data");
-        iniparser_freedict(d);
-        return ESP_FAIL;
-    }
-    // 2. check key and value
-    size_t n;
-    // size_t size = 0;
-    // char out[32] = {0};
-    for (n = 0 ; n < d->size ; n++) {
-        if (d->key[n] == NULL || d->val[n] == NULL) {
-            continue;
-        }
-        // size = sizeof(out);
-        // // not found
-        // if (nvs_get_str(g_userHandle, d->key[n], out, &size) != ESP_OK) {
-        //     ESP_LOGE(TAG, "Invalid key: %s", d->key[n]);
-        //     continue;
-        // }
-        // // same value
-        // if (strcmp(d->val[n], out) == 0) {
-        //     ESP_LOGI(TAG, "Key: %s, value: %s same", d->key[n], d->val[n]);
-        //     continue;
-        // set value
-        // }
-        ESP_LOGI(TAG, "Importing key: %s, value: %s", d->key[n], d->val[n]);
-        set_str(g_userHandle, d->key[n], d->val[n]);
-    }
-    iniparser_freedict(d);
-    return ESP_OK;
+    cfg_import_feed(import, data, len);
+    return cfg_import_end(import, true, NULL);
 }
 
 esp_err_t cfg_get_trigger_mode(uint8_t *mode)
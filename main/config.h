@@ -61,6 +61,12 @@ extern "C" {
 #define KEY_IMG_DCW         "img:bDcw"
 #define KEY_IMG_COLORBAR    "img:bColorbar"
 #define KEY_IMG_HDR         "img:hdr"
+#define KEY_IMG_ROI_MODE    "img:roiMode"
+#define KEY_IMG_ROI_X       "img:roiX"
+#define KEY_IMG_ROI_Y       "img:roiY"
+#define KEY_IMG_ROI_W       "img:roiW"
+#define KEY_IMG_ROI_H       "img:roiH"
+#define KEY_IMG_BUDGET      "img:budget"
 
 #define KEY_LIGHT_MODE      "light:mode"
 #define KEY_LIGHT_THRESHOLD "light:thr"
@@ -75,11 +81,15 @@ extern "C" {
 #define KEY_CAP_INTERVAL_V  "cap:iValue"
 #define KEY_CAP_INTERVAL_U  "cap:iUnit"
 #define KEY_CAP_CAM_WARMUP_MS "cap:camWarmupMs"
+#define KEY_CAP_BURST       "cap:burst"
 #define KEY_UPLOAD_MODE     "upload:mode"
 #define KEY_UPLOAD_COUNT    "upload:count"
 #define KEY_UPLOAD_INTERVAL_V "upload:iValue"
 #define KEY_UPLOAD_INTERVAL_U "upload:iUnit"
 #define KEY_UPLOAD_RETRY    "upload:retry"
+#define KEY_UPLOAD_CHUNK    "upload:chunk"
+#define KEY_UPLOAD_PREVIEW  "upload:preview"
+#define KEY_UPLOAD_BUDGET   "upload:budget"
 #define KEY_PLATFORM_TYPE   "plat:type"
 #define KEY_SNS_HTTP_PORT   "sns:httpPort"
 #define KEY_MQTT_ENABLE     "mqtt:enable"
@@ -106,6 +116,8 @@ extern "C" {
 #define KEY_SYS_TIME_ZONE   "sys:tz"
 #define KEY_SYS_TIME_ERR_RATE "sys:errRate"
 #define KEY_SYS_NTP_SYNC    "sys:bNtpSync"
+#define KEY_SYS_WAKE_WINDOW "sys:wakeWin"
+#define KEY_SYS_DNS_MAX_AGE "sys:dnsAge"
 #define KEY_CFG_CRC32       "cfg:crc32"
 #define KEY_CAT1_IMEI       "cat1:imei"
 #define KEY_CAT1_APN        "cat1:apn"
@@ -114,6 +126,7 @@ extern "C" {
 #define KEY_CAT1_PIN        "cat1:pin"
 #define KEY_CAT1_AUTH_TYPE  "cat1:authType"
 #define KEY_CAT1_BAUD_RATE  "cat1:baudRate"
+#define KEY_CAT1_PSM        "cat1:psm"
 #define KEY_TRIGGER_MODE    "trigger:mode"
 #define KEY_PIR_SENS        "pir:sens"
 #define KEY_PIR_BLIND       "pir:blind"
@@ -180,6 +193,12 @@ typedef struct imgAttr {
     uint8_t bDcw;               // downsampling switch
     uint8_t bColorbar;          // color bar test pattern switch (for debugging)
     uint8_t hdrEnable;          // HDR enable/disable for USB camera
+    uint8_t roiMode;            // region of interest: 0: off, 1: lossless JPEG crop, 2: sensor window (falls back to the JPEG crop)
+    uint16_t roiX;              // region of interest left edge, in permille of the frame width
+    uint16_t roiY;              // region of interest top edge, in permille of the frame height
+    uint16_t roiW;              // region of interest width, in permille of the frame width
+    uint16_t roiH;              // region of interest height, in permille of the frame height
+    uint32_t jpegBudget;        // target JPEG size in bytes, 0: capture at the configured quality
 } imgAttr_t;
 
 /**
@@ -203,6 +222,7 @@ typedef struct capAttr {
     uint32_t intervalValue; // use for interval mode
     uint8_t  intervalUnit; // use for interval mode. 0: minutes, 1: hours, 2:day
     uint32_t camWarmupMs; // camera warm-up delay in milliseconds
+    uint8_t burstCount; // frames grabbed per capture, the sharpest one is kept (1: no burst)
 } capAttr_t;
 
 /**
@@ -213,6 +233,10 @@ typedef struct uploadAttr {
     uint8_t timedCount; // number of scheduled upload times
     timedNode_t timedNodes[10]; // scheduled upload times (max 10)
     uint8_t retryCount; // retry count for failed uploads (default 3)
+    uint32_t chunkSize; // resumable upload chunk size in bytes, 0: upload whole image in one message
+    uint32_t previewWidth; // largest width of a preview uploaded right away while the full image goes to flash, 0: no preview
+    uint32_t uploadBudget; // seconds an instant upload may take before the framesize is lowered, 0: keep the configured one
+    uint32_t wakeWindow; // seconds the upload and schedule jobs may move to share the wake of a capture
 } uploadAttr_t;
 
 /**
@@ -363,6 +387,11 @@ typedef struct pirAttr {
     uint8_t window; // [1:0] Window time (0-3), time = value * 2s + 2s
 } pirAttr_t;
 
+/**
+ * Config import parsed as the INI file arrives, see cfg_import_begin
+ */
+typedef struct cfgImport cfgImport_t;
+
 esp_err_t cfg_init(void);
 esp_err_t cfg_deinit();
 void cfg_dump();
@@ -377,6 +406,44 @@ void cfg_get_str(const char *key, char *value, size_t length, const char *def);
 void cfg_erase_key(const char *key);
 
 esp_err_t cfg_import(char *data, size_t len);
+
+/**
+ * Start a config import. The INI file is parsed as it is fed, only the keys whose value
+ * differs from the stored one are kept, and they are written together by cfg_import_end
+ * @return Import, NULL if out of memory
+ */
+cfgImport_t *cfg_import_begin(void);
+
+/**
+ * Feed the next bytes of the INI file
+ * @param import Import
+ * @param data Bytes of the file, split anywhere
+ * @param len Number of bytes
+ * @return ESP_OK, or ESP_FAIL once the file has a syntax error or memory ran out
+ */
+esp_err_t cfg_import_feed(cfgImport_t *import, const char *data, size_t len);
+
+/**
+ * End a config import and free it
+ * @param import Import
+ * @param apply false to drop the import, e.g. when the file does not match its checksum
+ * @param changed Keys written, may be NULL
+ * @return ESP_OK if the file was for this model and its changes are committed
+ */
+esp_err_t cfg_import_end(cfgImport_t *import, bool apply, uint32_t *changed);
+
+/**
+ * Start a batch. The calling task holds the configuration until cfg_batch_end, so the
+ * cfg_get_* in between read one consistent state, and the cfg_set_* in between are
+ * committed once at the end. Batches nest
+ */
+void cfg_batch_begin(void);
+
+/**
+ * End a batch and commit its writes
+ * @return ESP_OK, or the first error of the writes or of the commit
+ */
+esp_err_t cfg_batch_end(void);
 esp_err_t cfg_user_erase_all();
 esp_err_t cfg_set_firmware_crc32(uint32_t crc);
 uint32_t cfg_get_firmware_crc32();
@@ -410,8 +477,18 @@ esp_err_t cfg_get_cellular_param_attr(cellularParamAttr_t *cellularParam);
 esp_err_t cfg_set_cellular_param_attr(cellularParamAttr_t *cellularParam);
 esp_err_t cfg_get_cellular_baud_rate(uint32_t *baudRate);
 esp_err_t cfg_set_cellular_baud_rate(uint32_t baudRate);
+esp_err_t cfg_get_cellular_psm(uint8_t *enable);
+esp_err_t cfg_set_cellular_psm(uint8_t enable);
 esp_err_t cfg_set_ntp_sync(uint8_t enable);
 esp_err_t cfg_get_ntp_sync(uint8_t *enable);
+esp_err_t cfg_set_wakeup_window(uint32_t seconds);
+esp_err_t cfg_get_wakeup_window(uint32_t *seconds);
+esp_err_t cfg_set_dns_max_age(uint32_t seconds);
+esp_err_t cfg_get_dns_max_age(uint32_t *seconds);
+esp_err_t cfg_set_jpeg_budget(uint32_t bytes);
+esp_err_t cfg_get_jpeg_budget(uint32_t *bytes);
+esp_err_t cfg_set_upload_budget(uint32_t seconds);
+esp_err_t cfg_get_upload_budget(uint32_t *seconds);
 bool cfg_is_undefined(char *value);
 esp_err_t cfg_get_trigger_mode(uint8_t *mode);
 esp_err_t cfg_set_trigger_mode(uint8_t mode);
@@ -0,0 +1,348 @@
+/**
+ * DNS cache across deep sleep
+ *
+ * Every wake used to resolve the MQTT broker, the MIP endpoint and the NTP
+ * servers from scratch, which costs one cellular RTT per name over CAT1.
+ * Resolved addresses are kept in RTC memory and served until they expire or
+ * a connection to them fails.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "lwip/netdb.h"
+#include "lwip/dns.h"
+#include "lwip/ip_addr.h"
+#include "lwip/inet.h"
+#include "debug.h"
+#include "config.h"
+#include "dns_cache.h"
+
+#define TAG "-->DNS"
+
+#define DNS_CACHE_SIZE      6                   // Broker, MIP endpoint and NTP servers
+#define DNS_CACHE_HOST_LEN  64                  // Longer names are not cached
+
+/**
+ * Cached address of one host
+ */
+typedef struct dnsEntry {
+    char host[DNS_CACHE_HOST_LEN];  // Host name, empty if the slot is free
+    ip_addr_t addr;                 // Resolved address
+    time_t expire;                  // Entry is stale after this time
+} dnsEntry_t;
+
+/**
+ * DNS cache state, preserved in RTC memory
+ */
+typedef struct dnsCache {
+    dnsEntry_t entries[DNS_CACHE_SIZE];
+    uint32_t hit;                   // Lookups served from the cache
+    uint32_t miss;                  // Lookups resolved live
+} dnsCache_t;
+
+/**
+ * Pending live lookup started by dns_gethostbyname()
+ */
+typedef struct dnsPending {
+    dns_found_callback found;       // Caller callback
+    void *arg;                      // Caller callback argument
+} dnsPending_t;
+
+static RTC_DATA_ATTR dnsCache_t g_dnsCache = {0};
+static uint32_t g_dnsMaxAge = DNS_CACHE_MAX_AGE_S;  // lwIP does not expose the record TTL, see dns_cache.h
+static portMUX_TYPE g_dnsMux = portMUX_INITIALIZER_UNLOCKED; // lookups run both in tasks and in the tcpip thread
+
+int __real_lwip_getaddrinfo(const char *nodename, const char *servname,
+                            const struct addrinfo *hints, struct addrinfo **res);
+err_t __real_dns_gethostbyname(const char *hostname, ip_addr_t *addr,
+                               dns_found_callback found, void *callback_arg);
+
+/**
+ * Check if a host can be cached: a name, not a numeric address
+ * @param host Host name
+ * @return true if the host is a cacheable name
+ */
+static bool dns_cache_is_name(const char *host)
+{
+    ip_addr_t addr;
+
+    if (host == NULL || host[0] == '\0' || strlen(host) >= DNS_CACHE_HOST_LEN) {
+        return false;
+    }
+    return !ipaddr_aton(host, &addr);
+}
+
+/**
+ * Check if an entry can be served
+ * @param entry Cache entry
+ * @param now Current time
+ * @return true if the entry is in use and not stale
+ */
+static bool dns_cache_entry_valid(const dnsEntry_t *entry, time_t now)
+{
+    // an expire time too far ahead means the clock went back, do not trust it
+    // as does one stored under a longer maximum age
+    return entry->host[0] && now < entry->expire && entry->expire - now <= g_dnsMaxAge;
+}
+
+/**
+ * Find a host in the cache
+ * @param host Host name
+ * @param addr Output address
+ * @return true on hit
+ */
+static bool dns_cache_lookup(const char *host, ip_addr_t *addr)
+{
+    bool found = false;
+    time_t now = time(NULL);
+
+    taskENTER_CRITICAL(&g_dnsMux);
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        dnsEntry_t *entry = &g_dnsCache.entries[i];
+        if (dns_cache_entry_valid(entry, now) && strcasecmp(entry->host, host) == 0) {
+            ip_addr_copy(*addr, entry->addr);
+            found = true;
+            break;
+        }
+    }
+    if (found) {
+        g_dnsCache.hit++;
+    } else {
+        g_dnsCache.miss++;
+    }
+    taskEXIT_CRITICAL(&g_dnsMux);
+    return found;
+}
+
+/**
+ * Store the address of a host, replacing the same host or the entry closest to expiry
+ * @param host Host name
+ * @param addr Resolved address
+ */
+static void dns_cache_store(const char *host, const ip_addr_t *addr)
+{
+    time_t now = time(NULL);
+    dnsEntry_t *slot = NULL;
+
+    if (!dns_cache_is_name(host) || addr == NULL || ip_addr_isany(addr) || g_dnsMaxAge == 0) {
+        return;
+    }
+    taskENTER_CRITICAL(&g_dnsMux);
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        dnsEntry_t *entry = &g_dnsCache.entries[i];
+        if (entry->host[0] && strcasecmp(entry->host, host) == 0) {
+            slot = entry;
+            break;
+        }
+        if (slot == NULL || (dns_cache_entry_valid(slot, now) &&
+                             (!dns_cache_entry_valid(entry, now) || entry->expire < slot->expire))) {
+            slot = entry;
+        }
+    }
+    strlcpy(slot->host, host, sizeof(slot->host));
+    ip_addr_copy(slot->addr, *addr);
+    slot->expire = now + g_dnsMaxAge;
+    taskEXIT_CRITICAL(&g_dnsMux);
+}
+
+/**
+ * Store the first address returned by getaddrinfo()
+ * @param host Host name
+ * @param sa Socket address
+ */
+static void dns_cache_store_sockaddr(const char *host, const struct sockaddr *sa)
+{
+    ip_addr_t addr;
+
+    memset(&addr, 0, sizeof(addr));
+    if (sa->sa_family == AF_INET) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)sa;
+        inet_addr_to_ip4addr(ip_2_ip4(&addr), &sin->sin_addr);
+        IP_SET_TYPE_VAL(addr, IPADDR_TYPE_V4);
+#if LWIP_IPV6
+    } else if (sa->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sa;
+        inet6_addr_to_ip6addr(ip_2_ip6(&addr), &sin6->sin6_addr);
+        IP_SET_TYPE_VAL(addr, IPADDR_TYPE_V6);
+#endif
+    } else {
+        return;
+    }
+    dns_cache_store(host, &addr);
+}
+
+/**
+ * Link-time wrapper of lwip_getaddrinfo(), used by esp-tls for esp-mqtt and esp_http_client
+ * On a hit the cached address is passed to lwIP as a numeric host, so the result is
+ * allocated by lwIP and released by the caller with freeaddrinfo() as usual.
+ */
+int __wrap_lwip_getaddrinfo(const char *nodename, const char *servname,
+                            const struct addrinfo *hints, struct addrinfo **res)
+{
+    ip_addr_t addr;
+    char ip[IPADDR_STRLEN_MAX];
+    int ret;
+
+    if (!dns_cache_is_name(nodename)) {
+        return __real_lwip_getaddrinfo(nodename, servname, hints, res);
+    }
+    if (dns_cache_lookup(nodename, &addr) && ipaddr_ntoa_r(&addr, ip, sizeof(ip))) {
+        ret = __real_lwip_getaddrinfo(ip, servname, hints, res);
+        if (ret == 0) {
+            ESP_LOGI(TAG, "hit %s -> %s", nodename, ip);
+            return ret;
+        }
+        // the cached family does not match the hints, resolve live
+    }
+    ret = __real_lwip_getaddrinfo(nodename, servname, hints, res);
+    if (ret == 0 && *res && (*res)->ai_addr) {
+        dns_cache_store_sockaddr(nodename, (*res)->ai_addr);
+    }
+    return ret;
+}
+
+/**
+ * Completion of a live lookup started by __wrap_dns_gethostbyname(), runs in the tcpip thread
+ */
+static void dns_cache_found_cb(const char *name, const ip_addr_t *ipaddr, void *arg)
+{
+    dnsPending_t *pending = (dnsPending_t *)arg;
+
+    if (ipaddr) {
+        dns_cache_store(name, ipaddr);
+    }
+    pending->found(name, ipaddr, pending->arg);
+    free(pending);
+}
+
+/**
+ * Link-time wrapper of dns_gethostbyname(), used by SNTP
+ * A hit completes synchronously with ERR_OK, which dns_gethostbyname() callers already handle.
+ */
+err_t __wrap_dns_gethostbyname(const char *hostname, ip_addr_t *addr,
+                               dns_found_callback found, void *callback_arg)
+{
+    dnsPending_t *pending = NULL;
+    err_t err;
+
+    if (!dns_cache_is_name(hostname) || found == NULL) {
+        return __real_dns_gethostbyname(hostname, addr, found, callback_arg);
+    }
+    if (dns_cache_lookup(hostname, addr)) {
+        return ERR_OK;
+    }
+    pending = malloc(sizeof(dnsPending_t));
+    if (pending == NULL) {
+        return __real_dns_gethostbyname(hostname, addr, found, callback_arg);
+    }
+    pending->found = found;
+    pending->arg = callback_arg;
+    err = __real_dns_gethostbyname(hostname, addr, dns_cache_found_cb, pending);
+    if (err == ERR_OK) {
+        dns_cache_store(hostname, addr);
+    }
+    if (err != ERR_INPROGRESS) {
+        free(pending);
+    }
+    return err;
+}
+
+void dns_cache_invalidate(const char *host)
+{
+    char name[DNS_CACHE_HOST_LEN];
+    const char *start = NULL;
+    size_t len = 0;
+
+    if (host == NULL) {
+        return;
+    }
+    start = strstr(host, "://");
+    start = start ? start + 3 : host;
+    len = strcspn(start, ":/?#");
+    if (len == 0 || len >= sizeof(name)) {
+        return;
+    }
+    memcpy(name, start, len);
+    name[len] = '\0';
+
+    taskENTER_CRITICAL(&g_dnsMux);
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        if (strcasecmp(g_dnsCache.entries[i].host, name) == 0) {
+            memset(&g_dnsCache.entries[i], 0, sizeof(dnsEntry_t));
+        }
+    }
+    taskEXIT_CRITICAL(&g_dnsMux);
+    ESP_LOGI(TAG, "invalidate %s", name);
+}
+
+void dns_cache_clear(void)
+{
+    taskENTER_CRITICAL(&g_dnsMux);
+    memset(g_dnsCache.entries, 0, sizeof(g_dnsCache.entries));
+    taskEXIT_CRITICAL(&g_dnsMux);
+}
+
+void dns_cache_get_stats(uint32_t *hit, uint32_t *miss)
+{
+    if (hit) {
+        *hit = g_dnsCache.hit;
+    }
+    if (miss) {
+        *miss = g_dnsCache.miss;
+    }
+}
+
+void dns_cache_set_max_age(uint32_t seconds)
+{
+    g_dnsMaxAge = MIN(seconds, DNS_CACHE_MAX_AGE_LIMIT);
+    cfg_set_dns_max_age(g_dnsMaxAge);
+    ESP_LOGI(TAG, "max age %lus", g_dnsMaxAge);
+}
+
+/**
+ * Console command handler for showing or clearing the DNS cache, or setting its maximum age
+ * @param argc Argument count
+ * @param argv Argument values
+ * @return ESP_OK
+ */
+static int do_dnscache_cmd(int argc, char **argv)
+{
+    char ip[IPADDR_STRLEN_MAX];
+    time_t now = time(NULL);
+
+    if (argc > 1 && strcmp(argv[1], "clear") == 0) {
+        dns_cache_clear();
+        ESP_LOGI(TAG, "cache cleared");
+        return ESP_OK;
+    }
+    if (argc > 2 && strcmp(argv[1], "age") == 0) {
+        dns_cache_set_max_age(strtoul(argv[2], NULL, 10));
+        return ESP_OK;
+    }
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        dnsEntry_t *entry = &g_dnsCache.entries[i];
+        if (entry->host[0]) {
+            ipaddr_ntoa_r(&entry->addr, ip, sizeof(ip));
+            ESP_LOGI(TAG, "------ %s -> %s (expire in %llds)", entry->host, ip, entry->expire - now);
+        }
+    }
+    ESP_LOGI(TAG, "Hit: %lu, Miss: %lu, Max age: %lus", g_dnsCache.hit, g_dnsCache.miss, g_dnsMaxAge);
+    return ESP_OK;
+}
+
+static esp_console_cmd_t g_cmd[] = {
+    {"dnscache", "dnscache [clear | age <seconds>], show or clear the DNS cache, or set its maximum age", NULL, do_dnscache_cmd, NULL},
+};
+
+void dns_cache_open(void)
+{
+    uint32_t age = DNS_CACHE_MAX_AGE_S;
+
+    cfg_get_dns_max_age(&age);
+    g_dnsMaxAge = MIN(age, DNS_CACHE_MAX_AGE_LIMIT);
+    debug_cmd_add(g_cmd, sizeof(g_cmd) / sizeof(esp_console_cmd_t));
+}
@@ -0,0 +1,64 @@
+#ifndef __DNS_CACHE_H__
+#define __DNS_CACHE_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Resolver cache kept in RTC memory across deep sleep
+ *
+ * lwip_getaddrinfo() (esp-mqtt, esp_http_client) and dns_gethostbyname() (SNTP)
+ * are wrapped at link time, so the cache is consulted before lwIP DNS without
+ * any change to the client configs. See main/CMakeLists.txt for the wrap flags.
+ *
+ * Limitation: lwIP does not pass the TTL of a record to its callers, so the cache
+ * can not honour it. Every entry is kept for the same maximum age instead, an hour
+ * by default and set with the sys:dnsAge key (console: dnscache age <seconds>, 0
+ * turns the cache off). A record whose TTL is shorter is served past it until the
+ * age runs out or a connection to the address fails and dns_cache_invalidate()
+ * drops it, so keep the age under the TTL of the broker records when they move.
+ */
+
+#define DNS_CACHE_MAX_AGE_S     3600    // Default maximum age of an entry, seconds
+#define DNS_CACHE_MAX_AGE_LIMIT 86400   // Largest maximum age that can be set, seconds
+
+/**
+ * Initialize the DNS cache module, load its maximum age and register its console command
+ * Call it after cfg_init()
+ */
+void dns_cache_open(void);
+
+/**
+ * Set the maximum age of the entries, stored in the config
+ * Entries stored for longer are dropped at their next lookup
+ * @param seconds Maximum age, at most DNS_CACHE_MAX_AGE_LIMIT, 0 to stop caching
+ */
+void dns_cache_set_max_age(uint32_t seconds);
+
+/**
+ * Drop the cached address of a host, the next lookup resolves it live
+ * Call it when a connection to the cached address failed
+ * @param host Host name or URL ("mqtts://host:8883/path" is accepted)
+ */
+void dns_cache_invalidate(const char *host);
+
+/**
+ * Drop every cached address
+ */
+void dns_cache_clear(void);
+
+/**
+ * Get the cache statistics
+ * @param hit Output number of lookups served from the cache (can be NULL)
+ * @param miss Output number of lookups resolved live (can be NULL)
+ */
+void dns_cache_get_stats(uint32_t *hit, uint32_t *miss);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DNS_CACHE_H__ */
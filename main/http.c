@@ -1,4 +1,7 @@
 #include <sys/param.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <ctype.h>
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_console.h"
@@ -24,6 +27,8 @@
 #include "storage.h"
 #include "utils.h"
 #include "pir.h"
+#include "web_assets.h"
+#include "wake_sched.h"
 
 #define TAG "-->HTTP"  // Logging tag for HTTP module
 
@@ -41,6 +46,31 @@ extern const char js_start[] asm("_binary_index_js_start");
 extern const char js_end[] asm("_binary_index_js_end");
 extern const char css_start[] asm("_binary_index_css_start");
 extern const char css_end[] asm("_binary_index_css_end");
+// gzip of the text assets, made by the build
+extern const char root_gz_start[] asm("_binary_index_html_gz_start");
+extern const char root_gz_end[] asm("_binary_index_html_gz_end");
+extern const char js_gz_start[] asm("_binary_index_js_gz_start");
+extern const char js_gz_end[] asm("_binary_index_js_gz_end");
+extern const char css_gz_start[] asm("_binary_index_css_gz_start");
+extern const char css_gz_end[] asm("_binary_index_css_gz_end");
+
+// The page revalidates on each load, the scripts and styles are fetched with a version query
+static webAsset_t g_rootAsset = {
+    .type = "text/html", .cache = "no-cache",
+    .start = root_start, .end = root_end, .gz_start = root_gz_start, .gz_end = root_gz_end,
+};
+static webAsset_t g_faviconAsset = {
+    .type = "image/x-icon", .cache = "public, max-age=604800",
+    .start = favicon_start, .end = favicon_end,
+};
+static webAsset_t g_jsAsset = {
+    .type = "text/javascript", .cache = "public, max-age=604800",
+    .start = js_start, .end = js_end, .gz_start = js_gz_start, .gz_end = js_gz_end,
+};
+static webAsset_t g_cssAsset = {
+    .type = "text/css", .cache = "public, max-age=604800",
+    .start = css_start, .end = css_end, .gz_start = css_gz_start, .gz_end = css_gz_end,
+};
 
 /**
  * HTTP response structure
@@ -83,19 +113,28 @@ static void clear_timeout()
 /**
  * Get content from HTTP request
  * @param req HTTP request handle
- * @return Pointer to allocated content buffer, or NULL on failure
+ * @return Pointer to allocated content buffer, NUL terminated, or NULL on failure
  */
 static char *http_get_content_from_req(httpd_req_t *req)
 {
-    char *content = (char *)malloc(req->content_len);
-    int ret = httpd_req_recv(req, content, req->content_len);
-    if (ret <= 0) {
-        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
-            httpd_resp_send_408(req);
-        }
-        free(content);
+    char *content = (char *)malloc(req->content_len + 1);
+    size_t received = 0;
+    if (content == NULL) {
         return NULL;
     }
+    // a body larger than one TCP segment arrives in several reads
+    while (received < req->content_len) {
+        int ret = httpd_req_recv(req, content + received, req->content_len - received);
+        if (ret <= 0) {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+                httpd_resp_send_408(req);
+            }
+            free(content);
+            return NULL;
+        }
+        received += ret;
+    }
+    content[received] = '\0';
     return content;
 }
 
@@ -136,12 +175,9 @@ static void http_send_json_response(httpd_req_t *req, uint32_t result)
  */
 static esp_err_t get_root_handler(httpd_req_t *req)
 {
-    const uint32_t len = root_end - root_start;
     clear_timeout();
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, root_start, len);
     ESP_LOGI(TAG, "Serve root");
-    return ESP_OK;
+    return web_asset_send(req, &g_rootAsset);
 }
 
 /**
@@ -151,11 +187,8 @@ static esp_err_t get_root_handler(httpd_req_t *req)
  */
 static esp_err_t get_favicon_handler(httpd_req_t *req)
 {
-    const uint32_t len = favicon_end - favicon_start;
     clear_timeout();
-    httpd_resp_set_type(req, "image/x-icon");
-    httpd_resp_send(req, (const char *)favicon_start, len);
-    return ESP_OK;
+    return web_asset_send(req, &g_faviconAsset);
 }
 
 /**
@@ -165,12 +198,8 @@ static esp_err_t get_favicon_handler(httpd_req_t *req)
  */
 static esp_err_t get_js_handler(httpd_req_t *req)
 {
-    const uint32_t len = js_end - js_start;
     clear_timeout();
-    httpd_resp_set_type(req, "text/javascript");
-    httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=604800");
-    httpd_resp_send(req, (const char *)js_start, len);
-    return ESP_OK;
+    return web_asset_send(req, &g_jsAsset);
 }
 /**
  * CSS GET handler
@@ -179,11 +208,8 @@ static esp_err_t get_js_handler(httpd_req_t *req)
  */
 static esp_err_t get_css_handler(httpd_req_t *req)
 {
-    const uint32_t len = css_end - css_start;
     clear_timeout();
-    httpd_resp_set_type(req, "text/css");
-    httpd_resp_send(req, (const char *)css_start, len);
-    return ESP_OK;
+    return web_asset_send(req, &g_cssAsset);
 }
 /**
  * 404 Error handler - Redirects to root page
@@ -237,6 +263,12 @@ esp_err_t get_cam_param_handle(httpd_req_t *req)
     s2j_json_set_basic_element(json_obj, &image, int, bDcw);
     s2j_json_set_basic_element(json_obj, &image, int, bColorbar);
     s2j_json_set_basic_element(json_obj, &image, int, hdrEnable);
+    s2j_json_set_basic_element(json_obj, &image, int, roiMode);
+    s2j_json_set_basic_element(json_obj, &image, int, roiX);
+    s2j_json_set_basic_element(json_obj, &image, int, roiY);
+    s2j_json_set_basic_element(json_obj, &image, int, roiW);
+    s2j_json_set_basic_element(json_obj, &image, int, roiH);
+    cJSON_AddNumberToObject(json_obj, "jpegBudget", image.jpegBudget);
 
     str = cJSON_PrintUnformatted(json_obj);
     httpd_resp_sendstr(req, str);
@@ -267,6 +299,16 @@ esp_err_t set_cam_param_handle(httpd_req_t *req)
         s2j_struct_get_basic_element(image, json, int, frameSize);
         s2j_struct_get_basic_element(image, json, int, quality);
         s2j_struct_get_basic_element(image, json, int, hdrEnable);
+        s2j_struct_get_basic_element(image, json, int, roiMode);
+        s2j_struct_get_basic_element(image, json, int, roiX);
+        s2j_struct_get_basic_element(image, json, int, roiY);
+        s2j_struct_get_basic_element(image, json, int, roiW);
+        s2j_struct_get_basic_element(image, json, int, roiH);
+        // target JPEG size in bytes, 0 captures at the configured quality
+        cJSON *jpegBudget = cJSON_GetObjectItem(json, "jpegBudget");
+        if (cJSON_IsNumber(jpegBudget) && jpegBudget->valuedouble >= 0) {
+            image->jpegBudget = jpegBudget->valuedouble < UINT32_MAX ? (uint32_t)jpegBudget->valuedouble : UINT32_MAX;
+        }
 
         // Apply JPEG quality limit for resolutions > 3MP
         if (image->frameSize < FRAMESIZE_INVALID && image->quality <= 63) {
@@ -373,6 +415,7 @@ esp_err_t get_cap_param_handle(httpd_req_t *req)
     s2j_json_set_basic_element(json_obj, &capture, int, intervalValue);
     s2j_json_set_basic_element(json_obj, &capture, int, intervalUnit);
     s2j_json_set_basic_element(json_obj, &capture, int, camWarmupMs);
+    s2j_json_set_basic_element(json_obj, &capture, int, burstCount);
     s2j_json_set_basic_element(json_obj, &capture, int, timedCount);
     s2j_json_set_struct_array_element_by_func(json_obj, &capture, timedNode_t, timedNodes, capture.timedCount);
 
@@ -412,6 +455,9 @@ esp_err_t set_cap_param_handle(httpd_req_t *req)
         if (cJSON_HasObjectItem(json, "camWarmupMs")) {
             s2j_struct_get_basic_element(capture, json, int, camWarmupMs);
         }
+        if (cJSON_HasObjectItem(json, "burstCount")) {
+            s2j_struct_get_basic_element(capture, json, int, burstCount);
+        }
         s2j_struct_get_basic_element(capture, json, int, timedCount);
         s2j_struct_get_struct_array_element_by_func(capture, json, timedNode_t, timedNodes);
         http_send_json_response(req, RES_OK);
@@ -548,8 +594,12 @@ esp_err_t get_upload_param_handle(httpd_req_t *req)
     /* serialize data to JSON object. */
     s2j_json_set_basic_element(json_obj, &upload, int, uploadMode);
     s2j_json_set_basic_element(json_obj, &upload, int, retryCount);
+    s2j_json_set_basic_element(json_obj, &upload, int, chunkSize);
+    s2j_json_set_basic_element(json_obj, &upload, int, previewWidth);
     s2j_json_set_basic_element(json_obj, &upload, int, timedCount);
     s2j_json_set_struct_array_element_by_func(json_obj, &upload, timedNode_t, timedNodes, upload.timedCount);
+    cJSON_AddNumberToObject(json_obj, "wakeWindow", upload.wakeWindow);
+    cJSON_AddNumberToObject(json_obj, "uploadBudget", upload.uploadBudget);
     str = cJSON_PrintUnformatted(json_obj);
     httpd_resp_sendstr(req, str);
     cJSON_free(str);
@@ -570,8 +620,20 @@ esp_err_t set_upload_param_handle(httpd_req_t *req)
         cfg_get_upload_attr(upload);
         s2j_struct_get_basic_element(upload, json, int, uploadMode);
         s2j_struct_get_basic_element(upload, json, int, retryCount);
+        s2j_struct_get_basic_element(upload, json, int, chunkSize);
+        s2j_struct_get_basic_element(upload, json, int, previewWidth);
         s2j_struct_get_basic_element(upload, json, int, timedCount);
         s2j_struct_get_struct_array_element_by_func(upload, json, timedNode_t, timedNodes);
+        // seconds the upload and schedule jobs may move to share the wake of a capture
+        cJSON *wakeWindow = cJSON_GetObjectItem(json, "wakeWindow");
+        if (cJSON_IsNumber(wakeWindow) && wakeWindow->valueint >= 0) {
+            upload->wakeWindow = MIN(wakeWindow->valueint, WAKE_SCHED_WINDOW_MAX);
+        }
+        // seconds an instant upload may take before the framesize is lowered, 0 keeps the configured one
+        cJSON *uploadBudget = cJSON_GetObjectItem(json, "uploadBudget");
+        if (cJSON_IsNumber(uploadBudget) && uploadBudget->valueint >= 0) {
+            upload->uploadBudget = uploadBudget->valueint;
+        }
         http_send_json_response(req, RES_OK);
         cfg_set_upload_attr(upload);
         if (upload->uploadMode == 0) {
@@ -1491,6 +1553,739 @@ static esp_err_t delete_mqtt_key_handle(httpd_req_t *req)
 return ESP_OK;
 }
 
+/*------------------------------------------------------------------------*/
+/* Batched configuration: /api/v1/config returns or patches the whole configuration in one document */
+
+/**
+ * Trigger settings as the trigger group of the document has them
+ */
+typedef struct triggerCfg {
+    uint8_t trigger_mode;
+    uint8_t sens;
+    uint8_t blind;
+    uint8_t pulse;
+    uint8_t window;
+} triggerCfg_t;
+
+/**
+ * Whole device configuration, one member per group of the document
+ */
+typedef struct devConfig {
+    deviceInfo_t device;
+    imgAttr_t image;
+    lightAttr_t light;
+    capAttr_t capture;
+    triggerCfg_t trigger;
+    uploadAttr_t upload;
+    wifiAttr_t wifi;
+    platformParamAttr_t platform;
+    IoTAttr_t iot;
+    cellularParamAttr_t cellular;
+} devConfig_t;
+
+typedef enum {
+    CFG_FIELD_INT,      // signed integer
+    CFG_FIELD_UINT,     // unsigned integer
+    CFG_FIELD_STR,      // char array, min and max bound the length
+    CFG_FIELD_TIME,     // char array of HH:MM or HH:MM:SS
+    CFG_FIELD_OBJ,      // object of the fields in sub
+    CFG_FIELD_LIST,     // array of at most max objects of the fields in sub
+} cfgFieldType_e;
+
+/**
+ * Field of the document, at offset in the struct of its parent object
+ */
+typedef struct cfgField {
+    const char *name;
+    cfgFieldType_e type;
+    uint16_t offset;
+    uint16_t size;              // of the member, of one item for a list
+    int32_t min;
+    int32_t max;
+    bool readOnly;              // in the document, left as is by a PATCH
+    const struct cfgField *sub; // fields of an object or of the items of a list
+    uint8_t subCount;
+    uint16_t countOffset;       // of the uint8_t item count of a list, in its parent
+} cfgField_t;
+
+#define CFG_SIZEOF(st, m) sizeof(((st *)0)->m)
+#define CFG_COUNT(fields) (sizeof(fields) / sizeof(cfgField_t))
+#define CFG_NUM(t, st, m, lo, hi) \
+    { .name = #m, .type = t, .offset = offsetof(st, m), .size = CFG_SIZEOF(st, m), .min = lo, .max = hi }
+#define CFG_I(st, m, lo, hi) CFG_NUM(CFG_FIELD_INT, st, m, lo, hi)
+#define CFG_U(st, m, lo, hi) CFG_NUM(CFG_FIELD_UINT, st, m, lo, hi)
+#define CFG_S(st, m, lo) CFG_NUM(CFG_FIELD_STR, st, m, lo, CFG_SIZEOF(st, m) - 1)
+#define CFG_T(st, m) CFG_NUM(CFG_FIELD_TIME, st, m, 0, 0)
+#define CFG_RO(t, st, m) \
+    { .name = #m, .type = t, .offset = offsetof(st, m), .size = CFG_SIZEOF(st, m), .readOnly = true }
+#define CFG_RO_I(st, m) CFG_RO(CFG_FIELD_INT, st, m)
+#define CFG_RO_U(st, m) CFG_RO(CFG_FIELD_UINT, st, m)
+#define CFG_RO_S(st, m) CFG_RO(CFG_FIELD_STR, st, m)
+#define CFG_OBJ(n, st, m, fields) \
+    { .name = n, .type = CFG_FIELD_OBJ, .offset = offsetof(st, m), .size = CFG_SIZEOF(st, m), \
+      .sub = fields, .subCount = CFG_COUNT(fields) }
+#define CFG_LIST(st, m, count, fields) \
+    { .name = #m, .type = CFG_FIELD_LIST, .offset = offsetof(st, m), .size = CFG_SIZEOF(st, m[0]), \
+      .max = CFG_SIZEOF(st, m) / CFG_SIZEOF(st, m[0]), .sub = fields, .subCount = CFG_COUNT(fields), \
+      .countOffset = offsetof(st, count) }
+
+// Only the name and the country are set by the user, the rest is factory data
+static const cfgField_t g_deviceFields[] = {
+    CFG_S(deviceInfo_t, name, 1),
+    CFG_S(deviceInfo_t, countryCode, 2),
+    CFG_RO_S(deviceInfo_t, mac),
+    CFG_RO_S(deviceInfo_t, sn),
+    CFG_RO_S(deviceInfo_t, hardVersion),
+    CFG_RO_S(deviceInfo_t, softVersion),
+    CFG_RO_S(deviceInfo_t, model),
+    CFG_RO_S(deviceInfo_t, netmod),
+    CFG_RO_S(deviceInfo_t, camera),
+};
+
+// The fields not stored by cfg_set_image_attr are reported as setCamParam has them
+static const cfgField_t g_imageFields[] = {
+    CFG_I(imgAttr_t, brightness, -2, 2),
+    CFG_I(imgAttr_t, contrast, -2, 2),
+    CFG_I(imgAttr_t, saturation, -2, 2),
+    CFG_I(imgAttr_t, aeLevel, -2, 2),
+    CFG_U(imgAttr_t, bAgc, 0, 1),
+    CFG_U(imgAttr_t, gain, 0, 64),
+    CFG_U(imgAttr_t, gainCeiling, 0, 6),
+    CFG_U(imgAttr_t, bHorizonetal, 0, 1),
+    CFG_U(imgAttr_t, bVertical, 0, 1),
+    CFG_U(imgAttr_t, frameSize, 0, FRAMESIZE_INVALID - 1),
+    CFG_U(imgAttr_t, quality, 0, 63),
+    CFG_U(imgAttr_t, hdrEnable, 0, 1),
+    CFG_U(imgAttr_t, roiMode, 0, 2),
+    CFG_U(imgAttr_t, roiX, 0, 1000),
+    CFG_U(imgAttr_t, roiY, 0, 1000),
+    CFG_U(imgAttr_t, roiW, 0, 1000),
+    CFG_U(imgAttr_t, roiH, 0, 1000),
+    CFG_U(imgAttr_t, jpegBudget, 0, INT32_MAX),
+    CFG_RO_I(imgAttr_t, sharpness),
+    CFG_RO_U(imgAttr_t, denoise),
+    CFG_RO_U(imgAttr_t, specialEffect),
+    CFG_RO_U(imgAttr_t, bAwb),
+    CFG_RO_U(imgAttr_t, bAwbGain),
+    CFG_RO_U(imgAttr_t, wbMode),
+    CFG_RO_U(imgAttr_t, bAec),
+    CFG_RO_U(imgAttr_t, bAec2),
+    CFG_RO_U(imgAttr_t, aecValue),
+    CFG_RO_U(imgAttr_t, bBpc),
+    CFG_RO_U(imgAttr_t, bWpc),
+    CFG_RO_U(imgAttr_t, bRawGma),
+    CFG_RO_U(imgAttr_t, bLenc),
+    CFG_RO_U(imgAttr_t, bDcw),
+    CFG_RO_U(imgAttr_t, bColorbar),
+};
+
+static const cfgField_t g_lightFields[] = {
+    CFG_U(lightAttr_t, lightMode, 0, 3),
+    CFG_U(lightAttr_t, threshold, 0, 100),
+    CFG_U(lightAttr_t, duty, 0, 100),
+    CFG_T(lightAttr_t, startTime),
+    CFG_T(lightAttr_t, endTime),
+    CFG_RO_U(lightAttr_t, value),
+};
+
+static const cfgField_t g_timedNodeFields[] = {
+    CFG_U(timedNode_t, day, 0, 7),
+    CFG_T(timedNode_t, time),
+};
+
+static const cfgField_t g_captureFields[] = {
+    CFG_U(capAttr_t, bScheCap, 0, 1),
+    CFG_U(capAttr_t, bAlarmInCap, 0, 1),
+    CFG_U(capAttr_t, bButtonCap, 0, 1),
+    CFG_U(capAttr_t, scheCapMode, 0, 1),
+    CFG_U(capAttr_t, intervalValue, 0, INT32_MAX),
+    CFG_U(capAttr_t, intervalUnit, 0, 2),
+    CFG_U(capAttr_t, camWarmupMs, 0, INT32_MAX),
+    CFG_U(capAttr_t, burstCount, 1, 8),
+    CFG_U(capAttr_t, timedCount, 0, CFG_SIZEOF(capAttr_t, timedNodes) / sizeof(timedNode_t)),
+    CFG_LIST(capAttr_t, timedNodes, timedCount, g_timedNodeFields),
+};
+
+static const cfgField_t g_triggerFields[] = {
+    CFG_U(triggerCfg_t, trigger_mode, TRIGGER_MODE_DISABLED, TRIGGER_MODE_PIR),
+    CFG_U(triggerCfg_t, sens, 0, 255),
+    CFG_U(triggerCfg_t, blind, 0, 15),
+    CFG_U(triggerCfg_t, pulse, 0, 3),
+    CFG_U(triggerCfg_t, window, 0, 3),
+};
+
+static const cfgField_t g_uploadFields[] = {
+    CFG_U(uploadAttr_t, uploadMode, 0, 1),
+    CFG_U(uploadAttr_t, retryCount, 0, UINT8_MAX),
+    CFG_U(uploadAttr_t, chunkSize, 0, INT32_MAX),
+    CFG_U(uploadAttr_t, previewWidth, 0, INT32_MAX),
+    CFG_U(uploadAttr_t, uploadBudget, 0, INT32_MAX),
+    CFG_U(uploadAttr_t, wakeWindow, 0, WAKE_SCHED_WINDOW_MAX),
+    CFG_U(uploadAttr_t, timedCount, 0, CFG_SIZEOF(uploadAttr_t, timedNodes) / sizeof(timedNode_t)),
+    CFG_LIST(uploadAttr_t, timedNodes, timedCount, g_timedNodeFields),
+};
+
+static const cfgField_t g_wifiFields[] = {
+    CFG_S(wifiAttr_t, ssid, 0),
+    CFG_S(wifiAttr_t, password, 0),
+    CFG_RO_U(wifiAttr_t, isConnected),
+};
+
+static const cfgField_t g_sensingFields[] = {
+    CFG_RO_U(sensingPlatformAttr_t, platformType),
+    CFG_RO_S(sensingPlatformAttr_t, platformName),
+    CFG_S(sensingPlatformAttr_t, host, 0),
+    CFG_U(sensingPlatformAttr_t, mqttPort, 0, UINT16_MAX),
+    CFG_U(sensingPlatformAttr_t, httpPort, 0, UINT16_MAX),
+};
+
+static const cfgField_t g_mqttPlatformFields[] = {
+    CFG_RO_U(mqttPlatformAttr_t, platformType),
+    CFG_RO_S(mqttPlatformAttr_t, platformName),
+    CFG_S(mqttPlatformAttr_t, host, 0),
+    CFG_U(mqttPlatformAttr_t, mqttPort, 0, UINT16_MAX),
+    CFG_S(mqttPlatformAttr_t, topic, 0),
+    CFG_S(mqttPlatformAttr_t, clientId, 0),
+    CFG_U(mqttPlatformAttr_t, qos, 0, 2),
+    CFG_S(mqttPlatformAttr_t, username, 0),
+    CFG_S(mqttPlatformAttr_t, password, 0),
+    CFG_RO_U(mqttPlatformAttr_t, isConnected),
+    CFG_U(mqttPlatformAttr_t, tlsEnable, 0, 1),
+    CFG_S(mqttPlatformAttr_t, caName, 0),
+    CFG_S(mqttPlatformAttr_t, certName, 0),
+    CFG_S(mqttPlatformAttr_t, keyName, 0),
+};
+
+// As setPlatformParam, only the group of the current platform is stored
+static const cfgField_t g_platformFields[] = {
+    CFG_U(platformParamAttr_t, currentPlatformType, 0, PLATFORM_TYPE_MAX - 1),
+    CFG_OBJ("sensingParam", platformParamAttr_t, sensingPlatform, g_sensingFields),
+    CFG_OBJ("mqttParam", platformParamAttr_t, mqttPlatform, g_mqttPlatformFields),
+};
+
+static const cfgField_t g_iotFields[] = {
+    CFG_U(IoTAttr_t, autop_enable, 0, 1),
+    CFG_U(IoTAttr_t, dm_enable, 0, 1),
+};
+
+static const cfgField_t g_cellularFields[] = {
+    CFG_RO_S(cellularParamAttr_t, imei),
+    CFG_S(cellularParamAttr_t, apn, 0),
+    CFG_S(cellularParamAttr_t, user, 0),
+    CFG_S(cellularParamAttr_t, password, 0),
+    CFG_S(cellularParamAttr_t, pin, 0),
+    CFG_U(cellularParamAttr_t, authentication, CELLULAR_AUTH_TYPE_NONE, CELLULAR_AUTH_TYPE_MAX - 1),
+};
+
+// The groups, in the order of devConfig_t
+typedef enum {
+    CFG_GROUP_DEVICE,
+    CFG_GROUP_IMAGE,
+    CFG_GROUP_LIGHT,
+    CFG_GROUP_CAPTURE,
+    CFG_GROUP_TRIGGER,
+    CFG_GROUP_UPLOAD,
+    CFG_GROUP_WIFI,
+    CFG_GROUP_PLATFORM,
+    CFG_GROUP_IOT,
+    CFG_GROUP_CELLULAR,
+} cfgGroup_e;
+
+static const cfgField_t g_configFields[] = {
+    [CFG_GROUP_DEVICE] = CFG_OBJ("device", devConfig_t, device, g_deviceFields),
+    [CFG_GROUP_IMAGE] = CFG_OBJ("image", devConfig_t, image, g_imageFields),
+    [CFG_GROUP_LIGHT] = CFG_OBJ("light", devConfig_t, light, g_lightFields),
+    [CFG_GROUP_CAPTURE] = CFG_OBJ("capture", devConfig_t, capture, g_captureFields),
+    [CFG_GROUP_TRIGGER] = CFG_OBJ("trigger", devConfig_t, trigger, g_triggerFields),
+    [CFG_GROUP_UPLOAD] = CFG_OBJ("upload", devConfig_t, upload, g_uploadFields),
+    [CFG_GROUP_WIFI] = CFG_OBJ("wifi", devConfig_t, wifi, g_wifiFields),
+    [CFG_GROUP_PLATFORM] = CFG_OBJ("platform", devConfig_t, platform, g_platformFields),
+    [CFG_GROUP_IOT] = CFG_OBJ("iot", devConfig_t, iot, g_iotFields),
+    [CFG_GROUP_CELLULAR] = CFG_OBJ("cellular", devConfig_t, cellular, g_cellularFields),
+};
+
+#define CFG_GROUP_BIT(group) (1U << (group))
+
+/**
+ * Read the whole configuration under one hold of the config lock
+ * @param cfg Configuration read
+ */
+static void config_read(devConfig_t *cfg)
+{
+    pirAttr_t pir;
+
+    memset(cfg, 0, sizeof(devConfig_t));
+    cfg_batch_begin();
+    cfg_get_device_info(&cfg->device);
+    cfg_get_image_attr(&cfg->image);
+    cfg_get_light_attr(&cfg->light);
+    cfg_get_cap_attr(&cfg->capture);
+    cfg_get_trigger_mode(&cfg->trigger.trigger_mode);
+    cfg_get_pir_attr(&pir);
+    cfg_get_upload_attr(&cfg->upload);
+    cfg_get_wifi_attr(&cfg->wifi);
+    cfg_get_platform_param_attr(&cfg->platform);
+    cfg_get_iot_attr(&cfg->iot);
+    cfg_get_cellular_param_attr(&cfg->cellular);
+    cfg_batch_end();
+
+    cfg->trigger.sens = pir.sens;
+    cfg->trigger.blind = pir.blind;
+    cfg->trigger.pulse = pir.pulse;
+    cfg->trigger.window = pir.window;
+    cfg->light.value = misc_get_light_value_rate();
+    cfg->wifi.isConnected = wifi_sta_is_connected();
+    cfg->platform.mqttPlatform.isConnected = mqtt_mip_is_connected();
+}
+
+/**
+ * Write the given groups of the configuration in one batch
+ * @param cfg Configuration
+ * @param groups CFG_GROUP_BIT of the groups to write
+ * @return ESP_OK if all writes and the commit succeeded
+ */
+static esp_err_t config_write(devConfig_t *cfg, uint32_t groups)
+{
+    cfg_batch_begin();
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_DEVICE)) {
+        cfg_set_str(KEY_DEVICE_NAME, cfg->device.name);
+        cfg_set_str(KEY_DEVICE_COUNTRY, cfg->device.countryCode);
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_IMAGE)) {
+        cfg_set_image_attr(&cfg->image);
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_LIGHT)) {
+        cfg_set_light_attr(&cfg->light);
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_CAPTURE)) {
+        cfg_set_cap_attr(&cfg->capture);
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_TRIGGER)) {
+        pirAttr_t pir = {
+            .sens = cfg->trigger.sens, .blind = cfg->trigger.blind,
+            .pulse = cfg->trigger.pulse, .window = cfg->trigger.window,
+        };
+        cfg_set_trigger_mode(cfg->trigger.trigger_mode);
+        cfg_set_pir_attr(&pir);
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_UPLOAD)) {
+        cfg_set_upload_attr(&cfg->upload);
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_WIFI)) {
+        cfg_set_wifi_attr(&cfg->wifi);
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_PLATFORM)) {
+        cfg_set_platform_param_attr(&cfg->platform);
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_IOT)) {
+        cfg_set_iot_attr(&cfg->iot);
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_CELLULAR)) {
+        cfg_set_cellular_param_attr(&cfg->cellular);
+    }
+    return cfg_batch_end();
+}
+
+static int32_t config_load_int(const uint8_t *p, const cfgField_t *field)
+{
+    switch (field->size) {
+        case 1: return field->type == CFG_FIELD_INT ? *(int8_t *)p : *(uint8_t *)p;
+        case 2: return field->type == CFG_FIELD_INT ? *(int16_t *)p : *(uint16_t *)p;
+        default: return *(int32_t *)p;
+    }
+}
+
+static void config_store_int(uint8_t *p, const cfgField_t *field, int32_t value)
+{
+    switch (field->size) {
+        case 1: *(uint8_t *)p = (uint8_t)value; break;
+        case 2: *(uint16_t *)p = (uint16_t)value; break;
+        default: *(uint32_t *)p = (uint32_t)value; break;
+    }
+}
+
+/**
+ * Whether a string is a time of day, HH:MM or HH:MM:SS
+ */
+static bool config_is_time(const char *str)
+{
+    size_t len = strlen(str);
+    if (len != 5 && len != 8) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (i % 3 == 2 ? str[i] != ':' : !isdigit((unsigned char)str[i])) {
+            return false;
+        }
+    }
+    return atoi(str) < 24 && atoi(str + 3) < 60 && (len == 5 || atoi(str + 6) < 60);
+}
+
+/**
+ * Add an object of fields to a JSON object
+ * @param json JSON object
+ * @param fields Fields
+ * @param count Number of fields
+ * @param base Struct the field offsets are in
+ */
+static void config_to_json(cJSON *json, const cfgField_t *fields, size_t count, const uint8_t *base)
+{
+    for (size_t i = 0; i < count; i++) {
+        const cfgField_t *field = &fields[i];
+        const uint8_t *p = base + field->offset;
+        switch (field->type) {
+            case CFG_FIELD_INT:
+            case CFG_FIELD_UINT:
+                if (field->size == 4 && field->type == CFG_FIELD_UINT) {
+                    cJSON_AddNumberToObject(json, field->name, *(uint32_t *)p);
+                } else {
+                    cJSON_AddNumberToObject(json, field->name, config_load_int(p, field));
+                }
+                break;
+            case CFG_FIELD_STR:
+            case CFG_FIELD_TIME:
+                cJSON_AddStringToObject(json, field->name, (const char *)p);
+                break;
+            case CFG_FIELD_OBJ:
+                config_to_json(cJSON_AddObjectToObject(json, field->name), field->sub, field->subCount, p);
+                break;
+            case CFG_FIELD_LIST: {
+                cJSON *list = cJSON_AddArrayToObject(json, field->name);
+                uint8_t n = MIN(base[field->countOffset], field->max);
+                for (uint8_t k = 0; k < n; k++) {
+                    cJSON *item = cJSON_CreateObject();
+                    config_to_json(item, field->sub, field->subCount, p + k * field->size);
+                    cJSON_AddItemToArray(list, item);
+                }
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Find the field of a JSON member
+ */
+static const cfgField_t *config_find(const cfgField_t *fields, size_t count, const char *name)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(fields[i].name, name) == 0) {
+            return &fields[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Check a JSON object against its fields before anything is applied
+ * @param json JSON object
+ * @param fields Fields
+ * @param count Number of fields
+ * @param path Path of json, e.g. "capture.timedNodes[1]", replaced by the path of the bad member
+ * @param size Size of path
+ * @return true if every member is a known field of the right type and in range
+ */
+static bool config_check(const cJSON *json, const cfgField_t *fields, size_t count, char *path, size_t size)
+{
+    size_t len = strlen(path);
+    const cJSON *item;
+
+    if (!cJSON_IsObject(json)) {
+        return false;
+    }
+    cJSON_ArrayForEach(item, json) {
+        const cfgField_t *field = config_find(fields, count, item->string);
+        snprintf(path + len, size - len, "%s%s", len ? "." : "", item->string);
+        if (field == NULL) {
+            return false;
+        }
+        if (field->readOnly) {
+            continue;
+        }
+        switch (field->type) {
+            case CFG_FIELD_INT:
+            case CFG_FIELD_UINT:
+                if (!cJSON_IsNumber(item) || item->valuedouble != (double)(int64_t)item->valuedouble ||
+                        item->valuedouble < field->min || item->valuedouble > field->max) {
+                    return false;
+                }
+                break;
+            case CFG_FIELD_STR:
+                if (!cJSON_IsString(item) || (int32_t)strlen(item->valuestring) < field->min ||
+                        (int32_t)strlen(item->valuestring) > field->max) {
+                    return false;
+                }
+                break;
+            case CFG_FIELD_TIME:
+                if (!cJSON_IsString(item) || strlen(item->valuestring) >= field->size ||
+                        !config_is_time(item->valuestring)) {
+                    return false;
+                }
+                break;
+            case CFG_FIELD_OBJ:
+                if (!config_check(item, field->sub, field->subCount, path, size)) {
+                    return false;
+                }
+                break;
+            case CFG_FIELD_LIST: {
+                // the count of a list given with it is its length
+                const cJSON *n = NULL;
+                for (size_t i = 0; i < count; i++) {
+                    if (fields[i].type != CFG_FIELD_LIST && fields[i].offset == field->countOffset) {
+                        n = cJSON_GetObjectItem(json, fields[i].name);
+                    }
+                }
+                if (!cJSON_IsArray(item) || cJSON_GetArraySize(item) > field->max ||
+                        (n && cJSON_IsNumber(n) && n->valueint != cJSON_GetArraySize(item))) {
+                    return false;
+                }
+                size_t at = strlen(path);
+                for (int k = 0; k < cJSON_GetArraySize(item); k++) {
+                    snprintf(path + at, size - at, "[%d]", k);
+                    if (!config_check(cJSON_GetArrayItem(item, k), field->sub, field->subCount, path, size)) {
+                        return false;
+                    }
+                }
+                break;
+            }
+        }
+    }
+    path[len] = '\0';
+    return true;
+}
+
+/**
+ * Set the fields a checked JSON object has, the others keep their value
+ * @param json JSON object passed by config_check
+ * @param fields Fields
+ * @param count Number of fields
+ * @param base Struct the field offsets are in
+ */
+static void config_from_json(const cJSON *json, const cfgField_t *fields, size_t count, uint8_t *base)
+{
+    const cJSON *item;
+
+    cJSON_ArrayForEach(item, json) {
+        const cfgField_t *field = config_find(fields, count, item->string);
+        uint8_t *p = base + field->offset;
+        if (field->readOnly) {
+            continue;
+        }
+        switch (field->type) {
+            case CFG_FIELD_INT:
+            case CFG_FIELD_UINT:
+                config_store_int(p, field, (int32_t)item->valuedouble);
+                break;
+            case CFG_FIELD_STR:
+            case CFG_FIELD_TIME:
+                memset(p, 0, field->size);
+                strncpy((char *)p, item->valuestring, field->size - 1);
+                break;
+            case CFG_FIELD_OBJ:
+                config_from_json(item, field->sub, field->subCount, p);
+                break;
+            case CFG_FIELD_LIST: {
+                int n = cJSON_GetArraySize(item);
+                memset(p, 0, field->size * field->max);
+                for (int k = 0; k < n; k++) {
+                    config_from_json(cJSON_GetArrayItem(item, k), field->sub, field->subCount, p + k * field->size);
+                }
+                base[field->countOffset] = n;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Send the result of a PATCH, with the path of the field it failed on
+ */
+static void config_send_result(httpd_req_t *req, httpResult_e result, const char *field)
+{
+    s2j_create_json_obj(json_obj);
+    httpd_resp_set_type(req, "application/json");
+    cJSON_AddNumberToObject(json_obj, "result", result);
+    if (field && field[0] != '\0') {
+        cJSON_AddStringToObject(json_obj, "field", field);
+    }
+    char *str = cJSON_PrintUnformatted(json_obj);
+    httpd_resp_sendstr(req, str);
+    cJSON_free(str);
+    s2j_delete_json_obj(json_obj);
+}
+
+static esp_err_t get_config_handle(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "%s", req->uri);
+    clear_timeout();
+
+    devConfig_t *cfg = malloc(sizeof(devConfig_t));
+    if (cfg == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    config_read(cfg);
+    s2j_create_json_obj(json_obj);
+    config_to_json(json_obj, g_configFields, CFG_COUNT(g_configFields), (uint8_t *)cfg);
+    free(cfg);
+
+    httpd_resp_set_type(req, "application/json");
+    char *str = cJSON_PrintUnformatted(json_obj);
+    httpd_resp_sendstr(req, str);
+    cJSON_free(str);
+    s2j_delete_json_obj(json_obj);
+    return ESP_OK;
+}
+
+/**
+ * Put back the camera and the light of the given groups
+ */
+static void config_undo(devConfig_t *old, uint32_t groups)
+{
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_IMAGE)) {
+        camera_set_image(&old->image);
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_LIGHT)) {
+        camera_flash_led_ctrl(&old->light);
+    }
+}
+
+/**
+ * Apply to the hardware the groups their own set handlers apply at once, after they are
+ * stored and outside the config lock, and undo them if one is refused
+ * @return RES_OK, or the result to send with the group refused in field
+ */
+static httpResult_e config_try(devConfig_t *old, devConfig_t *cfg, uint32_t groups, const char **field)
+{
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_IMAGE)) {
+        if (camera_set_image(&cfg->image) != ESP_OK) {
+            *field = "image";
+            return RES_FAIL;
+        }
+    }
+    if ((groups & CFG_GROUP_BIT(CFG_GROUP_LIGHT)) && camera_flash_led_ctrl(&cfg->light) != ESP_OK) {
+        config_undo(old, groups & CFG_GROUP_BIT(CFG_GROUP_IMAGE));
+        *field = "light";
+        return RES_FAIL;
+    }
+    if ((groups & CFG_GROUP_BIT(CFG_GROUP_WIFI)) && wifi_sta_reconnect(cfg->wifi.ssid, cfg->wifi.password) != ESP_OK) {
+        config_undo(old, groups);
+        *field = "wifi";
+        return RES_WIFI_DISCONNECTED;
+    }
+    return RES_OK;
+}
+
+/**
+ * Start the services whose configuration changed, once it is stored
+ */
+static void config_apply(devConfig_t *old, devConfig_t *cfg, uint32_t groups)
+{
+    bool restart_mqtt = false;
+
+    if ((groups & CFG_GROUP_BIT(CFG_GROUP_DEVICE)) && netModule_is_mmwifi()) {
+        mm_wifi_set_country_code(cfg->device.countryCode);
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_LIGHT)) {
+        misc_set_flash_duty(cfg->light.duty);
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_CAPTURE)) {
+        sleep_set_last_capture_time(time(NULL));
+    }
+    if ((groups & CFG_GROUP_BIT(CFG_GROUP_TRIGGER)) && cfg->trigger.trigger_mode == TRIGGER_MODE_PIR) {
+        pir_update_config();
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_UPLOAD)) {
+        if (cfg->upload.uploadMode == 0) {
+            storage_upload_start();
+        } else {
+            storage_upload_stop();
+        }
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_PLATFORM)) {
+        restart_mqtt = wifi_sta_is_connected() || netModule_is_cat1();
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_IOT)) {
+        if (old->iot.autop_enable != cfg->iot.autop_enable) {
+            iot_mip_autop_enable(cfg->iot.autop_enable);
+        }
+        if (old->iot.dm_enable != cfg->iot.dm_enable) {
+            mqtt_stop();
+            iot_mip_dm_enable(cfg->iot.dm_enable);
+            mqtt_start();
+            restart_mqtt = false;
+        }
+    }
+    if (restart_mqtt) {
+        mqtt_restart();
+    }
+    if (groups & CFG_GROUP_BIT(CFG_GROUP_CELLULAR)) {
+        cat1_restart();
+    }
+}
+
+/**
+ * PATCH of the configuration. The document has any of the groups of the GET, each with any
+ * of its fields. The whole document is checked first, and only the groups that change are
+ * written in one batch. The hardware is changed only once the batch is committed, and a
+ * refused change puts the stored groups back, so a bad field leaves the device as it was
+ */
+static esp_err_t set_config_handle(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "%s", req->uri);
+    clear_timeout();
+
+    char *content = http_get_content_from_req(req);
+    if (content == NULL) {
+        return ESP_FAIL;
+    }
+    char path[64] = "";
+    const char *field = NULL;
+    httpResult_e res = RES_OK;
+    uint32_t groups = 0;
+    cJSON *json = cJSON_Parse(content);
+    devConfig_t *old = malloc(2 * sizeof(devConfig_t));
+    devConfig_t *cfg = old + 1;
+
+    if (old == NULL) {
+        res = RES_FAIL;
+    } else if (!config_check(json, g_configFields, CFG_COUNT(g_configFields), path, sizeof(path))) {
+        ESP_LOGW(TAG, "invalid config field \"%s\"", path);
+        res = RES_INVALID_PARAM;
+        field = path;
+    } else {
+        config_read(old);
+        memcpy(cfg, old, sizeof(devConfig_t));
+        config_from_json(json, g_configFields, CFG_COUNT(g_configFields), (uint8_t *)cfg);
+        for (size_t i = 0; i < CFG_COUNT(g_configFields); i++) {
+            const cfgField_t *group = &g_configFields[i];
+            if (memcmp((uint8_t *)old + group->offset, (uint8_t *)cfg + group->offset, group->size) != 0) {
+                groups |= CFG_GROUP_BIT(i);
+            }
+        }
+        ESP_LOGI(TAG, "config groups changed 0x%03" PRIx32, groups);
+        if ((groups & CFG_GROUP_BIT(CFG_GROUP_IMAGE)) && cfg->image.frameSize < FRAMESIZE_INVALID) {
+            camera_apply_jpeg_quality_limit((framesize_t)cfg->image.frameSize, &cfg->image.quality);
+        }
+        if (groups && config_write(cfg, groups) != ESP_OK) {
+            // NVS writes take effect one by one, put back the groups some were written to
+            ESP_LOGE(TAG, "config write failed, restoring");
+            config_write(old, groups);
+            res = RES_FAIL;
+        } else if ((res = config_try(old, cfg, groups, &field)) != RES_OK) {
+            config_write(old, groups);
+        }
+    }
+    config_send_result(req, res, field);
+    if (res == RES_OK) {
+        config_apply(old, cfg, groups);
+    }
+    free(old);
+    cJSON_Delete(json);
+    http_free_content(content);
+    return ESP_OK;
+}
+
 /**
  * MJPEG stream handler
  * @param req HTTP request handle
@@ -1744,6 +2539,17 @@ static const httpd_uri_t g_webHandlers[] = {
         .method = HTTP_GET,
         .handler = get_dev_ntp_sync_handle,
     },
+    // whole configuration in one document
+    {
+        .uri = "/api/v1/config",
+        .method = HTTP_GET,
+        .handler = get_config_handle,
+    },
+    {
+        .uri = "/api/v1/config",
+        .method = HTTP_PATCH,
+        .handler = set_config_handle,
+    },
     // certificate upload (three static paths, directly write to LittleFS)
     {
         .uri = "/api/v1/network/uploadMqttCa",
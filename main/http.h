@@ -14,6 +14,7 @@ typedef enum httpResult {
     RES_WIFI_CONNECTED = 1001,  ///< WiFi connected event
     RES_WIFI_DISCONNECTED = 1002, ///< WiFi disconnected event
     RES_OTA_FAILED = 1003,      ///< OTA update failed
+    RES_INVALID_PARAM = 1004,   ///< A field is unknown, of the wrong type or out of range
 } httpResult_e;
 
 /**
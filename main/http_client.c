@@ -3,6 +3,8 @@
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_http_client.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
 #include "config.h"
 #include "system.h"
 #include "ota.h"
@@ -11,8 +13,14 @@
 #include "http_client.h"
 #include "esp_crt_bundle.h"
 #include "esp_rom_crc.h"
+#include "dns_cache.h"
+#include "link_est.h"
+#include "delta_patch.h"
+#include "fw_download.h"
 
 #define MAX_HTTP_RECV_BUFFER 4096
+#define OTA_CHUNK_SIZE 4096        // Firmware bytes written to flash at a time
+#define OTA_DOWNLOAD_ATTEMPTS 3    // Connections per wake, each one resuming where the last one dropped
 
 #define TAG "-->HTTP_CLIENT"
 
@@ -22,6 +30,33 @@ typedef struct user_data {
     uint32_t remain;
 } user_data_t;
 
+/**
+ * Firmware download in progress, preserved in RTC memory so that a later wake resumes it
+ */
+static RTC_DATA_ATTR fwDownloadProgress_t g_otaProgress = {0};
+
+/**
+ * Connection and writer of a firmware download, the ctx of fw_download_run()
+ */
+typedef struct fwDownloadCtx {
+    const char *url;
+    esp_http_client_handle_t client;
+    otaHandle_t handle;
+    bool started;
+    uint32_t written;    // Bytes written by this connection
+} fwDownloadCtx_t;
+
+/**
+ * Delta update being applied, the patch turns the running image into the new one
+ */
+typedef struct deltaUpdate {
+    const esp_partition_t *running;
+    deltaPatch_t *patch;
+    uint32_t checksum;   // CRC32 of the new image, as announced by the server
+    otaHandle_t handle;
+    bool started;
+} deltaUpdate_t;
+
 static esp_err_t event_handle(esp_http_client_event_t *evt)
 {
     user_data_t *user_data = (user_data_t *)evt->user_data;
@@ -83,6 +118,8 @@ static esp_err_t http_client_post(char *url, char *data, char *header)
         ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %lld",
                  esp_http_client_get_status_code(client),
                  esp_http_client_get_content_length(client));
+    } else {
+        dns_cache_invalidate(url);
     }
     esp_http_client_cleanup(client);
     return err;
@@ -111,20 +148,13 @@ static int http_client_get(char *url, char *data, uint32_t len)
         ESP_LOGE(TAG, "http_client_init failed");
         return 0;
     }
-    esp_http_client_perform(client);
+    if (esp_http_client_perform(client) != ESP_OK) {
+        dns_cache_invalidate(url);
+    }
     esp_http_client_cleanup(client);
     return user_data.len;
 }
 
-static esp_err_t get_ota_data(char *url, char *data, uint32_t *len)
-{
-    *len = http_client_get(url, data, OTA_BIN_MAX_SIZE);
-    if (*len > 0) {
-        return ESP_OK;
-    }
-    return ESP_FAIL;
-}
-
 static esp_err_t get_ota_package(char *url, OTApackage_t *package)
 {
     char content[256] = {0};
@@ -134,6 +164,7 @@ static esp_err_t get_ota_package(char *url, OTApackage_t *package)
         cJSON *json = cJSON_Parse(content);
         s2j_struct_get_basic_element(package, json, string, fwTitle);
         s2j_struct_get_basic_element(package, json, string, fwChecksum);
+        s2j_struct_get_basic_element(package, json, string, fwDelta);
         s2j_struct_get_basic_element(package, json, string, cfTitle);
         s2j_struct_get_basic_element(package, json, string, cfChecksum);
         s2j_delete_json_obj(json);
@@ -170,10 +201,268 @@ static esp_err_t post_ota_package(char *url, OTApackage_t *package)
     return ESP_FAIL;
 }
 
-static esp_err_t update_firmware(char *url, char *title, char *crc)
+static int fw_open(void *ctx, uint32_t offset, int *status, int64_t *length)
+{
+    fwDownloadCtx_t *dl = (fwDownloadCtx_t *)ctx;
+
+    if (offset) {
+        char range[32];
+        snprintf(range, sizeof(range), "bytes=%lu-", offset);
+        esp_http_client_set_header(dl->client, "Range", range);
+    }
+    if (esp_http_client_open(dl->client, 0) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection to %s", dl->url);
+        dns_cache_invalidate(dl->url);
+        return -1;
+    }
+    *length = esp_http_client_fetch_headers(dl->client);
+    *status = esp_http_client_get_status_code(dl->client);
+    ESP_LOGI(TAG, "firmware download from %lu: status %d, length %lld", offset, *status, *length);
+    return 0;
+}
+
+static int fw_read(void *ctx, uint8_t *buf, size_t len)
+{
+    fwDownloadCtx_t *dl = (fwDownloadCtx_t *)ctx;
+    return esp_http_client_read(dl->client, (char *)buf, len);
+}
+
+static int fw_start(void *ctx, const uint8_t *head, size_t len, uint32_t total)
+{
+    fwDownloadCtx_t *dl = (fwDownloadCtx_t *)ctx;
+
+    if (ota_vertify((char *)head, len, total) != ESP_OK || ota_start(&dl->handle, total) != ESP_OK) {
+        return -1;
+    }
+    dl->started = true;
+    return 0;
+}
+
+static int fw_resume(void *ctx, uint32_t offset)
+{
+    fwDownloadCtx_t *dl = (fwDownloadCtx_t *)ctx;
+
+    if (ota_resume(&dl->handle, offset) != ESP_OK) {
+        return -1;
+    }
+    dl->started = true;
+    return 0;
+}
+
+static int fw_write(void *ctx, const uint8_t *chunk, size_t len)
+{
+    fwDownloadCtx_t *dl = (fwDownloadCtx_t *)ctx;
+
+    if (ota_run(&dl->handle, (void *)chunk, len) != ESP_OK) {
+        dl->started = false;    // aborted
+        return -1;
+    }
+    dl->written += len;
+    return 0;
+}
+
+static uint32_t fw_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    return esp_rom_crc32_le(crc, buf, len);
+}
+
+/**
+ * Stream the firmware into the update partition in OTA_CHUNK_SIZE writes with a running CRC32.
+ * A download cut by the link goes on from the last chunk written, with a Range request
+ * @param url Firmware URL
+ * @param checksum CRC32 of the whole image
+ * @param buff OTA_CHUNK_SIZE bytes
+ * @return ESP_OK when the image is written, checked and set to boot, ESP_ERR_TIMEOUT if the
+ * connection dropped (the progress is kept), another error if the download restarts from zero
+ */
+static esp_err_t download_firmware(char *url, uint32_t checksum, char *buff)
+{
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    fwDownloadCtx_t ctx = {
+        .url = url,
+    };
+    esp_err_t err;
+
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "no update partition");
+        return ESP_FAIL;
+    }
+    esp_http_client_config_t config = {
+        .method = HTTP_METHOD_GET,
+        .url = replace_space(url, '+'),
+        .timeout_ms = 20000,
+        .buffer_size = 1024,
+    };
+    if (strncasecmp(url, "https", 5) == 0) {
+        config.crt_bundle_attach = esp_crt_bundle_attach;
+    }
+    ctx.client = esp_http_client_init(&config);
+    if (ctx.client == NULL) {
+        ESP_LOGE(TAG, "http_client_init failed");
+        return ESP_FAIL;
+    }
+    const fwDownload_t dl = {
+        .checksum = checksum,
+        .partition = partition->address,
+        .max_size = partition->size,
+        .buf = (uint8_t *)buff,
+        .chunk_size = OTA_CHUNK_SIZE,
+        .ctx = &ctx,
+        .open = fw_open,
+        .read = fw_read,
+        .start = fw_start,
+        .resume = fw_resume,
+        .write = fw_write,
+        .crc32 = fw_crc32,
+    };
+    int64_t start = esp_timer_get_time();
+    int ret = fw_download_run(&dl, &g_otaProgress);
+    esp_http_client_cleanup(ctx.client);
+    if (ctx.written > 0) {
+        link_est_add_transfer(ctx.written, (esp_timer_get_time() - start) / 1000);
+    }
+
+    switch (ret) {
+        case FW_DL_OK:
+            ESP_LOGI(TAG, "ota_len = %ld", g_otaProgress.total);
+            err = ota_stop(&ctx.handle);
+            memset(&g_otaProgress, 0, sizeof(g_otaProgress));
+            return err;
+        case FW_DL_ERR_DROPPED:
+            ESP_LOGW(TAG, "firmware download dropped at %lu/%lu", g_otaProgress.offset, g_otaProgress.total);
+            err = ESP_ERR_TIMEOUT;
+            break;
+        case FW_DL_ERR_CRC:
+            ESP_LOGE(TAG, "firmware crc32 does not match %lx", checksum);
+            err = ESP_ERR_INVALID_CRC;
+            break;
+        default:
+            ESP_LOGE(TAG, "firmware download failed with %d", ret);
+            err = ESP_FAIL;
+            break;
+    }
+    if (ctx.started) {
+        ota_abort(&ctx.handle);
+    }
+    return err;
+}
+
+static int delta_read_old(void *ctx, uint32_t offset, uint8_t *buf, size_t len)
+{
+    deltaUpdate_t *delta = (deltaUpdate_t *)ctx;
+    return esp_partition_read(delta->running, offset, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int delta_write_new(void *ctx, const uint8_t *data, size_t len)
+{
+    deltaUpdate_t *delta = (deltaUpdate_t *)ctx;
+    if (!delta->started) {
+        // the first bytes of the new image hold its header
+        const deltaHeader_t *header = delta_patch_header(delta->patch);
+        if (header->new_crc != delta->checksum) {
+            ESP_LOGE(TAG, "patch makes firmware %lx, not %lx", header->new_crc, delta->checksum);
+            return -1;
+        }
+        if (ota_vertify((char *)data, len, header->new_size) != ESP_OK || ota_start(&delta->handle, header->new_size) != ESP_OK) {
+            return -1;
+        }
+        delta->started = true;
+    }
+    if (ota_run(&delta->handle, (void *)data, len) != ESP_OK) {
+        delta->started = false;     // aborted
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stream a patch from the running firmware and write the new image it makes to the update partition.
+ * The running partition is checked against the patch before anything is written, the new image
+ * against its CRC32 before it is set to boot
+ * @param url Patch URL
+ * @param checksum CRC32 of the new image
+ * @param buff OTA_CHUNK_SIZE bytes
+ * @return ESP_OK when the image is written, checked and set to boot
+ */
+static esp_err_t download_delta(char *url, uint32_t checksum, char *buff)
+{
+    deltaUpdate_t delta = {
+        .running = esp_ota_get_running_partition(),
+        .checksum = checksum,
+    };
+    esp_err_t err = ESP_OK;
+
+    esp_http_client_config_t config = {
+        .method = HTTP_METHOD_GET,
+        .url = replace_space(url, '+'),
+        .timeout_ms = 20000,
+        .buffer_size = 1024,
+    };
+    if (strncasecmp(url, "https", 5) == 0) {
+        config.crt_bundle_attach = esp_crt_bundle_attach;
+    }
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL) {
+        ESP_LOGE(TAG, "http_client_init failed");
+        return ESP_FAIL;
+    }
+    if (esp_http_client_open(client, 0) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection to %s", url);
+        dns_cache_invalidate(url);
+        esp_http_client_cleanup(client);
+        return ESP_FAIL;
+    }
+    esp_http_client_fetch_headers(client);
+    int status = esp_http_client_get_status_code(client);
+    if (status != 200) {
+        ESP_LOGE(TAG, "patch download refused, status %d", status);
+        esp_http_client_cleanup(client);
+        return ESP_FAIL;
+    }
+    delta.patch = delta_patch_new(delta_read_old, delta_write_new, &delta);
+    if (delta.patch == NULL) {
+        ESP_LOGE(TAG, "malloc delta patch failed");
+        esp_http_client_cleanup(client);
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint32_t total = 0;
+    int64_t start = esp_timer_get_time();
+    int ret = DELTA_OK;
+    while (ret == DELTA_OK) {
+        int len = esp_http_client_read(client, buff, OTA_CHUNK_SIZE);
+        if (len < 0) {
+            ESP_LOGW(TAG, "patch download dropped at %lu", total);
+            err = ESP_ERR_TIMEOUT;
+            break;
+        }
+        if (len == 0) {
+            ret = delta_patch_finish(delta.patch);
+            break;
+        }
+        total += len;
+        ret = delta_patch_feed(delta.patch, (uint8_t *)buff, len);
+    }
+    esp_http_client_cleanup(client);
+    link_est_add_transfer(total, (esp_timer_get_time() - start) / 1000);
+
+    if (err == ESP_OK && ret != DELTA_OK) {
+        ESP_LOGE(TAG, "patch failed with %d after %lu bytes", ret, total);
+        err = ret == DELTA_ERR_OLD_IMAGE ? ESP_ERR_INVALID_VERSION : ESP_FAIL;
+    }
+    if (err == ESP_OK) {
+        const deltaHeader_t *header = delta_patch_header(delta.patch);
+        ESP_LOGI(TAG, "patch of %lu bytes made firmware of %lu bytes", total, header->new_size);
+        err = ota_stop(&delta.handle);
+    } else if (delta.started) {
+        ota_abort(&delta.handle);
+    }
+    delta_patch_free(delta.patch);
+    return err;
+}
+
+static esp_err_t update_firmware(char *url, char *delta_url, char *title, char *crc)
 {
-    char *ota_data = NULL;
-    uint32_t ota_len = 0;
     uint32_t fwChecksum = 0, devChecksum = 0;
 
     // 1. Get cloud device firmware information
@@ -186,32 +475,118 @@ static esp_err_t update_firmware(char *url, char *title, char *crc)
     // 2. Compare the cloud firmware information with the local firmware information. If they are inconsistent, download the firmware and update it
     if (fwChecksum != devChecksum) {
         ESP_LOGI(TAG, "fwChecksum = %lx != devChecksum = %lx, will try updating", fwChecksum, devChecksum);
-        ota_data = (char *)malloc(OTA_BIN_MAX_SIZE);
-        if (ota_data == NULL) {
-            ESP_LOGE(TAG, "malloc ota_data failed");
+        char *buff = (char *)malloc(OTA_CHUNK_SIZE);
+        if (buff == NULL) {
+            ESP_LOGE(TAG, "malloc ota buffer failed");
             return ESP_FAIL;
         }
-        if (get_ota_data(url, ota_data, &ota_len) == ESP_OK &&
-            fwChecksum == esp_rom_crc32_le(0, (uint8_t *)ota_data, ota_len)) {
-            ESP_LOGI(TAG, "ota_len = %ld", ota_len);
-            if (ota_update(ota_data, ota_len) == ESP_OK) {
-                cfg_set_firmware_crc32(fwChecksum);
-                free(ota_data);
-                return ESP_OK;
+        esp_err_t err = ESP_ERR_TIMEOUT;
+        // a full download already begun goes on, it is resumable and a patch is not
+        bool resuming = g_otaProgress.checksum == fwChecksum && g_otaProgress.offset > 0;
+        if (delta_url != NULL && !resuming) {
+            err = download_delta(delta_url, fwChecksum, buff);
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "download_delta failed with %s, downloading the whole firmware", esp_err_to_name(err));
+                err = ESP_ERR_TIMEOUT;
             }
-        } else {
-            ESP_LOGE(TAG, "get_ota_data[len=%lu] failed from url = %s", ota_len, url);
         }
-        free(ota_data);
+        for (int i = 0; i < OTA_DOWNLOAD_ATTEMPTS && err == ESP_ERR_TIMEOUT; i++) {
+            err = download_firmware(url, fwChecksum, buff);
+        }
+        free(buff);
+        if (err == ESP_OK) {
+            cfg_set_firmware_crc32(fwChecksum);
+            return ESP_OK;
+        }
+        ESP_LOGE(TAG, "download_firmware failed with %s from url = %s", esp_err_to_name(err), url);
         return ESP_FAIL;
     }
     return ESP_FAIL;
 }
 
+/**
+ * Stream the configuration into cfg_import as it downloads, without holding the file.
+ * The changes are applied only once the whole file matches its CRC32
+ * @param url Configuration URL
+ * @param checksum CRC32 of the file
+ * @return ESP_OK when the configuration is imported
+ */
+static esp_err_t download_config(char *url, uint32_t checksum)
+{
+    char buff[512];
+    uint32_t total = 0, crc = 0, changed = 0;
+    esp_err_t err = ESP_OK;
+
+    esp_http_client_config_t config = {
+        .method = HTTP_METHOD_GET,
+        .url = replace_space(url, '+'),
+        .timeout_ms = 20000,
+        .buffer_size = 1024,
+    };
+    if (strncasecmp(url, "https", 5) == 0) {
+        config.crt_bundle_attach = esp_crt_bundle_attach;
+    }
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL) {
+        ESP_LOGE(TAG, "http_client_init failed");
+        return ESP_FAIL;
+    }
+    if (esp_http_client_open(client, 0) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection to %s", url);
+        dns_cache_invalidate(url);
+        esp_http_client_cleanup(client);
+        return ESP_FAIL;
+    }
+    esp_http_client_fetch_headers(client);
+    int status = esp_http_client_get_status_code(client);
+    if (status != 200) {
+        ESP_LOGE(TAG, "config download refused, status %d", status);
+        esp_http_client_cleanup(client);
+        return ESP_FAIL;
+    }
+    cfgImport_t *import = cfg_import_begin();
+    if (import == NULL) {
+        ESP_LOGE(TAG, "malloc config import failed");
+        esp_http_client_cleanup(client);
+        return ESP_ERR_NO_MEM;
+    }
+
+    int64_t start = esp_timer_get_time();
+    while (err == ESP_OK) {
+        int len = esp_http_client_read(client, buff, sizeof(buff));
+        if (len < 0) {
+            ESP_LOGE(TAG, "config download dropped at %lu", total);
+            err = ESP_FAIL;
+            break;
+        }
+        if (len == 0) {
+            break;
+        }
+        total += len;
+        if (total > OTA_CFG_MAX_SIZE) {
+            ESP_LOGE(TAG, "config larger than %d", OTA_CFG_MAX_SIZE);
+            err = ESP_FAIL;
+            break;
+        }
+        crc = esp_rom_crc32_le(crc, (uint8_t *)buff, len);
+        err = cfg_import_feed(import, buff, len);
+    }
+    esp_http_client_cleanup(client);
+    link_est_add_transfer(total, (esp_timer_get_time() - start) / 1000);
+
+    if (err == ESP_OK && crc != checksum) {
+        ESP_LOGE(TAG, "config crc32 %lx != %lx", crc, checksum);
+        err = ESP_ERR_INVALID_CRC;
+    }
+    if (cfg_import_end(import, err == ESP_OK, &changed) != ESP_OK) {
+        return err == ESP_OK ? ESP_FAIL : err;
+    }
+    ESP_LOGI(TAG, "config of %lu bytes, %lu keys changed", total, changed);
+    return ESP_OK;
+}
+
 static esp_err_t update_config(char *url, char *title, char *crc)
 {
-    char *ota_data = NULL;
-    uint32_t ota_len = 0;
     uint32_t cfChecksum = 0, devChecksum = 0;
 
     // 1. Get cloud device firmware information
@@ -224,23 +599,11 @@ static esp_err_t update_config(char *url, char *title, char *crc)
     // 2. Compare the cloud firmware information with the local firmware information. If they are inconsistent, download the firmware and update it
     if (cfChecksum != devChecksum) {
         ESP_LOGI(TAG, "cfChecksum = %lx != devChecksum = %lx, will try updating", cfChecksum, devChecksum);
-        ota_data = (char *)malloc(OTA_CFG_MAX_SIZE);
-        if (ota_data == NULL) {
-            ESP_LOGE(TAG, "malloc ota_data failed");
-            return ESP_FAIL;
+        if (download_config(url, cfChecksum) == ESP_OK) {
+            cfg_set_config_crc32(cfChecksum);
+            return ESP_OK;
         }
-        if (get_ota_data(url, ota_data, &ota_len) == ESP_OK &&
-            cfChecksum == esp_rom_crc32_le(0, (uint8_t *)ota_data, ota_len)) {
-            ESP_LOGI(TAG, "ota_len = %ld", ota_len);
-            if (cfg_import(ota_data, ota_len) == ESP_OK) {
-                cfg_set_config_crc32(cfChecksum);
-                free(ota_data);
-                return ESP_OK;
-            }
-        } else {
-            ESP_LOGE(TAG, "get_ota_data failed from url = %s", url);
-        }
-        free(ota_data);
+        ESP_LOGE(TAG, "download_config failed from url = %s", url);
         return ESP_FAIL;
     }
     return ESP_FAIL;
@@ -281,6 +644,7 @@ void http_client_check_update()
     mqttAttr_t mqtt;
     deviceInfo_t device;
     char url[512] = {0};
+    char delta_url[512] = {0};
     OTApackage_t package, respone;
     esp_err_t fwRet = ESP_FAIL;
     esp_err_t cfRet = ESP_FAIL;
@@ -290,6 +654,7 @@ void http_client_check_update()
 
     // 1. Get cloud device firmware information
     cfg_get_device_info(&device);
+    memset(&package, 0, sizeof(package));
     sprintf(url, "http://%s:%ld/api/v1/%s/latestOtaPackage", mqtt.host, mqtt.httpPort, device.sn);
     if (get_ota_package(url, &package) != ESP_OK) {
         ESP_LOGE(TAG, "get_ota_package failed from url = %s", url);
@@ -305,6 +670,7 @@ void http_client_check_update()
     }
     ESP_LOGI(TAG, "fwTitle = %s", package.fwTitle);
     ESP_LOGI(TAG, "fwChecksum = %s", package.fwChecksum);
+    ESP_LOGI(TAG, "fwDelta = %s", package.fwDelta);
     ESP_LOGI(TAG, "cfTitle = %s", package.cfTitle);
     ESP_LOGI(TAG, "cfChecksum = %s", package.cfChecksum);
     memset(&respone, 0, sizeof(respone));
@@ -315,7 +681,11 @@ void http_client_check_update()
     } else {
         sprintf(url, "http://%s:%ld/api/v1/%s/firmware?title=%s", mqtt.host, mqtt.httpPort, device.sn, package.fwTitle);
     }
-    fwRet = update_firmware(url, package.fwTitle, package.fwChecksum);
+    if (strlen(package.fwDelta)) {
+        sprintf(delta_url, "%s://%s:%ld/api/v1/%s/firmware?title=%s", isHttps ? "https" : "http",
+                mqtt.host, mqtt.httpPort, device.sn, package.fwDelta);
+    }
+    fwRet = update_firmware(url, strlen(delta_url) ? delta_url : NULL, package.fwTitle, package.fwChecksum);
     if (fwRet == ESP_OK) {
         strcpy(respone.fwTitle, package.fwTitle);
         strcpy(respone.fwChecksum, package.fwChecksum);
@@ -399,6 +769,7 @@ int8_t http_client_send_req(http_t *http)
     ret = esp_http_client_open(client, write_len);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(ret));
+        dns_cache_invalidate(http->url);
         goto FAIL;
     }
 
@@ -482,6 +853,7 @@ int8_t http_client_download_file(const char *url, const char *filename, int time
     ret = esp_http_client_open(client, 0);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(ret));
+        dns_cache_invalidate(url);
         goto FAIL;
     }
     ret = esp_http_client_fetch_headers(client);
@@ -579,6 +951,7 @@ int8_t http_client_upload_file(const char *url, const char *filename, int timeou
     ret = esp_http_client_open(client, -1);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(ret));
+        dns_cache_invalidate(url);
         goto FAIL;
     }
     ret = esp_http_client_fetch_headers(client);
@@ -594,6 +967,8 @@ int8_t http_client_upload_file(const char *url, const char *filename, int timeou
     }
 
     int data_read = 0;
+    size_t total = 0;
+    int64_t start = esp_timer_get_time();
     do {
         data_read = fread(buff, 1, 4096, f);
         if (data_read < 0) {
@@ -605,10 +980,12 @@ int8_t http_client_upload_file(const char *url, const char *filename, int timeou
                 ESP_LOGE(TAG, "Error: SSL data write error");
                 goto FAIL;
             }
+            total += data_read;
         }
     } while (data_read > 0);
 
     fclose(f);
+    link_est_add_transfer(total, (esp_timer_get_time() - start) / 1000);
     esp_http_client_cleanup(client);
     return 0;
 FAIL:
@@ -12,6 +12,7 @@ extern "C" {
 typedef struct OTApackage {
     char fwTitle[32];
     char fwChecksum[32];
+    char fwDelta[32];       // Patch from the running firmware to fwTitle, empty if the server has none
     char cfTitle[32];
     char cfChecksum[32];
 } OTApackage_t;
@@ -8,6 +8,7 @@
 #include "iot_mip.h"
 #include "pthread.h"
 #include "esp_timer.h"
+#include "ota.h"
 
 /* Logging tag for MIP module */
 #define TAG "-->IOT_MIP"
@@ -17,6 +18,9 @@
 #define MIP_DM_START_BIT BIT(1)       // Device management start flag  
 #define MIP_API_TOKEN_BIT BIT(2)      // API token received flag
 
+/* Downlink carrying a whole config INI file, streamed into cfg_import */
+#define MIP_DM_CONFIG_TOPIC "iot/v1/device/+/downlink/config_import"
+
 /* Queue node structure for async operations */
 typedef struct qNode {
     int8_t (*cb)(void *param);    // Callback function
@@ -339,6 +343,7 @@ remap_t g_remap[] = {
     {"cat1_apn", KEY_CAT1_APN, apply_str_value, fetch_str_value, ""},
     {"cat1_pin", KEY_CAT1_PIN, apply_str_value, fetch_str_value, ""},
     {"cat1_auth_type", KEY_CAT1_AUTH_TYPE, apply_u8_value, fetch_u8_value, "0"},
+    {"cat1_psm", KEY_CAT1_PSM, apply_u8_value, fetch_u8_value, "0"},
 };
 
 // --------------------iot mip--------------------
@@ -785,6 +790,33 @@ static void dm_wake_up(dm_downlink_header_t dh, cJSON *ddata, dm_downlink_result
     snprintf(dres->status, sizeof(dres->status), DM_DOWNLINK_RES_SUCCESS);
 }
 
+static void *dm_config_begin(void *ctx, const char *topic, size_t total)
+{
+    ESP_LOGI(TAG, "dm_config_import: %u bytes", (unsigned int)total);
+    cfgImport_t *import = cfg_import_begin();
+    if (import == NULL) {
+        ESP_LOGE(TAG, "malloc config import failed");
+    }
+    return import;
+}
+
+static int dm_config_data(void *session, const uint8_t *data, size_t len, size_t offset)
+{
+    return cfg_import_feed((cfgImport_t *)session, (const char *)data, len) == ESP_OK ? 0 : -1;
+}
+
+static void dm_config_end(void *session, bool complete)
+{
+    uint32_t changed = 0;
+
+    // a message cut short or with a syntax error is dropped whole
+    if (cfg_import_end((cfgImport_t *)session, complete, &changed) != ESP_OK) {
+        ESP_LOGE(TAG, "dm_config_import %s", complete ? "refused" : "aborted");
+        return;
+    }
+    ESP_LOGI(TAG, "dm_config_import: %lu keys changed", changed);
+}
+
 static void dm_connecet_status(int status)
 {
     ESP_LOGI(TAG, "dm_connecet_status: %d", status);
@@ -841,6 +873,18 @@ int8_t iot_mip_dm_init()
     mqttcbs.mqtt_publish = mqtt_mip_publish;
     mqttcbs.mqtt_get_timestamp = get_timestamp;
 
+    // config pushes are streamed as they arrive, the MIP callback takes the JSON commands
+    mqttRxConsumer_t config = {
+        .filter = MIP_DM_CONFIG_TOPIC,
+        .max_len = OTA_CFG_MAX_SIZE,
+        .begin = dm_config_begin,
+        .data = dm_config_data,
+        .end = dm_config_end,
+    };
+    if (mqtt_register_consumer(&config) != 0) {
+        ESP_LOGE(TAG, "register config consumer failed");
+    }
+
     return mip_dm_init(&dmcbs, &mqttcbs);
 }
 
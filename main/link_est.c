@@ -0,0 +1,191 @@
+/**
+ * Uplink throughput and RTT estimator
+ *
+ * The firmware used to have no idea how fast its uplink is. Every acknowledged
+ * upload is timed: small messages measure the RTT, large ones the throughput
+ * once the RTT is subtracted. Both are smoothed and kept in RTC memory per link
+ * type. Until a link is measured, and when its signal level changed since, the
+ * estimate is derived from a per-level prior.
+ */
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "debug.h"
+#include "link_est.h"
+
+#define TAG "-->LINK"
+
+#define LINK_EST_SMALL_BYTES    2048    // Transfers below this size measure the RTT only
+#define LINK_EST_ALPHA          0.3f    // Weight of a new sample
+#define LINK_EST_LEVEL_UNKNOWN  2       // Level used for the prior when the signal is unknown
+#define LINK_EST_LEVELS         6       // Signal levels 0-5
+
+/**
+ * Estimate of one link type
+ */
+typedef struct linkStat {
+    float bps;                  // Smoothed throughput in bytes per second, 0 if never measured
+    float rttMs;                // Smoothed RTT in milliseconds, 0 if never measured
+    int8_t bpsLevel;            // Signal level when the throughput was last measured
+    uint32_t samples;           // Number of transfers measured
+} linkStat_t;
+
+/**
+ * Estimator state, preserved in RTC memory
+ */
+typedef struct linkEst {
+    linkStat_t links[LINK_TYPE_MAX];
+    uint8_t current;            // Link in use
+    int8_t level;               // Signal level of the link in use, -1 if unknown
+} linkEst_t;
+
+// Throughput priors per signal level in bytes per second, after TLS and base64 overhead
+static const uint32_t g_bpsPrior[LINK_TYPE_MAX][LINK_EST_LEVELS] = {
+    [LINK_CELLULAR] = {2000, 8000, 16000, 32000, 48000, 64000},
+    [LINK_WIFI]     = {20000, 60000, 120000, 250000, 400000, 500000},
+};
+static const uint32_t g_rttPrior[LINK_TYPE_MAX] = {
+    [LINK_CELLULAR] = 400,
+    [LINK_WIFI]     = 60,
+};
+
+static RTC_DATA_ATTR linkEst_t g_linkEst = {.level = -1};
+static portMUX_TYPE g_linkMux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Get the throughput prior of a link at a signal level
+ * @param type Link type
+ * @param level Signal level, -1 if unknown
+ * @return Throughput in bytes per second
+ */
+static float link_est_prior(uint8_t type, int8_t level)
+{
+    if (level < 0 || level >= LINK_EST_LEVELS) {
+        level = LINK_EST_LEVEL_UNKNOWN;
+    }
+    return g_bpsPrior[type][level];
+}
+
+/**
+ * Smooth a sample into an estimate
+ * @param value Current estimate, 0 if none
+ * @param sample New sample
+ * @return Updated estimate
+ */
+static float link_est_smooth(float value, float sample)
+{
+    return value > 0 ? value + LINK_EST_ALPHA * (sample - value) : sample;
+}
+
+void link_est_set_signal(linkType_e type, int8_t level)
+{
+    if (type >= LINK_TYPE_MAX) {
+        return;
+    }
+    taskENTER_CRITICAL(&g_linkMux);
+    g_linkEst.current = type;
+    g_linkEst.level = level < LINK_EST_LEVELS ? level : LINK_EST_LEVELS - 1;
+    taskEXIT_CRITICAL(&g_linkMux);
+    ESP_LOGI(TAG, "link %d, signal level %d", type, level);
+}
+
+void link_est_add_transfer(size_t bytes, uint32_t ms)
+{
+    linkStat_t *s = NULL;
+
+    if (ms == 0) {
+        return;
+    }
+    taskENTER_CRITICAL(&g_linkMux);
+    s = &g_linkEst.links[g_linkEst.current];
+    if (bytes < LINK_EST_SMALL_BYTES) {
+        s->rttMs = link_est_smooth(s->rttMs, ms);
+    } else {
+        float rtt = s->rttMs > 0 ? s->rttMs : g_rttPrior[g_linkEst.current];
+        float transferMs = ms - rtt;
+        if (transferMs < ms / 4.0f) {
+            transferMs = ms / 4.0f; // the RTT estimate is off, do not let it inflate the throughput
+        }
+        s->bps = link_est_smooth(s->bps, bytes * 1000.0f / transferMs);
+        s->bpsLevel = g_linkEst.level;
+    }
+    s->samples++;
+    taskEXIT_CRITICAL(&g_linkMux);
+    ESP_LOGI(TAG, "%u bytes in %lu ms, estimate %lu B/s, rtt %lu ms",
+             bytes, ms, link_est_get_bps(), link_est_get_rtt_ms());
+}
+
+uint32_t link_est_get_bps(void)
+{
+    float bps;
+
+    taskENTER_CRITICAL(&g_linkMux);
+    const linkStat_t *s = &g_linkEst.links[g_linkEst.current];
+    if (s->bps <= 0) {
+        bps = link_est_prior(g_linkEst.current, g_linkEst.level);
+    } else if (g_linkEst.level >= 0 && s->bpsLevel >= 0 && g_linkEst.level != s->bpsLevel) {
+        // measured at another signal level, scale by the ratio of the priors
+        bps = s->bps * link_est_prior(g_linkEst.current, g_linkEst.level) /
+              link_est_prior(g_linkEst.current, s->bpsLevel);
+    } else {
+        bps = s->bps;
+    }
+    taskEXIT_CRITICAL(&g_linkMux);
+    return bps < 1 ? 1 : (uint32_t)bps;
+}
+
+uint32_t link_est_get_rtt_ms(void)
+{
+    uint32_t rtt;
+
+    taskENTER_CRITICAL(&g_linkMux);
+    const linkStat_t *s = &g_linkEst.links[g_linkEst.current];
+    rtt = s->rttMs > 0 ? (uint32_t)s->rttMs : g_rttPrior[g_linkEst.current];
+    taskEXIT_CRITICAL(&g_linkMux);
+    return rtt;
+}
+
+uint32_t link_est_upload_ms(size_t bytes)
+{
+    return link_est_get_rtt_ms() + (uint32_t)((uint64_t)bytes * 1000 / link_est_get_bps());
+}
+
+bool link_est_is_measured(void)
+{
+    return g_linkEst.links[g_linkEst.current].bps > 0;
+}
+
+/**
+ * Console command handler for showing or clearing the link estimates
+ * @param argc Argument count
+ * @param argv Argument values
+ * @return ESP_OK
+ */
+static int do_linkstat_cmd(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "clear") == 0) {
+        taskENTER_CRITICAL(&g_linkMux);
+        memset(g_linkEst.links, 0, sizeof(g_linkEst.links));
+        taskEXIT_CRITICAL(&g_linkMux);
+        ESP_LOGI(TAG, "estimates cleared");
+        return ESP_OK;
+    }
+    for (int i = 0; i < LINK_TYPE_MAX; i++) {
+        linkStat_t *s = &g_linkEst.links[i];
+        ESP_LOGI(TAG, "------ link %d: %lu B/s at level %d, rtt %lu ms, %lu samples",
+                 i, (uint32_t)s->bps, s->bpsLevel, (uint32_t)s->rttMs, s->samples);
+    }
+    ESP_LOGI(TAG, "Current: link %d, level %d, estimate %lu B/s, rtt %lu ms",
+             g_linkEst.current, g_linkEst.level, link_est_get_bps(), link_est_get_rtt_ms());
+    return ESP_OK;
+}
+
+static esp_console_cmd_t g_cmd[] = {
+    {"linkstat", "linkstat [clear], show or clear the uplink throughput estimates", NULL, do_linkstat_cmd, NULL},
+};
+
+void link_est_open(void)
+{
+    debug_cmd_add(g_cmd, sizeof(g_cmd) / sizeof(esp_console_cmd_t));
+}
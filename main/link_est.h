@@ -0,0 +1,76 @@
+#ifndef __LINK_EST_H__
+#define __LINK_EST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Uplink throughput and RTT estimator kept in RTC memory across deep sleep
+ *
+ * Fed by the duration of every acknowledged MQTT/MIP publish and HTTP upload,
+ * and by the signal level (CSQ for CAT1, RSSI for WiFi) of the current link.
+ */
+
+/**
+ * Link types, each one has its own estimate
+ */
+typedef enum linkType {
+    LINK_CELLULAR = 0,      // CAT1 modem
+    LINK_WIFI,              // WiFi station
+    LINK_TYPE_MAX,
+} linkType_e;
+
+/**
+ * Initialize the estimator module and register its console command
+ */
+void link_est_open(void);
+
+/**
+ * Set the link in use and its signal level, called when the link comes up
+ * @param type Link type
+ * @param level Signal level (0-5), -1 if unknown
+ */
+void link_est_set_signal(linkType_e type, int8_t level);
+
+/**
+ * Add an acknowledged transfer on the current link
+ * @param bytes Bytes sent
+ * @param ms Time from the start of the send to the acknowledgement
+ */
+void link_est_add_transfer(size_t bytes, uint32_t ms);
+
+/**
+ * Get the estimated uplink throughput of the current link
+ * @return Throughput in bytes per second
+ */
+uint32_t link_est_get_bps(void);
+
+/**
+ * Get the estimated round trip time of the current link
+ * @return RTT in milliseconds
+ */
+uint32_t link_est_get_rtt_ms(void);
+
+/**
+ * Estimate the time to upload a payload on the current link
+ * @param bytes Payload size in bytes
+ * @return Upload time in milliseconds
+ */
+uint32_t link_est_upload_ms(size_t bytes);
+
+/**
+ * Check if the current link has been measured, not only guessed from the signal level
+ * @return true if at least one transfer was measured
+ */
+bool link_est_is_measured(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LINK_EST_H__ */
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <esp_heap_caps.h>
 #include "config.h"
 #include "system.h"
 #include "wifi.h"
@@ -40,12 +41,17 @@
 #include "net_module.h"
 #include "morse.h"
 #include "utils.h"
+#include "dns_cache.h"
+#include "link_est.h"
+#include "capture_bp.h"
 
 #define TAG "-->MAIN"
 
-// Queue configuration constants
+// Queue configuration constants, minimum depths
 #define MQTT_QUEUE_SIZE     3
 #define STORAGE_QUEUE_SIZE  2
+#define QUEUE_SIZE_MAX      16
+#define QUEUE_FRAME_BUDGET  (512 * 1024)  // PSRAM reserved per queued frame
 
 // LED blink configuration for status indication
 #define STATUS_LED_BLINK_COUNT    1
@@ -177,6 +183,9 @@ static void print_system_info(void)
     printf("  Horizontal Flip: %s\n", image.bHorizonetal ? "Yes" : "No");
     printf("  Vertical Flip: %s\n", image.bVertical ? "Yes" : "No");
     printf("  HDR: %s\n", image.hdrEnable ? "Enabled" : "Disabled");
+    printf("  ROI: %s (x=%d y=%d w=%d h=%d permille)\n",
+           image.roiMode == 0 ? "Disabled" : (image.roiMode == 2 ? "Sensor" : "Crop"),
+           image.roiX, image.roiY, image.roiW, image.roiH);
     printf("\n");
     printf("Capture Configuration:\n");
     printf("  Scheduled Capture: %s\n", capture.bScheCap ? "Enabled" : "Disabled");
@@ -184,6 +193,7 @@ static void print_system_info(void)
     printf("  Trigger Capture: %s\n", capture.bAlarmInCap ? "Enabled" : "Disabled");
     printf("  Button Capture: %s\n", capture.bButtonCap ? "Enabled" : "Disabled");
     printf("  Camera Warmup Delay: %lu ms\n", capture.camWarmupMs);
+    printf("  Burst Frames: %d\n", capture.burstCount);
     if (capture.scheCapMode == 1) {
         const char* unit_str[] = {"min", "hour", "day"};
         printf("  Interval: %lu %s\n", capture.intervalValue, 
@@ -265,6 +275,7 @@ static modeSel_e handle_deep_sleep_wakeup(snapType_e *snapType)
 
     switch (type) {
         case WAKEUP_TIMER:
+            sleep_record_timer_wakeup();
             if (!sleep_is_will_wakeup_time_reached()) {
                 ESP_LOGI(TAG, "Wake up from timer, but the time is not reached, sleep again");
                 return MODE_SLEEP;
@@ -345,11 +356,37 @@ static void common_init(void)
     srand(esp_random());
 
     debug_open();
+    link_est_open();
     cfg_init();
+    dns_cache_open();
     sleep_open();
     iot_mip_init();
 }
 
+/**
+ * @brief Run jobs that were coalesced into this wake, sharing its network session
+ * Must be called after netModule_open()
+ * @param bUpload Run the scheduled upload
+ * @param bSchedule Run the scheduled system tasks
+ * @return Extra sleep bits to wait for before sleeping
+ */
+static sleepBits_e run_coalesced_todo(bool bUpload, bool bSchedule)
+{
+    sleepBits_e bits = 0;
+
+    if (bSchedule) {
+        ESP_LOGI(TAG, "coalesced schedule");
+        system_schedule_todo();
+        bits |= SLEEP_SCHEDULE_DONE_BIT;
+    }
+    if (bUpload) {
+        ESP_LOGI(TAG, "coalesced upload");
+        system_upload_todo();
+        bits |= SLEEP_STORAGE_UPLOAD_STOP_BIT;
+    }
+    return bits;
+}
+
 /**
  * @brief Handle snapshot mode operations (image capture)
  * @param snapType Type of snapshot trigger
@@ -364,11 +401,16 @@ static void handle_snapshot_mode(snapType_e snapType, QueueHandle_t xQueueMqtt,
     uint8_t need_netModule = 0;
     ntpSync_t ntp_sync;
     uploadAttr_t upload;
+    sleepBits_e bits = SLEEP_SNAPSHOT_STOP_BIT | SLEEP_STORAGE_UPLOAD_STOP_BIT | SLEEP_MIP_DONE_BIT;
+    // Jobs coalesced into this wake reuse the network bring-up of the snapshot
+    bool coalesceUpload = sleep_take_wakeup_todo(WAKEUP_TODO_UPLOAD);
+    bool coalesceSchedule = sleep_take_wakeup_todo(WAKEUP_TODO_SCHEDULE);
 
     system_get_ntp_sync(&ntp_sync);
     cfg_get_upload_attr(&upload);
     
     need_netModule = ntp_sync.enable || upload.uploadMode == 0; //If the NTP synchronization is enabled or the upload mode is instant upload, the network module is needed.
+    need_netModule = need_netModule || coalesceUpload || coalesceSchedule;
 
     ESP_LOGI(TAG,"ntp_sync.enable: %d", ntp_sync.enable);
     ESP_LOGI(TAG, "upload.uploadMode: %d", upload.uploadMode);
@@ -376,6 +418,12 @@ static void handle_snapshot_mode(snapType_e snapType, QueueHandle_t xQueueMqtt,
 
     if (need_netModule) {
         camera_open(NULL, xQueueMqtt); //If the network module is needed, the camera send the image to the MQTT server.
+        camera_set_spill_queue(xQueueStorage); //If the MQTT queue is full, the image is saved to the storage instead of dropped.
+        if (upload.uploadMode == 0) {
+            uint32_t budget = 0;
+            cfg_get_upload_budget(&budget);
+            camera_set_upload_budget(budget); //Lower the resolution if the image would not upload within the budget.
+        }
     } else {
         camera_open(NULL, xQueueStorage); //If the network module is not needed, the camera send the image to the storage.
     }
@@ -386,9 +434,10 @@ static void handle_snapshot_mode(snapType_e snapType, QueueHandle_t xQueueMqtt,
     
     if (need_netModule) {
         netModule_open(main_mode);
+        bits |= run_coalesced_todo(coalesceUpload, coalesceSchedule);
     }
     
-    sleep_wait_event_bits(SLEEP_SNAPSHOT_STOP_BIT | SLEEP_STORAGE_UPLOAD_STOP_BIT | SLEEP_MIP_DONE_BIT, true);
+    sleep_wait_event_bits(bits, true);
 }
 
 /**
@@ -421,8 +470,11 @@ static void handle_schedule_mode(void)
     misc_led_blink(STATUS_LED_BLINK_COUNT, STATUS_LED_BLINK_INTERVAL);
     ESP_LOGI(TAG, "schedule mode");
     
+    bool coalesceUpload = sleep_take_wakeup_todo(WAKEUP_TODO_UPLOAD);
+
     netModule_open(main_mode);
     system_schedule_todo();
+    run_coalesced_todo(coalesceUpload, false);
     sleep_wait_event_bits(SLEEP_SCHEDULE_DONE_BIT | SLEEP_STORAGE_UPLOAD_STOP_BIT | SLEEP_MIP_DONE_BIT, true);
 }
 
@@ -434,9 +486,13 @@ static void handle_upload_mode(void)
     misc_led_blink(STATUS_LED_BLINK_COUNT, STATUS_LED_BLINK_INTERVAL);
     ESP_LOGI(TAG, "upload mode");
     
+    sleepBits_e bits = SLEEP_STORAGE_UPLOAD_STOP_BIT | SLEEP_MIP_DONE_BIT;
+    bool coalesceSchedule = sleep_take_wakeup_todo(WAKEUP_TODO_SCHEDULE);
+
     netModule_open(main_mode);
     system_upload_todo();
-    sleep_wait_event_bits(SLEEP_STORAGE_UPLOAD_STOP_BIT | SLEEP_MIP_DONE_BIT, true);
+    bits |= run_coalesced_todo(false, coalesceSchedule);
+    sleep_wait_event_bits(bits, true);
 }
 
 
@@ -458,14 +514,20 @@ static esp_err_t init_queues_and_services(QueueHandle_t *xQueueMqtt, QueueHandle
     misc_open((uint8_t*)&main_mode);
     netModule_init(main_mode);
 
+    // Size the queues from the free PSRAM, a third of it may be held by queued frames
+    size_t psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 3;
+    uint32_t mqttDepth = capture_bp_queue_depth(psram, QUEUE_FRAME_BUDGET, MQTT_QUEUE_SIZE, QUEUE_SIZE_MAX);
+    uint32_t storageDepth = capture_bp_queue_depth(psram, QUEUE_FRAME_BUDGET, STORAGE_QUEUE_SIZE, QUEUE_SIZE_MAX);
+    ESP_LOGI(TAG, "queue depth mqtt %lu, storage %lu", mqttDepth, storageDepth);
+
     // Create queues with error checking
-    *xQueueMqtt = xQueueCreate(MQTT_QUEUE_SIZE, sizeof(queueNode_t *));
+    *xQueueMqtt = xQueueCreate(mqttDepth, sizeof(queueNode_t *));
     if (*xQueueMqtt == NULL) {
         ESP_LOGE(TAG, "Failed to create MQTT queue");
         return ESP_ERR_NO_MEM;
     }
 
-    *xQueueStorage = xQueueCreate(STORAGE_QUEUE_SIZE, sizeof(queueNode_t *));
+    *xQueueStorage = xQueueCreate(storageDepth, sizeof(queueNode_t *));
     if (*xQueueStorage == NULL) {
         ESP_LOGE(TAG, "Failed to create Storage queue");
         vQueueDelete(*xQueueMqtt);  // Cleanup on failure
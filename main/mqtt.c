@@ -12,6 +12,8 @@
 // #include "esp_tls.h"
 #include "esp_tls_crypto.h"
 #include "esp_crt_bundle.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
 #include "mqtt_client.h"
 #include "storage.h"
 #include "config.h"
@@ -22,6 +24,10 @@
 #include "debug.h"
 #include "utils.h"
 #include "iot_mip.h"
+#include "dns_cache.h"
+#include "link_est.h"
+#include "mqtt_rx.h"
+#include "chunk_upload.h"
 
 // Event bit definitions for MQTT state tracking
 #define MQTT_START_BIT BIT(0)          // Client started
@@ -40,7 +46,10 @@
 
 // Buffer sizes
 #define MQTT_SEND_BUFFER_SIZE  (1536000)  // Send buffer size
-#define MQTT_RECV_BUFFER_SIZE 8192       // Receive buffer size
+#define MQTT_RECV_BUFFER_SIZE 8192       // Longest downlink held in RAM, longer ones spill to STORAGE_ROOT
+#define MQTT_RECV_RAM_BUDGET  (16 * 1024) // RAM the downlinks being reassembled take together
+#define MQTT_NOTIFY_MAX_SIZE  (64 * 1024) // Longest downlink passed to the MIP callback
+#define MQTT_CHUNK_MIN_SIZE   1024       // Smallest resumable upload chunk
 
 #define TAG "-->MQTT"  // Logging tag
 
@@ -65,7 +74,7 @@ typedef struct mdMqtt {
     bool isConnected;                  // Connection status
     SemaphoreHandle_t mutex;           // Mutex for thread safety
     void *sendBuf;                     // Send buffer
-    void *recvBuf;                     // Receive buffer
+    mqttRx_t *rx;                      // Downlink reassembly
     size_t sendBufSize;                // Send buffer size
     int8_t cfg_set_flag;               // Configuration flag
     subscribe_t sub;                   // Subscription info
@@ -73,14 +82,16 @@ typedef struct mdMqtt {
     mqtt_t *mip;                       // MIP configuration
     esp_mqtt_client_config_t cfg;      // ESP MQTT client config
     bool isOpen;                        // MQTT client opened flag
+    int64_t sendStart;                  // Time the last message was sent (us)
+    size_t sendLen;                     // Length of the last message sent
 } mdMqtt_t;
 
 static RTC_DATA_ATTR int g_sned_total = 0;
 static RTC_DATA_ATTR int g_sned_success = 0;
 
 static mdMqtt_t g_MQ = {0};
-static int buff_index = 0;
-static char event_topic[128];
+static mqttRxConsumer_t g_consumers[MQTT_RX_CONSUMERS - 1];   // One is left for the MIP callback
+static int g_consumerCnt = 0;
 
 /**
  * MQTT event handler callback
@@ -116,6 +127,9 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event, void *hand
                 mqtt->status_cb(false);
             }
             mqtt->isConnected = false;
+            if (mqtt->rx) {
+                mqtt_rx_reset(mqtt->rx);
+            }
             storage_upload_stop();
             break;
 
@@ -138,25 +152,26 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event, void *hand
             xEventGroupSetBits(mqtt->eventGroup, MQTT_PUBLISHED_BIT);
             break;
         case MQTT_EVENT_DATA:
-            ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-            ESP_LOGI(TAG, "TOPIC=%.*s", event->topic_len, event->topic);
-            ESP_LOGI(TAG, "DATA=%.*s", event->data_len, event->data);
+            ESP_LOGI(TAG, "MQTT_EVENT_DATA, msg_id=%d, %d/%d bytes at %d", event->msg_id,
+                     event->data_len, event->total_data_len, event->current_data_offset);
             if (event->topic_len) {
-                snprintf(event_topic, sizeof(event_topic), "%.*s", event->topic_len, event->topic);
-            }
-            if (event->data_len) {
-                snprintf(mqtt->recvBuf + buff_index, MQTT_RECV_BUFFER_SIZE - buff_index, "%.*s", event->data_len, event->data);
-                buff_index += event->data_len;
+                ESP_LOGI(TAG, "TOPIC=%.*s", event->topic_len, event->topic);
             }
-            if (buff_index == event->total_data_len) {
-                if (mqtt->sub.notify_cb) {
-                    mqtt->sub.notify_cb(event_topic, mqtt->recvBuf);
+            if (mqtt->rx) {
+                int ret = mqtt_rx_feed(mqtt->rx, event->msg_id, event->topic, event->topic_len,
+                                       (const uint8_t *)event->data, event->data_len,
+                                       event->current_data_offset, event->total_data_len);
+                if (ret != MQTT_RX_OK) {
+                    ESP_LOGW(TAG, "downlink msg_id=%d dropped: %d", event->msg_id, ret);
                 }
-                buff_index = 0;
             }
             break;
         case MQTT_EVENT_ERROR:
             ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+            if (event->error_handle && event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
+                // the cached broker address may be stale, resolve it live on the next connect
+                dns_cache_invalidate(mqtt->mip ? mqtt->mip->host : mqtt->mqtt.host);
+            }
             break;
         default:
             ESP_LOGI(TAG, "Other event id:%d", event->event_id);
@@ -179,20 +194,15 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 }
 
 /**
- * Send message as JSON payload
- * @param mqtt MQTT state
+ * Fill the device and capture description shared by all image messages
+ * @param subJson JSON "values" object to fill
  * @param node Queue node containing message data
- * @return ESP_OK on success, ESP_FAIL on error
  */
-static esp_err_t mqtt_send_by_json(mdMqtt_t *mqtt, queueNode_t *node)
+static void mqtt_add_device_values(cJSON *subJson, queueNode_t *node)
 {
-    esp_err_t res = ESP_OK;
-    size_t picSize;
     deviceInfo_t device;
     char *snapType = NULL;
-    char *str = NULL;
     char time[32];
-    char header[] = "data:image/jpeg;base64,";
 
     switch (node->type) {
         case SNAP_ALARMIN:
@@ -208,86 +218,306 @@ static esp_err_t mqtt_send_by_json(mdMqtt_t *mqtt, queueNode_t *node)
             snapType = "Unknown";
             break;
     }
+    cfg_get_device_info(&device);
+    time_t t = node->pts / 1000;
+    strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    cJSON_AddStringToObject(subJson, "devName", device.name);
+    cJSON_AddStringToObject(subJson, "devMac", device.mac);
+    cJSON_AddStringToObject(subJson, "devSn", device.sn);
+    cJSON_AddStringToObject(subJson, "hwVersion", device.hardVersion);
+    cJSON_AddStringToObject(subJson, "fwVersion", device.softVersion);
+    cJSON_AddNumberToObject(subJson, "battery", misc_get_battery_voltage_rate());
+    cJSON_AddNumberToObject(subJson, "batteryVoltage", misc_get_battery_voltage());
+    cJSON_AddStringToObject(subJson, "snapType", snapType);
+    cJSON_AddStringToObject(subJson, "localtime", time);
+    if (node->isPreview) {
+        cJSON_AddBoolToObject(subJson, "preview", true);
+    }
+}
+
+/**
+ * Send a serialized message to the cloud (MIP HTTP uplink or MQTT topic)
+ * @param mqtt MQTT state
+ * @param str Message string
+ * @return Non-negative on success, negative on error
+ */
+static esp_err_t mqtt_send_str(mdMqtt_t *mqtt, const char *str)
+{
+    esp_err_t res;
+
+    mqtt->sendStart = esp_timer_get_time();
+    mqtt->sendLen = strlen(str);
+    if (iot_mip_dm_is_enable()) {
+        res = iot_mip_dm_uplink_picture(str);
+        if (res >= 0) {
+            link_est_add_transfer(mqtt->sendLen, (esp_timer_get_time() - mqtt->sendStart) / 1000);
+        }
+    } else {
+        xEventGroupClearBits(mqtt->eventGroup, MQTT_PUBLISHED_BIT);
+        res = esp_mqtt_client_publish(mqtt->client, mqtt->mqtt.topic, str, 0, mqtt->mqtt.qos, 0);
+        if (mqtt->mqtt.qos == 0) {
+            vTaskDelay(pdMS_TO_TICKS(500));
+        }
+    }
+    return res;
+}
+
+/**
+ * Wait until the last sent message is acknowledged by the cloud
+ * @param mqtt MQTT state
+ * @return ESP_OK on success, ESP_FAIL on timeout
+ */
+static esp_err_t mqtt_wait_published(mdMqtt_t *mqtt)
+{
+    EventBits_t uxBits;
+
+    if (mqtt->mqtt.qos == 0 || mqtt->mip != NULL) { // mqtt qos 0 or mip http upload to cloud platform does not need async wait;
+        return ESP_OK;
+    }
+    uxBits = xEventGroupWaitBits(mqtt->eventGroup, MQTT_PUBLISHED_BIT, true, true, pdMS_TO_TICKS(MQTT_PUBLISHED_TIMEOUT_MS));
+    if (uxBits & MQTT_PUBLISHED_BIT) {
+        link_est_add_transfer(mqtt->sendLen, (esp_timer_get_time() - mqtt->sendStart) / 1000);
+        return ESP_OK;
+    }
+    return ESP_FAIL;
+}
+
+/**
+ * Send message as JSON payload
+ * @param mqtt MQTT state
+ * @param node Queue node containing message data
+ * @return ESP_OK on success, ESP_FAIL on error
+ */
+static esp_err_t mqtt_send_by_json(mdMqtt_t *mqtt, queueNode_t *node)
+{
+    esp_err_t res = ESP_OK;
+    size_t picSize = 0;
+    char *str = NULL;
+    char header[] = "data:image/jpeg;base64,";
+    jpg_exif_part_t parts[2];
+    int count = storage_node_parts(node, parts);
+    size_t total = 0;
+
+    for (int i = 0; i < count; i++) {
+        total += parts[i].len;
+    }
+
     memcpy((char *)mqtt->sendBuf, header, strlen(header));
     // Calculate available buffer size after header (must subtract, not add)
     size_t header_len = strlen(header);
     size_t available_size = mqtt->sendBufSize - header_len;
     
     // Check if buffer is large enough for base64 encoding (base64 is ~4/3 of original size)
-    size_t required_size = ((node->len + 2) / 3) * 4;
+    size_t required_size = ((total + 2) / 3) * 4;
     if (required_size > available_size) {
         ESP_LOGE(TAG, "Buffer too small: required=%zu, available=%zu, header_len=%zu, node_len=%zu", 
-                 required_size, available_size, header_len, node->len);
+                 required_size, available_size, header_len, total);
         return ESP_FAIL;
     }
     
-    res = esp_crypto_base64_encode(mqtt->sendBuf + header_len, available_size, 
-                                   &picSize, node->data, node->len);
-    if (res < 0) {
-        ESP_LOGE(TAG, "esp_crypto_base64_encode failed: res=%d, node_len=%zu, available_size=%zu", 
-                 res, node->len, available_size);
-        return ESP_FAIL;
+    // the EXIF prefix is a multiple of 3 bytes, the encoded parts join into the encoded file
+    for (int i = 0; i < count; i++) {
+        size_t encSize = 0;
+        res = esp_crypto_base64_encode(mqtt->sendBuf + header_len + picSize, available_size - picSize,
+                                       &encSize, parts[i].buf, parts[i].len);
+        if (res < 0) {
+            ESP_LOGE(TAG, "esp_crypto_base64_encode failed: res=%d, node_len=%zu, available_size=%zu", 
+                     res, parts[i].len, available_size - picSize);
+            return ESP_FAIL;
+        }
+        picSize += encSize;
     }
-    cfg_get_device_info(&device);
-    time_t t = node->pts / 1000;
-    strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", localtime(&t));
     /* create Student JSON object */
     cJSON *json = cJSON_CreateObject();
     cJSON *subJson = cJSON_CreateObject();
     /* serialize data to JSON object. */
-    cJSON_AddStringToObject(subJson, "devName", device.name);
-    cJSON_AddStringToObject(subJson, "devMac", device.mac);
-    cJSON_AddStringToObject(subJson, "devSn", device.sn);
-    cJSON_AddStringToObject(subJson, "hwVersion", device.hardVersion);
-    cJSON_AddStringToObject(subJson, "fwVersion", device.softVersion);
-    cJSON_AddNumberToObject(subJson, "battery", misc_get_battery_voltage_rate());
-    cJSON_AddNumberToObject(subJson, "batteryVoltage", misc_get_battery_voltage());
-    cJSON_AddStringToObject(subJson, "snapType", snapType);
-    cJSON_AddStringToObject(subJson, "localtime", time);
+    mqtt_add_device_values(subJson, node);
     cJSON_AddNumberToObject(subJson, "imageSize", picSize + strlen(header));
     cJSON_AddStringToObject(subJson, "image", mqtt->sendBuf);
     cJSON_AddNumberToObject(json, "ts", node->pts);
     cJSON_AddItemToObject(json, "values", subJson);
     str = cJSON_PrintUnformatted(json);
     // ESP_LOGI(TAG, "mqtt_send_by_json: topic=%s, qos=%d", mqtt->mqtt.topic, mqtt->mqtt.qos);
-    if (iot_mip_dm_is_enable()) {
-        res = iot_mip_dm_uplink_picture(str);
-    } else {
-        res = esp_mqtt_client_publish(mqtt->client, mqtt->mqtt.topic, str, 0, mqtt->mqtt.qos, 0);
-        if (mqtt->mqtt.qos == 0) {
-            vTaskDelay(pdMS_TO_TICKS(500));
-        }
-    }
+    res = mqtt_send_str(mqtt, str);
     cJSON_Delete(json); // delete the cJSON object with all its sub-objects(sub-json)
     cJSON_free(str);
     return res;
 }
 
+/**
+ * Send one chunk of an image as JSON payload
+ *
+ * The message carries the same "values" as mqtt_send_by_json() plus:
+ *   imageId     - "<snapType><pts>", identical for every chunk of one image, "p" is appended for a preview
+ *   offset      - position of this chunk in the raw JPEG (with its EXIF segment), in bytes
+ *   total       - raw JPEG size in bytes
+ *   crc32       - CRC32 of the whole raw JPEG, to verify the reassembled image
+ *   chunkCrc32  - CRC32 of the raw bytes of this chunk
+ *   chunk       - base64 of the raw bytes [offset, offset + chunkSize)
+ * Chunks are sent in order, a chunk may be repeated after a resume and the
+ * receiver should keep it only if offset equals the bytes it already has.
+ *
+ * @param mqtt MQTT state
+ * @param node Queue node containing message data, node->offset is the chunk start
+ * @param chunk Chunk data
+ * @param len Chunk length in bytes
+ * @param total Image length in bytes
+ * @param crc CRC32 of the whole image
+ * @return Non-negative on success, negative on error
+ */
+static esp_err_t mqtt_send_chunk_by_json(mdMqtt_t *mqtt, queueNode_t *node, const uint8_t *chunk, size_t len,
+                                         size_t total, uint32_t crc)
+{
+    esp_err_t res = ESP_OK;
+    size_t encSize;
+    char *str = NULL;
+    char imageId[32];
+
+    res = esp_crypto_base64_encode(mqtt->sendBuf, mqtt->sendBufSize, &encSize, chunk, len);
+    if (res < 0) {
+        ESP_LOGE(TAG, "esp_crypto_base64_encode failed: res=%d, chunk_len=%zu", res, len);
+        return ESP_FAIL;
+    }
+    snprintf(imageId, sizeof(imageId), "%c%llu%s", node->type, node->pts, node->isPreview ? "p" : "");
+    cJSON *json = cJSON_CreateObject();
+    cJSON *subJson = cJSON_CreateObject();
+    mqtt_add_device_values(subJson, node);
+    cJSON_AddStringToObject(subJson, "imageId", imageId);
+    cJSON_AddNumberToObject(subJson, "offset", node->offset);
+    cJSON_AddNumberToObject(subJson, "total", total);
+    cJSON_AddNumberToObject(subJson, "crc32", crc);
+    cJSON_AddNumberToObject(subJson, "chunkCrc32", esp_rom_crc32_le(0, chunk, len));
+    cJSON_AddStringToObject(subJson, "chunk", mqtt->sendBuf);
+    cJSON_AddNumberToObject(json, "ts", node->pts);
+    cJSON_AddItemToObject(json, "values", subJson);
+    str = cJSON_PrintUnformatted(json);
+    res = mqtt_send_str(mqtt, str);
+    cJSON_Delete(json);
+    cJSON_free(str);
+    return res;
+}
+
+/**
+ * State of a chunked upload, the ctx of chunk_upload_run()
+ */
+typedef struct mqttChunks {
+    mdMqtt_t *mqtt;
+    queueNode_t *node;
+    jpg_exif_part_t parts[2];
+    int count;
+    size_t total;
+    uint32_t crc;
+} mqttChunks_t;
+
+static size_t mqtt_chunk_data(void *ctx, size_t offset, const uint8_t **data)
+{
+    mqttChunks_t *c = (mqttChunks_t *)ctx;
+    return jpg_exif_parts_at(c->parts, c->count, offset, data);
+}
+
+static int mqtt_chunk_send(void *ctx, const uint8_t *chunk, size_t len, size_t offset)
+{
+    mqttChunks_t *c = (mqttChunks_t *)ctx;
+
+    if (!c->mqtt->isConnected) {
+        return -1;
+    }
+    c->node->offset = offset;
+    if (mqtt_send_chunk_by_json(c->mqtt, c->node, chunk, len, c->total, c->crc) < 0) {
+        return -1;
+    }
+    if (mqtt_wait_published(c->mqtt) != ESP_OK) {
+        ESP_LOGW(TAG, "chunk %zu/%zu not acknowledged", offset, c->total);
+        return -1;
+    }
+    return 0;
+}
+
+static void mqtt_chunk_progress(void *ctx, size_t offset)
+{
+    mqttChunks_t *c = (mqttChunks_t *)ctx;
+    c->node->offset = offset;
+    storage_save_upload_progress(c->node);
+}
+
+/**
+ * Publish message in chunks, resuming from node->offset
+ * @param mqtt MQTT state
+ * @param node Queue node containing message data
+ * @param chunkSize Configured chunk size in bytes
+ * @return ESP_OK when the last chunk is acknowledged, ESP_FAIL on error
+ */
+static esp_err_t mqtt_publish_chunked(mdMqtt_t *mqtt, queueNode_t *node, size_t chunkSize)
+{
+    mqttChunks_t c = { .mqtt = mqtt, .node = node };
+    chunkUpload_t up = {
+        .ctx = &c,
+        .data = mqtt_chunk_data,
+        .send = mqtt_chunk_send,
+        .progress = mqtt_chunk_progress,
+    };
+    size_t offset = node->offset;
+
+    c.count = storage_node_parts(node, c.parts);
+    for (int i = 0; i < c.count; i++) {
+        c.crc = esp_rom_crc32_le(c.crc, c.parts[i].buf, c.parts[i].len);
+        c.total += c.parts[i].len;
+    }
+    up.total = c.total;
+    up.chunk_size = chunk_upload_size(chunkSize, MQTT_CHUNK_MIN_SIZE, mqtt->sendBufSize / 4 * 3);
+    if (offset) {
+        ESP_LOGI(TAG, "resume %c%llu from %zu/%zu", node->type, node->pts, offset, up.total);
+    }
+    // a chunk does not span the EXIF prefix and the frame
+    int ret = chunk_upload_run(&up, &offset);
+    node->offset = offset;
+    return ret == CHUNK_OK ? ESP_OK : ESP_FAIL;
+}
+
 /**
  * Publish message to MQTT broker
  * @param mqtt MQTT state
  * @param node Queue node containing message data
+ * @param chunkSize Resumable upload chunk size in bytes, 0 to send the whole image at once
  * @return ESP_OK on success, ESP_FAIL on error
  */
-static esp_err_t mqtt_publish(mdMqtt_t *mqtt, queueNode_t *node)
+static esp_err_t mqtt_publish(mdMqtt_t *mqtt, queueNode_t *node, size_t chunkSize)
 {
-    EventBits_t uxBits;
-    if (mqtt->isConnected) {
-        if (mqtt_send_by_json(mqtt, node) < 0) {
-            return ESP_FAIL;
-        }
-        if (mqtt->mqtt.qos == 0 || mqtt->mip != NULL) { // mqtt qos 0 or mip http upload to cloud platform does not need async wait;
-            return ESP_OK;
-        }
-    } else {
+    if (!mqtt->isConnected) {
         return ESP_FAIL;
     }
-    uxBits = xEventGroupWaitBits(g_MQ.eventGroup, MQTT_PUBLISHED_BIT, true, true, pdMS_TO_TICKS(MQTT_PUBLISHED_TIMEOUT_MS));
-    if (uxBits & MQTT_PUBLISHED_BIT) {
-        return ESP_OK;
-    } else {
+    if (chunkSize) {
+        return mqtt_publish_chunked(mqtt, node, chunkSize);
+    }
+    if (mqtt_send_by_json(mqtt, node) < 0) {
         return ESP_FAIL;
     }
+    return mqtt_wait_published(mqtt);
+}
+
+/**
+ * Publish the preview of a node and release it, the node keeps only the full image
+ * @param mqtt MQTT state
+ * @param node Queue node holding a preview
+ * @param chunkSize Resumable upload chunk size in bytes, 0 to send the whole image at once
+ * @return ESP_OK on success, ESP_FAIL on error
+ */
+static esp_err_t mqtt_publish_preview(mdMqtt_t *mqtt, queueNode_t *node, size_t chunkSize)
+{
+    queueNode_t preview = *node;
+    esp_err_t res;
+
+    preview.data = node->preview;
+    preview.len = node->previewLen;
+    preview.offset = 0;
+    preview.preview = NULL;
+    preview.previewLen = 0;
+    preview.isPreview = true;
+    res = mqtt_publish(mqtt, &preview, chunkSize);
+    free(node->preview);
+    node->preview = NULL;
+    node->previewLen = 0;
+    return res;
 }
 
 /**
@@ -319,15 +549,32 @@ static void task(mdMqtt_t *self)
                 node->pts = node->pts + (system_get_time_delta() * 1000);
                 node->ntp_sync_flag = system_get_ntp_sync_flag();
             }
+            storage_node_exif(node); // after the timestamp correction, the preview and the full image share it
             // Check upload configuration and system mode to decide upload behavior
             uploadAttr_t upload;
+            uint32_t budget = 0;
             cfg_get_upload_attr(&upload);
+            cfg_get_upload_budget(&budget);
             modeSel_e currentMode = system_get_mode();
-            
-            if (upload.uploadMode == 0 || currentMode == MODE_UPLOAD) { //
+            // base64 makes the message 4/3 of the image
+            uint32_t estimateMs = link_est_upload_ms(node->len / 3 * 4);
+
+            if (node->preview && self->out && (upload.uploadMode == 0 || currentMode == MODE_UPLOAD)) {
+                // The preview goes up now, the full image to flash for the archive
+                ESP_LOGI(TAG, "PUSH PREVIEW %d bytes, full image %d bytes to flash", node->previewLen, node->len);
+                if (mqtt_publish_preview(self, node, upload.chunkSize) != ESP_OK) {
+                    ESP_LOGW(TAG, "PUSH PREVIEW FAIL");
+                }
+                xQueueSend(self->out, &node, portMAX_DELAY);
+            } else if (upload.uploadMode == 0 && currentMode != MODE_UPLOAD && budget && self->out &&
+                estimateMs > budget * 1000) {
+                // Instant upload would not finish within the time budget, leave it to the scheduled upload
+                ESP_LOGI(TAG, "PUSH DEFER, estimate %lu ms > budget %lu s", estimateMs, budget);
+                xQueueSend(self->out, &node, portMAX_DELAY);
+            } else if (upload.uploadMode == 0 || currentMode == MODE_UPLOAD) { //
                 // Instant upload mode, or upload mode - attempt immediate upload
                 ESP_LOGI(TAG, "PUSH ... (mode: %d, uploadMode: %d)", currentMode, upload.uploadMode);
-                if (mqtt_publish(self, node) != ESP_OK) {
+                if (mqtt_publish(self, node, upload.chunkSize) != ESP_OK) {
                     if (self->out) {
                         ESP_LOGI(TAG, "PUSH FAIL, Save to flash");
                         xQueueSend(self->out, &node, portMAX_DELAY);
@@ -651,17 +898,98 @@ int8_t mqtt_mip_publish(const char *topic, const char *msg, int timeout)
     return 0;
 }
 
+/**
+ * Pass a whole downlink to the MIP callback, which takes a string
+ * @param ctx Pointer to mdMqtt_t state
+ * @param msg Downlink, in RAM or spilled
+ */
+static void mqtt_notify_message(void *ctx, const mqttRxMsg_t *msg)
+{
+    mdMqtt_t *mqtt = (mdMqtt_t *)ctx;
+    char *str = (char *)msg->data;
+
+    if (mqtt->sub.notify_cb == NULL) {
+        return;
+    }
+    if (str == NULL) {
+        str = malloc(msg->len + 1);
+        if (str == NULL) {
+            ESP_LOGE(TAG, "no memory for the %u bytes of %s", (unsigned)msg->len, msg->topic);
+            return;
+        }
+        if (mqtt_rx_msg_read(msg, 0, str, msg->len) != msg->len) {
+            ESP_LOGE(TAG, "read back of %s failed", msg->topic);
+            free(str);
+            return;
+        }
+        str[msg->len] = '\0';
+    }
+    if (memchr(str, '\0', msg->len) != NULL) {
+        ESP_LOGW(TAG, "binary downlink on %s dropped, no consumer takes it", msg->topic);
+    } else {
+        mqtt->sub.notify_cb((char *)msg->topic, str);
+    }
+    if (str != (char *)msg->data) {
+        free(str);
+    }
+}
+
+/**
+ * Create the downlink reassembly, the registered consumers first, the MIP callback for the rest
+ * @param m MQTT module state
+ * @return 0 on success, negative on error
+ */
+static int8_t mqtt_recv_open(mdMqtt_t *m)
+{
+    mqttRxConfig_t config = {
+        .ram_budget = MQTT_RECV_RAM_BUDGET,
+        .ram_max = MQTT_RECV_BUFFER_SIZE,
+        .spill_dir = STORAGE_ROOT,
+    };
+    mqttRxConsumer_t notify = {
+        .filter = "#",
+        .max_len = MQTT_NOTIFY_MAX_SIZE,
+        .ctx = m,
+        .message = mqtt_notify_message,
+    };
+
+    mqtt_rx_free(m->rx);
+    m->rx = mqtt_rx_new(&config);
+    if (m->rx == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < g_consumerCnt; i++) {
+        mqtt_rx_register(m->rx, &g_consumers[i]);
+    }
+    mqtt_rx_register(m->rx, &notify);
+    return 0;
+}
+
+int8_t mqtt_register_consumer(const mqttRxConsumer_t *consumer)
+{
+    if (g_consumerCnt == (int)(sizeof(g_consumers) / sizeof(g_consumers[0]))) {
+        return -1;
+    }
+    g_consumers[g_consumerCnt++] = *consumer;
+    return 0;
+}
+
 int8_t mqtt_mip_start(mqtt_t *mqtt, sub_notify_cb cb, connect_status_cb status_cb)
 {
     g_MQ.sub.notify_cb = cb;
     g_MQ.status_cb = status_cb;
     g_MQ.mip = mqtt;
-    g_MQ.recvBuf = mip_malloc(MQTT_RECV_BUFFER_SIZE);
+    if (mqtt_recv_open(&g_MQ) != 0) {
+        ESP_LOGE(TAG, "mqtt_recv_open failed");
+        return -1;
+    }
     mqtt_mip_config(&g_MQ);
 
     g_MQ.client = esp_mqtt_client_init(&g_MQ.cfg);
     if (!g_MQ.client) {
         ESP_LOGE(TAG, "esp_mqtt_client_init failed");
+        mqtt_rx_free(g_MQ.rx);
+        g_MQ.rx = NULL;
         return -1;
     }
     esp_mqtt_client_register_event(g_MQ.client, ESP_EVENT_ANY_ID, mqtt_event_handler, &g_MQ);
@@ -684,7 +1012,8 @@ int8_t mqtt_mip_stop(void)
         g_MQ.sub.notify_cb = NULL;
     }
     esp_mqtt_client_destroy(g_MQ.client);
-    mip_free((void **)&g_MQ.recvBuf);
+    mqtt_rx_free(g_MQ.rx);
+    g_MQ.rx = NULL;
     g_MQ.client = NULL;
     return 0;
 }
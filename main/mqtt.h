@@ -3,6 +3,7 @@
 
 #include "system.h"
 #include "mip.h"
+#include "mqtt_rx.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -49,6 +50,13 @@ void mqtt_restart();
  */
 int8_t mqtt_mip_start(mqtt_t *mqtt, sub_notify_cb cb, connect_status_cb status_cb);
 
+/**
+ * Register a consumer of the downlinks of a topic filter, before the MIP callback gets them
+ * @param consumer Consumer, copied; taken from the next mqtt_mip_start
+ * @return 0 on success, negative if MQTT_RX_CONSUMERS - 1 are registered already
+ */
+int8_t mqtt_register_consumer(const mqttRxConsumer_t *consumer);
+
 /**
  * Stop MIP MQTT connection
  * @return 0 on success, negative on error
@@ -129,6 +129,8 @@ esp_err_t ota_vertify(char *header_data, size_t header_size, size_t ota_size)
  */
 esp_err_t ota_start(otaHandle_t *handle, size_t size)
 {
+    handle->offset = 0;
+    handle->resumed = false;
     handle->update_partition = esp_ota_get_next_update_partition(NULL);
     assert(handle->update_partition != NULL);
     ESP_LOGI(TAG, "Writing to partition subtype %d at offset 0x%lx, size %lu",
@@ -142,6 +144,30 @@ esp_err_t ota_start(otaHandle_t *handle, size_t size)
     return err;
 }
 
+/**
+ * @brief Resume an OTA update begun before the last reset or deep sleep
+ *
+ * esp_ota_begin erased the whole image size, so the rest of the image is written
+ * straight to the partition, the ESP OTA handle being lost with the reset
+ * @param handle OTA handle to initialize
+ * @param offset Bytes of the image already written
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_resume(otaHandle_t *handle, size_t offset)
+{
+    handle->update_handle = 0;
+    handle->offset = offset;
+    handle->resumed = true;
+    handle->update_partition = esp_ota_get_next_update_partition(NULL);
+    if (handle->update_partition == NULL || offset >= handle->update_partition->size) {
+        ESP_LOGE(TAG, "no update partition to resume at %u", offset);
+        return ESP_ERR_INVALID_STATE;
+    }
+    ESP_LOGI(TAG, "Resuming partition subtype %d at offset 0x%lx, image offset %u",
+             handle->update_partition->subtype, handle->update_partition->address, offset);
+    return ESP_OK;
+}
+
 /**
  * @brief Write chunk of OTA data
  * @param handle Initialized OTA handle
@@ -151,11 +177,18 @@ esp_err_t ota_start(otaHandle_t *handle, size_t size)
  */
 esp_err_t ota_run(otaHandle_t *handle, void *data, size_t size)
 {
-    esp_err_t err = esp_ota_write(handle->update_handle, (const void *)data, size);
+    esp_err_t err;
+    if (handle->resumed) {
+        err = esp_partition_write(handle->update_partition, handle->offset, data, size);
+    } else {
+        err = esp_ota_write(handle->update_handle, (const void *)data, size);
+    }
     if (err != ESP_OK) {
-        esp_ota_abort(handle->update_handle);
+        ota_abort(handle);
         ESP_LOGE(TAG, "ota_run failed (%s)!", esp_err_to_name(err));
+        return err;
     }
+    handle->offset += size;
     return err;
 }
 
@@ -166,7 +199,8 @@ esp_err_t ota_run(otaHandle_t *handle, void *data, size_t size)
  */
 esp_err_t ota_stop(otaHandle_t *handle)
 {
-    esp_err_t err = esp_ota_end(handle->update_handle);
+    // a resumed image has no ESP OTA handle, esp_ota_set_boot_partition validates it
+    esp_err_t err = handle->resumed ? ESP_OK : esp_ota_end(handle->update_handle);
     if (err != ESP_OK) {
         if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
             ESP_LOGE(TAG, "Image validation failed, image is corrupted");
@@ -182,6 +216,17 @@ esp_err_t ota_stop(otaHandle_t *handle)
     return err;
 }
 
+/**
+ * @brief Drop an unfinished OTA update
+ * @param handle Initialized OTA handle
+ */
+void ota_abort(otaHandle_t *handle)
+{
+    if (!handle->resumed) {
+        esp_ota_abort(handle->update_handle);
+    }
+}
+
 /**
  * @brief Perform complete OTA update in one operation
  * @param data Pointer to complete OTA image data
@@ -18,10 +18,14 @@ extern "C" {
  * @brief OTA update handle structure
  * @param update_handle ESP OTA update handle
  * @param update_partition Pointer to partition being updated
+ * @param offset Bytes of the image written to the partition
+ * @param resumed Writing goes on with an image begun before the last reset, without an ESP OTA handle
  */
 typedef struct otaHandle {
     esp_ota_handle_t update_handle;
     const esp_partition_t *update_partition;
+    size_t offset;
+    bool resumed;
 } otaHandle_t;
 
 /**
@@ -41,6 +45,14 @@ esp_err_t ota_vertify(char *header_data, size_t header_size, size_t ota_size);
  */
 esp_err_t ota_start(otaHandle_t *handle, size_t size);
 
+/**
+ * @brief Resume an OTA update begun by ota_start before the last reset or deep sleep
+ * @param handle Pointer to OTA handle structure
+ * @param offset Bytes of the image already written to the update partition
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_resume(otaHandle_t *handle, size_t offset);
+
 /**
  * @brief Write OTA data chunk
  * @param handle Pointer to OTA handle structure
@@ -57,6 +69,12 @@ esp_err_t ota_run(otaHandle_t *handle, void *data, size_t size);
  */
 esp_err_t ota_stop(otaHandle_t *handle);
 
+/**
+ * @brief Drop an unfinished OTA update, the data written stays in the partition for ota_resume
+ * @param handle Pointer to OTA handle structure
+ */
+void ota_abort(otaHandle_t *handle);
+
 /**
  * @brief Perform complete OTA update
  * @param data Pointer to OTA image data
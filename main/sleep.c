@@ -16,6 +16,7 @@
 #include "esp_sleep.h"
 #include "esp_log.h"
 #include "driver/rtc_io.h"
+#include "driver/temperature_sensor.h"
 #include "soc/rtc.h"
 #include "sleep.h"
 #include "config.h"
@@ -27,6 +28,9 @@
 #include "mqtt.h"
 #include "pir.h"
 #include "net_module.h"
+#include "debug.h"
+#include "wake_sched.h"
+#include "drift_fit.h"
 
 #define TAG "-->SLEEP"  // Logging tag
 
@@ -34,19 +38,41 @@
 #define uS_TO_S_FACTOR 1000000ULL          // Microseconds to seconds conversion
 
 
-#define MAX_HISTORY   5      // Keep last 5 error records
-#define WRITE_CFG_CNT 10    // Every 20 records are written to config.
-#define ALPHA 0.4f  // Error value smoothing factor (0-1), the larger the value, the higher the weight of recent data
+#define WAKEUP_JOB_MAX 8     // One job slot per priority, 0 is the highest priority
+#define TIMED_NODE_MAX 10    // Most time nodes of a job, as the upload has
+
+#define WRITE_CFG_CNT 10    // Every 10 records are written to config.
+#define DRIFT_MAX_RATE 0.1f // A larger error rate is not clock drift, the sample is discarded
+#define DRIFT_MIN_DELTA_S 300 // Shorter intervals are dominated by the 1s resolution of the time source
+#define DRIFT_SEED_DELTA_S 3600 // The error rate stored in config seeds the fit as one sample of this length
 
 /* Time compensation controller structure
- * Maintains timing references and error history for drift compensation */
+ * Drift fit against the system time between two syncs and the chip temperature over it,
+ * the temperature is read before each sleep and averaged over the sleep seconds */
 typedef struct {
     time_t real_prev;       // Last synchronized real time
-    float errors[MAX_HISTORY]; // Error rate history (circular buffer)
-    int err_index;         // Current index in error buffer
-    int err_count;         // Valid error records count
+    driftFit_t fit;         // Drift fit, see drift_fit.h
+    float temp_prev;        // Chip temperature at the last sync, NAN if unknown
+    float temp_sum;         // Chip temperatures read before each sleep since the last sync, times the sleep seconds
+    uint32_t temp_secs;     // Sleep seconds of temp_sum
     uint32_t total_count;         // Total records count
 } TimeCompensator;
+
+/* Timer wakeup statistics, an early wakeup boots only to go back to sleep */
+typedef struct {
+    uint32_t timer_count;   // Timer wakeups
+    uint32_t early_count;   // Timer wakeups before the planned time
+    uint32_t early_seconds; // Total seconds woken too early
+} WakeupStats;
+/**
+ * Wakeup job, one slot per priority in the RTC job table
+ */
+typedef struct wakeupJob {
+    uint8_t todo;           // wakeupTodo_e, WAKEUP_TODO_NOTHING if the slot is free
+    bool asap;              // Queued to run in the next wake rather than planned for its due time
+    time_t due;             // Time the job was due when it was queued
+} wakeupJob_t;
+
 /**
  * Sleep module state structure
  */
@@ -55,62 +81,69 @@ typedef struct mdSleep {
 } mdSleep_t;
 
 // RTC memory preserved variables
-static RTC_DATA_ATTR uint32_t g_wakeupTodo = 0;  // each 4 bits represent one action, 8 actions total, 32 bits total, lower bits have higher priority
+static RTC_DATA_ATTR wakeupJob_t g_wakeupJobs[WAKEUP_JOB_MAX] = {0};  // indexed by priority, lower index has higher priority
 static RTC_DATA_ATTR time_t g_lastCapTime = 0;          // Timestamp of last capture
 static RTC_DATA_ATTR time_t g_lastUploadTime = 0;       // Timestamp of last upload
 static RTC_DATA_ATTR time_t g_lastScheduleTime = 0;      // Timestamp of last schedule
+static RTC_DATA_ATTR time_t g_jobDoneDue[WAKEUP_JOB_MAX] = {0};  // Due time of the last job taken, indexed by wakeupTodo_e
 static RTC_DATA_ATTR time_t g_willWakeupTime = 0;       // Timestamp of will wakeup
 static RTC_DATA_ATTR TimeCompensator g_TimeCompensator = {0};
+static RTC_DATA_ATTR WakeupStats g_wakeupStats = {0};
 
 static mdSleep_t g_sleep = {0};  // Global sleep state
 
-/* Initialize compensation controller */
-void comp_init()
+/**
+ * @brief Read the chip temperature
+ * @return Celsius, NAN if it can not be read
+ */
+static float chip_temperature(void)
 {
-    int32_t err_rate;
-    g_TimeCompensator.real_prev = 0;
-    g_TimeCompensator.err_index = 0;
-    g_TimeCompensator.err_count = 0;
-    g_TimeCompensator.total_count = 0;
-    for(int i=0; i<MAX_HISTORY; i++) g_TimeCompensator.errors[i] = 0;
+    temperature_sensor_handle_t sensor = NULL;
+    temperature_sensor_config_t config = TEMPERATURE_SENSOR_CONFIG_DEFAULT(-10, 80);
+    float celsius = NAN;
 
-    cfg_get_time_err_rate(&err_rate);
-    if(err_rate != 0){
-        g_TimeCompensator.err_count = 1;
-        g_TimeCompensator.errors[0] = err_rate / (float)(10000);
-        g_TimeCompensator.err_index = 1;
-        ESP_LOGI(TAG, "Default error rate: %.2f%%", g_TimeCompensator.errors[0]*100);
+    if (temperature_sensor_install(&config, &sensor) != ESP_OK) {
+        return NAN;
+    }
+    if (temperature_sensor_enable(sensor) == ESP_OK) {
+        if (temperature_sensor_get_celsius(sensor, &celsius) != ESP_OK) {
+            celsius = NAN;
+        }
+        temperature_sensor_disable(sensor);
     }
+    temperature_sensor_uninstall(sensor);
+    return celsius;
 }
 
-/* Calculate smoothed error rate using moving average
- * @return Weighted error rates */
-static float get_smoothed_error() 
+/* Mean chip temperature over the sleeps since the last sync, NAN if unknown */
+static float comp_mean_temp(void)
 {
-    if(g_TimeCompensator.err_count == 0) {
-        ESP_LOGD(TAG, "No error history available");
-        return 0.0f;
-    }
+    TimeCompensator *c = &g_TimeCompensator;
+    return c->temp_secs ? c->temp_sum / c->temp_secs : c->temp_prev;
+}
 
-    float weighted_error = 0;
-    float total_weight = 0;
-    float weight = 1.0f;  // Initial weights for recent data
-    
-    // Calculate the weighted average from the newest to the oldest data
-    for(int i = 0; i < g_TimeCompensator.err_count; i++) {
-        int idx = (g_TimeCompensator.err_index - 1 - i + MAX_HISTORY) % MAX_HISTORY;
-        weighted_error += g_TimeCompensator.errors[idx] * weight;
-        total_weight += weight;
-        weight *= (1.0f - ALPHA);  // Gradually decay weight
-        
-        ESP_LOGD(TAG, "[%d] err=%.2f%% weight=%.2f", 
-                i, g_TimeCompensator.errors[idx]*100, weight);
-    }
+/* Start a sync interval: no sleep temperature yet, the interval starts at the chip temperature now */
+static void comp_start_interval(time_t real_now)
+{
+    g_TimeCompensator.real_prev = real_now;
+    g_TimeCompensator.temp_prev = chip_temperature();
+    g_TimeCompensator.temp_sum = 0;
+    g_TimeCompensator.temp_secs = 0;
+}
 
-    float result = weighted_error / total_weight;
-    ESP_LOGI(TAG, "Weighted error: %.2f%% (α=%.1f, %d samples)", 
-            result*100, ALPHA, g_TimeCompensator.err_count);
-    return result;
+/* Initialize compensation controller */
+void comp_init()
+{
+    int32_t err_rate;
+    memset(&g_TimeCompensator, 0, sizeof(g_TimeCompensator));
+    drift_fit_reset(&g_TimeCompensator.fit);
+    g_TimeCompensator.temp_prev = NAN;
+
+    cfg_get_time_err_rate(&err_rate);
+    if(err_rate != 0){
+        drift_fit_add(&g_TimeCompensator.fit, DRIFT_SEED_DELTA_S, DRIFT_SEED_DELTA_S * (err_rate / 10000.0), NAN, NAN, 1.0);
+        ESP_LOGI(TAG, "Default error rate: %.2f%%", g_TimeCompensator.fit.rate*100);
+    }
 }
 
 /* Process time synchronization event
@@ -121,7 +154,7 @@ void record_time_sync(time_t real_now, time_t sys_now)
     ESP_LOGI(TAG,"Sync event - real: %lld, sys: %lld", real_now, sys_now);
     // Initial synchronization
     if(g_TimeCompensator.real_prev == 0) {
-        g_TimeCompensator.real_prev = real_now;
+        comp_start_interval(real_now);
         return;
     }
 
@@ -132,51 +165,51 @@ void record_time_sync(time_t real_now, time_t sys_now)
 
     // Handle abnormal cases (time rollback)
     if(delta_sys <= 0 || delta_real < 0) {
-        g_TimeCompensator.err_count = 0;  // Reset error history
-        g_TimeCompensator.real_prev = real_now;
+        comp_init();  // Restart the fit from the stored rate
+        comp_start_interval(real_now);
         return;
     }
 
     // Calculate error rate: (real_delta - sys_delta)/sys_delta
     float err_rate = (delta_real - delta_sys)/(float)delta_sys;
     //If the error rate exceeds the threshold or the time delta is too small, the data will be discarded.
-    if( (delta_real < 300 || delta_sys < 300) || 
-        err_rate < -0.1f || err_rate > 0.1f){
-        g_TimeCompensator.real_prev = real_now;
+    if( (delta_real < DRIFT_MIN_DELTA_S || delta_sys < DRIFT_MIN_DELTA_S) || 
+        err_rate < -DRIFT_MAX_RATE || err_rate > DRIFT_MAX_RATE){
+        comp_start_interval(real_now);
         return;
     }
-    ESP_LOGI(TAG, "New error rate calculated: %.2f%%", err_rate*100);
+    float mean_temp = comp_mean_temp();
+    ESP_LOGI(TAG, "New error rate calculated: %.2f%%, predicted %+.1fs, measured %+llds, %.1fC", err_rate*100,
+             drift_fit_predict(&g_TimeCompensator.fit, delta_sys, g_TimeCompensator.temp_prev),
+             delta_real - delta_sys, mean_temp);
 
-    // Update circular buffer
-    g_TimeCompensator.errors[g_TimeCompensator.err_index] = err_rate;
-    g_TimeCompensator.err_index = (g_TimeCompensator.err_index + 1) % MAX_HISTORY;
-    if(g_TimeCompensator.err_count < MAX_HISTORY) g_TimeCompensator.err_count++;
+    driftFit_t *fit = &g_TimeCompensator.fit;
+    drift_fit_add(fit, delta_sys, delta_real - delta_sys, mean_temp, g_TimeCompensator.temp_prev, 1.0);
+    ESP_LOGI(TAG, "Drift fit: rate=%.3f%% offset=%+.1fs temp=%+.4f%%/C margin=%.3f%% (weight %.2f)",
+             fit->rate * 100, fit->offset, fit->temp_coef * 100, fit->margin * 100, fit->sw);
 
     g_TimeCompensator.total_count++;
     if((g_TimeCompensator.total_count % WRITE_CFG_CNT) == 0){
-        int32_t w_rate = (int32_t)(get_smoothed_error() * 10000);
+        int32_t w_rate = (int32_t)(g_TimeCompensator.fit.rate * 10000);
         cfg_set_time_err_rate(w_rate);
-        ESP_LOGI(TAG, "write cfg rate: %.2f%%", (float)(w_rate/100));
+        ESP_LOGI(TAG, "write cfg rate: %.2f%%", w_rate / 100.0f);
     }
     // Update time references
-    g_TimeCompensator.real_prev = real_now;
+    comp_start_interval(real_now);
 }
 
 /**
- * @brief Calculate the time compensation value based on historical error
+ * @brief Calculate the time compensation value based on the drift fit
  * @param interval The nominal sleep interval in seconds
+ * @param temp Chip temperature expected over the interval, NAN if unknown
+ * @param bSleep Compensate a sleep, by the error margin less so that it ends late rather than early
  * @return The calculated compensation value in seconds (positive means system is slow, negative means fast)
  */
-static int calculate_compensation(time_t interval)
+static int calculate_compensation(time_t interval, float temp, bool bSleep)
 {
-    float err = get_smoothed_error();
-    
-    // When the sleep time is too long, manually compensate for the error to make the system wake up later.
-    if(interval > (5 * 3600)){
-        err -= 0.001f;
-    }
-    // Calculate raw compensation value (in seconds)
-    float compensation = interval * err;  // err = (real_delta - sys_delta)/sys_delta
+    // Predicted drift over the interval (in seconds), err = (real_delta - sys_delta)/sys_delta
+    float compensation = bSleep ? drift_fit_predict_safe(&g_TimeCompensator.fit, interval, temp)
+                                : drift_fit_predict(&g_TimeCompensator.fit, interval, temp);
     
     // Apply safety bounds (adjust these values as needed)
     const float MAX_COMPENSATION = interval * 0.3f; // Limit to ±30% of interval
@@ -192,8 +225,8 @@ static int calculate_compensation(time_t interval)
     int final_compensation = (int)(compensation + (compensation > 0 ? 0.5f : -0.5f));
     
 
-    ESP_LOGI(TAG, "Compensation calc: nominal=%lld, err=%.3f%%, comp=%+.1fs (%+ds)", 
-             interval, err*100, compensation, final_compensation);
+    ESP_LOGI(TAG, "Compensation calc: nominal=%lld, rate=%.3f%%, offset=%+.1fs, temp=%.1fC, comp=%+.1fs (%+ds)", 
+             interval, g_TimeCompensator.fit.rate*100, g_TimeCompensator.fit.offset, temp, compensation, final_compensation);
     
     return final_compensation;
 }
@@ -208,7 +241,7 @@ void time_compensation_boot()
     if(now <= g_TimeCompensator.real_prev || g_TimeCompensator.real_prev == 0)
         return;
 
-    int predicted_drift = calculate_compensation(now - g_TimeCompensator.real_prev);
+    int predicted_drift = calculate_compensation(now - g_TimeCompensator.real_prev, comp_mean_temp(), false);
     time_t adjusted_time = now + predicted_drift;
 
     ESP_LOGI(TAG, "Boot time adjustment: sys=%lld, pred=%lld (drift=%ds)",
@@ -225,7 +258,7 @@ int time_compensation(time_t time_sec)
     if(time_sec <= g_TimeCompensator.real_prev || g_TimeCompensator.real_prev == 0)
         return 0;
 
-    int predicted_drift = calculate_compensation(time_sec - g_TimeCompensator.real_prev);
+    int predicted_drift = calculate_compensation(time_sec - g_TimeCompensator.real_prev, comp_mean_temp(), false);
 
     ESP_LOGI(TAG, "compensation drift=%ds", predicted_drift);
     return predicted_drift;
@@ -235,48 +268,42 @@ int time_compensation(time_t time_sec)
  * Find the most recent time interval for scheduled wakeups
  * @param timedCount Number of scheduled time nodes
  * @param timedNodes Array of scheduled time configurations
+ * @param todo Job the times are for, the times up to the due time of its last run are skipped
+ * @param now Current time
  * @return Seconds until next scheduled wakeup
  */
-static uint32_t find_most_recent_time_interval(uint8_t timedCount, const timedNode_t *timedNodes)
+static uint32_t find_most_recent_time_interval(uint8_t timedCount, const timedNode_t *timedNodes,
+                                               wakeupTodo_e todo, time_t now)
 {
     int Hour, Minute, Second;
     struct tm timeinfo;
-    uint8_t i = 0;
-    time_t now;
-    time_t tmp;
-    time_t now2sunday;
-    time_t intervalSeconds = 0;
+    wakeTime_t times[TIMED_NODE_MAX];
+    int count = 0;
+    time_t ref = now;
 
-    time(&now);
-    localtime_r(&now, &timeinfo);
-    // Calculate seconds since last Sunday 00:00:00
-    now2sunday = ((timeinfo.tm_wday * 24 + timeinfo.tm_hour) * 60 + timeinfo.tm_min) * 60 + timeinfo.tm_sec;
-    
-    for (i = 0; i < timedCount; i++) {
+    // a job coalesced into an earlier wake already ran for this due time
+    time_t after = g_jobDoneDue[todo] + 1;
+    if (after > now && after - now < WAKE_SCHED_WEEK) {
+        ref = after;
+    }
+    localtime_r(&ref, &timeinfo);
+
+    for (uint8_t i = 0; i < timedCount && count < TIMED_NODE_MAX; i++) {
         if (sscanf(timedNodes[i].time, "%02d:%02d:%02d", &Hour, &Minute, &Second) != 3) {
             ESP_LOGE(TAG, "invalid date %s", timedNodes[i].time);
             continue;
         }
-        
-        if (timedNodes[i].day < 7) { // Day of week specified
-            tmp = ((timedNodes[i].day * 24 + Hour) * 60 + Minute) * 60 + Second;
-            if (tmp < now2sunday) { // Time is in past, schedule for next week
-                tmp += 7 * 24 * 60 * 60; // Add one week
-            }
-        } else { // Daily schedule
-            tmp = ((timeinfo.tm_wday * 24 + Hour) * 60 + Minute) * 60 + Second;
-            if (tmp < now2sunday) { // Time is in past, schedule for next day
-                tmp += 1 * 24 * 60 * 60; // Add one day
-            }
-        }
-        
-        if (intervalSeconds == 0) {
-            intervalSeconds = tmp - now2sunday;
-        } else {
-            intervalSeconds = MIN(intervalSeconds, (tmp - now2sunday)); // Find nearest wakeup time
-        }
+        times[count].day = timedNodes[i].day < 7 ? timedNodes[i].day : WAKE_SCHED_DAILY;
+        times[count].sec = (Hour * 60 + Minute) * 60 + Second;
+        count++;
+    }
+    // Seconds since last Sunday 00:00:00
+    int32_t wait = wake_sched_next_time(times, count, ((timeinfo.tm_wday * 24 + timeinfo.tm_hour) * 60 +
+                                                       timeinfo.tm_min) * 60 + timeinfo.tm_sec);
+    if (wait < 0) {
+        return 0;
     }
-    return timedCount ? MAX(intervalSeconds, 1) : 0; // Ensure minimum 1 second interval
+    return MAX(ref - now + wait, 1); // Ensure minimum 1 second interval
 }
 
 /**
@@ -333,25 +360,16 @@ static uint32_t calculate_capture_wakeup(const capAttr_t *capture, time_t lastCa
 
         ESP_LOGD(TAG, "Capture interval mode: %lu seconds", interval_sec);
 
-        // Handle missed captures
-        if (lastCapTime && lastCapTime > 0) {
-            if (now >= lastCapTime + interval_sec) {
-                ESP_LOGI(TAG, "Missed capture window, triggering immediate capture");
-                return 1; // Capture immediately if missed window
-            } else {
-                uint32_t next_capture = lastCapTime + interval_sec - now;
-                ESP_LOGD(TAG, "Next capture in %lu seconds", next_capture);
-                return next_capture; // Time until next capture
-            }
-        }
-        
         // Force immediate capture if last snapshot failed
-        if (camera_is_snapshot_fail()) {
+        if (lastCapTime <= 0 && camera_is_snapshot_fail()) {
             ESP_LOGI(TAG, "Last snapshot failed, triggering immediate retry");
             return 1; 
         }
-        
-        return interval_sec;
+
+        // Capture immediately if the window was missed
+        uint32_t next_capture = wake_sched_interval(interval_sec, lastCapTime, now);
+        ESP_LOGD(TAG, "Next capture in %lu seconds", next_capture);
+        return next_capture;
     } else if (capture->scheCapMode == 0) {
         // Time-based capture mode
         if (capture->timedCount == 0) {
@@ -359,7 +377,7 @@ static uint32_t calculate_capture_wakeup(const capAttr_t *capture, time_t lastCa
             return 0;
         }
         ESP_LOGD(TAG, "Time-based capture mode with %d scheduled times", capture->timedCount);
-        return find_most_recent_time_interval(capture->timedCount, capture->timedNodes);
+        return find_most_recent_time_interval(capture->timedCount, capture->timedNodes, WAKEUP_TODO_SNAPSHOT, now);
     } else {
         ESP_LOGW(TAG, "Unknown capture schedule mode: %d", capture->scheCapMode);
     }
@@ -395,7 +413,7 @@ static uint32_t calculate_upload_wakeup(const uploadAttr_t *upload, time_t lastU
             return 0;
         }
         ESP_LOGD(TAG, "Time-based upload with %d scheduled times", upload->timedCount);
-        return find_most_recent_time_interval(upload->timedCount, upload->timedNodes);
+        return find_most_recent_time_interval(upload->timedCount, upload->timedNodes, WAKEUP_TODO_UPLOAD, now);
     } else {
         ESP_LOGW(TAG, "Scheduled upload mode enabled but no timed configuration found");
     }
@@ -413,7 +431,10 @@ static uint32_t calculate_upload_wakeup(const uploadAttr_t *upload, time_t lastU
 static uint32_t calculate_schedule_wakeup(const timedNode_t *scheTimeNode, time_t lastScheduleTime, time_t now)
 {
     time_t tmp;
-    tmp = find_most_recent_time_interval(1, scheTimeNode);
+    tmp = find_most_recent_time_interval(1, scheTimeNode, WAKEUP_TODO_SCHEDULE, now);
+    if (tmp == 0) {
+        return 0;
+    }
     // if the next schedule time is less than 3 hours from the last schedule time, next day schedule
     if (now + tmp < lastScheduleTime + 3 * 60 * 60) {
         return tmp + 24 * 60 * 60;
@@ -422,33 +443,81 @@ static uint32_t calculate_schedule_wakeup(const timedNode_t *scheTimeNode, time_
     }
 }
 /**
- * Update the wakeup todo list with the earliest wakeup time and corresponding action with automatic conflict resolution
+ * Queue a job into the wakeup job table
+ * @param todo Action to perform
+ * @param priority Priority of the action, 0 is the highest priority, 7 is the lowest priority
+ * @param due Time the job is due
+ * @param asap Run the job in the next wake, a second away, rather than at its due time
+ */
+static void wakeup_job_set(wakeupTodo_e todo, uint8_t priority, time_t due, bool asap)
+{
+    if (priority >= WAKEUP_JOB_MAX) {
+        priority = WAKEUP_JOB_MAX - 1;
+    }
+    g_wakeupJobs[priority].todo = todo;
+    g_wakeupJobs[priority].asap = asap;
+    g_wakeupJobs[priority].due = due;
+}
+
+/**
+ * Log the wakeup job table
+ */
+static void wakeup_job_show(void)
+{
+    for (uint8_t priority = 0; priority < WAKEUP_JOB_MAX; priority++) {
+        if (g_wakeupJobs[priority].todo != WAKEUP_TODO_NOTHING) {
+            ESP_LOGI(TAG, "job[%d]: todo %d, due %lld", priority, g_wakeupJobs[priority].todo, g_wakeupJobs[priority].due);
+        }
+    }
+}
+
+/**
+ * Check for a job queued to run right away rather than planned for a wake
+ * @param now Current time
+ * @return true if such a job is queued and due by now
+ */
+static bool wakeup_job_asap(time_t now)
+{
+    for (uint8_t priority = 0; priority < WAKEUP_JOB_MAX; priority++) {
+        if (g_wakeupJobs[priority].todo != WAKEUP_TODO_NOTHING && g_wakeupJobs[priority].asap &&
+            g_wakeupJobs[priority].due <= now) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Update the wakeup job table with every job that runs in the selected wake
+ * @param wakeup_time Selected wakeup time in seconds
+ * @param mask Jobs that run in the wake, from wake_sched_plan()
  * @param capture_time Capture wakeup time in seconds
  * @param upload_time Upload wakeup time in seconds  
  * @param schedule_time Schedule wakeup time in seconds
+ * @param now Current time
  */
-static void update_wakeup_todo_list(uint32_t earliest_time, uint32_t capture_time, uint32_t upload_time, uint32_t schedule_time)
+static void update_wakeup_todo_list(uint32_t wakeup_time, uint32_t mask, uint32_t capture_time, uint32_t upload_time,
+                                    uint32_t schedule_time, time_t now)
 {
-
-    // add all tasks scheduled at earliest time to queue, sorted by priority
-    if (capture_time == earliest_time) {
-        sleep_set_wakeup_todo(WAKEUP_TODO_SNAPSHOT, 0);  // highest priority
-        ESP_LOGI(TAG, "Scheduled SNAPSHOT at time %lu with priority 0", earliest_time);
+    // add all tasks coalesced into this wake to the table, sorted by priority
+    if (mask & BIT(0)) {
+        wakeup_job_set(WAKEUP_TODO_SNAPSHOT, 0, now + capture_time, false);  // highest priority
+        ESP_LOGI(TAG, "Scheduled SNAPSHOT due %lu at time %lu with priority 0", capture_time, wakeup_time);
     }
     
-    if (upload_time == earliest_time) {
-        sleep_set_wakeup_todo(WAKEUP_TODO_UPLOAD, 1);    // medium priority
-        ESP_LOGI(TAG, "Scheduled UPLOAD at time %lu with priority 1", earliest_time);
+    if (mask & BIT(1)) {
+        wakeup_job_set(WAKEUP_TODO_UPLOAD, 1, now + upload_time, false);    // medium priority
+        ESP_LOGI(TAG, "Scheduled UPLOAD due %lu at time %lu with priority 1", upload_time, wakeup_time);
     }
     
-    if (schedule_time == earliest_time) {
-        sleep_set_wakeup_todo(WAKEUP_TODO_SCHEDULE, 2);  // lowest priority
-        ESP_LOGI(TAG, "Scheduled SCHEDULE at time %lu with priority 2", earliest_time);
+    if (mask & BIT(2)) {
+        wakeup_job_set(WAKEUP_TODO_SCHEDULE, 2, now + schedule_time, false);  // lowest priority
+        ESP_LOGI(TAG, "Scheduled SCHEDULE due %lu at time %lu with priority 2", schedule_time, wakeup_time);
     }
 
-    ESP_LOGI(TAG, "Wakeup times - Capture: %lu, Upload: %lu, Schedule: %lu, Selected: %lu, Queued tasks: 0x%08lx",
-             capture_time, upload_time, schedule_time, earliest_time, g_wakeupTodo);
-
+    ESP_LOGI(TAG, "Wakeup times - Capture: %lu, Upload: %lu, Schedule: %lu, Selected: %lu",
+             capture_time, upload_time, schedule_time, wakeup_time);
+    wakeup_job_show();
 }
 
 /**
@@ -461,7 +530,9 @@ uint32_t  calc_wakeup_time_seconds(bool bUpdateWakeupTodo)
     capAttr_t capture;
     uploadAttr_t upload;
     timedNode_t scheTimeNode;
-    uint32_t earliest_wakeup = 0;
+    uint32_t wakeup_time = 0;
+    uint32_t window = 0;
+    uint32_t mask = 0;
     time_t lastCapTime = sleep_get_last_capture_time();
     time_t now = time(NULL);
 
@@ -471,9 +542,11 @@ uint32_t  calc_wakeup_time_seconds(bool bUpdateWakeupTodo)
     cfg_get_schedule_time(scheTimeNode.time);
     cfg_get_cap_attr(&capture);
     cfg_get_upload_attr(&upload);
+    cfg_get_wakeup_window(&window);
+    window = MIN(window, WAKE_SCHED_WINDOW_MAX);
     
-    ESP_LOGI(TAG, "Calculating wakeup times - Capture enabled: %d, Upload mode: %d", 
-             capture.bScheCap, upload.uploadMode);
+    ESP_LOGI(TAG, "Calculating wakeup times - Capture enabled: %d, Upload mode: %d, Window: %lus", 
+             capture.bScheCap, upload.uploadMode, window);
 
     // Calculate wakeup times for each module
     time_t lastUploadTime = sleep_get_last_upload_time();
@@ -482,29 +555,26 @@ uint32_t  calc_wakeup_time_seconds(bool bUpdateWakeupTodo)
     uint32_t upload_wakeup = calculate_upload_wakeup(&upload, lastUploadTime, now);
     uint32_t schedule_wakeup = calculate_schedule_wakeup(&scheTimeNode, lastScheduleTime, now);
     // uint32_t schedule_wakeup = find_most_recent_time_interval(1, &scheTimeNode);
-        
-    // find earliest execution time
-    if (capture_wakeup > 0 && (earliest_wakeup == 0 || capture_wakeup < earliest_wakeup)) {
-        earliest_wakeup = capture_wakeup;
-    }
-    if (upload_wakeup > 0 && (earliest_wakeup == 0 || upload_wakeup < earliest_wakeup)) {
-        earliest_wakeup = upload_wakeup;
-    }
-    if (schedule_wakeup > 0 && (earliest_wakeup == 0 || schedule_wakeup < earliest_wakeup)) {
-        earliest_wakeup = schedule_wakeup;
-    }
-
-    if (earliest_wakeup == 0) {
+    // the order gives the bits of the mask, the capture runs at its due time
+    wakeJob_t jobs[] = {
+        {capture_wakeup, true},
+        {upload_wakeup, false},
+        {schedule_wakeup, false},
+    };
+
+    // jobs due close together share one wake and one network bring-up
+    wakeup_time = wake_sched_plan(jobs, sizeof(jobs) / sizeof(jobs[0]), window, &mask);
+    if (wakeup_time == 0) {
         ESP_LOGW(TAG, "No valid wakeup times found");
         return 0;
     }
 
-    // Determine the earliest wakeup time
+    // Determine the wakeup time
     if (bUpdateWakeupTodo) {
-        update_wakeup_todo_list(earliest_wakeup, capture_wakeup, upload_wakeup, schedule_wakeup);
+        update_wakeup_todo_list(wakeup_time, mask, capture_wakeup, upload_wakeup, schedule_wakeup, now);
     }
 
-    return earliest_wakeup;
+    return wakeup_time;
 }
 
 /**
@@ -537,12 +607,21 @@ void sleep_start(void)
     int wakeup_time_sec = 0;
     int calculate_sec;
 
-    if (sleep_has_wakeup_todo()) {
+    if (wakeup_job_asap(now)) {
+        // a job queued to run right away, by the button for one, wakes in a second
         wakeup_time_sec = 1;
+    } else if (sleep_has_wakeup_todo()) {
+        // woken before the planned time, sleep the rest instead of waking again right away
+        wakeup_time_sec = MAX(g_willWakeupTime - now, 1);
     } else {
         wakeup_time_sec = calc_wakeup_time_seconds(true);
     }
-    calculate_sec = calculate_compensation(wakeup_time_sec);
+    float temp = chip_temperature();
+    calculate_sec = calculate_compensation(wakeup_time_sec, temp, true);
+    if (wakeup_time_sec > 0 && !isnan(temp)) {
+        g_TimeCompensator.temp_sum += temp * wakeup_time_sec;
+        g_TimeCompensator.temp_secs += wakeup_time_sec;
+    }
     wakeup_time_sec -= calculate_sec;
     if (wakeup_time_sec > 0) {
         esp_sleep_enable_timer_wakeup(wakeup_time_sec * uS_TO_S_FACTOR);
@@ -585,6 +664,7 @@ void sleep_start(void)
 
     mqtt_stop();
     wifi_close();
+    cat1_prepare_sleep(wakeup_time_sec > 0 ? wakeup_time_sec + calculate_sec : 0);
     cat1_close();
     
     if(capture.bAlarmInCap == true && trigger_mode == TRIGGER_MODE_PIR){
@@ -629,6 +709,27 @@ wakeupType_e sleep_wakeup_case()
         }
     }
 }
+/**
+ * Console command handler for showing timer wakeup statistics
+ * @param argc Argument count
+ * @param argv Argument values
+ * @return ESP_OK
+ */
+static int do_wakestat_cmd(int argc, char **argv)
+{
+    uint32_t early_rate = g_wakeupStats.timer_count ? g_wakeupStats.early_count * 100 / g_wakeupStats.timer_count : 0;
+    ESP_LOGI(TAG, "Timer wakeup: %lu, early: %lu = %lu%%, early total: %lus",
+             g_wakeupStats.timer_count, g_wakeupStats.early_count, early_rate, g_wakeupStats.early_seconds);
+    ESP_LOGI(TAG, "Drift fit: rate=%.3f%% offset=%+.1fs temp=%+.4f%%/C margin=%.3f%% (weight %.2f, %lu syncs)",
+             g_TimeCompensator.fit.rate * 100, g_TimeCompensator.fit.offset, g_TimeCompensator.fit.temp_coef * 100,
+             g_TimeCompensator.fit.margin * 100, g_TimeCompensator.fit.sw, g_TimeCompensator.total_count);
+    return ESP_OK;
+}
+
+static esp_console_cmd_t g_cmd[] = {
+    {"wakestat", "timer wakeup and drift statistics", NULL, do_wakestat_cmd, NULL},
+};
+
 /**
  * Initialize sleep module
  */
@@ -636,6 +737,7 @@ void sleep_open()
 {
     memset(&g_sleep, 0, sizeof(g_sleep));
     g_sleep.eventGroup = xEventGroupCreate();
+    debug_cmd_add(g_cmd, sizeof(g_cmd) / sizeof(esp_console_cmd_t));
 }
 
 /**
@@ -677,35 +779,42 @@ void sleep_clear_event_bits(sleepBits_e bits)
  */
 wakeupTodo_e sleep_get_wakeup_todo()
 {
-    ESP_LOGI(TAG, "todo queue: 0x%lx", g_wakeupTodo);
-    
-    if (g_wakeupTodo == 0) {
-        ESP_LOGI(TAG, "No wakeup todo remaining");
-        return WAKEUP_TODO_NOTHING;
-    }
-    
-    // start searching from highest priority (priority 0, bits 0-3)
-    for (uint8_t priority = 0; priority < 8; priority++) {
-        uint32_t shift_amount = priority * 4;
-        uint32_t mask = 0x0000000F << shift_amount;
-        uint32_t todo_bits = (g_wakeupTodo & mask) >> shift_amount;
+    // start searching from highest priority (priority 0)
+    for (uint8_t priority = 0; priority < WAKEUP_JOB_MAX; priority++) {
+        wakeupTodo_e todo = (wakeupTodo_e)g_wakeupJobs[priority].todo;
         
-        if (todo_bits != 0) {
-            wakeupTodo_e todo = (wakeupTodo_e)todo_bits;
-            
+        if (todo != WAKEUP_TODO_NOTHING) {
             // clear this task
-            g_wakeupTodo &= ~mask;
+            g_wakeupJobs[priority].todo = WAKEUP_TODO_NOTHING;
+            g_jobDoneDue[todo] = g_wakeupJobs[priority].due;
             
-            ESP_LOGI(TAG, "Retrieved todo %d from priority %d, remaining: 0x%lx", 
-                     todo, priority, g_wakeupTodo);
+            ESP_LOGI(TAG, "Retrieved todo %d from priority %d, due %lld", todo, priority, g_wakeupJobs[priority].due);
             return todo;
         }
     }
     
-    ESP_LOGW(TAG, "No valid todo found in queue");
+    ESP_LOGI(TAG, "No wakeup todo remaining");
     return WAKEUP_TODO_NOTHING;
 }
 
+/**
+ * Take a specific action queued for this wakeup
+ * @param todo Action to take
+ * @return true if the action was queued and is now removed, false otherwise
+ */
+bool sleep_take_wakeup_todo(wakeupTodo_e todo)
+{
+    for (uint8_t priority = 0; priority < WAKEUP_JOB_MAX; priority++) {
+        if (g_wakeupJobs[priority].todo == todo) {
+            g_wakeupJobs[priority].todo = WAKEUP_TODO_NOTHING;
+            g_jobDoneDue[todo] = g_wakeupJobs[priority].due;
+            ESP_LOGI(TAG, "Coalesced todo %d from priority %d, due %lld", todo, priority, g_wakeupJobs[priority].due);
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
  * Set action to perform after wakeup
  * @param todo Action to perform
@@ -737,23 +846,9 @@ void sleep_set_wakeup_todo(wakeupTodo_e todo, uint8_t priority)
     
     ESP_LOGI(TAG, "sleep_set_wakeup_todo %d (%s), priority %d", todo, todo_str, priority);
     
-    // ensure priority is within valid range
-    if (priority > 7) {
-        priority = 7;
-    }
-    
-    // insert task to appropriate position based on priority
-    // high priority (small value) placed in lower bits, low priority (large value) placed in higher bits
-    uint32_t shift_amount = priority * 4;
-    uint32_t mask = 0x0000000F << shift_amount;
-    
-    // clear existing task at this priority position
-    g_wakeupTodo &= ~mask;
-    
-    // insert new task
-    g_wakeupTodo |= ((uint32_t)todo & 0x0F) << shift_amount;
-    
-    ESP_LOGI(TAG, "Updated wakeup todo queue: 0x%lx", g_wakeupTodo);
+    // replace the task at this priority position, it is due right now
+    wakeup_job_set(todo, priority, time(NULL), true);
+    wakeup_job_show();
 }
 
 /**
@@ -762,17 +857,14 @@ void sleep_set_wakeup_todo(wakeupTodo_e todo, uint8_t priority)
  */
 void sleep_clear_wakeup_todo(uint8_t priority)
 {
-    if (priority > 7) {
-        priority = 7;
+    if (priority >= WAKEUP_JOB_MAX) {
+        priority = WAKEUP_JOB_MAX - 1;
     }
     
-    uint32_t shift_amount = priority * 4;
-    uint32_t mask = 0x0000000F << shift_amount;
-    
     // clear task at this priority position
-    g_wakeupTodo &= ~mask;
+    g_wakeupJobs[priority].todo = WAKEUP_TODO_NOTHING;
     
-    ESP_LOGI(TAG, "Cleared wakeup todo at priority %d, remaining: 0x%lx", priority, g_wakeupTodo);
+    ESP_LOGI(TAG, "Cleared wakeup todo at priority %d", priority);
 }
 
 /**
@@ -781,7 +873,12 @@ void sleep_clear_wakeup_todo(uint8_t priority)
  */
 bool sleep_has_wakeup_todo()
 {
-    return g_wakeupTodo != 0;
+    for (uint8_t priority = 0; priority < WAKEUP_JOB_MAX; priority++) {
+        if (g_wakeupJobs[priority].todo != WAKEUP_TODO_NOTHING) {
+            return true;
+        }
+    }
+    return false;
 }
 
 
@@ -790,7 +887,7 @@ bool sleep_has_wakeup_todo()
  */
 void sleep_reset_wakeup_todo()
 {
-    g_wakeupTodo = 0;
+    memset(g_wakeupJobs, 0, sizeof(g_wakeupJobs));
 }
 
 /**
@@ -862,4 +959,25 @@ uint32_t sleep_is_alramin_goto_restart()
 bool sleep_is_will_wakeup_time_reached(void)
 {
     return g_willWakeupTime <= time(NULL);
-}
\ No newline at end of file
+}
+
+/**
+ * Record a timer wakeup in the wakeup statistics
+ * A wakeup before the planned time means the drift was over-compensated, the short
+ * wakes taken to run a job queued right away are not counted
+ */
+void sleep_record_timer_wakeup(void)
+{
+    time_t now = time(NULL);
+
+    if (wakeup_job_asap(now)) {
+        return;
+    }
+    g_wakeupStats.timer_count++;
+    if (g_willWakeupTime > now) {
+        g_wakeupStats.early_count++;
+        g_wakeupStats.early_seconds += g_willWakeupTime - now;
+        ESP_LOGW(TAG, "Timer wakeup %llds early (%lu/%lu)", g_willWakeupTime - now,
+                 g_wakeupStats.early_count, g_wakeupStats.timer_count);
+    }
+}
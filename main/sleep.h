@@ -121,6 +121,13 @@ void sleep_start();
  */
 wakeupTodo_e sleep_get_wakeup_todo();
 
+/**
+ * Take a specific action that was coalesced into this wakeup
+ * @param todo Wakeup action
+ * @return true if the action was queued and is now removed, false otherwise
+ */
+bool sleep_take_wakeup_todo(wakeupTodo_e todo);
+
 /**
  * @param todo Wakeup action
  * @param priority Priority of the action, 0 is the highest priority, 7 is the lowest priority
@@ -186,6 +193,11 @@ time_t sleep_get_last_schedule_time(void);
  */
 uint32_t sleep_is_alramin_goto_restart();
 
+/**
+ * Record a timer wakeup in the wakeup statistics, call once per timer wakeup
+ */
+void sleep_record_timer_wakeup(void);
+
 /**
  * Check if the will wakeup time is reached
  * @return true if the time is reached, false otherwise
@@ -17,6 +17,7 @@
 // #include "esp_spiffs.h"
 #include "esp_littlefs.h"
 #include "utils.h"
+#include "config.h"
 #include "storage.h"
 #include "sleep.h"
 #include "misc.h"
@@ -25,8 +26,11 @@
 #define STORAGE_UPLOAD_START_BIT BIT(0)
 #define STORAGE_UPLOAD_STOP_BIT BIT(1)
 #define STORAGE_UPLOAD_DONE_BIT BIT(2)
+#define STORAGE_UPLOAD_PROGRESS_BIT BIT(3)
 #define STORAGE_UPLOAD_DONE_TIMEOUT_MS  (30000) // 30s
 #define PATH_MAX_lEN (266)
+#define STORAGE_PROGRESS_SUFFIX ".prg" // resumable upload progress sidecar, e.g. T1700000000000.prg
+#define STORAGE_EXIF_MAKE "CamThink"
 
 
 #define TAG "-->STROAGE"
@@ -84,6 +88,117 @@ static size_t storage_free_space()
     return 0;
 }
 
+static bool storage_parse_jpg_name(const char *name, char *type, uint64_t *pts)
+{
+    int end = 0;
+    // sscanf() alone also matches the progress sidecar, so check the whole suffix
+    if (sscanf(name, "%c%llu.jpg%n", type, pts, &end) != 2 || end == 0 || name[end] != '\0') {
+        return false;
+    }
+    return true;
+}
+
+static void storage_progress_path(char *path, size_t size, uint64_t pts, snapType_e type)
+{
+    snprintf(path, size, "%s/%c%llu%s", STORAGE_ROOT, type, pts, STORAGE_PROGRESS_SUFFIX);
+}
+
+static size_t storage_read_progress(uint64_t pts, snapType_e type, size_t total)
+{
+    char path[PATH_MAX_lEN];
+    uint32_t offset = 0;
+
+    storage_progress_path(path, sizeof(path), pts, type);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    if (fread(&offset, sizeof(offset), 1, f) != 1 || offset > total) {
+        ESP_LOGW(TAG, "invalid progress %s, restart from 0", path);
+        offset = 0;
+    }
+    fclose(f);
+    return offset;
+}
+
+static void storage_write_progress(uint64_t pts, snapType_e type, size_t offset)
+{
+    char path[PATH_MAX_lEN];
+    uint32_t value = offset;
+
+    storage_progress_path(path, sizeof(path), pts, type);
+    FILE *f = fopen(path, "w");
+    if (f) {
+        if (fwrite(&value, sizeof(value), 1, f) != 1) {
+            ESP_LOGE(TAG, "Failed to write %s", path);
+        }
+        fclose(f);
+    } else {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+    }
+}
+
+static void storage_remove_progress(uint64_t pts, snapType_e type)
+{
+    char path[PATH_MAX_lEN];
+
+    storage_progress_path(path, sizeof(path), pts, type);
+    unlink(path);
+}
+
+void storage_save_upload_progress(queueNode_t *node)
+{
+    if (node == NULL || node->from != FROM_STORAGE) {
+        return;
+    }
+    xSemaphoreTake(g_mdStorage.mutex, portMAX_DELAY);
+    storage_write_progress(node->pts, node->type, node->offset);
+    xSemaphoreGive(g_mdStorage.mutex);
+    xEventGroupSetBits(g_mdStorage.eventGroup, STORAGE_UPLOAD_PROGRESS_BIT);
+}
+
+void storage_node_exif(queueNode_t *node)
+{
+    deviceInfo_t device;
+    jpg_exif_t exif = {0};
+    char comment[48];
+    time_t t;
+
+    if (node == NULL || node->from != FROM_CAMERA || node->exif) {
+        return;
+    }
+    node->exif = malloc(JPG_EXIF_PREFIX_MAX);
+    if (node->exif == NULL) {
+        return;
+    }
+    cfg_get_device_info(&device);
+    snprintf(comment, sizeof(comment), "battery=%d%%;voltage=%dmV",
+             misc_get_battery_voltage_rate(), misc_get_battery_voltage());
+    t = node->pts / 1000;
+    localtime_r(&t, &exif.time);
+    exif.subsec_ms = node->pts % 1000;
+    exif.make = STORAGE_EXIF_MAKE;
+    exif.model = device.model;
+    exif.software = device.softVersion;
+    exif.serial = device.sn;
+    exif.description = node->type == SNAP_ALARMIN ? "Alarm in" :
+                       node->type == SNAP_BUTTON ? "Button" :
+                       node->type == SNAP_TIMER ? "Timer" : "Unknown";
+    exif.comment = comment;
+    node->exifLen = jpg_exif_build(&exif, node->exif, JPG_EXIF_PREFIX_MAX);
+    if (node->exifLen == 0) {
+        ESP_LOGW(TAG, "EXIF build failed");
+        free(node->exif);
+        node->exif = NULL;
+    }
+}
+
+int storage_node_parts(queueNode_t *node, jpg_exif_part_t parts[2])
+{
+    storage_node_exif(node);
+    return jpg_exif_parts(node->exif, node->exifLen, node->data, node->len, parts);
+}
+
 void storage_show_file()
 {
     uint64_t pts;
@@ -96,12 +211,13 @@ void storage_show_file()
     DIR *dir = opendir(STORAGE_ROOT);
 
     while ((entry = readdir(dir)) != NULL) {
-        if (sscanf(entry->d_name, "%c%lld.jpg", &type, &pts) == 2) {
+        if (storage_parse_jpg_name(entry->d_name, &type, &pts)) {
             time_t t = pts / 1000;
             strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", localtime(&t));
             sprintf(filename, "%s/%c%lld.jpg", STORAGE_ROOT, type, pts);
             stat(filename, &fstat);
-            ESP_LOGI(TAG, "------ %s(type %c, time %s size %ld)", entry->d_name, type, time, fstat.st_size);
+            ESP_LOGI(TAG, "------ %s(type %c, time %s size %ld, uploaded %d)", entry->d_name, type, time, fstat.st_size,
+                     storage_read_progress(pts, type, fstat.st_size));
             num++;
         }
     }
@@ -116,7 +232,7 @@ void storage_clear_jpg_file()
     char path[PATH_MAX_lEN];
     DIR *dir = opendir(STORAGE_ROOT);
     while ((entry = readdir(dir)) != NULL) {
-        if (strstr(entry->d_name, ".jpg")) {
+        if (strstr(entry->d_name, ".jpg") || strstr(entry->d_name, STORAGE_PROGRESS_SUFFIX)) {
             sprintf(path, "%s/%s", STORAGE_ROOT, entry->d_name);
             unlink(path);
             ESP_LOGI(TAG, "unlink file %s", path);
@@ -127,21 +243,19 @@ void storage_clear_jpg_file()
 
 static esp_err_t storage_rm_oldest_file(char *root)
 {
-    time_t pts = 0;
-    time_t tmp = 0;
+    uint64_t pts = 0;
+    uint64_t tmp = 0;
     char type;
+    char tmpType = SNAP_UNDEFINED;
     struct dirent *entry;
     char path[PATH_MAX_lEN];
     DIR *dir = opendir(root);
 
     while ((entry = readdir(dir)) != NULL) {
-        if (sscanf(entry->d_name, "%c%lld.jpg", &type, &pts) == 2) {
-            if (tmp == 0) {
-                tmp = pts;
-                sprintf(path, "%s/%s", root, entry->d_name);
-            }
-            if (tmp > pts) {
+        if (storage_parse_jpg_name(entry->d_name, &type, &pts)) {
+            if (tmp == 0 || tmp > pts) {
                 tmp = pts;
+                tmpType = type;
                 sprintf(path, "%s/%s", root, entry->d_name);
             }
         }
@@ -149,6 +263,7 @@ static esp_err_t storage_rm_oldest_file(char *root)
     if (tmp) {
         ESP_LOGI(TAG, "Removing %s", path);
         unlink(path);
+        storage_remove_progress(tmp, tmpType);
         closedir(dir);
         return ESP_OK;
     }
@@ -156,9 +271,13 @@ static esp_err_t storage_rm_oldest_file(char *root)
     return ESP_FAIL;
 }
 
-static void storage_write_file(void *data, size_t len, uint64_t pts, snapType_e type)
+static void storage_write_file(const jpg_exif_part_t *parts, int count, uint64_t pts, snapType_e type, size_t offset)
 {
     char filename[32];
+    size_t len = 0;
+    for (int i = 0; i < count; i++) {
+        len += parts[i].len;
+    }
     while (storage_free_space() <  len * 5) {
         if (storage_rm_oldest_file(STORAGE_ROOT) != ESP_OK) {
             break;
@@ -167,12 +286,19 @@ static void storage_write_file(void *data, size_t len, uint64_t pts, snapType_e
     sprintf(filename, "%s/%c%llu.jpg", STORAGE_ROOT, type, pts);
     FILE *f = fopen(filename, "w");
     if (f) {
-        int res = fwrite(data, len, 1, f);
-        if (res != 1) {
-            ESP_LOGE(TAG, "Failed to write %s err %d", filename, res);
+        for (int i = 0; i < count; i++) {
+            int res = fwrite(parts[i].buf, parts[i].len, 1, f);
+            if (res != 1) {
+                ESP_LOGE(TAG, "Failed to write %s err %d", filename, res);
+                break;
+            }
         }
         fclose(f);
         ESP_LOGI(TAG, "Success to save %s size %d", filename, len);
+        if (offset) {
+            // part of the image is already on the server, keep it for the next upload
+            storage_write_progress(pts, type, offset);
+        }
     } else {
         ESP_LOGE(TAG, "Failed to open %s", filename);
     }
@@ -198,6 +324,10 @@ static esp_err_t storage_upload_file(char *filename, uint64_t pts, snapType_e ty
             fread(data, 1, fstat.st_size, f);
             node = storage_queue_node_malloc(data, fstat.st_size, pts, type);
             if (node) {
+                node->offset = storage_read_progress(pts, type, fstat.st_size);
+                if (node->offset) {
+                    ESP_LOGI(TAG, "resume %s from %d/%ld", filename, node->offset, fstat.st_size);
+                }
                 xQueueSend(g_mdStorage.out, &node, portMAX_DELAY);
                 fclose(f);
                 return ESP_OK;
@@ -221,8 +351,10 @@ static void record(mdStorage_t *self)
         if (xQueueReceive(self->in, &node, portMAX_DELAY)) {
             if (node->from == FROM_CAMERA) {
                 // write_to_flash();
+                jpg_exif_part_t parts[2];
+                int count = storage_node_parts(node, parts);
                 xSemaphoreTake(self->mutex, portMAX_DELAY);
-                storage_write_file(node->data, node->len, node->pts, node->type);
+                storage_write_file(parts, count, node->pts, node->type, node->offset);
                 xSemaphoreGive(self->mutex);
                 ESP_LOGI(TAG, "SAVE TO FLASH");
                 node->free_handler(node, EVENT_OK);
@@ -248,10 +380,11 @@ static void upload(mdStorage_t *self)
         sleep_set_event_bits(SLEEP_STORAGE_UPLOAD_STOP_BIT); // if no remaining images to upload in flash, will enter sleep
         xEventGroupWaitBits(self->eventGroup, STORAGE_UPLOAD_START_BIT, true, true, portMAX_DELAY);
         sleep_clear_event_bits(SLEEP_STORAGE_UPLOAD_STOP_BIT);
+        xEventGroupClearBits(self->eventGroup, STORAGE_UPLOAD_PROGRESS_BIT);
         struct dirent *entry;
         DIR *dir = opendir(STORAGE_ROOT);
         while ((entry = readdir(dir)) != NULL) {
-            if (sscanf(entry->d_name, "%c%llu.jpg", &type, &pts) != 2) {
+            if (!storage_parse_jpg_name(entry->d_name, &type, &pts)) {
                 // ESP_LOGW(TAG, "invalid file %s", entry->d_name);
                 continue;
             }
@@ -263,11 +396,15 @@ static void upload(mdStorage_t *self)
                 continue;
             }
             xSemaphoreGive(self->mutex);
-            uxBits = xEventGroupWaitBits(self->eventGroup, STORAGE_UPLOAD_DONE_BIT |
-                                         STORAGE_UPLOAD_STOP_BIT, true, false,
-                                         pdMS_TO_TICKS(STORAGE_UPLOAD_DONE_TIMEOUT_MS));
+            do {
+                // every acknowledged chunk restarts the timeout, a slow link is not a dead link
+                uxBits = xEventGroupWaitBits(self->eventGroup, STORAGE_UPLOAD_DONE_BIT | STORAGE_UPLOAD_STOP_BIT |
+                                             STORAGE_UPLOAD_PROGRESS_BIT, true, false,
+                                             pdMS_TO_TICKS(STORAGE_UPLOAD_DONE_TIMEOUT_MS));
+            } while (uxBits == STORAGE_UPLOAD_PROGRESS_BIT);
             if (uxBits & STORAGE_UPLOAD_DONE_BIT) {
                 unlink(path);
+                storage_remove_progress(pts, type);
                 ESP_LOGI(TAG, "unlink file %s", path);
                 continue;
             } else {
@@ -2,6 +2,7 @@
 #define __STORAGE_H__
 
 #include "system.h"
+#include "jpg_exif.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -42,6 +43,29 @@ void storage_upload_start();
  */
 void storage_upload_stop();
 
+/**
+ * Record how many bytes of a stored image the server has acknowledged,
+ * so the next upload attempt resumes from there instead of byte zero
+ * @param node Queue node read from storage, node->offset is saved
+ */
+void storage_save_upload_progress(queueNode_t *node);
+
+/**
+ * Build the EXIF prefix of a camera image once, from the device identity,
+ * snapshot type, battery and capture time; other nodes are left as they are
+ * @param node Queue node
+ */
+void storage_node_exif(queueNode_t *node);
+
+/**
+ * Get the parts of the JPEG file of a node, the EXIF prefix then the frame
+ * without its SOI, building the prefix if needed; the frame is not copied
+ * @param node Queue node
+ * @param parts Populated with the parts
+ * @return Number of parts
+ */
+int storage_node_parts(queueNode_t *node, jpg_exif_part_t parts[2]);
+
 /**
  * Format the storage
  */
@@ -12,9 +12,15 @@
 #include "wifi.h"
 #include "iot_mip.h"
 #include "net_module.h"
+#include "dns_cache.h"
 
 #define TAG "-->SYSTEM"  // Logging tag for system module
 
+// NTP servers, in order of preference
+#define NTP_SERVER_1 "pool.ntp.org"
+#define NTP_SERVER_2 "ntp.aliyun.com"
+#define NTP_SERVER_3 "time.windows.com"
+
 static int time_delta = 0;    //When synchronizing time, the error time between the system and the actual time, in seconds.
 static char ntp_sync_flag = 0;  //The flag indicating whether ntp is synchronized.
 /**
@@ -44,7 +50,7 @@ esp_err_t system_ntp_time(bool force_sync)
 
     ESP_LOGI(TAG, "Initializing SNTP");
     esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG_MULTIPLE(3,
-                               ESP_SNTP_SERVER_LIST("pool.ntp.org", "ntp.aliyun.com", "time.windows.com"));
+                               ESP_SNTP_SERVER_LIST(NTP_SERVER_1, NTP_SERVER_2, NTP_SERVER_3));
     esp_netif_sntp_init(&config);
     
     time(&sys_now);
@@ -63,6 +69,10 @@ esp_err_t system_ntp_time(bool force_sync)
     esp_netif_sntp_deinit();
     if (retry == retry_count) {
         ESP_LOGE(TAG, "Failed to obtain time");
+        // cached server addresses may be stale, resolve them live next time
+        dns_cache_invalidate(NTP_SERVER_1);
+        dns_cache_invalidate(NTP_SERVER_2);
+        dns_cache_invalidate(NTP_SERVER_3);
         return ESP_FAIL;
     }
     sys_now += retry;
@@ -71,6 +71,12 @@ typedef struct queueNode {
     void *data;                ///< Data pointer
     size_t len;                ///< Data length
     char ntp_sync_flag;        ///< Check whether there is a flag for ntp synchronization. If not, the timestamp will be corrected during upload.
+    size_t offset;             ///< Bytes already acknowledged by the server (resumable chunked upload)
+    void *preview;             ///< Reduced-resolution JPEG uploaded right away while the full image goes to flash, NULL if none
+    size_t previewLen;         ///< Preview length
+    bool isPreview;            ///< The node carries the preview of an image instead of the image
+    void *exif;                ///< SOI + EXIF APP1 written in front of the frame at upload/write time, NULL until built
+    size_t exifLen;            ///< EXIF prefix length
 } queueNode_t;
 
 /**
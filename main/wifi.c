@@ -12,6 +12,7 @@
 #include "lwip/netdb.h"
 #include "iot_mip.h"
 #include "net_module.h"
+#include "link_est.h"
 
 #define TAG "-->WIFI"  // Logging tag for WiFi module
 
@@ -89,6 +90,27 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t e
     return;
 }
 
+/**
+ * Map a WiFi RSSI to a signal level
+ * @param rssi RSSI in dBm
+ * @return Signal level (0-5)
+ */
+static int8_t wifi_rssi_level(int8_t rssi)
+{
+    if (rssi >= -55) {
+        return 5;
+    } else if (rssi >= -65) {
+        return 4;
+    } else if (rssi >= -72) {
+        return 3;
+    } else if (rssi >= -80) {
+        return 2;
+    } else if (rssi >= -88) {
+        return 1;
+    }
+    return 0;
+}
+
 /**
  * IP event handler
  * @param arg Pointer to mdWifi_t state
@@ -104,6 +126,12 @@ static void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t eve
         ip_event_got_ip_t *event = (ip_event_got_ip_t *) event_data;
         ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
         wifi->isConnected = true;
+        wifi_ap_record_t ap;
+        if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+            link_est_set_signal(LINK_WIFI, wifi_rssi_level(ap.rssi));
+        } else {
+            link_est_set_signal(LINK_WIFI, -1);
+        }
         xEventGroupClearBits(wifi->eventGroup, WIFI_STA_DISCONNECT_BIT);
         xEventGroupSetBits(wifi->eventGroup, WIFI_STA_CONNECT_BIT);
         if (iot_mip_autop_is_enable()) {
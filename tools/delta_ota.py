@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+#
+# Delta firmware patch, see components/delta_ota/include/delta_patch.h for the format.
+#
+#   delta_ota.py diff  running.bin new.bin patch.bin
+#   delta_ota.py apply running.bin patch.bin new.bin
+#
+# The running image is the .bin the device was flashed with, the patch only applies to it.
+
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = b'NEDELTA1'
+BLOCK_SIZE = 16 * 1024  # raw op stream bytes per compressed block, the device holds one at a time
+WINDOW = 16             # bytes of an anchor
+ANCHOR_MASK = 7         # one window out of 8 is indexed
+ANCHOR_SLOTS = 4        # old positions kept per anchor
+MIN_MATCH = 24          # shortest exact match worth an op
+
+
+def is_anchor(window):
+    return zlib.crc32(window) & ANCHOR_MASK == 0
+
+
+def index_old(old):
+    index = {}
+    for i in range(len(old) - WINDOW + 1):
+        window = old[i:i + WINDOW]
+        if is_anchor(window):
+            slots = index.setdefault(window, [])
+            if len(slots) < ANCHOR_SLOTS:
+                slots.append(i)
+    return index
+
+
+def match_length(old, o, new, n):
+    length = 0
+    while o + length < len(old) and n + length < len(new):
+        step = min(64, len(old) - o - length, len(new) - n - length)
+        if old[o + length:o + length + step] == new[n + length:n + length + step]:
+            length += step
+            continue
+        while old[o + length] == new[n + length]:
+            length += 1
+        break
+    return length
+
+
+def find_matches(old, new):
+    """Exact matches (new position, old position, length), in new order and not overlapping."""
+    index = index_old(old)
+    matches = []
+    offset = None   # old minus new position of the last match, code moves in runs
+    end = 0         # end of the last match in new
+    n = 0
+    while n + WINDOW <= len(new):
+        window = new[n:n + WINDOW]
+        candidates = []
+        if offset is not None and 0 <= n + offset and old[n + offset:n + offset + WINDOW] == window:
+            candidates.append(n + offset)
+        elif is_anchor(window):
+            candidates = index.get(window, [])
+        best_old, best_len = 0, 0
+        for o in candidates:
+            length = match_length(old, o, new, n)
+            if length > best_len:
+                best_old, best_len = o, length
+        if best_len < MIN_MATCH:
+            n += 1
+            continue
+        while n > end and best_old > 0 and new[n - 1] == old[best_old - 1]:
+            n -= 1
+            best_old -= 1
+            best_len += 1
+        matches.append((n, best_old, best_len))
+        offset = best_old - n
+        n += best_len
+        end = n
+    return matches
+
+
+def extend_forward(old, o, new, n, limit):
+    """Bytes after a match still worth a diff, the ones that mostly match."""
+    best, score, best_score = 0, 0, 0
+    for i in range(min(limit, len(old) - o)):
+        score += 1 if old[o + i] == new[n + i] else -1
+        if score > best_score:
+            best, best_score = i + 1, score
+    return best
+
+
+def make_ops(old, new):
+    matches = find_matches(old, new)
+    ops = []
+    first_new, first_old = (matches[0][0], matches[0][1]) if matches else (len(new), 0)
+    if first_new > 0 or first_old > 0:
+        ops.append((b'', new[:first_new], first_old))
+    for i, (n, o, length) in enumerate(matches):
+        next_new, next_old = (matches[i + 1][0], matches[i + 1][1]) if i + 1 < len(matches) else (len(new), o + length)
+        gap = next_new - n - length
+        if next_old - next_new == o - n:
+            length += gap   # same offset on both sides, the gap is changed bytes
+        else:
+            length += extend_forward(old, o + length, new, n + length, gap)
+        diff = bytes((a - b) & 0xff for a, b in zip(new[n:n + length], old[o:o + length]))
+        ops.append((diff, new[n + length:next_new], next_old - (o + length)))
+    return ops
+
+
+def diff(old, new):
+    stream = bytearray()
+    for diff_bytes, extra, seek in make_ops(old, new):
+        stream += struct.pack('<IIi', len(diff_bytes), len(extra), seek)
+        stream += diff_bytes
+        stream += extra
+    patch = bytearray(struct.pack('<8sIIIII4x', MAGIC, len(old), zlib.crc32(old), len(new), zlib.crc32(new), BLOCK_SIZE))
+    for pos in range(0, len(stream), BLOCK_SIZE):
+        raw = bytes(stream[pos:pos + BLOCK_SIZE])
+        compressor = zlib.compressobj(9, zlib.DEFLATED, -15)
+        comp = compressor.compress(raw) + compressor.flush()
+        patch += struct.pack('<II', len(raw), len(comp))
+        patch += comp
+    return bytes(patch)
+
+
+def apply(old, patch):
+    magic, old_size, old_crc, new_size, new_crc, block_size = struct.unpack_from('<8sIIIII4x', patch)
+    if magic != MAGIC:
+        raise ValueError('not a delta patch')
+    if old_size != len(old) or old_crc != zlib.crc32(old):
+        raise ValueError('patch made from another image')
+    stream = bytearray()
+    pos = 32
+    while pos < len(patch):
+        raw_len, comp_len = struct.unpack_from('<II', patch, pos)
+        pos += 8
+        raw = zlib.decompress(patch[pos:pos + comp_len], -15)
+        if len(raw) != raw_len or raw_len > block_size:
+            raise ValueError('corrupted block')
+        stream += raw
+        pos += comp_len
+    new = bytearray()
+    old_pos = 0
+    pos = 0
+    while pos < len(stream):
+        diff_len, extra_len, seek = struct.unpack_from('<IIi', stream, pos)
+        pos += 12
+        new += bytes((a + b) & 0xff for a, b in zip(stream[pos:pos + diff_len], old[old_pos:old_pos + diff_len]))
+        pos += diff_len
+        old_pos += diff_len + seek
+        new += stream[pos:pos + extra_len]
+        pos += extra_len
+    if len(new) != new_size or zlib.crc32(new) != new_crc:
+        raise ValueError('new image does not match its CRC32')
+    return bytes(new)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Delta firmware patch')
+    sub = parser.add_subparsers(dest='command', required=True)
+    p = sub.add_parser('diff', help='make a patch from the running image to the new one')
+    p.add_argument('old')
+    p.add_argument('new')
+    p.add_argument('patch')
+    p = sub.add_parser('apply', help='apply a patch, to check it')
+    p.add_argument('old')
+    p.add_argument('patch')
+    p.add_argument('new')
+    args = parser.parse_args()
+
+    if args.command == 'diff':
+        with open(args.old, 'rb') as f:
+            old = f.read()
+        with open(args.new, 'rb') as f:
+            new = f.read()
+        patch = diff(old, new)
+        with open(args.patch, 'wb') as f:
+            f.write(patch)
+        print('%s: %d bytes, %.1f%% of %d' % (args.patch, len(patch), 100.0 * len(patch) / max(len(new), 1), len(new)))
+    else:
+        with open(args.old, 'rb') as f:
+            old = f.read()
+        with open(args.patch, 'rb') as f:
+            patch = f.read()
+        try:
+            new = apply(old, patch)
+        except ValueError as e:
+            sys.exit('%s: %s' % (args.patch, e))
+        with open(args.new, 'wb') as f:
+            f.write(new)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,22 @@
+#!/usr/bin/env python3
+#
+# gzip a web asset for the firmware to embed next to it, see components/web_assets.
+# The output only depends on the input, so an unchanged asset rebuilds to the same bytes.
+#
+#   gzip_asset.py index.js index.js.gz
+
+import gzip
+import sys
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: %s input output.gz' % sys.argv[0])
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read()
+    with open(sys.argv[2], 'wb') as f:
+        f.write(gzip.compress(data, compresslevel=9, mtime=0))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,30 @@
+/*
+ * Checks of the host tests of the components. A test includes this header once, counts
+ * its failed checks with CHECK() and returns host_test_end() from main(). The rules that
+ * build and run it are in host_test.mk, the Makefile next to it runs every test.
+ */
+#ifndef __HOST_TEST_H__
+#define __HOST_TEST_H__
+
+#include <stdio.h>
+
+static int g_failed;            /* Failed checks */
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            g_failed++; \
+        } \
+    } while (0)
+
+/**
+ * @brief Print the result of the test
+ * @return Exit status of the test, 0 if every check passed
+ */
+static inline int host_test_end(void)
+{
+    printf("%s\n", g_failed ? "FAILED" : "OK");
+    return g_failed ? 1 : 0;
+}
+
+#endif /* __HOST_TEST_H__ */
@@ -0,0 +1,34 @@
+# Rules of the host test of a component, included by its test/Makefile once it has set
+#   SRC      test and component sources
+#   INCLUDE  include directories besides ../include and this one (optional)
+#   DEPS     headers the test depends on besides the component ones (optional)
+#   CSTD     C dialect, strict C99 by default (optional)
+#   LDFLAGS  libraries (optional)
+#   ARGS     arguments of the test run (optional)
+#   CLEAN    files the run leaves behind (optional)
+
+HOST_TEST_DIR := $(dir $(lastword $(MAKEFILE_LIST)))
+
+CC   ?= gcc
+CSTD ?= -std=c99 -pedantic
+
+ifndef V
+QUIET_CC         = @echo "CC	$@";
+endif
+
+DEPS    += $(wildcard ../*.c ../include/*.h) $(HOST_TEST_DIR)host_test.h
+INCLUDE += -I../include -I$(HOST_TEST_DIR)
+CFLAGS  += -pipe $(CSTD) -Wall -Wextra -g
+
+all: check
+
+check: testrun
+	@./testrun $(ARGS)
+
+testrun: $(SRC) $(DEPS)
+	$(QUIET_CC)$(CC) -o $@ $(SRC) $(CFLAGS) $(INCLUDE) $(LDFLAGS)
+
+clean veryclean:
+	rm -rf testrun $(CLEAN)
+
+.PHONY: all check clean veryclean